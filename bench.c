@@ -0,0 +1,803 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of the controller benchmark. Everything runs on one thread
+ * around a single poll(): the clients are libcall connections, each topped
+ * back up to --depth calls from its completion callback, and the cars are
+ * plain sockets whose FLOOR messages are read as they come so the
+ * controller never blocks writing to them.
+ *
+ * The controller only answers a STATUS with a FLOOR if the car opened its
+ * doors where the controller expects and its queue has a stop left to send.
+ * Each car therefore mirrors its queue in the controller with the same
+ * dispatch.c and queue.c code, so it knows which STATUS gets an answer and
+ * which FLOOR is coming, and a car with no stops left is given another call.
+ * The mirrors are exact as long as each car's calls come one at a time from
+ * one client, so the status phase runs first.
+ */
+
+#include "bench.h"
+#include "controller.h"
+#include "dispatch.h"
+#include "global.h"
+#include "libcall.h"
+#include "queue.h"
+#include "tcpip.h"
+#include "workload.h"
+
+/*
+ * Sleeps for some milliseconds.
+ */
+static void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options_t options;
+    bench_options_init(&options);
+    if (!bench_options_parse(&options, argc, argv))
+    {
+        return 1;
+    }
+
+    /* A controller that dies shouldn't take the benchmark with it. */
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE *csv = NULL;
+    if (options.csv_file != NULL)
+    {
+        csv = fopen(options.csv_file, "w");
+        if (csv == NULL)
+        {
+            perror(options.csv_file);
+            return 1;
+        }
+    }
+
+    bench_report_header(csv);
+    int status = 0;
+    for (size_t i = 0; i < options.num_car_counts && status == 0; i++)
+    {
+        for (size_t j = 0; j < options.num_client_counts && status == 0; j++)
+        {
+            bench_t bench;
+            if (bench_init(&bench, &options, options.cars[i],
+                           options.clients[j]) &&
+                bench_run(&bench))
+            {
+                bench_report(&bench, csv);
+            }
+            else
+            {
+                status = 1;
+            }
+            bench_deinit(&bench);
+        }
+    }
+
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return status;
+}
+
+/*
+ * Fills in the defaults.
+ */
+void bench_options_init(bench_options_t *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->cars[0] = BENCH_DEFAULT_CARS;
+    options->num_car_counts = 1;
+    options->clients[0] = BENCH_DEFAULT_CLIENTS;
+    options->num_client_counts = 1;
+    options->calls = BENCH_DEFAULT_CALLS;
+    options->depth = BENCH_DEFAULT_DEPTH;
+    options->statuses = BENCH_DEFAULT_STATUSES;
+    options->seed = BENCH_DEFAULT_SEED;
+    options->controller = BENCH_DEFAULT_CONTROLLER;
+    options->csv_file = NULL;
+}
+
+/*
+ * Reads the options given as `--{name} {value}` pairs, see bench.h.
+ */
+bool bench_options_parse(bench_options_t *options, int argc, char *argv[])
+{
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "Usage: %s [--{option} {value}]...\n", argv[0]);
+        return false;
+    }
+
+    for (int i = 1; i < argc - 1; i += 2)
+    {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        uint64_t number = 0;
+        bool numeric = parse_number(value, &number);
+        bool valid = true;
+
+        if (strcmp(name, "--cars") == 0)
+        {
+            valid = parse_counts(value, MAX_CAR_CONNECTIONS, options->cars,
+                                 BENCH_MAX_COUNTS, &options->num_car_counts);
+        }
+        else if (strcmp(name, "--clients") == 0)
+        {
+            valid = parse_counts(value, MAX_CALL_CONNECTIONS,
+                                 options->clients, BENCH_MAX_COUNTS,
+                                 &options->num_client_counts);
+        }
+        else if (strcmp(name, "--calls") == 0)
+        {
+            valid = numeric && number > 0 && number <= SIZE_MAX / 2;
+            options->calls = (size_t)number;
+        }
+        else if (strcmp(name, "--depth") == 0)
+        {
+            valid = numeric && number > 0 && number <= 1000000;
+            options->depth = (size_t)number;
+        }
+        else if (strcmp(name, "--statuses") == 0)
+        {
+            valid = numeric && number > 0 && number <= SIZE_MAX / 2;
+            options->statuses = (size_t)number;
+        }
+        else if (strcmp(name, "--seed") == 0)
+        {
+            valid = numeric;
+            options->seed = number;
+        }
+        else if (strcmp(name, "--controller") == 0)
+        {
+            options->controller = value;
+        }
+        else if (strcmp(name, "--csv") == 0)
+        {
+            options->csv_file = value;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid parameter: %s\n", name);
+            return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Starts the controller with its messages discarded. Returns false if it
+ * can't be, or if something is already listening where it would.
+ */
+static bool start_controller(bench_t *bench)
+{
+    int fd;
+    struct sockaddr_in addr;
+    if (connect_to_controller(&fd, &addr))
+    {
+        close(fd);
+        fprintf(stderr, "Error: Something is already listening on port %d.\n",
+                PORT);
+        return false;
+    }
+
+    const char *path = bench->options->controller;
+    bench->controller = fork();
+    if (bench->controller == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+        execl(path, path, (char *)NULL);
+        _exit(127);
+    }
+    if (bench->controller < 0)
+    {
+        perror("fork()");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Connects a car and sends its CAR message. The first car waits for the
+ * controller to start listening.
+ */
+static bool connect_car(bench_t *bench, size_t index)
+{
+    bench_car_t *car = &bench->cars[index];
+    struct sockaddr_in addr;
+    uint64_t deadline = monotonic_ns() + (uint64_t)BENCH_START_MS * 1000000;
+    while (!connect_to_controller(&car->fd, &addr))
+    {
+        car->fd = -1;
+        if (index > 0 || monotonic_ns() > deadline ||
+            waitpid(bench->controller, NULL, WNOHANG) == bench->controller)
+        {
+            fprintf(stderr, "Error: Unable to connect to %s.\n",
+                    bench->options->controller);
+            return false;
+        }
+        sleep_ms(10);
+    }
+    msg_reader_init(&car->reader, car->fd);
+
+    char lowest[8];
+    char highest[8];
+    int band = (int)index * BENCH_BAND;
+    int_to_floor(band, lowest, sizeof(lowest));
+    int_to_floor(band + BENCH_BAND - 1, highest, sizeof(highest));
+    return send_message(car->fd, "CAR Bench%zu %s %s", index + 1, lowest,
+                        highest);
+}
+
+/*
+ * Records the answer to a call made to check a car has joined.
+ */
+static void probe_answered(const call_completion_t *completion, void *arg)
+{
+    *(call_result_t *)arg = completion->result;
+}
+
+/*
+ * Waits for the controller to have taken every car's CAR message, which it
+ * reads in no particular order, by calling each car until it comes.
+ */
+static bool wait_for_cars(bench_t *bench)
+{
+    libcall_t *lib = &bench->clients[0].lib;
+    uint64_t deadline = monotonic_ns() + (uint64_t)BENCH_START_MS * 1000000;
+    for (size_t i = 0; i < bench->num_cars; i++)
+    {
+        char from[8];
+        char to[8];
+        int band = (int)i * BENCH_BAND;
+        int_to_floor(band, from, sizeof(from));
+        int_to_floor(band + 1, to, sizeof(to));
+
+        call_result_t result = CALL_RESULT_UNAVAILABLE;
+        while (result == CALL_RESULT_UNAVAILABLE)
+        {
+            if (monotonic_ns() > deadline)
+            {
+                fprintf(stderr, "Error: Car %zu never joined.\n", i + 1);
+                return false;
+            }
+            result = CALL_RESULT_FAILED;
+            if (libcall_submit(lib, from, to, probe_answered, &result) == 0)
+            {
+                break;
+            }
+            /* A wait that only sent the call completes nothing either. */
+            uint64_t timeout =
+                monotonic_ns() + (uint64_t)BENCH_TIMEOUT_MS * 1000000;
+            while (libcall_pending(lib) > 0 && monotonic_ns() < timeout)
+            {
+                if (libcall_wait(lib, BENCH_TIMEOUT_MS) == -1)
+                {
+                    break;
+                }
+            }
+            if (result == CALL_RESULT_UNAVAILABLE)
+            {
+                sleep_ms(10);
+            }
+        }
+        if (result != CALL_RESULT_CAR)
+        {
+            fprintf(stderr, "Error: The controller stopped answering.\n");
+            return false;
+        }
+
+        /* The car starts out waiting for the FLOOR the call leads to. */
+        bench_car_t *car = &bench->cars[i];
+        const char *floor = dispatch_call(&car->queue, from, to);
+        snprintf(car->expected, sizeof(car->expected), "%s",
+                 floor != NULL ? floor : "");
+        car->stage = BENCH_CAR_REFILL;
+    }
+    return true;
+}
+
+/*
+ * Starts a controller, connects the cars and clients and creates the calls.
+ */
+bool bench_init(bench_t *bench, const bench_options_t *options,
+                size_t num_cars, size_t num_clients)
+{
+    memset(bench, 0, sizeof(*bench));
+    bench->options = options;
+    bench->controller = -1;
+    bench->cars = calloc(num_cars, sizeof(*bench->cars));
+    bench->clients = calloc(num_clients, sizeof(*bench->clients));
+    bench->fds = calloc(num_cars + num_clients, sizeof(*bench->fds));
+    bench->trips = workload_generate(options->calls, 0, BENCH_BAND - 1, 0, 0,
+                                     options->seed);
+    if (bench->cars == NULL || bench->clients == NULL || bench->fds == NULL ||
+        bench->trips == NULL)
+    {
+        perror("malloc()");
+        return false;
+    }
+    workload_hist_init(&bench->call_latency);
+    workload_hist_init(&bench->status_latency);
+    for (size_t i = 0; i < num_cars; i++)
+    {
+        bench->cars[i].fd = -1;
+        queue_init(&bench->cars[i].queue);
+    }
+    for (size_t i = 0; i < num_clients; i++)
+    {
+        bench->clients[i].bench = bench;
+        bench->clients[i].lib.fd = -1;
+    }
+
+    if (!start_controller(bench))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < num_cars; i++)
+    {
+        bench->num_cars += 1;
+        if (!connect_car(bench, i))
+        {
+            return false;
+        }
+    }
+    /* The rest of the clients connect in run_calls(), see there. */
+    bench->num_clients = num_clients;
+    call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+    if (!libcall_init(&bench->clients[0].lib, &transport))
+    {
+        fprintf(stderr, "Error: Unable to connect client 1.\n");
+        return false;
+    }
+    return wait_for_cars(bench);
+}
+
+/*
+ * Stops the controller and disconnects the clients and cars.
+ */
+void bench_deinit(bench_t *bench)
+{
+    /* The controller goes first so it doesn't see everyone hang up. */
+    if (bench->controller > 0)
+    {
+        kill(bench->controller, SIGINT);
+        waitpid(bench->controller, NULL, 0);
+    }
+    for (size_t i = 0; i < bench->num_clients; i++)
+    {
+        libcall_deinit(&bench->clients[i].lib);
+    }
+    for (size_t i = 0; i < bench->num_cars; i++)
+    {
+        if (bench->cars[i].fd >= 0)
+        {
+            close(bench->cars[i].fd);
+        }
+        queue_deinit(&bench->cars[i].queue);
+    }
+    free(bench->cars);
+    free(bench->clients);
+    free(bench->fds);
+    free(bench->trips);
+    memset(bench, 0, sizeof(*bench));
+    bench->controller = -1;
+}
+
+static void call_answered(const call_completion_t *, void *);
+
+/*
+ * Makes the next call on a client. Calls are dealt to the cars' bands in
+ * turn. A call that can't be made counts as failed and the next is tried.
+ */
+static void submit_next(bench_t *bench, bench_client_t *client)
+{
+    while (bench->next_call < bench->options->calls)
+    {
+        const workload_trip_t *trip = &bench->trips[bench->next_call];
+        int band = (int)(bench->next_call % bench->num_cars) * BENCH_BAND;
+        bench->next_call += 1;
+
+        char from[8];
+        char to[8];
+        int_to_floor(band + trip->from, from, sizeof(from));
+        int_to_floor(band + trip->to, to, sizeof(to));
+        if (libcall_submit(&client->lib, from, to, call_answered, client) != 0)
+        {
+            return;
+        }
+        bench->failed += 1;
+        bench->completed += 1;
+    }
+}
+
+/*
+ * Records a call's latency and keeps the client's calls topped up.
+ */
+static void call_answered(const call_completion_t *completion, void *arg)
+{
+    bench_client_t *client = arg;
+    bench_t *bench = client->bench;
+    bench->completed += 1;
+    client->answers += 1;
+    if (completion->result == CALL_RESULT_FAILED)
+    {
+        bench->failed += 1;
+    }
+    else
+    {
+        if (completion->result == CALL_RESULT_UNAVAILABLE)
+        {
+            bench->unavailable += 1;
+        }
+        workload_hist_record(&bench->call_latency, completion->latency_ns);
+    }
+    submit_next(bench, client);
+}
+
+static void next_status(bench_t *, bench_car_t *);
+
+/*
+ * Reads what the controller sent a car. In the status phase the car knows
+ * which FLOOR is coming and why: one answering its STATUS is timed, and
+ * either kind moves the car on.
+ */
+static bool read_car(bench_t *bench, bench_car_t *car)
+{
+    ssize_t bytes = msg_reader_fill(&car->reader);
+    if (bytes == -1 && errno == EINTR)
+    {
+        return true;
+    }
+    if (bytes <= 0)
+    {
+        fprintf(stderr, "Error: The controller hung up on a car.\n");
+        return false;
+    }
+#ifdef TCP_QUICKACK
+    /* A real car soon answers a FLOOR with a STATUS that carries the ACK.
+     * One given a call instead would hold the ACK back, and the controller's
+     * next FLOOR would wait on it, so the ACK goes out straight away. */
+    int one = 1;
+    setsockopt(car->fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+#endif
+
+    char *message;
+    while ((message = msg_reader_frame(&car->reader)) != NULL)
+    {
+        if (strncmp(message, "FLOOR ", 6) != 0 ||
+            (car->stage != BENCH_CAR_STATUS && car->stage != BENCH_CAR_REFILL))
+        {
+            continue;
+        }
+        if (car->stage == BENCH_CAR_STATUS)
+        {
+            workload_hist_record(&bench->status_latency,
+                                 monotonic_ns() - car->status_ns);
+        }
+        if (strcmp(message + 6, car->expected) != 0)
+        {
+            bench->mismatches += 1;
+        }
+        next_status(bench, car);
+    }
+    return true;
+}
+
+/*
+ * Gives a car more stops with a call from its band. The FLOOR it leads to
+ * moves the car on.
+ */
+static void refill(bench_t *bench, bench_car_t *car)
+{
+    const workload_trip_t *trip =
+        &bench->trips[bench->refills++ % bench->options->calls];
+    int band = (int)(car - bench->cars) * BENCH_BAND;
+    char from[8];
+    char to[8];
+    int_to_floor(band + trip->from, from, sizeof(from));
+    int_to_floor(band + trip->to, to, sizeof(to));
+
+    /* Enqueuing a call always leaves a stop to send, see enqueue(). */
+    const char *floor = dispatch_call(&car->queue, from, to);
+    if (floor == NULL)
+    {
+        car->stage = BENCH_CAR_DONE;
+        return;
+    }
+    snprintf(car->expected, sizeof(car->expected), "%s", floor);
+    car->stage = BENCH_CAR_REFILL;
+    if (libcall_submit(&bench->clients[0].lib, from, to, NULL, NULL) == 0)
+    {
+        bench->lost = true;
+    }
+}
+
+/*
+ * Sends the car's next STATUS: doors opening at the floor the controller
+ * last sent it to, if that gets it another FLOOR. Otherwise the car is out
+ * of stops and is given more. Finishes with the car once there are enough
+ * samples.
+ */
+static void next_status(bench_t *bench, bench_car_t *car)
+{
+    if (bench->status_latency.count >= bench->options->statuses)
+    {
+        car->stage = BENCH_CAR_DONE;
+        return;
+    }
+
+    const char *current = queue_prev_floor(&car->queue);
+    char floor[4];
+    snprintf(floor, sizeof(floor), "%s", current != NULL ? current : "");
+    const char *next =
+        current != NULL ? dispatch_status(&car->queue, "Opening", floor)
+                        : NULL;
+    if (next == NULL)
+    {
+        refill(bench, car);
+        return;
+    }
+
+    snprintf(car->expected, sizeof(car->expected), "%s", next);
+    car->stage = BENCH_CAR_STATUS;
+    car->status_ns = monotonic_ns();
+    if (!send_message(car->fd, "STATUS Opening %s %s", floor, floor))
+    {
+        bench->lost = true;
+    }
+}
+
+/*
+ * Connects a client, unless it is the first which already is, and sends its
+ * first --depth calls.
+ */
+static bool start_client(bench_t *bench, size_t index)
+{
+    bench_client_t *client = &bench->clients[index];
+    call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+    if (index > 0 && !libcall_init(&client->lib, &transport))
+    {
+        fprintf(stderr, "Error: Unable to connect client %zu.\n", index + 1);
+        return false;
+    }
+    for (size_t i = 0; i < bench->options->depth; i++)
+    {
+        submit_next(bench, client);
+    }
+    libcall_dispatch(&client->lib);
+    return true;
+}
+
+/*
+ * Makes every call, keeping --depth in flight on each client. The controller
+ * reads a new connection's first message as soon as it accepts it, and only
+ * queues a few connections it hasn't accepted yet, so the clients join one
+ * at a time, each once the one before has had an answer. The cars just take
+ * their FLOOR messages.
+ */
+static bool run_calls(bench_t *bench)
+{
+    size_t num_fds = bench->num_clients + bench->num_cars;
+    uint64_t started = monotonic_ns();
+    size_t connected = 0;
+    while (bench->completed < bench->options->calls)
+    {
+        if (connected < bench->num_clients &&
+            (connected == 0 || bench->clients[connected - 1].answers > 0) &&
+            !start_client(bench, connected++))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < bench->num_clients; i++)
+        {
+            bench->fds[i].fd = libcall_fd(&bench->clients[i].lib);
+            bench->fds[i].events = libcall_events(&bench->clients[i].lib);
+        }
+        for (size_t i = 0; i < bench->num_cars; i++)
+        {
+            bench->fds[bench->num_clients + i].fd = bench->cars[i].fd;
+            bench->fds[bench->num_clients + i].events = POLLIN;
+        }
+
+        int ready = poll(bench->fds, (nfds_t)num_fds, BENCH_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            fprintf(stderr, "Error: The controller stopped answering.\n");
+            return false;
+        }
+
+        for (size_t i = 0; i < bench->num_clients; i++)
+        {
+            if (bench->fds[i].revents != 0)
+            {
+                libcall_dispatch(&bench->clients[i].lib);
+            }
+        }
+        for (size_t i = 0; i < bench->num_cars; i++)
+        {
+            if (bench->fds[bench->num_clients + i].revents != 0 &&
+                !read_car(bench, &bench->cars[i]))
+            {
+                return false;
+            }
+        }
+    }
+
+    bench->call_phase_ns = monotonic_ns() - started;
+    return true;
+}
+
+/*
+ * Walks every car through its stops at once until there are --statuses
+ * samples, starting from the FLOOR that wait_for_cars() led to. The calls
+ * that give cars more stops go out on the first client.
+ */
+static bool run_statuses(bench_t *bench)
+{
+    libcall_t *lib = &bench->clients[0].lib;
+    for (;;)
+    {
+        bool done = true;
+        for (size_t i = 0; i < bench->num_cars && done; i++)
+        {
+            done = bench->cars[i].stage == BENCH_CAR_DONE;
+        }
+        if (done || bench->lost)
+        {
+            break;
+        }
+
+        bench->fds[0].fd = libcall_fd(lib);
+        bench->fds[0].events = libcall_events(lib);
+        for (size_t i = 0; i < bench->num_cars; i++)
+        {
+            bench->fds[1 + i].fd = bench->cars[i].fd;
+            bench->fds[1 + i].events = POLLIN;
+        }
+
+        int ready =
+            poll(bench->fds, (nfds_t)(1 + bench->num_cars), BENCH_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            fprintf(stderr, "Error: The controller stopped answering.\n");
+            return false;
+        }
+
+        if (bench->fds[0].revents != 0 && libcall_dispatch(lib) == -1)
+        {
+            bench->lost = true;
+        }
+        for (size_t i = 0; i < bench->num_cars && !bench->lost; i++)
+        {
+            if (bench->fds[1 + i].revents != 0 &&
+                !read_car(bench, &bench->cars[i]))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (bench->lost)
+    {
+        fprintf(stderr, "Error: The controller hung up.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Runs the status phase while the cars' queues hold only the bench's own
+ * calls, then the call phase.
+ */
+bool bench_run(bench_t *bench)
+{
+    return run_statuses(bench) && run_calls(bench);
+}
+
+/*
+ * Prints the table heading and the CSV header.
+ */
+void bench_report_header(FILE *csv)
+{
+    printf("%-23s%-45s%s\n", "", "Call to CAR (us)", "STATUS to FLOOR (us)");
+    printf("%4s %7s %10s %7s %7s %7s %7s %8s %8s %7s %7s %7s %7s %8s\n",
+           "cars", "clients", "calls/s", "p50", "p90", "p99", "p99.9", "max",
+           "samples", "p50", "p90", "p99", "p99.9", "max");
+    if (csv != NULL)
+    {
+        fprintf(csv, "cars,clients,calls,calls_per_s,call_p50_us,"
+                     "call_p90_us,call_p99_us,call_p99_9_us,call_max_us,"
+                     "status_samples,status_p50_us,status_p90_us,"
+                     "status_p99_us,status_p99_9_us,status_max_us,"
+                     "unavailable,failed\n");
+    }
+}
+
+/*
+ * Prints a line of the table, with any calls that didn't get a car on the
+ * next, and the CSV row.
+ */
+void bench_report(bench_t *bench, FILE *csv)
+{
+    double call_us[WORKLOAD_NUM_PERCENTILES + 1];
+    double status_us[WORKLOAD_NUM_PERCENTILES + 1];
+    workload_hist_summarise(&bench->call_latency, 1e3, call_us);
+    workload_hist_summarise(&bench->status_latency, 1e3, status_us);
+    double rate = bench->call_phase_ns == 0
+                      ? 0.0
+                      : (double)bench->completed * 1e9 /
+                            (double)bench->call_phase_ns;
+
+    printf("%4zu %7zu %10.0f %7.1f %7.1f %7.1f %7.1f %8.1f %8zu %7.1f %7.1f "
+           "%7.1f %7.1f %8.1f\n",
+           bench->num_cars, bench->num_clients, rate, call_us[0], call_us[1],
+           call_us[2], call_us[3], call_us[4],
+           (size_t)bench->status_latency.count,
+           status_us[0], status_us[1], status_us[2], status_us[3],
+           status_us[4]);
+    if (bench->unavailable > 0 || bench->failed > 0)
+    {
+        printf("     %zu calls unavailable, %zu failed\n", bench->unavailable,
+               bench->failed);
+    }
+    if (bench->mismatches > 0)
+    {
+        printf("     %zu FLOOR messages not the ones the queues predicted\n",
+               bench->mismatches);
+    }
+    fflush(stdout);
+
+    if (csv != NULL)
+    {
+        fprintf(csv, "%zu,%zu,%zu,%.0f", bench->num_cars, bench->num_clients,
+                bench->completed, rate);
+        for (size_t i = 0; i <= WORKLOAD_NUM_PERCENTILES; i++)
+        {
+            fprintf(csv, ",%.1f", call_us[i]);
+        }
+        fprintf(csv, ",%zu", (size_t)bench->status_latency.count);
+        for (size_t i = 0; i <= WORKLOAD_NUM_PERCENTILES; i++)
+        {
+            fprintf(csv, ",%.1f", status_us[i]);
+        }
+        fprintf(csv, ",%zu,%zu\n", bench->unavailable, bench->failed);
+    }
+}
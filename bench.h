@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+ * This header file defines the controller benchmark run by `bench [options]`.
+ * For each combination of car and client counts it starts a fresh
+ * controller, connects stub cars that only answer their FLOOR messages, and
+ * measures the controller's two hot paths in turn:
+ *
+ *   status path  Every car works through its stops at once, answering each
+ *                FLOOR with `STATUS Opening {floor} {floor}` as if it had
+ *                arrived instantly, and is given another call whenever it
+ *                runs out. Gives the time from a STATUS to the FLOOR the
+ *                controller sends back.
+ *   call path    Clients make calls as fast as the controller answers them,
+ *                each keeping --depth calls in flight over one libcall
+ *                connection. Gives calls per second and the time from
+ *                sending a CALL to its `CAR {name}` answer.
+ *
+ * Car k serves its own band of BENCH_BAND floors and calls are spread evenly
+ * over the bands, so every car gets the same share of the calls however the
+ * controller picks cars. One line is printed per run, giving a scaling curve
+ * against both counts.
+ *
+ * Options are given as `--{name} {value}` pairs:
+ *
+ *   --cars {n,n,...}        Car counts to run, 1 to MAX_CAR_CONNECTIONS
+ *   --clients {n,n,...}     Client counts to run, 1 to MAX_CALL_CONNECTIONS
+ *   --calls {count}         Calls made in each run
+ *   --depth {count}         Calls each client keeps in flight
+ *   --statuses {count}      STATUS messages timed in each run
+ *   --seed {number}         Seed of the calls' floors, see workload.h
+ *   --controller {path}     Controller to start
+ *   --csv {file}            Also write the results as CSV
+ *
+ * Nothing else may be listening on the controller's port.
+ *
+ * See bench.c for implementation details.
+ */
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "libcall.h"
+#include "queue.h"
+#include "tcpip.h"
+#include "workload.h"
+
+/* Defaults */
+#define BENCH_DEFAULT_CARS 1
+#define BENCH_DEFAULT_CLIENTS 1
+#define BENCH_DEFAULT_CALLS 10000
+#define BENCH_DEFAULT_DEPTH 1
+#define BENCH_DEFAULT_STATUSES 2000
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_DEFAULT_CONTROLLER "./controller"
+
+/* Most counts a --cars or --clients list can have */
+#define BENCH_MAX_COUNTS 16
+/* Floors in each car's band */
+#define BENCH_BAND 10
+/* How long to wait for the controller to start listening */
+#define BENCH_START_MS 2000
+/* How long without a message before a run is given up on */
+#define BENCH_TIMEOUT_MS 5000
+
+/*
+ * Settings of a benchmark
+ */
+typedef struct bench_options
+{
+    size_t cars[BENCH_MAX_COUNTS];
+    size_t num_car_counts;
+    size_t clients[BENCH_MAX_COUNTS];
+    size_t num_client_counts;
+    size_t calls;
+    size_t depth;
+    size_t statuses;
+    uint64_t seed;
+    const char *controller;
+    const char *csv_file; // NULL for no CSV
+} bench_options_t;
+
+/*
+ * What a car is doing
+ */
+typedef enum
+{
+    BENCH_CAR_IDLE,   // Not yet joined
+    BENCH_CAR_STATUS, // Waiting for the FLOOR answering its STATUS
+    BENCH_CAR_REFILL, // Waiting for the FLOOR from a call giving it stops
+    BENCH_CAR_DONE    // Just taking its FLOOR messages
+} bench_car_stage_t;
+
+/*
+ * A stub car
+ */
+typedef struct bench_car
+{
+    int fd;
+    msg_reader_t reader;
+    queue_t queue;           // Mirror of the controller's queue for the car
+    bench_car_stage_t stage;
+    char expected[4];        // FLOOR the car is waiting for
+    uint64_t status_ns;      // When the last STATUS was sent
+} bench_car_t;
+
+struct bench;
+
+/*
+ * A client making calls on its own connection
+ */
+typedef struct bench_client
+{
+    struct bench *bench;
+    libcall_t lib;
+    size_t answers; // Calls answered so far
+} bench_client_t;
+
+/*
+ * One run against a fresh controller
+ */
+typedef struct bench
+{
+    const bench_options_t *options;
+    pid_t controller;
+    bench_car_t *cars;
+    size_t num_cars;
+    bench_client_t *clients;
+    size_t num_clients;
+    workload_trip_t *trips; // Floors within a band, see BENCH_BAND
+    size_t next_call;       // First trip not called yet
+    size_t completed;       // Calls answered or failed
+    size_t unavailable;     // Calls answered UNAVAILABLE
+    size_t failed;          // Calls that couldn't be made or were lost
+    uint64_t call_phase_ns; // How long the calls took
+    workload_hist_t call_latency;   // Nanoseconds, see workload.h
+    workload_hist_t status_latency; // Nanoseconds
+    struct pollfd *fds;     // The clients' then the cars'
+    size_t refills;         // Calls made to give cars more stops
+    size_t mismatches;      // FLOOR messages the mirrors didn't expect
+    bool lost;              // The controller hung up in the status phase
+} bench_t;
+
+// Fills in the defaults
+void bench_options_init(bench_options_t *);
+// Reads `--{name} {value}` arguments, prints the problem and returns false if
+// one isn't valid
+bool bench_options_parse(bench_options_t *, int, char *[]);
+// Starts a controller and connects the cars and clients, prints the problem
+// and returns false if it can't
+bool bench_init(bench_t *, const bench_options_t *, size_t, size_t);
+// Disconnects everything and stops the controller
+void bench_deinit(bench_t *);
+// Times the status path then the call path, prints the problem and returns
+// false if the controller stops answering
+bool bench_run(bench_t *);
+// Prints the heading of the table of results, and the CSV header if given a
+// file
+void bench_report_header(FILE *);
+// Prints the results of a run as a line of the table, and as CSV if given a
+// file
+void bench_report(bench_t *, FILE *);
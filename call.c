@@ -1,4 +1,5 @@
 #include <arpa/inet.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,14 +12,46 @@
  * and manages the connection to the elevator controller. The implementation
  * focuses on efficient communication to ensure smooth operation of the elevator
  * requests.
+ *
+ * `call --stream [file]` makes any number of calls over a single connection
+ * instead, reading one `{source floor} {destination floor}` pair per line from
+ * the file or standard input. Blank lines and lines starting with '#' are
+ * skipped. Each call gets one line on standard output:
+ *
+ *   {source} {destination} {car name|UNAVAILABLE|INVALID|SAME} {microseconds}
+ *
+ * where the time is how long the controller took to answer, 0 for calls that
+ * were never sent.
  */
 
 #include "call.h"
 #include "global.h"
+#include "libcall.h"
 #include "tcpip.h"
 
 int main(int argc, char *argv[])
 {
+    if (argc >= 2 && strcmp(argv[1], "--stream") == 0)
+    {
+        if (argc > 3)
+        {
+            printf("Usage: %s --stream [file]\n", argv[0]);
+            return 1;
+        }
+        FILE *input = argc == 3 ? fopen(argv[2], "r") : stdin;
+        if (input == NULL)
+        {
+            perror(argv[2]);
+            return 1;
+        }
+        int result = stream_calls(input);
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return result;
+    }
+
     /* Validate the command line arguments. Expecting exactly two floor
      * arguments. */
     if (argc != 3 || !is_valid_floor(argv[1]) || !is_valid_floor(argv[2]))
@@ -95,8 +128,14 @@ void handle_call(const call_pad_t *call_pad)
     /* Send the call request and wait for a response from the controller. */
     send_message(call_pad->sock, "CALL %s %s", call_pad->source_floor,
                  call_pad->destination_floor);
-    char *response =
-        receive_msg(call_pad->sock); // Receive the response message
+    msg_reader_t reader;
+    msg_reader_init(&reader, call_pad->sock);
+    char *response = msg_reader_next(&reader); // Receive the response message
+    if (response == NULL)
+    {
+        printf("Unable to connect to elevator system.\n");
+        return;
+    }
 
     /* Tokenize the response to extract its values. */
     char *saveptr;
@@ -112,6 +151,84 @@ void handle_call(const call_pad_t *call_pad)
         const char *car_name = strtok_r(NULL, " ", &saveptr);
         printf("Car %s is arriving.\n", car_name); // Announce the arriving car
     }
+}
+
+/*
+ * Completion callback for stream_calls(), prints the outcome of a call.
+ */
+static void print_completion(const call_completion_t *completion, void *arg)
+{
+    bool *failed = (bool *)arg;
+    if (completion->result == CALL_RESULT_FAILED)
+    {
+        printf("Unable to connect to elevator system.\n");
+        *failed = true;
+        return;
+    }
+
+    printf("%s %s %s %llu\n", completion->source_floor,
+           completion->destination_floor,
+           completion->result == CALL_RESULT_CAR ? completion->car_name
+                                                 : "UNAVAILABLE",
+           (unsigned long long)(completion->latency_ns / 1000u));
+}
+
+/*
+ * Makes every call listed in input over one connection to the controller and
+ * prints the outcome of each, see the top of this file. Each call is answered
+ * before the next line is read, so results come back as lines are typed.
+ * Returns 1 if the controller can't be reached or hangs up part way through.
+ */
+int stream_calls(FILE *input)
+{
+    libcall_t lib;
+    call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+    if (!libcall_init(&lib, &transport))
+    {
+        printf("Unable to connect to elevator system.\n");
+        return 1;
+    }
+
+    char line[256];
+    bool failed = false;
+    while (!failed && fgets(line, sizeof(line), input) != NULL)
+    {
+        char *saveptr;
+        const char *source_floor = strtok_r(line, " \t\r\n", &saveptr);
+        const char *destination_floor = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (source_floor == NULL || source_floor[0] == '#')
+        {
+            continue;
+        }
+        if (destination_floor == NULL)
+        {
+            destination_floor = "-";
+        }
+
+        /* Check the call the same way a single call is checked. */
+        if (!is_valid_floor(source_floor) || !is_valid_floor(destination_floor))
+        {
+            printf("%s %s INVALID 0\n", source_floor, destination_floor);
+        }
+        else if (strcmp(source_floor, destination_floor) == 0)
+        {
+            printf("%s %s SAME 0\n", source_floor, destination_floor);
+        }
+        else if (libcall_submit(&lib, source_floor, destination_floor,
+                                print_completion, &failed) == 0)
+        {
+            printf("Unable to connect to elevator system.\n");
+            failed = true;
+        }
+        while (libcall_pending(&lib) > 0)
+        {
+            libcall_wait(&lib, -1);
+        }
+
+        /* Whoever reads the results may be waiting for this one. */
+        fflush(stdout);
+    }
 
-    free(response); // Free the allocated response memory
+    libcall_deinit(&lib);
+    return failed ? 1 : 0;
 }
@@ -2,6 +2,7 @@
 
 #include <netinet/in.h> // Include for struct sockaddr_in
 #include <stdbool.h>
+#include <stdio.h>
 #include <unistd.h>
 
 /*
@@ -30,3 +31,5 @@ void call_pad_init(call_pad_t *, const char *, const char *);
 void call_pad_deinit(call_pad_t *);
 // Handles the call request from the call pad
 void handle_call(const call_pad_t *);
+// Makes every call read from a file over one connection
+int stream_calls(FILE *);
@@ -15,6 +15,8 @@
 #include <unistd.h>
 
 #include "car.h"
+#include "carloop.h"
+#include "fleet.h"
 #include "global.h"
 #include "posix.h"
 #include "tcpip.h"
@@ -28,14 +30,25 @@
  *   - A thread for handling controller updates.
  *   - A thread for receiving messages from the controller.
  *
- * The main thread is responsible for establishing and maintaining the server
- * connection, simplifying concurrency management by centralizing the connection
- * handling. This allows each worker thread to focus on specific tasks while the
- * main thread oversees the connection lifecycle and ensures coordination
- * between the car and the controller.
+ *   - A thread for establishing and maintaining the controller connection.
+ *
+ * The connection thread centralises the connection lifecycle. It sleeps on the
+ * car's condition variable until the connection is lost or a mode change lets
+ * the car connect again, then retries with a jittered exponential backoff (see
+ * reconnect.c) and starts a fresh receiver and updater for each connection.
+ *
+ * A FLOOR message never opens the doors between floors. A car travelling to
+ * the requested floor opens them when it gets there, which is the reply the
+ * controller waits for. A car stopped on the requested floor cycles them once
+ * any cycle in progress is over, even if it was about to leave for another
+ * floor.
  *
  * Signal handling is also implemented here to support clean shutdowns and
- * resource cleanup.
+ * resource cleanup. SIGINT is blocked in every thread but the main one, which
+ * just sleeps until it arrives.
+ *
+ * The same behaviour is available on a single thread with `--event-loop`, see
+ * carloop.c.
  */
 
 /*
@@ -62,8 +75,44 @@ static void signal_handler(int signum)
 
 int main(int argc, char *argv[])
 {
+    /* `car --event-loop {name} {lowest} {highest} {delay}` runs the car on a
+     * single epoll loop instead of the threads below, see carloop.c.
+     * `--plan` asks the controller for PLAN messages, see plan.h, and
+     * `--motion {file}` loads a motion model, see motion.h. They can be
+     * given in any order, and `--plan` and `--motion` also before `--fleet`,
+     * where a car's own motion file replaces the one given here. */
+    bool event_loop = false;
+    bool plan_mode = false;
+    const char *motion_file = NULL;
+    while (argc > 1)
+    {
+        if (strcmp(argv[1], "--event-loop") == 0)
+            event_loop = true;
+        else if (strcmp(argv[1], "--plan") == 0)
+            plan_mode = true;
+        else if (strcmp(argv[1], "--motion") == 0 && argc > 2)
+        {
+            motion_file = argv[2];
+            argc -= 1;
+            argv += 1;
+        }
+        else
+            break;
+        argc -= 1;
+        argv += 1;
+    }
+
+    /* `car --fleet {fleet file} [workers]` runs many cars in this process,
+     * see fleet.c. */
+    bool fleet_mode = argc > 1 && strcmp(argv[1], "--fleet") == 0;
+    size_t num_workers = 0;
+    if (fleet_mode && !is_fleet_args_valid(argc, argv, &num_workers))
+    {
+        return 1;
+    }
+
     /* Check if the correct number of command line arguments was given */
-    if (!is_args_valid(argc))
+    if (!fleet_mode && !is_args_valid(argc))
     {
         return 1;
     }
@@ -86,53 +135,98 @@ int main(int argc, char *argv[])
      * send */
     signal(SIGPIPE, SIG_IGN);
 
+    if (fleet_mode)
+    {
+        fleet_t fleet;
+        int result = 1;
+        if (fleet_init(&fleet, argv[2], num_workers, motion_file))
+        {
+            for (size_t i = 0; i < fleet.num_cars; i++)
+            {
+                fleet.cars[i].plan_enabled = plan_mode;
+            }
+            result = fleet_run(&fleet, &keep_running);
+        }
+        fleet_deinit(&fleet);
+        return result;
+    }
+
     /* Initialize car and threads */
     car_t car;
     car_init(&car, argv[1], argv[2], argv[3], argv[4]);
+    car.plan_enabled = plan_mode;
+    if (motion_file != NULL && !motion_load(&car.motion, motion_file))
+    {
+        car_deinit(&car);
+        return 1;
+    }
+
+    if (event_loop)
+    {
+        int result = car_loop_run(&car, &keep_running);
+        car_deinit(&car);
+        return result;
+    }
+
+    /* Threads start with SIGINT blocked so it is delivered to this thread,
+     * which keeps it blocked except while suspended to avoid missing it
+     * between checking the flag and waiting. */
+    sigset_t sigint, old;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, &old);
 
     pthread_create(&car.level_thread, NULL, handle_level, &car);
     pthread_create(&car.door_thread, NULL, handle_doors, &car);
+    pthread_create(&car.connection_thread, NULL, handle_connection, &car);
 
-    /* Main loop to maintain connection and handle service/emergency modes */
+    sigset_t wait_mask = old;
+    sigdelset(&wait_mask, SIGINT);
     while (keep_running)
     {
-        /*
-         * If the car hasn't been put into emergency or individual service mode
-         * and isn't connected to the controller, then connect the car
-         */
-        if (should_maintain_connection(&car) && !car.connected_to_controller &&
-            connect_to_controller(&car.server_sd, &car.server_addr))
-        {
-            handle_initial_connection(&car);
-
-            pthread_create(&car.updater_thread, NULL, handle_updater, &car);
-            pthread_create(&car.receiver_thread, NULL, handle_receiver, &car);
-        }
-        sleep_delay(&car);
+        sigsuspend(&wait_mask);
     }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    /* Stop the connection thread first, it ends the controller session. */
+    shm_lock(car.state, LOCK_SITE_CAR_CONNECTION);
+    car.stopping = true;
+    pthread_cond_broadcast(&car.state->cond);
+    shm_unlock(car.state);
+    pthread_join(car.connection_thread, NULL);
 
     /* Cleanup threads and car resources */
     pthread_cancel(car.level_thread);
     pthread_cancel(car.door_thread);
-    if (car.connected_to_controller)
-    {
-        pthread_cancel(car.receiver_thread);
-        pthread_cancel(car.updater_thread);
-    }
-
     pthread_join(car.level_thread, NULL);
     pthread_join(car.door_thread, NULL);
-    if (car.connected_to_controller)
-    {
-        pthread_join(car.receiver_thread, NULL);
-        pthread_join(car.updater_thread, NULL);
-    }
 
     car_deinit(&car);
 
     return 0;
 }
 
+/*
+ * Returns how long the car takes to move on to the next floor towards its
+ * destination, see motion_step_ms(). Must be called with the mutex held.
+ */
+static uint32_t next_step_ms(const car_t *car, int *start)
+{
+    return motion_step_ms(&car->motion, start,
+                          floor_to_int(car->state->current_floor),
+                          floor_to_int(car->state->destination_floor));
+}
+
+/*
+ * Returns true if the status is one of the door cycle's, the doors not yet
+ * Closed again.
+ */
+static bool is_door_cycling(const char *status)
+{
+    return strcmp(status, "Opening") == 0 || strcmp(status, "Open") == 0 ||
+           strcmp(status, "Closing") == 0;
+}
+
 /*
  * Thread function to handle door operations
  */
@@ -142,33 +236,37 @@ void *handle_doors(void *arg)
 
     while (1)
     {
-        pthread_mutex_lock(&car->state->mutex);
+        /* Read the state we need while still holding the mutex from the
+         * wait. */
+        shm_lock(car->state, LOCK_SITE_CAR_DOORS_WAIT);
         pthread_cleanup_push(cleanup_mutex_thread, &car->state->mutex);
-        pthread_cond_wait(&car->state->cond, &car->state->mutex);
-        pthread_cleanup_pop(1);
+        shm_cond_wait(car->state);
+        pthread_cleanup_pop(0);
+        bool between = strcmp(car->state->status, "Between") == 0;
+        uint8_t open_button = car->state->open_button;
+        shm_unlock(car->state);
 
         /* Dont allow door buttons to do anything if the car is between floors.
          */
-        if (status_is(car->state, "Between"))
+        if (between)
             continue;
 
         /* If the open button was pressed, set open button to 0 and cycle doors
          * making sure to check if the cycling was interupted at any point. */
-        if (open_button_is(car->state, 1))
+        if (open_button == 1)
         {
-            set_open_button(car->state, 0);
-            open_doors(car);
-            if (sleep_delay_cond(car) == 0 && service_mode_is(car->state, 0))
+            open_doors(car, true);
+            if (sleep_delay_cond(car, car->motion.door_dwell_ms) == 0 &&
+                service_mode_is(car->state, 0))
             {
-                close_doors(car);
+                close_doors(car, false);
             }
         }
 
         /* Do the same for the close button */
         if (close_button_is(car->state, 1))
         {
-            set_close_button(car->state, 0);
-            close_doors(car);
+            close_doors(car, true);
         }
 
         /* Check if a thread cancelation was requested */
@@ -186,36 +284,50 @@ void *handle_level(void *arg)
     while (1)
     {
         /* Wait on the condition variable and make sure to unlock the mutex if
-         * the thread was canceled while waiting */
-        pthread_mutex_lock(&car->state->mutex);
+         * the thread was canceled while waiting. Only wait while the car is
+         * on its destination floor and nobody asked for the doors to be
+         * cycled: a new destination set while the doors were cycling was
+         * broadcast before this thread got here. The car doesn't leave until
+         * the doors are closed, which matters when another thread is cycling
+         * them. Arriving answers a pending cycle, so it is cleared either
+         * way. */
+        shm_lock(car->state, LOCK_SITE_CAR_LEVEL_WAIT);
         pthread_cleanup_push(cleanup_mutex_thread, &car->state->mutex);
-        pthread_cond_wait(&car->state->cond, &car->state->mutex);
-        pthread_cleanup_pop(1);
+        while ((floor_to_int(car->state->current_floor) ==
+                    floor_to_int(car->state->destination_floor) &&
+                !car->cycle_doors) ||
+               is_door_cycling(car->state->status))
+        {
+            shm_cond_wait(car->state);
+        }
+        car->cycle_doors = false;
+        pthread_cleanup_pop(0);
+        shm_unlock(car->state);
 
         /* If the current and destination floors are different then move the car
          * towards the destination floor. */
         if (cdcmp_floors(car->state) != 0)
         {
             /* Acquire the mutex to check if the destination floor is in range
-             * of the car. */
-            pthread_mutex_lock(&car->state->mutex);
+             * of the car. If it is out of range, put it back in range by
+             * setting it to the lowest or highest floor and set the status back
+             * to Closed, both in a single update. */
+            shm_update_t bounds;
+            shm_begin(&bounds, car->state, LOCK_SITE_CAR_LEVEL_BOUNDS);
             int bounds_check =
                 bounds_check_floor(car, car->state->destination_floor);
-            pthread_mutex_unlock(&car->state->mutex);
-
-            /* If the destination floor is out of range, put it back in range by
-             * setting it to the lowest or highest floor and set the status back
-             * to Closed. */
-            if (bounds_check == -1)
+            int start = floor_to_int(car->state->current_floor);
+            uint32_t step_ms = next_step_ms(car, &start);
+            if (bounds_check != 0)
             {
-                set_destination_floor(car->state, car->lowest_floor);
-                set_status(car->state, "Closed");
-                continue;
+                shm_update_destination_floor(&bounds, bounds_check == -1
+                                                          ? car->lowest_floor
+                                                          : car->highest_floor);
+                shm_update_status(&bounds, "Closed");
             }
-            else if (bounds_check == 1)
+            shm_commit(&bounds);
+            if (bounds_check != 0)
             {
-                set_destination_floor(car->state, car->highest_floor);
-                set_status(car->state, "Closed");
                 continue;
             }
 
@@ -224,54 +336,53 @@ void *handle_level(void *arg)
             set_status(car->state, "Between");
             while (cdcmp_floors(car->state) != 0)
             {
-                sleep_delay(car);
+                sleep_delay(step_ms);
                 /* Find out witch direction the destination floor is in by
                  * comparing it to the current floor to determina whether to
                  * increment the current floor or decrement the current floor.
                  */
                 int compare_floors = cdcmp_floors(car->state);
-                if (compare_floors == 1)
+                shm_update_t u;
+                shm_begin(&u, car->state, LOCK_SITE_CAR_LEVEL_MOVE);
+                /* If the current floor was successfully incremented or
+                 * decremented then publish the change. */
+                if (compare_floors == 1 &&
+                    increment_floor(car->state->current_floor) == 0)
                 {
-                    pthread_mutex_lock(&car->state->mutex);
-                    /* If the current floor was successfully incremented them
-                     * broadcast on the condition variable. */
-                    if (increment_floor(car->state->current_floor) == 0)
-                    {
-                        pthread_cond_broadcast(&car->state->cond);
-                    }
-                    pthread_mutex_unlock(&car->state->mutex);
+                    shm_mark_dirty(&u, SHM_FIELD_CURRENT_FLOOR);
                 }
-                else if (compare_floors == -1)
+                else if (compare_floors == -1 &&
+                         decrement_floor(car->state->current_floor) == 0)
                 {
-                    pthread_mutex_lock(&car->state->mutex);
-                    /* Broadcast on the condition variable if the floor was
-                     * successfully decremented. */
-                    if (decrement_floor(car->state->current_floor) == 0)
-                    {
-                        pthread_cond_broadcast(&car->state->cond);
-                    }
-                    pthread_mutex_unlock(&car->state->mutex);
+                    shm_mark_dirty(&u, SHM_FIELD_CURRENT_FLOOR);
                 }
+                step_ms = next_step_ms(car, &start);
 
                 /* If the current and destination floors are now the same, set
-                 * the status to closed before exiting the loop. */
-                if (cdcmp_floors(car->state) == 0)
+                 * the status to closed in the same update so the car is never
+                 * seen Between on its destination floor. */
+                bool arrived = floor_to_int(car->state->current_floor) ==
+                               floor_to_int(car->state->destination_floor);
+                if (arrived)
+                {
+                    shm_update_status(&u, "Closed");
+                }
+                shm_commit(&u);
+                if (arrived)
                 {
-                    set_status(car->state, "Closed");
                     break;
                 }
             }
+        }
 
-            /* Cycle the doors if the car isn't in individual service mode. We
-             * dont want to do this inside the above loop because there a are
-             * times when the caller is already on the destination floor and the
-             * car doesn't have to move. */
-            if (service_mode_is(car->state, 0))
-            {
-                open_doors(car);
-                sleep_delay(car);
-                close_doors(car);
-            }
+        /* Cycle the doors if the car isn't in individual service mode, either
+         * on arrival or because the controller sent the floor the car is
+         * already on. */
+        if (service_mode_is(car->state, 0))
+        {
+            open_doors(car, false);
+            sleep_delay(car->motion.door_dwell_ms);
+            close_doors(car, false);
         }
 
         /* set a safe cancelation point for the thread to prevent deadlocks */
@@ -289,9 +400,16 @@ void car_init(car_t *car, const char *name, const char *lowest_floor,
     car->shm_name = get_shm_name(car->name);
     car->lowest_floor = lowest_floor;
     car->highest_floor = highest_floor;
-    car->delay = (uint8_t)atoi(delay);
+    car->delay = (uint32_t)atoi(delay);
+    motion_init(&car->motion, car->delay);
     car->connected_to_controller = false;
+    car->session_running = false;
+    car->stopping = false;
     car->server_sd = -1;
+    memset(&car->sent, 0, sizeof(car->sent));
+    car->plan_enabled = false;
+    plan_init(&car->plan);
+    car->cycle_doors = false;
 
     /* Create shared memory for car state */
     if (!create_shared_mem(&car->state, &car->fd, car->shm_name))
@@ -302,11 +420,14 @@ void car_init(car_t *car, const char *name, const char *lowest_floor,
 
     /* Set the current and destination floors to the cars lowest floor */
     init_shm(car->state);
-    pthread_mutex_lock(&car->state->mutex);
-    strcpy(car->state->current_floor, car->lowest_floor);
-    strcpy(car->state->destination_floor, car->lowest_floor);
-    pthread_cond_broadcast(&car->state->cond);
-    pthread_mutex_unlock(&car->state->mutex);
+    car_shm_ext *ext = get_shm_ext(car->state);
+    reconnect_init(&car->reconnect, car->delay,
+                   ext != NULL ? &ext->reconnect : NULL);
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_INIT);
+    shm_update_current_floor(&u, car->lowest_floor);
+    shm_update_destination_floor(&u, car->lowest_floor);
+    shm_commit(&u);
 }
 
 /*
@@ -315,7 +436,7 @@ void car_init(car_t *car, const char *name, const char *lowest_floor,
 void car_deinit(car_t *car)
 {
     /* Close the shared memory object */
-    munmap(car->state, sizeof(car_shared_mem));
+    unmap_car(car->state);
     shm_unlink(car->shm_name);
     car->state = NULL;
 
@@ -328,46 +449,66 @@ void car_deinit(car_t *car)
 }
 
 /*
- * Open car doors and update state.
+ * Open car doors and update state. If clear_button is true the open button is
+ * reset in the same update that starts opening the doors.
  */
-void open_doors(car_t *car)
+void open_doors(car_t *car, bool clear_button)
 {
-    set_status(car->state, "Opening");
-    sleep_delay(car);
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_OPEN_DOORS);
+    if (clear_button)
+    {
+        shm_update_open_button(&u, 0);
+    }
+    shm_update_status(&u, "Opening");
+    shm_commit(&u);
+
+    sleep_delay(car->motion.door_open_ms);
     set_status(car->state, "Open");
 }
 
 /*
- * close car doors and update state
+ * close car doors and update state. If clear_button is true the close button
+ * is reset in the same update that starts closing the doors.
  */
-void close_doors(car_t *car)
+void close_doors(car_t *car, bool clear_button)
 {
-    if (status_is(car->state, "Closed"))
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_CLOSE_DOORS);
+    if (clear_button)
+    {
+        shm_update_close_button(&u, 0);
+    }
+    bool closed = strcmp(car->state->status, "Closed") == 0;
+    if (!closed)
+    {
+        shm_update_status(&u, "Closing");
+    }
+    shm_commit(&u);
+    if (closed)
         return;
-    set_status(car->state, "Closing");
-    sleep_delay(car);
+
+    sleep_delay(car->motion.door_close_ms);
     set_status(car->state, "Closed");
 }
 
 /*
- * Sleeps s untill car.delay nannoseconds has passes or one of the dorr buttons
+ * Sleeps until ms milliseconds have passed or one of the dorr buttons
  * was pressed.
  */
-int sleep_delay_cond(car_t *car)
+int sleep_delay_cond(car_t *car, uint32_t ms)
 {
-    /* Create a timestamp with car->delay */
+    /* Create a deadline ms from now */
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    ts.tv_nsec += car->delay * 1000000;
+    shm_deadline(car->state, ms, &ts);
 
     while (true)
     {
-        pthread_mutex_lock(&car->state->mutex);
-        int result =
-            pthread_cond_timedwait(&car->state->cond, &car->state->mutex, &ts);
+        shm_lock(car->state, LOCK_SITE_CAR_SLEEP_DELAY_COND);
+        int result = shm_cond_timedwait(car->state, &ts);
         uint8_t open_button = car->state->open_button;
         uint8_t close_button = car->state->close_button;
-        pthread_mutex_unlock(&car->state->mutex);
+        shm_unlock(car->state);
 
         /* Check if a door button was pressed */
         if (open_button == 1 || close_button == 1)
@@ -410,10 +551,10 @@ int bounds_check_floor(const car_t *car, const char *floor)
 int cdcmp_floors(car_shared_mem *state)
 {
     /* Acquire the mutex and convert the floors to integers */
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_CAR_CDCMP_FLOORS);
     int cf_number = floor_to_int(state->current_floor);
     int df_number = floor_to_int(state->destination_floor);
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
 
     /* Compare the floors and return the corrisponding result. */
     if (cf_number > df_number)
@@ -424,54 +565,128 @@ int cdcmp_floors(car_shared_mem *state)
         return 0;
 }
 
+/*
+ * Sends the car to a floor, or cycles the doors if it is already there, as
+ * asked by a FLOOR message or the next stop of a PLAN. The doors never open
+ * between floors: a car travelling to the requested floor opens them when it
+ * gets there, which is the reply the controller waits for. A car stopped on
+ * the requested floor has the level thread cycle them once any cycle in
+ * progress is over, even if it was about to leave for another floor.
+ */
+static void request_floor(car_t *car, const char *floor)
+{
+    /* The destination and the request change together so the level thread
+     * never sees the request with the old destination. */
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_RECEIVER);
+    bool here =
+        floor_to_int(car->state->current_floor) == floor_to_int(floor) &&
+        strcmp(car->state->status, "Between") != 0;
+    if (strcmp(car->state->destination_floor, floor) != 0)
+    {
+        /* The level thread will take over from here and set the status to
+         * Between. */
+        shm_update_destination_floor(&u, floor);
+        car->cycle_doors = false;
+    }
+    if (here)
+    {
+        car->cycle_doors = true;
+        pthread_cond_broadcast(&car->state->cond);
+    }
+    shm_commit(&u);
+}
+
 /*
  * Thread function for handling incoming messages from the controller.
  */
 void *handle_receiver(void *arg)
 {
     car_t *car = (car_t *)arg;
+    msg_reader_t reader;
+    msg_reader_init(&reader, car->server_sd);
 
     while (1)
     {
-        /* Wait for a message from the controller */
-        char *message = receive_msg(car->server_sd);
+        /* Wait for a message from the controller, handing over to the
+         * connection thread if it hung up. */
+        char *message = msg_reader_next(&reader);
+        if (message == NULL)
+        {
+            lose_connection(car, true);
+            return NULL;
+        }
 
         /* Begin tokenizing the string to confirm that its form is valid */
         char *saveptr;
         const char *message_type = strtok_r(message, " ", &saveptr);
+        if (message_type == NULL)
+        {
+            continue;
+        }
 
         /* Confirm the message is a floor request. */
         if (strcmp(message_type, "FLOOR") == 0)
         {
             /* continue tokenizing the message to extract the floor. */
             const char *floor = strtok_r(NULL, " ", &saveptr);
-
-            /* Compare the requested floor with the current destination floor.
-             */
-            pthread_mutex_lock(&car->state->mutex);
-            int result = strcmp(car->state->destination_floor, floor);
-            pthread_mutex_unlock(&car->state->mutex);
-
-            /* If the car is already on the requested floor then cycle the
-             * doors. */
-            if (result == 0)
+            if (floor != NULL)
             {
-                open_doors(car);
-                sleep_delay(car);
-                close_doors(car);
+                request_floor(car, floor);
             }
-            else
+        }
+        /* A new plan only moves the car if its first stop changed. */
+        else if (strcmp(message_type, "PLAN") == 0)
+        {
+            char next[sizeof(car->plan.target)] = "";
+            shm_lock(car->state, LOCK_SITE_CAR_RECEIVER);
+            const char *stop = plan_replace(&car->plan, &saveptr);
+            if (stop != NULL)
             {
-                /* Otherwise send the car to its destination. The level thread
-                 * will take over from here. */
-                set_status(car->state, "Beterrn");
-                set_destination_floor(car->state, floor);
+                strcpy(next, stop);
+            }
+            shm_unlock(car->state);
+
+            if (next[0] != '\0')
+            {
+                request_floor(car, next);
             }
         }
-        free(message);
     }
 }
 
+/*
+ * Holds on to a changed status for up to STATUS_COALESCE_MS so that a burst of
+ * transitions is sent to the controller as a single STATUS. The caller must
+ * hold the mutex, which is released while waiting. "Opening" is always sent
+ * straight away because the controller waits for it before scheduling the
+ * car's next floor, and the window is capped at half the shortest door phase
+ * so no status can come and go while it's being held.
+ */
+static void coalesce_status(car_t *car, car_status_t *status)
+{
+    uint32_t window = STATUS_COALESCE_MS;
+    if (window > motion_min_door_ms(&car->motion) / 2)
+    {
+        window = motion_min_door_ms(&car->motion) / 2;
+    }
+    if (window == 0 || memcmp(status, &car->sent, sizeof(*status)) == 0)
+    {
+        return;
+    }
+
+    struct timespec deadline;
+    shm_deadline(car->state, window, &deadline);
+    while (strcmp(status->status, "Opening") != 0 &&
+           car->state->emergency_mode == 0 &&
+           car->state->individual_service_mode == 0 &&
+           shm_cond_timedwait(car->state, &deadline) == 0)
+    {
+        read_status(car->state, status);
+    }
+    read_status(car->state, status);
+}
+
 /*
  * Thread function that keeps the controller updated about the internal state of
  * the car.
@@ -479,27 +694,76 @@ void *handle_receiver(void *arg)
 void *handle_updater(void *arg)
 {
     car_t *car = (car_t *)arg;
+    bool at_stop = false; // The doors are cycling at the plan's target
+    const car_shm_ext *ext = get_shm_ext(car->state);
+    uint32_t seen = 0; // commit_seq when the status was last read
 
     while (1)
     {
         /* Acquire the mutex and wait on the condition variable ensuring to
-         * release the mutex if the thread is canceled while waiting. */
-        pthread_mutex_lock(&car->state->mutex);
+         * release the mutex if the thread is canceled while waiting. Don't
+         * wait if an update was published while the last status was being
+         * sent, its broadcast has already been missed. */
+        /* Read service mode and emergency mode before releasing the mutex. */
+        car_status_t status;
+        shm_lock(car->state, LOCK_SITE_CAR_UPDATER_WAIT);
         pthread_cleanup_push(cleanup_mutex_thread, &car->state->mutex);
-        pthread_cond_wait(&car->state->cond, &car->state->mutex);
-        pthread_cleanup_pop(1);
-
-        /* Acquire service mode and emergency mode from the car state. */
-        pthread_mutex_lock(&car->state->mutex);
+        if (ext == NULL || ext->commit_seq == seen)
+        {
+            shm_cond_wait(car->state);
+        }
+        read_status(car->state, &status);
+        coalesce_status(car, &status);
+        if (ext != NULL)
+        {
+            seen = ext->commit_seq;
+        }
+        pthread_cleanup_pop(0);
         uint8_t service_mode = car->state->individual_service_mode;
         uint8_t emergency_mode = car->state->emergency_mode;
-        pthread_mutex_unlock(&car->state->mutex);
 
-        /* If emergency mode is on, alert the controller and close the
-         * connection. */
+        /* Once the doors have cycled at a planned stop, head for the next
+         * one without waiting for the controller. The receiver cycles the
+         * doors itself when the car is already on the stop, so setting the
+         * destination any earlier would let the level thread leave with the
+         * doors open. */
+        char next[sizeof(car->plan.target)] = "";
+        if (is_door_cycling(status.status))
+        {
+            at_stop = strcmp(status.current_floor, car->plan.target) == 0;
+        }
+        else if (at_stop && strcmp(status.status, "Closed") == 0)
+        {
+            /* Stay until the doors have cycled again if that was asked for
+             * while they were cycling. */
+            if (!car->cycle_doors)
+            {
+                const char *stop =
+                    plan_arrived(&car->plan, status.current_floor);
+                if (stop != NULL)
+                {
+                    strcpy(next, stop);
+                }
+                at_stop = false;
+            }
+        }
+        else
+        {
+            at_stop = false;
+        }
+        shm_unlock(car->state);
+
+        if (next[0] != '\0')
+        {
+            set_destination_floor(car->state, next);
+        }
+
+        /* If emergency mode is on, alert the controller and stop updating
+         * it. The socket stays open until the car reconnects. */
         if (emergency_mode == 1)
         {
             send_message(car->server_sd, "EMERGENCY");
+            lose_connection(car, false);
             break;
         }
         /* If individual service mode is on, alert the controller and set
@@ -507,13 +771,13 @@ void *handle_updater(void *arg)
         else if (service_mode == 1)
         {
             send_message(car->server_sd, "INDIVIDUAL SERVICE");
-            car->connected_to_controller = false;
+            lose_connection(car, false);
             break;
         }
         else /* Otherwise signal the controller with the cars new internal
-                state. */
+                state, unless nothing it cares about changed. */
         {
-            signal_controller(car);
+            send_status(car, &status);
         }
 
         /* Test to se if the thread has been requested to cancel. */
@@ -524,24 +788,162 @@ void *handle_updater(void *arg)
 }
 
 /*
- * Signals the controller with the cars new internal state.
+ * Returns true if the car should be connected to the controller but isn't.
+ * The caller must hold the car's mutex.
+ */
+static bool wants_connection(const car_t *car)
+{
+    return !car->connected_to_controller &&
+           car->state->individual_service_mode != 1 &&
+           car->state->emergency_mode != 1;
+}
+
+/*
+ * Stops the receiver and updater of the last connection, if any, and closes
+ * its socket. It was left open when the car left normal operation so the
+ * controller could tell the car had stopped talking rather than hung up.
+ */
+static void end_session(car_t *car)
+{
+    if (car->session_running)
+    {
+        pthread_cancel(car->receiver_thread);
+        pthread_cancel(car->updater_thread);
+        pthread_join(car->receiver_thread, NULL);
+        pthread_join(car->updater_thread, NULL);
+        car->session_running = false;
+    }
+    if (car->server_sd >= 0)
+    {
+        close(car->server_sd);
+        car->server_sd = -1;
+    }
+}
+
+/*
+ * Thread function that keeps the car connected to the controller. Rather than
+ * polling, it sleeps until the car is disconnected and allowed to connect,
+ * and after a failed attempt backs off before trying again. The backoff ends
+ * early if the car is stopped or put into a mode that doesn't connect.
+ */
+void *handle_connection(void *arg)
+{
+    car_t *car = (car_t *)arg;
+    uint32_t wait_ms = 0;
+    bool stopping = false;
+
+    while (!stopping)
+    {
+        shm_lock(car->state, LOCK_SITE_CAR_CONNECTION);
+        while (!car->stopping && !wants_connection(car))
+        {
+            shm_cond_wait(car->state);
+        }
+        if (wait_ms > 0)
+        {
+            struct timespec deadline;
+            shm_deadline(car->state, wait_ms, &deadline);
+            int result = 0;
+            while (result != ETIMEDOUT && !car->stopping &&
+                   wants_connection(car))
+            {
+                result = shm_cond_timedwait(car->state, &deadline);
+            }
+        }
+        stopping = car->stopping;
+        bool wanted = wants_connection(car);
+        shm_unlock(car->state);
+        if (stopping || !wanted)
+        {
+            continue;
+        }
+
+        end_session(car);
+        if (!connect_to_controller(&car->server_sd, &car->server_addr))
+        {
+            car->server_sd = -1;
+            wait_ms = reconnect_failed(&car->reconnect);
+            continue;
+        }
+
+        wait_ms = 0;
+        reconnect_connected(&car->reconnect);
+        handle_initial_connection(car);
+        pthread_create(&car->updater_thread, NULL, handle_updater, car);
+        pthread_create(&car->receiver_thread, NULL, handle_receiver, car);
+        car->session_running = true;
+    }
+
+    end_session(car);
+    return NULL;
+}
+
+/*
+ * Signals the controller with the cars new internal state, even if it was
+ * sent before.
  */
 void signal_controller(car_t *car)
 {
-    send_message(car->server_sd, "STATUS %s %s %s", car->state->status,
-                 car->state->current_floor, car->state->destination_floor);
+    car_status_t status;
+    shm_lock(car->state, LOCK_SITE_CAR_SIGNAL_CONTROLLER);
+    read_status(car->state, &status);
+    shm_unlock(car->state);
+
+    car->sent.status[0] = '\0';
+    send_status(car, &status);
 }
 
 /*
- * Sleep for car->delay.
+ * Copies the fields sent in a STATUS message out of shared memory. The caller
+ * must hold the car's mutex.
  */
-void sleep_delay(const car_t *car)
+void read_status(const car_shared_mem *state, car_status_t *status)
 {
-    /* create a time stamp with the cars delay in it */
-    struct timespec req;
-    req.tv_sec = 0;
-    req.tv_nsec = car->delay * 1000000;
-    nanosleep(&req, NULL);
+    /* strncpy() zero fills the rest of each field so whole tuples can be
+     * compared with memcmp(). */
+    strncpy(status->status, state->status, sizeof(status->status) - 1);
+    strncpy(status->current_floor, state->current_floor,
+            sizeof(status->current_floor) - 1);
+    strncpy(status->destination_floor, state->destination_floor,
+            sizeof(status->destination_floor) - 1);
+    status->status[sizeof(status->status) - 1] = '\0';
+    status->current_floor[sizeof(status->current_floor) - 1] = '\0';
+    status->destination_floor[sizeof(status->destination_floor) - 1] = '\0';
+}
+
+/*
+ * Sends a STATUS message with the given fields unless they are the same as
+ * the last ones sent, since the controller ignores repeats anyway.
+ */
+bool send_status(car_t *car, const car_status_t *status)
+{
+    if (memcmp(status, &car->sent, sizeof(*status)) == 0)
+    {
+        return false;
+    }
+    send_message(car->server_sd, "STATUS %s %s %s", status->status,
+                 status->current_floor, status->destination_floor);
+    car->sent = *status;
+    return true;
+}
+
+/*
+ * Sleeps for ms milliseconds.
+ */
+void sleep_delay(uint32_t ms)
+{
+    /* Sleep until an absolute monotonic deadline. A signal still cuts the
+     * sleep short so SIGINT stops the car promptly. */
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)(ms / 1000);
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
 }
 
 /*
@@ -552,10 +954,10 @@ bool should_maintain_connection(car_t *car)
 {
     /* Return false if the car is in emergency mode or individual service mode
      * otherwise return true. */
-    pthread_mutex_lock(&car->state->mutex);
+    shm_lock(car->state, LOCK_SITE_CAR_MAINTAIN_CONNECTION);
     bool service_on = car->state->individual_service_mode == 1;
     bool emergency_on = car->state->emergency_mode == 1;
-    pthread_mutex_unlock(&car->state->mutex);
+    shm_unlock(car->state);
 
     if (service_on || emergency_on)
         return false;
@@ -570,12 +972,40 @@ bool should_maintain_connection(car_t *car)
  */
 void handle_initial_connection(car_t *car)
 {
+    shm_lock(car->state, LOCK_SITE_CAR_CONNECTION);
     car->connected_to_controller = true;
+    shm_unlock(car->state);
     send_message(car->server_sd, "CAR %s %s %s", car->name, car->lowest_floor,
                  car->highest_floor);
+
+    /* A plan belongs to the connection it was sent on. The receiver and
+     * updater aren't running yet so the plan can be reset without the
+     * mutex. */
+    plan_init(&car->plan);
+    if (car->plan_enabled)
+    {
+        send_message(car->server_sd, "FEATURES PLAN");
+    }
     signal_controller(car);
 }
 
+/*
+ * Marks the car as no longer connected and wakes the connection thread.
+ * outage is false when the car dropped the connection itself because it left
+ * normal operation.
+ */
+void lose_connection(car_t *car, bool outage)
+{
+    shm_lock(car->state, LOCK_SITE_CAR_CONNECTION);
+    if (car->connected_to_controller)
+    {
+        car->connected_to_controller = false;
+        reconnect_lost(&car->reconnect, outage);
+    }
+    pthread_cond_broadcast(&car->state->cond);
+    shm_unlock(car->state);
+}
+
 /*
  * Validates command line arguments.
  */
@@ -592,3 +1022,25 @@ bool is_args_valid(int argc)
     }
     return true;
 }
+
+/*
+ * Validates the command line arguments of fleet mode and works out how many
+ * worker threads to use, one per online CPU unless given.
+ */
+bool is_fleet_args_valid(int argc, char *argv[], size_t *num_workers)
+{
+    if (argc != 3 && argc != 4)
+    {
+        fprintf(stderr, "Usage: %s --fleet {fleet file} [workers]\n", argv[0]);
+        return false;
+    }
+
+    long workers = argc == 4 ? atol(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+    {
+        fprintf(stderr, "Error: The number of workers must be at least 1.\n");
+        return false;
+    }
+    *num_workers = (size_t)workers;
+    return true;
+}
@@ -2,9 +2,31 @@
 
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "motion.h"
+#include "plan.h"
 #include "posix.h"
+#include "reconnect.h"
+
+/* How long, in milliseconds, the updater waits for further changes before
+ * sending a STATUS so a burst of transitions reaches the controller as one
+ * message. Set with `make STATUS_COALESCE_MS={ms}`, 0 sends every change. */
+#ifndef STATUS_COALESCE_MS
+#define STATUS_COALESCE_MS 0
+#endif
+
+/*
+ * The fields of a car reported to the controller in a STATUS message
+ */
+typedef struct car_status
+{
+    char status[8];
+    char current_floor[4];
+    char destination_floor[4];
+} car_status_t;
 
 /*
  * Structure representing a car in the elevator system. Contains information
@@ -21,13 +43,23 @@ typedef struct car
     const char *lowest_floor;       // The lowest accessible floor for this car
     const char *highest_floor;      // The highest accessible floor for this car
     uint32_t delay;                 // Delay duration for certain operations
+    motion_t motion;                // Travel and door times, see motion.h
     pthread_t door_thread;          // Thread for handling door operations
     pthread_t level_thread;    // Thread for handling level (floor) operations
     pthread_t receiver_thread; // Thread for receiving messages from controller
     pthread_t updater_thread;  // Thread for updating the controller
+    pthread_t connection_thread;  // Thread for (re)connecting to the controller
     bool connected_to_controller; // Flag to indicate connection status
+    bool session_running; // The receiver and updater threads were started
+    bool stopping;        // Asks the connection thread to exit, mutex protected
+    reconnect_t reconnect; // Backoff between connection attempts
     int fd;                       // File descriptor for shared memory
     car_shared_mem *state; // Pointer to shared memory containing car state
+    car_status_t sent;     // Last STATUS sent to the controller
+    bool plan_enabled;     // Ask the controller for PLAN messages
+    car_plan_t plan;       // Stops sent in PLAN messages, mutex protected
+    bool cycle_doors; // A FLOOR for the floor the car is on asks the level
+                      // thread to cycle the doors again, mutex protected
 } car_t;
 
 /*
@@ -51,24 +83,26 @@ void *handle_level(void *);
 void *handle_receiver(void *);
 // Function for updating the controller
 void *handle_updater(void *);
+// Function for keeping the car connected to the controller
+void *handle_connection(void *);
 
 /*
  * Functions to manage door operations
  */
 
-// Opens the car doors
-void open_doors(car_t *);
-// Closes the car doors
-void close_doors(car_t *);
+// Opens the car doors, optionally resetting the open button
+void open_doors(car_t *, bool);
+// Closes the car doors, optionally resetting the close button
+void close_doors(car_t *, bool);
 
 /*
  * Functions for managing delay
  */
 
-// Sleeps for a delay unless the condition variable is signaled
-int sleep_delay_cond(car_t *);
-// Sleeps for the configured delay
-void sleep_delay(const car_t *);
+// Sleeps for some ms unless a door button is pressed
+int sleep_delay_cond(car_t *, uint32_t);
+// Sleeps for some ms
+void sleep_delay(uint32_t);
 
 /*
  * Utility functions for floor bounds checking and comparison
@@ -85,9 +119,17 @@ int cdcmp_floors(car_shared_mem *);
 
 // Updates the condroller with the cares current state.
 void signal_controller(car_t *);
+// Copies the STATUS fields out of shared memory, the mutex must be held
+void read_status(const car_shared_mem *, car_status_t *);
+// Sends a STATUS unless it repeats the last one sent, returns true if sent
+bool send_status(car_t *, const car_status_t *);
 // Checks if car should be connected to the controller.
 bool should_maintain_connection(car_t *);
 // Handles steps needed after initial server connection.
 void handle_initial_connection(car_t *);
+// Marks the car as disconnected and wakes the connection thread
+void lose_connection(car_t *, bool);
 // Validates command-line arguments
 bool is_args_valid(int);
+// Validates the command-line arguments of fleet mode
+bool is_fleet_args_valid(int, char *[], size_t *);
@@ -0,0 +1,812 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * This is the event driven runtime for the car, selected with `car
+ * --event-loop`. It behaves like the threaded runtime in car.c but every
+ * decision is made on one thread:
+ *
+ *   - Door and travel delays are timers on a timing wheel (timerwheel.c)
+ *     instead of sleeps, so the doors can be held open or reopened by
+ *     rescheduling a timer rather than interrupting a sleeping thread. The
+ *     wheel belongs to whoever runs the loop and is driven by one timerfd.
+ *   - Messages from the controller are read from the socket as epoll reports
+ *     it readable and split into frames in a small buffer.
+ *   - Other processes (internal, safety, the testers) change the shared memory
+ *     directly and only broadcast on its condition variable, which can't be
+ *     waited on with epoll. A bridge thread waits on the condition variable
+ *     and writes to an eventfd each time it wakes. It holds the mutex
+ *     whenever it isn't waiting, so no broadcast is missed. Loops started
+ *     without a bridge (a fleet, see fleet.c) call car_loop_poll() instead.
+ *
+ * Every event ends with evaluate(), which reads the shared memory once and
+ * advances the door and level state machines in a single transaction, and
+ * sync_controller(), which sends a STATUS message only when the status or
+ * floors actually changed.
+ */
+
+#include "carloop.h"
+#include "global.h"
+#include "plan.h"
+#include "posix.h"
+#include "tcpip.h"
+
+#include "timerwheel.h"
+
+/*
+ * Reads the counter of a timerfd or eventfd so epoll stops reporting it.
+ * Returns false if there was nothing to read.
+ */
+static bool drain_fd(int fd)
+{
+    uint64_t count;
+    ssize_t result;
+    do
+    {
+        result = read(fd, &count, sizeof(count));
+    } while (result == -1 && errno == EINTR);
+    return result == sizeof(count);
+}
+
+/*
+ * Thread function that forwards broadcasts on the car's condition variable to
+ * the loop's eventfd.
+ */
+static void *shm_bridge(void *arg)
+{
+    car_loop_t *loop = (car_loop_t *)arg;
+    car_shared_mem *state = loop->car->state;
+    uint64_t one = 1;
+
+    shm_lock(state, LOCK_SITE_CAR_LOOP_BRIDGE);
+    while (!loop->bridge_stop)
+    {
+        shm_cond_wait(state);
+        if (write(loop->shm_fd, &one, sizeof(one)) == -1)
+        {
+            perror("write()");
+        }
+    }
+    shm_unlock(state);
+
+    return NULL;
+}
+
+/*
+ * Starts the bridge thread with signals blocked so they are delivered to the
+ * thread waiting in epoll_wait().
+ */
+static bool start_bridge(car_loop_t *loop)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int result = pthread_create(&loop->bridge_thread, NULL, shm_bridge, loop);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (result != 0)
+    {
+        perror("pthread_create()");
+        return false;
+    }
+    loop->bridge_running = true;
+    return true;
+}
+
+/*
+ * Registers one of the loop's fds with epoll.
+ */
+static bool watch_fd(car_loop_t *loop, int fd, car_source_kind_t kind)
+{
+    loop->sources[kind].loop = loop;
+    loop->sources[kind].kind = kind;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->sources[kind];
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/*
+ * Closes the socket to the controller. If the car was still connected the
+ * connection was lost rather than dropped for a mode change.
+ */
+static void disconnect(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    if (car->server_sd >= 0)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, car->server_sd, NULL);
+        close(car->server_sd);
+        car->server_sd = -1;
+    }
+    if (car->connected_to_controller)
+    {
+        car->connected_to_controller = false;
+        reconnect_lost(&car->reconnect, true);
+    }
+    msg_reader_init(&loop->rx, -1);
+}
+
+/*
+ * Makes sure a connection attempt is coming if the car is disconnected and
+ * allowed to connect. After a failed attempt the connect timer is already
+ * pending with the backoff, which is left alone.
+ */
+static void schedule_connect(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    if (!loop->connect_timer.pending && !car->connected_to_controller &&
+        should_maintain_connection(car))
+    {
+        timer_schedule(loop->wheel, &loop->connect_timer, 0);
+    }
+}
+
+/*
+ * Keeps the controller informed about the car. Mirrors handle_updater() in
+ * car.c, except that STATUS is only sent when the status or one of the floors
+ * changed since the last one. After EMERGENCY or INDIVIDUAL SERVICE the car
+ * stops sending but leaves the socket open for the controller to close; the
+ * connect timer replaces it once the car may reconnect.
+ */
+static void sync_controller(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    if (!car->connected_to_controller)
+    {
+        schedule_connect(loop);
+        return;
+    }
+
+    car_status_t status;
+    shm_lock(car->state, LOCK_SITE_CAR_LOOP_SYNC);
+    uint8_t service_mode = car->state->individual_service_mode;
+    uint8_t emergency_mode = car->state->emergency_mode;
+    read_status(car->state, &status);
+    shm_unlock(car->state);
+
+    /* Tell the controller if the car left normal operation and stop sending. */
+    if (emergency_mode == 1)
+    {
+        send_message(car->server_sd, "EMERGENCY");
+        car->connected_to_controller = false;
+        reconnect_lost(&car->reconnect, false);
+        return;
+    }
+    else if (service_mode == 1)
+    {
+        send_message(car->server_sd, "INDIVIDUAL SERVICE");
+        car->connected_to_controller = false;
+        reconnect_lost(&car->reconnect, false);
+        return;
+    }
+
+    send_status(car, &status);
+}
+
+/*
+ * Starts opening the doors as part of an update. auto_close closes them again
+ * after the hold even in individual service mode, which is what the level
+ * thread and the receiver do in car.c.
+ */
+static void start_opening(car_loop_t *loop, shm_update_t *u, bool auto_close)
+{
+    shm_update_open_button(u, 0);
+    shm_update_status(u, "Opening");
+    loop->doors = DOORS_OPENING;
+    loop->auto_close = auto_close;
+    timer_schedule(loop->wheel, &loop->door_timer,
+                   loop->car->motion.door_open_ms);
+}
+
+/*
+ * Starts closing the doors as part of an update, unless they already are.
+ */
+static void start_closing(car_loop_t *loop, shm_update_t *u)
+{
+    shm_update_close_button(u, 0);
+    if (strcmp(u->state->status, "Closed") == 0)
+    {
+        loop->doors = DOORS_IDLE;
+        timer_cancel(loop->wheel, &loop->door_timer);
+        return;
+    }
+    shm_update_status(u, "Closing");
+    loop->doors = DOORS_CLOSING;
+    timer_schedule(loop->wheel, &loop->door_timer,
+                   loop->car->motion.door_close_ms);
+}
+
+/*
+ * Compares the current and destination floors like cdcmp_floors(). Must be
+ * called with the mutex held.
+ */
+static int compare_floors(const car_shared_mem *state)
+{
+    int cf_number = floor_to_int(state->current_floor);
+    int df_number = floor_to_int(state->destination_floor);
+    if (cf_number > df_number)
+        return -1;
+    else if (cf_number < df_number)
+        return 1;
+    else
+        return 0;
+}
+
+/*
+ * Returns how long the car takes to move on to the next floor towards its
+ * destination, see motion_step_ms(). Must be called with the mutex held.
+ */
+static uint32_t next_step_ms(car_loop_t *loop)
+{
+    const car_shared_mem *state = loop->car->state;
+    return motion_step_ms(&loop->car->motion, &loop->trip_start,
+                          floor_to_int(state->current_floor),
+                          floor_to_int(state->destination_floor));
+}
+
+/*
+ * Reacts to the current contents of the shared memory: door buttons and a new
+ * destination floor. Called after every event, so it must be idempotent.
+ */
+static void evaluate(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_LOOP_EVALUATE);
+
+    /* Door buttons don't do anything while the car is between floors, they
+     * stay pressed until it arrives. */
+    if (strcmp(car->state->status, "Between") != 0)
+    {
+        if (car->state->open_button == 1)
+        {
+            /* The doors are already opening, otherwise (re)open them. */
+            if (loop->doors == DOORS_OPENING)
+            {
+                shm_update_open_button(&u, 0);
+            }
+            else
+            {
+                start_opening(loop, &u, false);
+            }
+        }
+        else if (car->state->close_button == 1 &&
+                 (loop->doors == DOORS_IDLE || loop->doors == DOORS_OPEN))
+        {
+            start_closing(loop, &u);
+        }
+    }
+
+    /* Start travelling once the doors have finished cycling. A destination
+     * outside the car's range is pulled back to the nearest floor in range. */
+    if (!loop->moving && loop->doors == DOORS_IDLE &&
+        compare_floors(car->state) != 0)
+    {
+        int bounds_check =
+            bounds_check_floor(car, car->state->destination_floor);
+        if (bounds_check != 0)
+        {
+            shm_update_destination_floor(&u, bounds_check == -1
+                                                 ? car->lowest_floor
+                                                 : car->highest_floor);
+            shm_update_status(&u, "Closed");
+        }
+        else
+        {
+            shm_update_status(&u, "Between");
+            loop->moving = true;
+            loop->trip_start = floor_to_int(car->state->current_floor);
+            timer_schedule(loop->wheel, &loop->level_timer, next_step_ms(loop));
+        }
+    }
+
+    shm_commit(&u);
+}
+
+/*
+ * Advances the doors to their next phase. Returns true if they have just
+ * finished closing.
+ */
+static bool on_door_timer(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    bool closed = false;
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_LOOP_DOORS);
+
+    switch (loop->doors)
+    {
+    case DOORS_OPENING:
+        shm_update_status(&u, "Open");
+        loop->doors = DOORS_OPEN;
+        timer_schedule(loop->wheel, &loop->door_timer,
+                       car->motion.door_dwell_ms);
+        break;
+    case DOORS_OPEN:
+        /* In individual service mode the doors stay open until the close
+         * button is pressed. */
+        if (loop->auto_close || car->state->individual_service_mode == 0)
+        {
+            start_closing(loop, &u);
+        }
+        else
+        {
+            loop->doors = DOORS_IDLE;
+        }
+        break;
+    case DOORS_CLOSING:
+        shm_update_status(&u, "Closed");
+        loop->doors = DOORS_IDLE;
+        closed = true;
+        break;
+    case DOORS_IDLE:
+        break;
+    }
+
+    shm_commit(&u);
+    return closed;
+}
+
+/*
+ * At a planned stop, heads for the next one once the doors have finished
+ * cycling. evaluate() sets the car moving.
+ */
+static void next_planned_stop(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_LOOP_DOORS);
+    const char *next = plan_arrived(&car->plan, car->state->current_floor);
+    if (next != NULL)
+    {
+        shm_update_destination_floor(&u, next);
+    }
+    shm_commit(&u);
+}
+
+/*
+ * Moves the car one floor towards its destination. On arrival the doors are
+ * cycled in the same update unless the car is in individual service mode.
+ */
+static void on_level_timer(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_LOOP_LEVEL);
+
+    int direction = compare_floors(car->state);
+    if (direction == 1 && increment_floor(car->state->current_floor) == 0)
+    {
+        shm_mark_dirty(&u, SHM_FIELD_CURRENT_FLOOR);
+    }
+    else if (direction == -1 &&
+             decrement_floor(car->state->current_floor) == 0)
+    {
+        shm_mark_dirty(&u, SHM_FIELD_CURRENT_FLOOR);
+    }
+
+    if (compare_floors(car->state) != 0)
+    {
+        timer_schedule(loop->wheel, &loop->level_timer, next_step_ms(loop));
+    }
+    else
+    {
+        loop->moving = false;
+        if (car->state->individual_service_mode == 0)
+        {
+            start_opening(loop, &u, true);
+        }
+        else
+        {
+            shm_update_status(&u, "Closed");
+        }
+    }
+
+    shm_commit(&u);
+}
+
+/*
+ * Sends the car to a floor, or cycles the doors if it is already there, as
+ * asked by a FLOOR message or the next stop of a PLAN. Like the threaded car,
+ * a car travelling to the requested floor opens the doors when it gets there,
+ * and one stopped on it cycles them once any cycle in progress is over, even
+ * if it was about to leave for another floor.
+ */
+static void request_floor(car_loop_t *loop, const char *floor)
+{
+    car_t *car = loop->car;
+    shm_update_t u;
+    shm_begin(&u, car->state, LOCK_SITE_CAR_LOOP_RECEIVER);
+    if (strcmp(car->state->destination_floor, floor) != 0)
+    {
+        /* Send the car to its destination, evaluate() sets it moving. */
+        shm_update_destination_floor(&u, floor);
+        loop->cycle_doors = false;
+    }
+    if (!loop->moving && compare_floors(car->state) == 0)
+    {
+        if (loop->doors == DOORS_IDLE)
+        {
+            start_opening(loop, &u, true);
+        }
+        else
+        {
+            loop->cycle_doors = true;
+        }
+    }
+    shm_commit(&u);
+}
+
+/*
+ * Handles a single message from the controller.
+ */
+static void handle_message(car_loop_t *loop, char *message)
+{
+    char *saveptr;
+    const char *message_type = strtok_r(message, " ", &saveptr);
+    if (message_type == NULL)
+    {
+        return;
+    }
+
+    if (strcmp(message_type, "FLOOR") == 0)
+    {
+        const char *floor = strtok_r(NULL, " ", &saveptr);
+        if (floor != NULL)
+        {
+            request_floor(loop, floor);
+        }
+    }
+    else if (strcmp(message_type, "PLAN") == 0)
+    {
+        /* A new plan only moves the car if its first stop changed. */
+        const char *next = plan_replace(&loop->car->plan, &saveptr);
+        if (next != NULL)
+        {
+            request_floor(loop, next);
+        }
+    }
+}
+
+/*
+ * Reads what the controller sent with a single read() and handles every
+ * complete frame, see msg_reader_t in tcpip.h.
+ */
+static void on_server(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    if (car->server_sd < 0)
+    {
+        return;
+    }
+
+    ssize_t received = msg_reader_fill(&loop->rx);
+    if (received <= 0)
+    {
+        /* The controller hung up. */
+        disconnect(loop);
+        return;
+    }
+
+    char *message;
+    while ((message = msg_reader_frame(&loop->rx)) != NULL)
+    {
+        handle_message(loop, message);
+    }
+    if (loop->rx.failed)
+    {
+        /* Nothing the controller sends is this large. */
+        fprintf(stderr, "Frame from controller too large.\n");
+        disconnect(loop);
+    }
+}
+
+/*
+ * Connects to the controller when the car is allowed to, the same way the
+ * connection thread does in car.c. A failed attempt schedules the next one
+ * after the backoff.
+ */
+static void on_connect_timer(car_loop_t *loop)
+{
+    car_t *car = loop->car;
+    if (car->connected_to_controller || !should_maintain_connection(car))
+    {
+        return;
+    }
+
+    disconnect(loop);
+    if (!connect_to_controller(&car->server_sd, &car->server_addr))
+    {
+        car->server_sd = -1;
+        timer_schedule(loop->wheel, &loop->connect_timer,
+                       reconnect_failed(&car->reconnect));
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &loop->sources[CAR_SOURCE_SERVER];
+    loop->sources[CAR_SOURCE_SERVER].loop = loop;
+    loop->sources[CAR_SOURCE_SERVER].kind = CAR_SOURCE_SERVER;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, car->server_sd, &ev) == -1)
+    {
+        perror("epoll_ctl()");
+        close(car->server_sd);
+        car->server_sd = -1;
+        return;
+    }
+
+    car->connected_to_controller = true;
+    reconnect_connected(&car->reconnect);
+    msg_reader_init(&loop->rx, car->server_sd);
+    send_message(car->server_sd, "CAR %s %s %s", car->name, car->lowest_floor,
+                 car->highest_floor);
+    plan_init(&car->plan);
+    if (car->plan_enabled)
+    {
+        send_message(car->server_sd, "FEATURES PLAN");
+    }
+
+    /* Forget the last STATUS so the controller gets one straight away. */
+    car->sent.status[0] = '\0';
+}
+
+/*
+ * Opens the doors again if a FLOOR for the floor the car is on arrived while
+ * they were cycling. Returns true if they are opening.
+ */
+static bool cycle_doors_again(car_loop_t *loop)
+{
+    if (!loop->cycle_doors)
+    {
+        return false;
+    }
+    loop->cycle_doors = false;
+
+    shm_update_t u;
+    shm_begin(&u, loop->car->state, LOCK_SITE_CAR_LOOP_DOORS);
+    start_opening(loop, &u, true);
+    shm_commit(&u);
+    return true;
+}
+
+/*
+ * Timer callbacks. Each one advances its state machine and then reacts to the
+ * new state like any other event.
+ */
+static void door_timer_fired(void *arg)
+{
+    car_loop_t *loop = (car_loop_t *)arg;
+    /* Report the doors closed before they open again or the car leaves for
+     * its next planned stop, like the threaded car. */
+    if (on_door_timer(loop))
+    {
+        sync_controller(loop);
+        if (!cycle_doors_again(loop))
+        {
+            next_planned_stop(loop);
+        }
+    }
+    evaluate(loop);
+    sync_controller(loop);
+}
+
+static void level_timer_fired(void *arg)
+{
+    car_loop_t *loop = (car_loop_t *)arg;
+    on_level_timer(loop);
+    evaluate(loop);
+    sync_controller(loop);
+}
+
+static void connect_timer_fired(void *arg)
+{
+    car_loop_t *loop = (car_loop_t *)arg;
+    on_connect_timer(loop);
+    evaluate(loop);
+    sync_controller(loop);
+}
+
+/*
+ * Initialises a car loop and registers its fds with epoll_fd. The car must
+ * already have been initialised with car_init(). Without a bridge thread the
+ * owner of the loop must call car_loop_poll() regularly to notice changes
+ * made by other programs.
+ */
+bool car_loop_init(car_loop_t *loop, car_t *car, int epoll_fd,
+                   timer_wheel_t *wheel, bool bridge)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->car = car;
+    loop->epoll_fd = epoll_fd;
+    loop->wheel = wheel;
+    loop->doors = DOORS_IDLE;
+    timer_event_init(&loop->door_timer, door_timer_fired, loop);
+    timer_event_init(&loop->level_timer, level_timer_fired, loop);
+    timer_event_init(&loop->connect_timer, connect_timer_fired, loop);
+    loop->shm_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (loop->shm_fd == -1 || !watch_fd(loop, loop->shm_fd, CAR_SOURCE_SHM))
+    {
+        perror("car_loop_init()");
+        car_loop_deinit(loop);
+        return false;
+    }
+
+    if (bridge && !start_bridge(loop))
+    {
+        car_loop_deinit(loop);
+        return false;
+    }
+
+    /* Try to connect straight away, like car.c. */
+    connect_timer_fired(loop);
+    sync_controller(loop);
+
+    return true;
+}
+
+/*
+ * Stops the bridge thread, hangs up on the controller and closes the loop's
+ * fds. The car itself is left for car_deinit().
+ */
+void car_loop_deinit(car_loop_t *loop)
+{
+    if (loop->bridge_running)
+    {
+        shm_lock(loop->car->state, LOCK_SITE_CAR_LOOP_BRIDGE);
+        loop->bridge_stop = true;
+        pthread_cond_broadcast(&loop->car->state->cond);
+        shm_unlock(loop->car->state);
+        pthread_join(loop->bridge_thread, NULL);
+        loop->bridge_running = false;
+    }
+
+    disconnect(loop);
+
+    timer_cancel(loop->wheel, &loop->door_timer);
+    timer_cancel(loop->wheel, &loop->level_timer);
+    timer_cancel(loop->wheel, &loop->connect_timer);
+    if (loop->shm_fd >= 0)
+    {
+        close(loop->shm_fd);
+    }
+    loop->shm_fd = -1;
+}
+
+/*
+ * Checks the shared memory for changes made since the last call and reacts to
+ * them. Used instead of the bridge thread when many cars share a thread; it
+ * costs one uncontended lock per call. Returns whether anything changed.
+ */
+bool car_loop_poll(car_loop_t *loop)
+{
+    car_shared_mem *state = loop->car->state;
+    size_t offset = offsetof(car_shared_mem, current_floor);
+
+    shm_lock(state, LOCK_SITE_CAR_LOOP_POLL);
+    bool changed = memcmp(loop->seen, (char *)state + offset,
+                          sizeof(loop->seen)) != 0;
+    if (changed)
+    {
+        memcpy(loop->seen, (char *)state + offset, sizeof(loop->seen));
+    }
+    shm_unlock(state);
+
+    if (changed)
+    {
+        evaluate(loop);
+        sync_controller(loop);
+    }
+    return changed;
+}
+
+/*
+ * Handles an event reported by epoll for one of a car loop's fds.
+ */
+void car_loop_dispatch(car_source_t *source, uint32_t events)
+{
+    car_loop_t *loop = source->loop;
+
+    switch (source->kind)
+    {
+    case CAR_SOURCE_SERVER:
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            on_server(loop);
+        }
+        break;
+    case CAR_SOURCE_SHM:
+        drain_fd(loop->shm_fd);
+        break;
+    case CAR_SOURCE_COUNT:
+        break;
+    }
+
+    evaluate(loop);
+    sync_controller(loop);
+}
+
+/*
+ * Runs a single car on its own epoll instance and timing wheel until
+ * *keep_running is cleared by a signal handler installed without SA_RESTART.
+ */
+int car_loop_run(car_t *car, volatile sig_atomic_t *keep_running)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || wheel_fd == -1)
+    {
+        perror("car_loop_run()");
+        return 1;
+    }
+
+    /* The wheel's timerfd is told apart from the car's fds by its epoll data.
+     */
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel);
+    car_source_t wheel_tag;
+    memset(&wheel_tag, 0, sizeof(wheel_tag));
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wheel_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wheel_fd, &ev);
+
+    car_loop_t loop;
+    if (!car_loop_init(&loop, car, epoll_fd, &wheel, true))
+    {
+        close(wheel_fd);
+        close(epoll_fd);
+        return 1;
+    }
+
+    struct epoll_event events[8];
+    while (*keep_running)
+    {
+        timer_wheel_arm_timerfd(&wheel, wheel_fd);
+        int n = epoll_wait(epoll_fd, events, 8, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait()");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            car_source_t *source = (car_source_t *)events[i].data.ptr;
+            if (source == &wheel_tag)
+            {
+                drain_fd(wheel_fd);
+                timer_wheel_advance(&wheel);
+            }
+            else
+            {
+                car_loop_dispatch(source, events[i].events);
+            }
+        }
+    }
+
+    car_loop_deinit(&loop);
+    close(wheel_fd);
+    close(epoll_fd);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+ * This header file defines the single threaded, event driven runtime for a
+ * car. Instead of one thread per responsibility the runtime waits on a single
+ * epoll instance for:
+ *   - timers on a timing wheel that drive the door and travel delays and
+ *     retry the controller connection with backoff,
+ *   - the socket connected to the controller,
+ *   - an eventfd written to whenever the car's shared memory changes, or
+ *     regular calls to car_loop_poll() when many cars share a thread.
+ *
+ * See carloop.c for implementation details.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "car.h"
+#include "tcpip.h"
+#include "timerwheel.h"
+
+/*
+ * Phases of the door state machine
+ */
+typedef enum
+{
+    DOORS_IDLE,    // Doors are not being cycled
+    DOORS_OPENING, // Waiting for the doors to finish opening
+    DOORS_OPEN,    // Holding the doors open
+    DOORS_CLOSING  // Waiting for the doors to finish closing
+} door_phase_t;
+
+/*
+ * The kinds of file descriptor a car loop registers with epoll
+ */
+typedef enum
+{
+    CAR_SOURCE_SERVER,
+    CAR_SOURCE_SHM,
+    CAR_SOURCE_COUNT
+} car_source_kind_t;
+
+struct car_loop;
+
+/*
+ * Registered as the epoll data of each file descriptor so an event can be
+ * routed back to its car and handler.
+ */
+typedef struct car_source
+{
+    struct car_loop *loop;
+    car_source_kind_t kind;
+} car_source_t;
+
+/*
+ * State of a car driven by an event loop
+ */
+typedef struct car_loop
+{
+    car_t *car;           // The car being driven
+    int epoll_fd;         // Epoll instance the car's fds are registered with
+    timer_wheel_t *wheel; // Wheel the loop's timers are scheduled on
+    timer_event_t door_timer;  // Fires when the current door phase is over
+    timer_event_t level_timer; // Fires when the car reaches the next floor
+    timer_event_t connect_timer; // Next attempt to connect to the controller
+    int shm_fd; // eventfd the bridge thread writes to on each change
+    car_source_t sources[CAR_SOURCE_COUNT]; // epoll data for each fd
+
+    door_phase_t doors;  // Current phase of the doors
+    bool auto_close;     // Close the doors after the hold even in service mode
+    bool moving;         // The car is travelling between floors
+    bool cycle_doors;    // Cycle the doors again once they have closed
+    int trip_start;      // Floor the current trip started from at rest
+
+    msg_reader_t rx; // Messages received from the controller
+
+    /* Copy of the shared memory fields as of the last car_loop_poll() */
+    char seen[sizeof(car_shared_mem) - offsetof(car_shared_mem, current_floor)];
+
+    pthread_t bridge_thread; // Turns condition variable broadcasts into
+                             // writes to shm_fd
+    bool bridge_running;     // The bridge thread was started
+    bool bridge_stop;        // Asks the bridge thread to exit, mutex protected
+} car_loop_t;
+
+// Creates the loop's fds, registers them with an epoll instance and optionally
+// starts the shared memory bridge
+bool car_loop_init(car_loop_t *, car_t *, int, timer_wheel_t *, bool);
+// Stops the bridge and closes every fd the loop owns
+void car_loop_deinit(car_loop_t *);
+// Handles an epoll event for one of the loop's fds
+void car_loop_dispatch(car_source_t *, uint32_t);
+// Reacts to shared memory changes for loops started without a bridge
+bool car_loop_poll(car_loop_t *);
+
+// Runs a single car on its own epoll instance until *keep_running is cleared
+int car_loop_run(car_t *, volatile sig_atomic_t *);
@@ -21,9 +21,12 @@
  */
 
 #include "controller.h"
+#include "dispatch.h"
 #include "global.h"
+#include "plan.h"
 #include "queue.h"
 #include "tcpip.h"
+#include "trace.h"
 
 static volatile sig_atomic_t keep_running = 1;
 
@@ -38,8 +41,22 @@ static void signal_handler(int signum)
     }
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+    /* `controller --trace {file}` records the traffic it handles, see
+     * trace.h. */
+    trace_writer_t trace;
+    bool tracing = argc == 3 && strcmp(argv[1], "--trace") == 0;
+    if (argc != 1 && !tracing)
+    {
+        fprintf(stderr, "Usage: %s [--trace {file}]\n", argv[0]);
+        return 1;
+    }
+    if (tracing && !trace_writer_open(&trace, argv[2]))
+    {
+        return 1;
+    }
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = signal_handler;
@@ -55,16 +72,27 @@ int main(void)
 
     controller_t controller;
     controller_init(&controller);
+    controller.trace = tracing ? &trace : NULL;
 
     /* Main loop that continuously processes incoming messages until a
      * termination signal is received. */
     while (keep_running)
     {
         handle_incoming_messages(&controller);
+
+        /* Only once the round's answers have gone out. */
+        if (controller.trace != NULL)
+        {
+            trace_writer_flush(controller.trace);
+        }
     }
 
     /* Deinitialise controller to free up resources */
     controller_deinit(&controller);
+    if (tracing)
+    {
+        trace_writer_close(&trace);
+    }
 
     return 0;
 }
@@ -80,6 +108,11 @@ void car_connection_init(car_connection_t *c)
     c->lowest_floor = NULL;
     c->highest_floor = NULL;
     queue_init(&c->queue);
+    msg_reader_init(&c->reader, -1);
+    c->plan = false;
+    c->plan_dirty = false;
+    c->plan_amended = false;
+    c->plan_resend = false;
 }
 
 /*
@@ -111,6 +144,8 @@ void controller_init(controller_t *controller)
     {
         car_connection_init(&controller->car_connections[i]);
     }
+    controller->num_call_connections = 0;
+    controller->trace = NULL;
 }
 
 /*
@@ -131,15 +166,28 @@ void controller_deinit(controller_t *controller)
             car_connection_deinit(c);
         }
     }
+
+    /* Hang up on every call pad still connected */
+    while (controller->num_call_connections > 0)
+    {
+        remove_call_connection(controller, 0);
+    }
 }
 
 /*
  * Handles an incoming call request to the elevator system by finding a suitable
- * car and managing the request queue.
+ * car and managing the request queue. The call pad's answer is sent without
+ * blocking so one that stops reading can't stall the controller. Returns false
+ * if it couldn't be sent, in which case the call pad should be hung up on.
  */
-void handle_call(controller_t *controller, int sd, const char *source_floor,
+bool handle_call(controller_t *controller, int sd, const char *source_floor,
                  const char *destination_floor)
 {
+    if (controller->trace != NULL)
+    {
+        trace_write_call(controller->trace, source_floor, destination_floor);
+    }
+
     /*
      * Find a car capable of servicing the call and handle it.
      */
@@ -149,17 +197,25 @@ void handle_call(controller_t *controller, int sd, const char *source_floor,
 
         /* Check if the source and destination floors are within the car's range
          */
-        if (floor_in_range(source_floor, c->lowest_floor, c->highest_floor) ==
-                0 &&
-            floor_in_range(destination_floor, c->lowest_floor,
-                           c->highest_floor) == 0)
+        if (dispatch_in_range(c->lowest_floor, c->highest_floor, source_floor,
+                              destination_floor))
         {
-            /* Add source and destination floor to the queue */
-            enqueue_pair(&c->queue, source_floor, destination_floor);
+            bool answered = send_message_nowait(sd, "CAR %s", c->name);
 
-            send_message(sd, "CAR %s", c->name);
-            /* Get the next undisplayed floor and send a message to the car */
-            char *next_floor = queue_get_undisplayed(&c->queue);
+            /* A car that takes plans gets the whole amended plan once this
+             * round of messages has been handled. */
+            if (c->plan)
+            {
+                enqueue_pair(&c->queue, source_floor, destination_floor);
+                c->plan_dirty = true;
+                c->plan_amended = true;
+                return answered;
+            }
+
+            /* Add source and destination floor to the queue and send the car
+             * the next undisplayed floor */
+            char *next_floor =
+                dispatch_call(&c->queue, source_floor, destination_floor);
             if (next_floor != NULL)
             {
                 send_message(c->sd, "FLOOR %s", next_floor);
@@ -169,25 +225,42 @@ void handle_call(controller_t *controller, int sd, const char *source_floor,
                 printf("Something went wrong with the car scheduling\n");
             }
 
-            return;
+            return answered;
         }
     }
 
     /* If no car wa found. */
-    send_message(sd, "UNAVAILABLE");
+    return send_message_nowait(sd, "UNAVAILABLE");
 }
 
 /*
- * Adds a new car connection to the controller
+ * Adds a new car connection to the controller. The reader that received the
+ * car's CAR message is taken over along with anything it already buffered
+ * after it.
  */
-void add_car_connection(controller_t *controller, int sd, const char *name,
-                        const char *lowest_floor, const char *highest_floor)
+void add_car_connection(controller_t *controller, const msg_reader_t *reader,
+                        const char *name, const char *lowest_floor,
+                        const char *highest_floor)
 {
-    car_connection_t new_car_connection = {
-        sd, strdup(name), strdup(lowest_floor), strdup(highest_floor), {NULL}};
-    controller->car_connections[controller->num_car_connections] =
-        new_car_connection;
+    car_connection_t *c =
+        &controller->car_connections[controller->num_car_connections];
+    c->sd = reader->fd;
+    c->name = strdup(name);
+    c->lowest_floor = strdup(lowest_floor);
+    c->highest_floor = strdup(highest_floor);
+    queue_init(&c->queue);
+    c->reader = *reader;
+    c->plan = false;
+    c->plan_dirty = false;
+    c->plan_amended = false;
+    c->plan_resend = false;
     controller->num_car_connections += 1;
+
+    if (controller->trace != NULL)
+    {
+        trace_write_join(controller->trace, name, lowest_floor,
+                         highest_floor);
+    }
 }
 
 /*
@@ -195,8 +268,9 @@ void add_car_connection(controller_t *controller, int sd, const char *name,
  * requests and new car connection messages.
  */
 void handle_server_message(controller_t *controller, char *message,
-                           int client_sock)
+                           const msg_reader_t *reader)
 {
+    int client_sock = reader->fd;
     char *saveptr;
     const char *connection_type = strtok_r(message, " ", &saveptr);
 
@@ -208,8 +282,21 @@ void handle_server_message(controller_t *controller, char *message,
          * handle the call. */
         const char *source_floor = strtok_r(NULL, " ", &saveptr);
         const char *destination_floor = strtok_r(NULL, " ", &saveptr);
+        if (source_floor == NULL || destination_floor == NULL)
+        {
+            close(client_sock);
+            return;
+        }
+
+        if (!handle_call(controller, client_sock, source_floor,
+                         destination_floor))
+        {
+            close(client_sock);
+            return;
+        }
 
-        handle_call(controller, client_sock, source_floor, destination_floor);
+        /* The call pad may have more calls to make, e.g. `call --stream`. */
+        add_call_connection(controller, reader);
     }
     else if (strcmp(connection_type, "CAR") == 0)
     {
@@ -219,11 +306,56 @@ void handle_server_message(controller_t *controller, char *message,
         const char *lowest_floor = strtok_r(NULL, " ", &saveptr);
         const char *highest_floor = strtok_r(NULL, "", &saveptr);
 
-        add_car_connection(controller, client_sock, name, lowest_floor,
+        add_car_connection(controller, reader, name, lowest_floor,
                            highest_floor);
     }
 }
 
+/*
+ * Keeps a call pad connected after its first call so it can make more over the
+ * same connection. A call pad that only makes one call simply hangs up. If
+ * too many are connected the new one is hung up on, it still got its answer.
+ */
+void add_call_connection(controller_t *controller, const msg_reader_t *reader)
+{
+    if (controller->num_call_connections == MAX_CALL_CONNECTIONS)
+    {
+        close(reader->fd);
+        return;
+    }
+    controller->call_connections[controller->num_call_connections++] =
+        *reader;
+}
+
+/*
+ * Handles a message from a connected call pad. Anything but a well formed
+ * CALL is ignored. Returns false if the call pad should be hung up on.
+ */
+bool handle_call_message(controller_t *controller, int sd, char *message)
+{
+    char *saveptr;
+    const char *message_type = strtok_r(message, " ", &saveptr);
+    const char *source_floor = strtok_r(NULL, " ", &saveptr);
+    const char *destination_floor = strtok_r(NULL, " ", &saveptr);
+    if (message_type != NULL && strcmp(message_type, "CALL") == 0 &&
+        source_floor != NULL && destination_floor != NULL)
+    {
+        return handle_call(controller, sd, source_floor, destination_floor);
+    }
+    return true;
+}
+
+/*
+ * Hangs up on a call pad. The last call pad takes its place.
+ */
+void remove_call_connection(controller_t *controller, size_t index)
+{
+    close(controller->call_connections[index].fd);
+    controller->num_call_connections -= 1;
+    controller->call_connections[index] =
+        controller->call_connections[controller->num_call_connections];
+}
+
 /*
  * Handles messages received from car connections
  */
@@ -241,16 +373,57 @@ void handle_car_connection_message(controller_t *controller,
     {
         remove_car_connection(controller, c);
     }
-    else if (strcmp(strtok_r(message, " ", &saveptr), "STATUS") == 0)
+    else
     {
-        /*
-         * Otherwise the controller recieved a status update and should decide
-         * weather it should schedule the car ferther.
-         */
-        const char *status = strtok_r(NULL, " ", &saveptr);
-        const char *current_floor = strtok_r(NULL, " ", &saveptr);
+        const char *message_type = strtok_r(message, " ", &saveptr);
+        if (message_type == NULL)
+        {
+            return;
+        }
 
-        schedule_car(c, status, current_floor);
+        if (strcmp(message_type, "STATUS") == 0)
+        {
+            /*
+             * Otherwise the controller recieved a status update and should
+             * decide weather it should schedule the car ferther.
+             */
+            const char *status = strtok_r(NULL, " ", &saveptr);
+            const char *current_floor = strtok_r(NULL, " ", &saveptr);
+            if (status != NULL && current_floor != NULL)
+            {
+                schedule_car(c, status, current_floor);
+            }
+        }
+        else if (strcmp(message_type, "FEATURES") == 0)
+        {
+            /* The car lists what it supports beyond FLOOR messages. Anything
+             * unknown is ignored. */
+            for (const char *feature = strtok_r(NULL, " ", &saveptr);
+                 feature != NULL; feature = strtok_r(NULL, " ", &saveptr))
+            {
+                if (strcmp(feature, "PLAN") == 0)
+                {
+                    c->plan = true;
+                    c->plan_dirty = !queue_empty(&c->queue);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Handles a message from a car followed by every other complete message
+ * already buffered for it, since select() won't report those. Stops early if
+ * the car is removed.
+ */
+void handle_buffered_car_messages(controller_t *controller,
+                                  car_connection_t *c, char *message)
+{
+    int sd = c->sd;
+    while (message != NULL)
+    {
+        handle_car_connection_message(controller, c, message);
+        message = c->sd == sd ? msg_reader_frame(&c->reader) : NULL;
     }
 }
 
@@ -285,6 +458,15 @@ void handle_incoming_messages(controller_t *controller)
             controller->max_sd = car_connection.sd;
     }
 
+    /* And any call pads that stayed connected */
+    for (size_t i = 0; i < controller->num_call_connections; i++)
+    {
+        int sd = controller->call_connections[i].fd;
+        FD_SET(sd, &controller->readfds);
+        if (sd > controller->max_sd)
+            controller->max_sd = sd;
+    }
+
     /* Wait for activity on any of the sockets */
     int activity =
         select(controller->max_sd + 1, &controller->readfds, NULL, NULL, NULL);
@@ -313,10 +495,40 @@ void handle_incoming_messages(controller_t *controller)
             return;
         }
 
-        /* Handle incoming messages from new connections */
-        char *message = receive_msg(client_sock);
-        handle_server_message(controller, message, client_sock);
-        free(message);
+        /* Handle incoming messages from new connections, dropping any that
+         * hang up before sending one */
+        msg_reader_t reader;
+        msg_reader_init(&reader, client_sock);
+        char *message = msg_reader_next(&reader);
+        if (message == NULL)
+        {
+            close(client_sock);
+            return;
+        }
+        size_t num_cars = controller->num_car_connections;
+        size_t num_calls = controller->num_call_connections;
+        handle_server_message(controller, message, &reader);
+
+        /* A new car may have sent more than its CAR message already. */
+        if (controller->num_car_connections > num_cars)
+        {
+            car_connection_t *c = &controller->car_connections[num_cars];
+            handle_buffered_car_messages(controller, c,
+                                         msg_reader_frame(&c->reader));
+        }
+        /* Likewise a call pad more than one call. */
+        else if (controller->num_call_connections > num_calls)
+        {
+            msg_reader_t *r = &controller->call_connections[num_calls];
+            while ((message = msg_reader_frame(r)) != NULL)
+            {
+                if (!handle_call_message(controller, r->fd, message))
+                {
+                    remove_call_connection(controller, num_calls);
+                    break;
+                }
+            }
+        }
     }
 
     /* Handle incoming messages from car connections */
@@ -325,11 +537,46 @@ void handle_incoming_messages(controller_t *controller)
         car_connection_t *c = &controller->car_connections[i];
         if (FD_ISSET(c->sd, &controller->readfds))
         {
-            char *message = receive_msg(c->sd);
-            handle_car_connection_message(controller, c, message);
-            free(message);
+            /* A car that hung up is treated like one that left normal
+             * operation so it can register again when it reconnects. */
+            char *message = msg_reader_next(&c->reader);
+            if (message == NULL)
+            {
+                remove_car_connection(controller, c);
+                continue;
+            }
+            handle_buffered_car_messages(controller, c, message);
         }
     }
+
+    /* Handle calls from connected call pads. Go backwards because removing
+     * one moves the last into its place. New call pads were just dealt
+     * with and are skipped by FD_ISSET(). */
+    for (size_t i = controller->num_call_connections; i-- > 0;)
+    {
+        msg_reader_t *r = &controller->call_connections[i];
+        if (!FD_ISSET(r->fd, &controller->readfds))
+        {
+            continue;
+        }
+        char *message = msg_reader_next(r);
+        if (message == NULL)
+        {
+            remove_call_connection(controller, i);
+            continue;
+        }
+        do
+        {
+            if (!handle_call_message(controller, r->fd, message))
+            {
+                remove_call_connection(controller, i);
+                break;
+            }
+        } while ((message = msg_reader_frame(r)) != NULL);
+    }
+
+    /* Plans are sent once per round so a burst of calls costs one PLAN. */
+    send_plans(controller);
 }
 
 /*
@@ -338,19 +585,82 @@ void handle_incoming_messages(controller_t *controller)
 void schedule_car(car_connection_t *c, const char *status,
                   const char *current_floor)
 {
+    /*
+     * A car with a plan moves on to its next stop by itself, so the stop it
+     * opened its doors at only has to be crossed off. The plan is sent again
+     * if the car may have been working from a PLAN sent before it got there,
+     * or if it didn't fit in one message.
+     */
+    if (c->plan)
+    {
+        if (strcmp(status, "Opening") == 0 &&
+            queue_display_floor(&c->queue, current_floor) && c->plan_resend)
+        {
+            c->plan_dirty = true;
+            c->plan_resend = false;
+        }
+        return;
+    }
+
     /*
      * Schedules the car for the next FLOOR message if the doors are opening,
      * the queue is not empty, and the current floor matches the last FLOOR
      * message.
      */
-    if (strcmp(status, "Opening") == 0 &&
-        strcmp(queue_prev_floor(&c->queue), current_floor) == 0 &&
-        !queue_empty(&c->queue))
+    char *next_floor = dispatch_status(&c->queue, status, current_floor);
+    if (next_floor != NULL)
+    {
+        send_message(c->sd, "FLOOR %s", next_floor);
+    }
+}
+
+/*
+ * Sends a car every stop it hasn't reached yet, in the order it should make
+ * them, up to PLAN_MAX_STOPS.
+ */
+void send_plan(car_connection_t *c)
+{
+    char plan[8 + PLAN_MAX_STOPS * 4] = "PLAN";
+    size_t length = strlen(plan);
+    size_t num_stops = 0;
+    bool truncated = false;
+
+    for (node_t *node = c->queue.head; node != NULL; node = node->next)
+    {
+        if (node->data.been_displayed)
+        {
+            continue;
+        }
+        if (num_stops == PLAN_MAX_STOPS)
+        {
+            truncated = true;
+            break;
+        }
+        length += (size_t)snprintf(plan + length, sizeof(plan) - length,
+                                   " %s", node->data.floor);
+        num_stops += 1;
+    }
+
+    if (num_stops > 0)
     {
-        char *next_floor = queue_get_undisplayed(&c->queue);
-        if (next_floor != NULL)
+        send_message(c->sd, "%s", plan);
+    }
+    c->plan_resend = truncated || c->plan_amended;
+    c->plan_amended = false;
+    c->plan_dirty = false;
+}
+
+/*
+ * Sends the plan of every car that takes plans and whose plan changed.
+ */
+void send_plans(controller_t *controller)
+{
+    for (size_t i = 0; i < controller->num_car_connections; i++)
+    {
+        car_connection_t *c = &controller->car_connections[i];
+        if (c->plan && c->plan_dirty)
         {
-            send_message(c->sd, "FLOOR %s", next_floor);
+            send_plan(c);
         }
     }
 }
@@ -361,6 +671,11 @@ void schedule_car(car_connection_t *c, const char *status,
  */
 void remove_car_connection(controller_t *controller, car_connection_t *c)
 {
+    if (controller->trace != NULL)
+    {
+        trace_write_leave(controller->trace, c->name);
+    }
+
     /* Deinitialise the car connection and remove if from the fd_set. */
     FD_CLR(c->sd, &controller->readfds);
     car_connection_deinit(c);
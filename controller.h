@@ -1,9 +1,11 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <stdbool.h>
 
 #include "queue.h"
 #include "tcpip.h"
+#include "trace.h"
 
 /*
  * Structure representing a connection to a car, including the socket
@@ -13,6 +15,8 @@
 
 /* Defines how many car connections the server can handle */
 #define MAX_CAR_CONNECTIONS 40
+/* Defines how many call pads can stay connected to send more calls */
+#define MAX_CALL_CONNECTIONS 64
 
 typedef struct car_connection
 {
@@ -21,6 +25,11 @@ typedef struct car_connection
     char *lowest_floor;  // Lowest floor the car can access
     char *highest_floor; // Highest floor the car can access
     queue_t queue;       // Queue for messages related to the car
+    msg_reader_t reader; // Buffered messages received from the car
+    bool plan;           // The car said it takes PLAN messages
+    bool plan_dirty;     // A PLAN must be sent before the next select()
+    bool plan_amended;   // Calls were added since the last PLAN
+    bool plan_resend;    // Send the plan again when the car reaches a stop
 } car_connection_t;
 
 /*
@@ -37,6 +46,10 @@ typedef struct controller
     size_t num_car_connections; // Number of active car connections
     car_connection_t
         car_connections[MAX_CAR_CONNECTIONS]; // Array of car connections
+    size_t num_call_connections; // Number of connected call pads
+    msg_reader_t
+        call_connections[MAX_CALL_CONNECTIONS]; // Call pads and their input
+    trace_writer_t *trace; // Records calls and cars, NULL if not tracing
 } controller_t;
 
 /* Function prototypes for managing the controller and car connections */
@@ -46,18 +59,32 @@ void car_connection_init(car_connection_t *);   // Initialize a car connection
 void car_connection_deinit(car_connection_t *); // Deinitialize a car connection
 
 // Add a car connection
-void add_car_connection(controller_t *, int, const char *, const char *,
-                        const char *);
-// Handle a call to the controller
-void handle_call(controller_t *, int, const char *, const char *);
+void add_car_connection(controller_t *, const msg_reader_t *, const char *,
+                        const char *, const char *);
+// Handle a call to the controller, returns false if the call pad couldn't be
+// answered
+bool handle_call(controller_t *, int, const char *, const char *);
 // Handle messages from the server
-void handle_server_message(controller_t *, char *, int);
+void handle_server_message(controller_t *, char *, const msg_reader_t *);
+// Keep a call pad connected so it can send more calls
+void add_call_connection(controller_t *, const msg_reader_t *);
+// Handle a message from a connected call pad, returns false if it should be
+// disconnected
+bool handle_call_message(controller_t *, int, char *);
+// Disconnect a call pad
+void remove_call_connection(controller_t *, size_t);
 // Handle messages from a car connection
 void handle_car_connection_message(controller_t *, car_connection_t *, char *);
+// Handle a message from a car connection and any others already buffered
+void handle_buffered_car_messages(controller_t *, car_connection_t *, char *);
 // Process incoming messages
 void handle_incoming_messages(controller_t *);
 // Schedule a car for a specific floor
 void schedule_car(car_connection_t *, const char *, const char *);
+// Send a PLAN with every pending stop of a car that takes them
+void send_plan(car_connection_t *);
+// Send the PLAN of every car whose plan changed
+void send_plans(controller_t *);
 // Shift
 // removes a car connection from controller->car_connections
 void remove_car_connection(controller_t *, car_connection_t *);
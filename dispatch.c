@@ -0,0 +1,51 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Implementation of the controller's scheduling decisions. A call goes to the
+ * first car whose range covers both of its floors and is added to that car's
+ * queue, see queue.c. The car is then sent to the first stop in its queue it
+ * hasn't been sent to yet, and again each time it opens its doors at the
+ * stop it was last sent to.
+ */
+
+#include "dispatch.h"
+#include "global.h"
+#include "queue.h"
+
+/*
+ * Returns whether both floors of a call are within a car's range.
+ */
+bool dispatch_in_range(const char *lowest_floor, const char *highest_floor,
+                       const char *source_floor, const char *destination_floor)
+{
+    return floor_in_range(source_floor, lowest_floor, highest_floor) == 0 &&
+           floor_in_range(destination_floor, lowest_floor, highest_floor) == 0;
+}
+
+/*
+ * Adds the source and destination floor of a call to a car's queue and
+ * returns the next floor the car should be sent to.
+ */
+char *dispatch_call(queue_t *queue, const char *source_floor,
+                    const char *destination_floor)
+{
+    enqueue_pair(queue, source_floor, destination_floor);
+    return queue_get_undisplayed(queue);
+}
+
+/*
+ * Returns the next floor for a car whose doors are opening at the floor it
+ * was last sent to, if there is one.
+ */
+char *dispatch_status(queue_t *queue, const char *status,
+                      const char *current_floor)
+{
+    if (strcmp(status, "Opening") != 0 || queue_empty(queue) ||
+        strcmp(queue_prev_floor(queue), current_floor) != 0)
+    {
+        return NULL;
+    }
+    return queue_get_undisplayed(queue);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * This header file defines the scheduling decisions the controller makes for
+ * cars that are sent one FLOOR at a time: which car takes a call and where a
+ * car goes next. They are kept apart from the controller's sockets so the
+ * simulator (sim.c) makes exactly the same decisions.
+ *
+ * See dispatch.c for implementation details.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+// Returns whether a car serving the first two floors can take a call from the
+// third floor to the fourth
+bool dispatch_in_range(const char *, const char *, const char *, const char *);
+// Adds a call to a car's queue, returns the floor to send the car or NULL
+char *dispatch_call(queue_t *, const char *, const char *);
+// Returns the floor to send a car that reported its status and current floor,
+// or NULL if it should carry on
+char *dispatch_status(queue_t *, const char *, const char *);
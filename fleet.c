@@ -0,0 +1,600 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/*
+ * This is the implementation of the fleet mode of the car. A fleet file lists
+ * one car per line in the same order as the car's command line arguments:
+ *
+ *   # name lowest highest delay [motion file]
+ *   A B2 10 50
+ *   B 1 20 50 express.motion
+ *
+ * Blank lines and lines starting with '#' are ignored. A car without a motion
+ * file uses the one given on the command line, if any, see motion.h. Each car
+ * gets its own shared memory object and controller connection exactly as if
+ * it had been started on its own, so the controller, safety and internal
+ * can't tell the difference. The cars are driven by the event loop in
+ * carloop.c and spread round robin over the worker threads. Each worker has
+ * one epoll instance and one timing wheel for the timers of all its cars.
+ *
+ * A car started on its own uses a bridge thread to learn about changes made
+ * to its shared memory by other programs. That would cost a thread per car,
+ * so instead each worker starts one watcher thread per FLEET_WATCH_CARS cars.
+ * A watcher sleeps in futex_waitv() on the wake_seq words of its cars'
+ * history rings (see history.h), which every update published through
+ * posix.c bumps, and marks the cars whose word moved before writing to the
+ * worker's watch_fd. The worker then calls car_loop_poll() on those cars
+ * only, so an idle worker sleeps until a timer is due, a controller socket is
+ * readable or another program changes one of its cars. Programs that write
+ * the shared memory directly without publishing (the testers do) aren't
+ * noticed. On kernels without futex_waitv() the worker falls back to checking
+ * every car every FLEET_POLL_MS.
+ */
+
+#include "car.h"
+#include "carloop.h"
+#include "fleet.h"
+#include "global.h"
+#include "posix.h"
+
+/*
+ * Reads a whole file into a NUL terminated buffer. Returns NULL on failure.
+ */
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    size_t size = 0;
+    size_t capacity = 1024;
+    char *text = malloc(capacity);
+    while (text != NULL)
+    {
+        size += fread(text + size, 1, capacity - size - 1, file);
+        if (size < capacity - 1)
+        {
+            break;
+        }
+        capacity *= 2;
+        char *grown = realloc(text, capacity);
+        if (grown == NULL)
+        {
+            free(text);
+        }
+        text = grown;
+    }
+
+    if (text != NULL)
+    {
+        text[size] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+/*
+ * Raises the open file limit as far as allowed, every car needs half a dozen
+ * file descriptors.
+ */
+static void raise_fd_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/*
+ * Splits the fleet file into cars. Returns false and prints the offending
+ * line if a line doesn't have exactly four fields.
+ */
+static bool parse_fleet(fleet_t *fleet)
+{
+    /* Count the lines first so the cars can be allocated in one go. */
+    size_t max_cars = 1;
+    for (const char *c = fleet->text; *c != '\0'; c++)
+    {
+        if (*c == '\n')
+            max_cars += 1;
+    }
+    fleet->cars = calloc(max_cars, sizeof(*fleet->cars));
+    fleet->motion_files = calloc(max_cars, sizeof(*fleet->motion_files));
+    if (fleet->cars == NULL || fleet->motion_files == NULL)
+    {
+        return false;
+    }
+
+    char *line_saveptr;
+    int line_number = 0;
+    for (char *line = strtok_r(fleet->text, "\n", &line_saveptr); line != NULL;
+         line = strtok_r(NULL, "\n", &line_saveptr))
+    {
+        line_number += 1;
+
+        char *saveptr;
+        char *fields[6];
+        int num_fields = 0;
+        for (char *field = strtok_r(line, " \t\r", &saveptr);
+             field != NULL && num_fields < 6;
+             field = strtok_r(NULL, " \t\r", &saveptr))
+        {
+            fields[num_fields++] = field;
+        }
+
+        if (num_fields == 0 || fields[0][0] == '#')
+        {
+            continue;
+        }
+        if (num_fields != 4 && num_fields != 5)
+        {
+            fprintf(stderr,
+                    "Error: Fleet line %d should be {name} {lowest floor} "
+                    "{highest floor} {delay} [motion file].\n",
+                    line_number);
+            return false;
+        }
+
+        fleet->motion_files[fleet->num_cars] =
+            num_fields == 5 ? fields[4] : NULL;
+        car_t *car = &fleet->cars[fleet->num_cars++];
+        car->name = fields[0];
+        car->lowest_floor = fields[1];
+        car->highest_floor = fields[2];
+        car->delay = (uint32_t)atoi(fields[3]);
+    }
+
+    if (fleet->num_cars == 0)
+    {
+        fprintf(stderr, "Error: The fleet file has no cars.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Timer callback that checks every car of a worker for changes made by other
+ * programs and schedules the next check.
+ */
+static void poll_cars(void *arg)
+{
+    fleet_worker_t *worker = (fleet_worker_t *)arg;
+    timer_schedule(&worker->wheel, &worker->poll_timer, FLEET_POLL_MS);
+    for (size_t i = 0; i < worker->num_loops; i++)
+    {
+        car_loop_poll(worker->loops[i]);
+    }
+}
+
+/*
+ * Thread function for a watcher. Sleeps until the history ring of one of its
+ * cars is published to, marks the car as changed and wakes the worker, until
+ * the worker's watch_stop is set.
+ */
+static void *watch_cars(void *arg)
+{
+    fleet_watcher_t *watcher = (fleet_watcher_t *)arg;
+    fleet_worker_t *worker = watcher->worker;
+    struct futex_waitv words[FLEET_WATCH_CARS + 1];
+    history_ring_t *rings[FLEET_WATCH_CARS];
+    uint64_t one = 1;
+
+    /* Count as a waiter before taking the sequence numbers, so a publish
+     * either changes the number taken or wakes the futex. */
+    memset(words, 0, sizeof(words));
+    for (size_t i = 0; i < watcher->count; i++)
+    {
+        car_loop_t *loop = worker->loops[watcher->first + i];
+        rings[i] = &get_shm_ext(loop->car->state)->history;
+        atomic_fetch_add(&rings[i]->waiters, 1);
+        words[i].uaddr = (uintptr_t)&rings[i]->wake_seq;
+        words[i].val = atomic_load(&rings[i]->wake_seq);
+        words[i].flags = FUTEX_32;
+    }
+    words[watcher->count].uaddr = (uintptr_t)&worker->watch_stop;
+    words[watcher->count].val = 0;
+    words[watcher->count].flags = FUTEX_32;
+
+    while (!atomic_load(&worker->watch_stop))
+    {
+        if (futex_waitv(words, (unsigned int)watcher->count + 1, NULL) == -1 &&
+            errno != EAGAIN && errno != EINTR)
+        {
+            perror("futex_waitv()");
+            break;
+        }
+
+        bool moved = false;
+        for (size_t i = 0; i < watcher->count; i++)
+        {
+            uint32_t seq = atomic_load(&rings[i]->wake_seq);
+            if (seq != words[i].val)
+            {
+                words[i].val = seq;
+                atomic_store(&worker->changed[watcher->first + i], true);
+                moved = true;
+            }
+        }
+        if (moved && write(worker->watch_fd, &one, sizeof(one)) == -1)
+        {
+            perror("write()");
+        }
+    }
+
+    for (size_t i = 0; i < watcher->count; i++)
+    {
+        atomic_fetch_sub(&rings[i]->waiters, 1);
+    }
+    return NULL;
+}
+
+/*
+ * Starts the watchers of a worker's cars. Returns false if the kernel can't
+ * wait on several futexes at once or a thread can't be started, in which case
+ * the cars have to be polled.
+ */
+static bool start_watchers(fleet_worker_t *worker)
+{
+    /* An empty wait fails with EINVAL where futex_waitv() exists. */
+    if (futex_waitv(NULL, 0, NULL) == 0 || errno != EINVAL)
+    {
+        return false;
+    }
+
+    atomic_store(&worker->watch_stop, 0);
+    for (size_t first = 0; first < worker->num_loops;
+         first += FLEET_WATCH_CARS)
+    {
+        fleet_watcher_t *watcher = &worker->watchers[worker->num_watchers];
+        watcher->worker = worker;
+        watcher->first = first;
+        watcher->count = worker->num_loops - first < FLEET_WATCH_CARS
+                             ? worker->num_loops - first
+                             : FLEET_WATCH_CARS;
+        if (pthread_create(&watcher->thread, NULL, watch_cars, watcher) != 0)
+        {
+            perror("pthread_create()");
+            return false;
+        }
+        worker->num_watchers += 1;
+    }
+    return true;
+}
+
+/*
+ * Stops a worker's watchers and waits for them to exit.
+ */
+static void stop_watchers(fleet_worker_t *worker)
+{
+    atomic_store(&worker->watch_stop, 1);
+    futex_wake(&worker->watch_stop);
+    for (size_t i = 0; i < worker->num_watchers; i++)
+    {
+        pthread_join(worker->watchers[i].thread, NULL);
+    }
+    worker->num_watchers = 0;
+}
+
+/*
+ * Checks the cars a watcher marked as changed.
+ */
+static void poll_changed_cars(fleet_worker_t *worker)
+{
+    uint64_t count;
+    if (read(worker->watch_fd, &count, sizeof(count)) != sizeof(count))
+    {
+        return;
+    }
+    for (size_t i = 0; i < worker->num_loops; i++)
+    {
+        if (atomic_exchange(&worker->changed[i], false))
+        {
+            car_loop_poll(worker->loops[i]);
+        }
+    }
+}
+
+/*
+ * Creates the epoll instance, timing wheel and control fds of a worker.
+ */
+static bool worker_init(fleet_worker_t *worker, size_t max_loops)
+{
+    timer_wheel_init(&worker->wheel);
+    timer_event_init(&worker->poll_timer, poll_cars, worker);
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wheel_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    worker->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    worker->watch_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    worker->loops = calloc(max_loops, sizeof(*worker->loops));
+    worker->num_loops = 0;
+    worker->changed = calloc(max_loops, sizeof(*worker->changed));
+    worker->watchers =
+        calloc((max_loops + FLEET_WATCH_CARS - 1) / FLEET_WATCH_CARS,
+               sizeof(*worker->watchers));
+    worker->num_watchers = 0;
+    if (worker->epoll_fd == -1 || worker->wheel_fd == -1 ||
+        worker->stop_fd == -1 || worker->watch_fd == -1 ||
+        worker->loops == NULL || worker->changed == NULL ||
+        worker->watchers == NULL)
+    {
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &worker->wheel_tag;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wheel_fd, &ev) ==
+        -1)
+    {
+        return false;
+    }
+    ev.data.ptr = &worker->stop_tag;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->stop_fd, &ev) == -1)
+    {
+        return false;
+    }
+    ev.data.ptr = &worker->watch_tag;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->watch_fd, &ev) ==
+        -1)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Closes a worker's fds.
+ */
+static void worker_deinit(fleet_worker_t *worker)
+{
+    timer_cancel(&worker->wheel, &worker->poll_timer);
+    int fds[] = {worker->epoll_fd, worker->wheel_fd, worker->stop_fd,
+                 worker->watch_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    free(worker->loops);
+    free(worker->changed);
+    free(worker->watchers);
+    worker->loops = NULL;
+    worker->changed = NULL;
+    worker->watchers = NULL;
+}
+
+/*
+ * Thread function for a worker. Dispatches events for the worker's cars until
+ * its stop_fd is written to.
+ */
+static void *fleet_worker(void *arg)
+{
+    fleet_worker_t *worker = (fleet_worker_t *)arg;
+    struct epoll_event events[64];
+    bool running = true;
+
+    if (!start_watchers(worker))
+    {
+        stop_watchers(worker);
+        timer_schedule(&worker->wheel, &worker->poll_timer, FLEET_POLL_MS);
+    }
+    /* Check every car once for changes made before the watchers started. */
+    for (size_t i = 0; i < worker->num_loops; i++)
+    {
+        car_loop_poll(worker->loops[i]);
+    }
+
+    while (running)
+    {
+        timer_wheel_arm_timerfd(&worker->wheel, worker->wheel_fd);
+        int n = epoll_wait(worker->epoll_fd, events, 64, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait()");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            car_source_t *source = (car_source_t *)events[i].data.ptr;
+            if (source == &worker->stop_tag)
+            {
+                running = false;
+            }
+            else if (source == &worker->wheel_tag)
+            {
+                uint64_t expirations;
+                if (read(worker->wheel_fd, &expirations, sizeof(expirations)) ==
+                    sizeof(expirations))
+                {
+                    timer_wheel_advance(&worker->wheel);
+                }
+            }
+            else if (source == &worker->watch_tag)
+            {
+                poll_changed_cars(worker);
+            }
+            else
+            {
+                car_loop_dispatch(source, events[i].events);
+            }
+        }
+    }
+
+    stop_watchers(worker);
+    return NULL;
+}
+
+/*
+ * Reads the fleet file, creates every car's shared memory object and hands
+ * the cars out to num_workers workers. motion_file, if not NULL, is the
+ * motion model of cars that don't name their own.
+ */
+bool fleet_init(fleet_t *fleet, const char *path, size_t num_workers,
+                const char *motion_file)
+{
+    memset(fleet, 0, sizeof(*fleet));
+    fleet->text = read_file(path);
+    if (fleet->text == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    if (!parse_fleet(fleet))
+    {
+        return false;
+    }
+    raise_fd_limit();
+
+    if (num_workers > fleet->num_cars)
+    {
+        num_workers = fleet->num_cars;
+    }
+    fleet->num_workers = num_workers;
+    fleet->workers = calloc(num_workers, sizeof(*fleet->workers));
+    fleet->loops = calloc(fleet->num_cars, sizeof(*fleet->loops));
+    if (fleet->workers == NULL || fleet->loops == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        fleet->workers[i].epoll_fd = -1;
+        fleet->workers[i].wheel_fd = -1;
+        fleet->workers[i].stop_fd = -1;
+        fleet->workers[i].watch_fd = -1;
+    }
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        size_t max_loops = fleet->num_cars / num_workers + 1;
+        if (!worker_init(&fleet->workers[i], max_loops))
+        {
+            perror("fleet worker");
+            return false;
+        }
+    }
+
+    /* car_init() overwrites the car, so initialise it from a copy of what the
+     * parser found. */
+    for (size_t i = 0; i < fleet->num_cars; i++)
+    {
+        car_t parsed = fleet->cars[i];
+        char delay[16];
+        snprintf(delay, sizeof(delay), "%u", parsed.delay);
+        car_init(&fleet->cars[i], parsed.name, parsed.lowest_floor,
+                 parsed.highest_floor, delay);
+
+        const char *motion = fleet->motion_files[i] != NULL
+                                 ? fleet->motion_files[i]
+                                 : motion_file;
+        if (motion != NULL && !motion_load(&fleet->cars[i].motion, motion))
+        {
+            car_deinit(&fleet->cars[i]);
+            return false;
+        }
+
+        fleet_worker_t *worker = &fleet->workers[i % num_workers];
+        if (!car_loop_init(&fleet->loops[i], &fleet->cars[i], worker->epoll_fd,
+                           &worker->wheel, false))
+        {
+            car_deinit(&fleet->cars[i]);
+            return false;
+        }
+        worker->loops[worker->num_loops++] = &fleet->loops[i];
+    }
+
+    return true;
+}
+
+/*
+ * Tears down every car loop, worker and car. Safe to call on a fleet that
+ * failed to initialise.
+ */
+void fleet_deinit(fleet_t *fleet)
+{
+    for (size_t i = 0; i < fleet->num_workers && fleet->workers != NULL; i++)
+    {
+        fleet_worker_t *worker = &fleet->workers[i];
+        for (size_t j = 0; j < worker->num_loops; j++)
+        {
+            car_loop_deinit(worker->loops[j]);
+            car_deinit(worker->loops[j]->car);
+        }
+        worker_deinit(worker);
+    }
+
+    free(fleet->workers);
+    free(fleet->loops);
+    free(fleet->cars);
+    free(fleet->motion_files);
+    free(fleet->text);
+    memset(fleet, 0, sizeof(*fleet));
+}
+
+/*
+ * Starts the workers and waits for SIGINT, then stops them. The signal handler
+ * must clear *keep_running.
+ */
+int fleet_run(fleet_t *fleet, volatile sig_atomic_t *keep_running)
+{
+    /* Workers start with every signal blocked so SIGINT is delivered to this
+     * thread, which keeps it blocked except while suspended to avoid missing
+     * it between checking the flag and waiting. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    size_t started = 0;
+    for (; started < fleet->num_workers; started++)
+    {
+        if (pthread_create(&fleet->workers[started].thread, NULL, fleet_worker,
+                           &fleet->workers[started]) != 0)
+        {
+            perror("pthread_create()");
+            *keep_running = 0;
+            break;
+        }
+    }
+
+    sigset_t wait_mask = old;
+    sigdelset(&wait_mask, SIGINT);
+    while (*keep_running)
+    {
+        sigsuspend(&wait_mask);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    uint64_t one = 1;
+    for (size_t i = 0; i < started; i++)
+    {
+        if (write(fleet->workers[i].stop_fd, &one, sizeof(one)) == -1)
+        {
+            perror("write()");
+        }
+        pthread_join(fleet->workers[i].thread, NULL);
+    }
+
+    return started == fleet->num_workers ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/*
+ * This header file defines the data structures used to run a fleet of cars
+ * inside a single car process (`car --fleet {fleet file} [workers]`). Every car
+ * keeps its own shared memory object and controller connection, but the cars
+ * are spread over a small pool of worker threads, each running one epoll loop.
+ *
+ * See fleet.c for implementation details.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "car.h"
+#include "carloop.h"
+#include "timerwheel.h"
+
+/* How often a worker checks its cars for changes made by other programs if
+ * the kernel can't watch their history rings */
+#define FLEET_POLL_MS 1
+/* Most cars a watcher thread follows. futex_waitv() takes up to 128 words and
+ * one of them is the stop word. */
+#define FLEET_WATCH_CARS 127
+
+struct fleet_worker;
+
+/*
+ * A thread that sleeps on the history rings of some of a worker's cars and
+ * wakes the worker when one of them moves
+ */
+typedef struct fleet_watcher
+{
+    pthread_t thread;
+    struct fleet_worker *worker;
+    size_t first; // Index of the first of the worker's cars it follows
+    size_t count; // Number of cars it follows
+} fleet_watcher_t;
+
+/*
+ * A worker thread and the cars it drives
+ */
+typedef struct fleet_worker
+{
+    pthread_t thread;
+    int epoll_fd;              // Epoll instance shared by the worker's cars
+    int wheel_fd;              // timerfd that drives the wheel
+    int stop_fd;               // eventfd written to when the fleet shuts down
+    int watch_fd;              // eventfd written to by the watchers
+    car_source_t wheel_tag;    // epoll data for wheel_fd
+    car_source_t stop_tag;     // epoll data for stop_fd
+    car_source_t watch_tag;    // epoll data for watch_fd
+    timer_wheel_t wheel;       // Timers of every car on this worker
+    timer_event_t poll_timer;  // Calls car_loop_poll() every FLEET_POLL_MS
+                               // when the rings can't be watched
+    car_loop_t **loops;        // The worker's cars
+    size_t num_loops;
+    _Atomic bool *changed;     // Per car, set by a watcher when its ring moved
+    _Atomic uint32_t watch_stop; // Futex word set to stop the watchers
+    fleet_watcher_t *watchers;
+    size_t num_watchers;       // Watchers running
+} fleet_worker_t;
+
+/*
+ * A fleet of cars read from a fleet file
+ */
+typedef struct fleet
+{
+    char *text;                // Contents of the fleet file, tokenised in place
+    size_t num_cars;           // Number of cars in the fleet
+    car_t *cars;               // The cars
+    const char **motion_files; // Each car's motion file or NULL
+    car_loop_t *loops;         // One event loop state per car
+    size_t num_workers;        // Number of worker threads
+    fleet_worker_t *workers;   // The worker threads
+} fleet_t;
+
+// Reads a fleet file and creates the shared memory objects of its cars, the
+// last argument is the default motion file or NULL
+bool fleet_init(fleet_t *, const char *, size_t, const char *);
+// Releases the fleet's resources
+void fleet_deinit(fleet_t *);
+// Runs the fleet until *keep_running is cleared
+int fleet_run(fleet_t *, volatile sig_atomic_t *);
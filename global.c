@@ -1,8 +1,14 @@
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "global.h"
 
@@ -69,19 +75,24 @@ int decrement_floor(char *floor)
 
 int floor_to_int(const char *floor)
 {
-    int floor_number;
-    char *temp_floor = strdup(floor);
-    if (temp_floor[0] == 'B')
+    /* "1" is 0 and "B1" is -1, so the numbers are contiguous */
+    if (floor[0] == 'B')
+    {
+        return -atoi(floor + 1);
+    }
+    return atoi(floor) - 1;
+}
+
+void int_to_floor(int number, char *floor, size_t size)
+{
+    if (number < 0)
     {
-        temp_floor[0] = '-';
-        floor_number = atoi(temp_floor);
+        snprintf(floor, size, "B%d", -number);
     }
     else
     {
-        floor_number = atoi(temp_floor) - 1;
+        snprintf(floor, size, "%d", number + 1);
     }
-    free(temp_floor);
-    return floor_number;
 }
 
 int floor_in_range(const char *floor, const char *lowest_floor,
@@ -135,3 +146,92 @@ bool is_valid_floor(const char *floor)
 
     return true;
 }
+
+/*
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Reads a whole decimal number. Returns false if there is anything else.
+ */
+bool parse_number(const char *text, uint64_t *value)
+{
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-')
+    {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+/*
+ * Reads a comma separated list of counts from 1 to max. Returns false if
+ * there is anything else or more than capacity.
+ */
+bool parse_counts(const char *text, size_t max, size_t *counts,
+                  size_t capacity, size_t *num_counts)
+{
+    *num_counts = 0;
+    for (const char *p = text;;)
+    {
+        char *end;
+        errno = 0;
+        unsigned long long number = strtoull(p, &end, 10);
+        if (errno != 0 || end == p || p[0] == '-' || number == 0 ||
+            number > max || *num_counts == capacity)
+        {
+            return false;
+        }
+        counts[(*num_counts)++] = (size_t)number;
+        if (*end == '\0')
+        {
+            return true;
+        }
+        if (*end != ',')
+        {
+            return false;
+        }
+        p = end + 1;
+    }
+}
+
+/*
+ * Thin wrappers around the futex system call. The words live in memory
+ * shared between processes so the non-private operations are used.
+ */
+long futex_wait(_Atomic uint32_t *addr, uint32_t expected,
+                const struct timespec *timeout)
+{
+    return syscall(SYS_futex, (uint32_t *)(uintptr_t)addr, FUTEX_WAIT,
+                   expected, timeout, NULL, 0);
+}
+
+long futex_wake(_Atomic uint32_t *addr)
+{
+    return syscall(SYS_futex, (uint32_t *)(uintptr_t)addr, FUTEX_WAKE,
+                   INT_MAX, NULL, NULL, 0);
+}
+
+long futex_waitv(struct futex_waitv *waiters, unsigned int count,
+                 const struct timespec *timeout)
+{
+#ifdef SYS_futex_waitv
+    return syscall(SYS_futex_waitv, waiters, count, 0, timeout,
+                   CLOCK_MONOTONIC);
+#else
+    (void)waiters;
+    (void)count;
+    (void)timeout;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
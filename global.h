@@ -1,9 +1,35 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 int increment_floor(char *);
 int decrement_floor(char *);
 int floor_to_int(const char *);
+void int_to_floor(int, char *, size_t);
 int floor_in_range(const char *, const char *, const char *);
 bool is_valid_floor(const char *);
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonic_ns(void);
+// Reads a whole decimal number, returns false if there is anything else
+bool parse_number(const char *, uint64_t *);
+// Reads a comma separated list of counts from 1 to a maximum into an array of
+// the given capacity, returns false if there is anything else or too many
+bool parse_counts(const char *, size_t, size_t *, size_t, size_t *);
+
+// Waits on a futex word in shared memory while it holds the expected value,
+// for at most a relative timeout (NULL waits forever), like FUTEX_WAIT
+long futex_wait(_Atomic uint32_t *, uint32_t, const struct timespec *);
+// Wakes every waiter on a futex word in shared memory
+long futex_wake(_Atomic uint32_t *);
+
+struct futex_waitv; // See linux/futex.h
+// Waits until one of several futex words no longer holds its expected value
+// or is woken, like futex_waitv() (Linux 5.16), with an absolute
+// CLOCK_MONOTONIC timeout (NULL waits forever). Fails with ENOSYS on older
+// kernels
+long futex_waitv(struct futex_waitv *, unsigned int, const struct timespec *);
@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Implementation of the per-car event history ring. The car publishes a record
+ * every time its shared state changes and observers tail the ring at their own
+ * pace, so a slow observer no longer misses intermediate states the way it
+ * does when it wakes on the condition variable and diffs struct copies.
+ *
+ * Every slot carries a sequence number that works like a small seqlock. The
+ * producer clears it, writes the record and then stores the record's index
+ * plus one. A reader copies the record out and checks the sequence number
+ * before and after the copy; if it changed, the producer lapped the reader and
+ * the copy is thrown away. Readers never write to the ring (other than the
+ * waiter count used for futex wake-ups), so there can be any number of them.
+ *
+ * The ring has a single producer because records are only published while the
+ * car's mutex is held.
+ */
+
+#include "global.h"
+#include "history.h"
+
+/*
+ * Initialises an empty ring. Must be called before the ring is shared.
+ */
+void history_init(history_ring_t *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->wake_seq, 0);
+    atomic_init(&ring->waiters, 0);
+    for (int i = 0; i < HISTORY_CAPACITY; i++)
+    {
+        atomic_init(&ring->slots[i].seq, 0);
+    }
+}
+
+/*
+ * Publishes a record into the ring unless it describes the same state as the
+ * last record published. Must be called with the car's mutex held.
+ */
+bool history_publish(history_ring_t *ring, const history_record_t *record)
+{
+    /* Only state transitions are recorded, so ignore the timestamp when
+     * comparing against the last record. */
+    size_t offset = offsetof(history_record_t, current_floor);
+    uint64_t n = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (n > 0 && memcmp((const char *)&ring->last + offset,
+                        (const char *)record + offset,
+                        sizeof(*record) - offset) == 0)
+    {
+        return false;
+    }
+    ring->last = *record;
+
+    /* Invalidate the slot, write the record and then publish it. */
+    history_slot_t *slot = &ring->slots[n & (HISTORY_CAPACITY - 1)];
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->record = *record;
+    atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, n + 1, memory_order_release);
+
+    /* Wake any readers blocked in history_wait(). Both sides use sequentially
+     * consistent operations on wake_seq and waiters so a reader that is about
+     * to sleep is never missed. */
+    atomic_fetch_add(&ring->wake_seq, 1);
+    if (atomic_load(&ring->waiters) > 0)
+    {
+        futex_wake(&ring->wake_seq);
+    }
+    return true;
+}
+
+/*
+ * Starts a reader at the oldest record the ring still holds.
+ */
+void history_reader_init(history_reader_t *reader, history_ring_t *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    reader->ring = ring;
+    reader->next = head > HISTORY_CAPACITY ? head - HISTORY_CAPACITY : 0;
+    reader->lost = 0;
+}
+
+/*
+ * Copies the next record out of the ring. Returns false if the reader has
+ * caught up with the producer. Records overwritten before the reader got to
+ * them are skipped and counted in reader->lost.
+ */
+bool history_read(history_reader_t *reader, history_record_t *out)
+{
+    history_ring_t *ring = reader->ring;
+
+    while (true)
+    {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (reader->next >= head)
+        {
+            return false;
+        }
+
+        /* Skip ahead if the producer has already lapped the reader. */
+        if (head - reader->next > HISTORY_CAPACITY)
+        {
+            reader->lost += head - HISTORY_CAPACITY - reader->next;
+            reader->next = head - HISTORY_CAPACITY;
+        }
+
+        const history_slot_t *slot =
+            &ring->slots[reader->next & (HISTORY_CAPACITY - 1)];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == reader->next + 1)
+        {
+            *out = slot->record;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+            {
+                reader->next += 1;
+                return true;
+            }
+        }
+
+        /* The slot was rewritten underneath us, drop the record and retry. */
+        reader->lost += 1;
+        reader->next += 1;
+    }
+}
+
+/*
+ * Blocks until the producer publishes past the reader's cursor. timeout_ms is
+ * relative, a negative value waits forever. Returns false if the wait timed
+ * out or was interrupted by a signal.
+ */
+bool history_wait(history_reader_t *reader, int timeout_ms)
+{
+    history_ring_t *ring = reader->ring;
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+
+    atomic_fetch_add(&ring->waiters, 1);
+    bool result = true;
+    while (true)
+    {
+        uint32_t seq = atomic_load(&ring->wake_seq);
+        if (atomic_load_explicit(&ring->head, memory_order_acquire) >
+            reader->next)
+        {
+            break;
+        }
+        if (futex_wait(&ring->wake_seq, seq, timeout_ms < 0 ? NULL : &ts) ==
+                -1 &&
+            (errno == ETIMEDOUT || errno == EINTR))
+        {
+            result = false;
+            break;
+        }
+    }
+    atomic_fetch_sub(&ring->waiters, 1);
+    return result;
+}
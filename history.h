@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * This header file defines the event history ring that a car publishes its
+ * state transitions into, along with the reader used by observers to tail it.
+ * The ring lives in the extension region of the car's shared memory object
+ * (see posix.h) so any process that maps the car can follow it without taking
+ * the car's mutex. See history.c for the details of the protocol.
+ */
+
+/* Number of records kept in the ring, must be a power of two */
+#define HISTORY_CAPACITY 256
+
+/*
+ * A single state transition as seen by the car.
+ */
+typedef struct
+{
+    uint64_t timestamp_ns;           // CLOCK_MONOTONIC time of the transition
+    uint32_t dirty;                  // SHM_FIELD_* bits the update changed
+    char current_floor[4];           // Current floor after the transition
+    char destination_floor[4];       // Destination floor after the transition
+    char status[8];                  // Status after the transition
+    uint8_t open_button;             // Open doors button flag
+    uint8_t close_button;            // Close doors button flag
+    uint8_t door_obstruction;        // Door obstruction flag
+    uint8_t overload;                // Overload flag
+    uint8_t emergency_stop;          // Emergency stop flag
+    uint8_t individual_service_mode; // Individual service mode flag
+    uint8_t emergency_mode;          // Emergency mode flag
+} history_record_t;
+
+/*
+ * A slot in the ring. seq holds the record's index plus one once the record is
+ * fully written and 0 while the producer is writing it.
+ */
+typedef struct
+{
+    _Atomic uint64_t seq;
+    history_record_t record;
+} history_slot_t;
+
+/*
+ * The ring itself. It is written by whoever holds the car's mutex, which makes
+ * it single-producer, and read by any number of observers.
+ */
+typedef struct
+{
+    _Atomic uint64_t head;      // Index of the next record to be written
+    _Atomic uint32_t wake_seq;  // Futex word bumped on every publish
+    _Atomic uint32_t waiters;   // Number of readers blocked on wake_seq
+    history_record_t last;      // Last published record, producer only
+    history_slot_t slots[HISTORY_CAPACITY];
+} history_ring_t;
+
+/*
+ * Per-observer cursor into a ring.
+ */
+typedef struct
+{
+    history_ring_t *ring; // Ring being tailed
+    uint64_t next;        // Index of the next record to read
+    uint64_t lost;        // Records overwritten before they could be read
+} history_reader_t;
+
+// Initialises an empty ring
+void history_init(history_ring_t *);
+// Publishes a record if it differs from the last one, returns true if it did
+bool history_publish(history_ring_t *, const history_record_t *);
+
+// Starts a reader at the oldest record still held by the ring
+void history_reader_init(history_reader_t *, history_ring_t *);
+// Copies the next record out of the ring, returns false if there is none
+bool history_read(history_reader_t *, history_record_t *);
+// Blocks until a record past the reader's cursor is published or timeout_ms
+// passes (negative waits forever). Returns false on timeout or signal.
+bool history_wait(history_reader_t *, int);
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -10,6 +11,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /*
@@ -17,6 +19,25 @@
  * with the shared memory segment to indicate passenger requests, such as
  * opening or closing the doors. It also manages elevator operations in service
  * mode.
+ *
+ * `internal {car} --script [file]` runs a sequence of operations against a
+ * single mapping of the car's shared memory instead, reading one step per line
+ * from the file or standard input. Blank lines and lines starting with '#' are
+ * skipped. A step is either one of the operations accepted on the command line
+ * or
+ *
+ *   wait {status|floor|destination} {value} [timeout in milliseconds]
+ *
+ * which blocks on the car's condition variable until the field holds the
+ * value. Each step gets one line on standard output:
+ *
+ *   {step} {result} {microseconds}
+ *
+ * where the result is OK, SERVICE_MODE, DOORS, BETWEEN_FLOORS, INVALID or
+ * TIMEOUT.
+ * A failed operation is reported and the script carries on, as a separate
+ * invocation would. A wait that times out ends the script, since the steps
+ * after it were written assuming the car got there.
  */
 
 #include "global.h"
@@ -25,16 +46,25 @@
 
 int main(int argc, char *argv[])
 {
+    bool script = argc >= 3 && strcmp(argv[2], "--script") == 0;
+
     /* Check if the correct number of command line arguments is provided */
-    if (argc != 3)
+    if (script ? argc > 4 : argc != 3)
     {
         printf("Incorrect number of command line args.\n");
         return 1;
     }
 
+    FILE *input = stdin;
+    if (script && argc == 4 && (input = fopen(argv[3], "r")) == NULL)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+
     /* Declare and initialise the elevator controller */
     icontroller_t icontroller;
-    icontroller_init(&icontroller, argv[1], argv[2]);
+    icontroller_init(&icontroller, argv[1], script ? "" : argv[2]);
 
     /* Attempt to connect to the car's shared memory object */
     if (!connect_to_car(&icontroller.state, icontroller.shm_name,
@@ -42,9 +72,24 @@ int main(int argc, char *argv[])
     {
         printf("Unable to access car %s.\n", icontroller.car_name);
         icontroller_deinit(&icontroller);
+        if (input != stdin)
+        {
+            fclose(input);
+        }
         return 1;
     }
 
+    if (script)
+    {
+        int result = run_script(&icontroller, input);
+        icontroller_deinit(&icontroller);
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return result;
+    }
+
     /*
      * Handle the specified operation and print any relevant error messages. All
      * messages printed as the program’s output are handled here.
@@ -83,6 +128,7 @@ void icontroller_init(icontroller_t *icontroller, const char *car_name,
     icontroller->operation = operation;
     icontroller->shm_name = get_shm_name(car_name);
     icontroller->fd = -1;
+    icontroller->state = NULL;
 }
 
 /*
@@ -110,7 +156,7 @@ void icontroller_deinit(icontroller_t *icontroller)
     /* Unmap shared memory if it's mapped */
     if (icontroller->state != NULL)
     {
-        munmap(icontroller->state, sizeof(car_shared_mem));
+        unmap_car(icontroller->state);
         icontroller->state = NULL;
     }
 }
@@ -121,12 +167,12 @@ void icontroller_deinit(icontroller_t *icontroller)
 int can_car_move(car_shared_mem *state)
 {
     /* Acquire the mutex to access shared state */
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_INTERNAL_CAN_MOVE);
     /* Check if car is between floors */
     bool is_between = strcmp(state->status, "Between") == 0;
     /* Check if doors are closed */
     bool is_closed = strcmp(state->status, "Closed") == 0;
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
 
     /*
      * The car can't move if it's in individual service mode, if doors aren't
@@ -205,14 +251,15 @@ int handle_operation(icontroller_t *icontroller)
  */
 int up(car_shared_mem *state)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_update_t u;
+    shm_begin(&u, state, LOCK_SITE_INTERNAL_UP);
     int result = increment_floor(state->destination_floor);
     /* Only broadcast if the floor was incremented. */
     if (result == 0)
     {
-        pthread_cond_broadcast(&state->cond);
+        shm_mark_dirty(&u, SHM_FIELD_DESTINATION_FLOOR);
     }
-    pthread_mutex_unlock(&state->mutex);
+    shm_commit(&u);
     return result;
 }
 
@@ -223,14 +270,15 @@ int up(car_shared_mem *state)
  */
 int down(car_shared_mem *state)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_update_t u;
+    shm_begin(&u, state, LOCK_SITE_INTERNAL_DOWN);
     int result = decrement_floor(state->destination_floor);
     /* Only broadcast if the floor was decremented. */
     if (result == 0)
     {
-        pthread_cond_broadcast(&state->cond);
+        shm_mark_dirty(&u, SHM_FIELD_DESTINATION_FLOOR);
     }
-    pthread_mutex_unlock(&state->mutex); /* Unlock mutex */
+    shm_commit(&u); /* Unlock mutex */
     return result;
 }
 
@@ -241,3 +289,143 @@ bool op_is(const icontroller_t *icontroller, const char *op)
 {
     return strcmp(icontroller->operation, op) == 0;
 }
+
+/*
+ * Names a result of handle_operation() or wait_for() in script output.
+ */
+static const char *result_name(int result)
+{
+    switch (result)
+    {
+    case I_SUCCESS:
+        return "OK";
+    case I_SERVICE_MODE_ERROR:
+        return "SERVICE_MODE";
+    case I_DOORS_ERROR:
+        return "DOORS";
+    case I_BETWEEN_FLOORS_ERROR:
+        return "BETWEEN_FLOORS";
+    case I_TIMEOUT_ERROR:
+        return "TIMEOUT";
+    default:
+        return "INVALID";
+    }
+}
+
+/*
+ * Blocks until a field of the car's shared memory holds the given value,
+ * waking only when the car's condition variable is broadcast. A timeout of 0
+ * waits for as long as it takes.
+ */
+int wait_for(car_shared_mem *state, const char *field, const char *value,
+             uint32_t timeout_ms)
+{
+    const char *target;
+    if (strcmp(field, "status") == 0)
+    {
+        target = state->status;
+    }
+    else if (strcmp(field, "floor") == 0 && is_valid_floor(value))
+    {
+        target = state->current_floor;
+    }
+    else if (strcmp(field, "destination") == 0 && is_valid_floor(value))
+    {
+        target = state->destination_floor;
+    }
+    else
+    {
+        return I_INVALID_OPERATION_ERROR;
+    }
+
+    struct timespec deadline;
+    shm_deadline(state, timeout_ms, &deadline);
+
+    int result = I_SUCCESS;
+    shm_lock(state, LOCK_SITE_INTERNAL_WAIT);
+    while (strcmp(target, value) != 0)
+    {
+        int wait_result = timeout_ms == 0
+                              ? shm_cond_wait(state)
+                              : shm_cond_timedwait(state, &deadline);
+        if (wait_result == ETIMEDOUT)
+        {
+            result = strcmp(target, value) == 0 ? I_SUCCESS : I_TIMEOUT_ERROR;
+            break;
+        }
+    }
+    shm_unlock(state);
+    return result;
+}
+
+/*
+ * Runs every step listed in input against the car and reports the outcome
+ * and duration of each, see the top of this file. Returns 1 if any step
+ * failed.
+ */
+int run_script(icontroller_t *icontroller, FILE *input)
+{
+    char line[256];
+    bool failed = false;
+    while (fgets(line, sizeof(line), input) != NULL)
+    {
+        char *saveptr;
+        char *command = strtok_r(line, " \t\r\n", &saveptr);
+        if (command == NULL || command[0] == '#')
+        {
+            continue;
+        }
+
+        uint64_t start = monotonic_ns();
+        int result;
+        if (strcmp(command, "wait") == 0)
+        {
+            const char *field = strtok_r(NULL, " \t\r\n", &saveptr);
+            const char *value = strtok_r(NULL, " \t\r\n", &saveptr);
+            const char *timeout = strtok_r(NULL, " \t\r\n", &saveptr);
+            char *end = NULL;
+            unsigned long timeout_ms =
+                timeout != NULL ? strtoul(timeout, &end, 10) : 0;
+
+            if (field == NULL || value == NULL ||
+                (timeout != NULL && (*end != '\0' || timeout_ms == 0 ||
+                                     timeout_ms > UINT32_MAX)))
+            {
+                result = I_INVALID_OPERATION_ERROR;
+            }
+            else
+            {
+                result = wait_for(icontroller->state, field, value,
+                                  (uint32_t)timeout_ms);
+            }
+            printf("wait %s %s", field != NULL ? field : "-",
+                   value != NULL ? value : "-");
+            if (timeout != NULL)
+            {
+                printf(" %s", timeout);
+            }
+        }
+        else
+        {
+            icontroller->operation = command;
+            result = handle_operation(icontroller);
+            printf("%s", command);
+        }
+
+        printf(" %s %llu\n", result_name(result),
+               (unsigned long long)((monotonic_ns() - start) / 1000u));
+
+        /* Whoever drives the script may be waiting for this step. */
+        fflush(stdout);
+
+        if (result != I_SUCCESS)
+        {
+            failed = true;
+            if (result == I_TIMEOUT_ERROR)
+            {
+                break;
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
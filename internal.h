@@ -9,6 +9,9 @@
  * See internal.c for implementation details.
  */
 
+#include <stdint.h>
+#include <stdio.h>
+
 #include "posix.h"
 
 /*
@@ -21,6 +24,7 @@ typedef enum
     I_DOORS_ERROR = -2,
     I_BETWEEN_FLOORS_ERROR = -3,
     I_INVALID_OPERATION_ERROR = -4,
+    I_TIMEOUT_ERROR = -5,
 } icontroller_error_t;
 
 /*
@@ -45,3 +49,9 @@ int handle_operation(icontroller_t *);
 int up(car_shared_mem *);
 int down(car_shared_mem *);
 bool op_is(const icontroller_t *, const char *);
+
+// Blocks until a named field holds a value, or the timeout in milliseconds
+// (0 for none) passes
+int wait_for(car_shared_mem *, const char *, const char *, uint32_t);
+// Runs a script of operations and waits against one mapping of the car
+int run_script(icontroller_t *, FILE *);
@@ -0,0 +1,364 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of libcall. Submitting a call only encodes its CALL message
+ * into an output buffer and appends it to a ring of unanswered calls, so
+ * submitting thousands of calls costs no system calls at all. Dispatching
+ * writes as much of the output buffer as the socket takes and reads every
+ * answer that has arrived, each of which completes the oldest call in the
+ * ring. Both buffers grow as needed.
+ *
+ * The socket is non-blocking and written with MSG_NOSIGNAL, so a controller
+ * that goes away fails the calls in flight instead of blocking or killing the
+ * program that embeds libcall.
+ */
+
+#include "global.h"
+#include "libcall.h"
+#include "tcpip.h"
+
+/*
+ * Removes the oldest call from the ring and runs its callback.
+ */
+static void complete_oldest(libcall_t *lib, call_result_t result,
+                            const char *car_name)
+{
+    /* Copy the call out first, the callback may submit another. */
+    call_pending_t call = lib->pending[lib->pending_head];
+    lib->pending_head = (lib->pending_head + 1) % lib->pending_capacity;
+    lib->pending_count -= 1;
+
+    call_completion_t completion = {
+        .handle = call.handle,
+        .source_floor = call.source_floor,
+        .destination_floor = call.destination_floor,
+        .result = result,
+        .car_name = result == CALL_RESULT_CAR ? car_name : NULL,
+        .latency_ns = monotonic_ns() - call.submitted_ns,
+    };
+    if (call.callback != NULL)
+    {
+        call.callback(&completion, call.user_data);
+    }
+}
+
+/*
+ * Marks the connection as lost and fails every call in flight.
+ */
+static void fail_all(libcall_t *lib)
+{
+    lib->failed = true;
+    lib->out_start = lib->out_end = 0;
+    while (lib->pending_count > 0)
+    {
+        complete_oldest(lib, CALL_RESULT_FAILED, NULL);
+    }
+}
+
+/*
+ * Doubles the ring, moving the calls so the oldest is first again.
+ */
+static bool grow_pending(libcall_t *lib)
+{
+    size_t capacity = lib->pending_capacity > 0 ? lib->pending_capacity * 2
+                                                : 64;
+    call_pending_t *pending = malloc(capacity * sizeof(*pending));
+    if (pending == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < lib->pending_count; i++)
+    {
+        pending[i] =
+            lib->pending[(lib->pending_head + i) % lib->pending_capacity];
+    }
+    free(lib->pending);
+    lib->pending = pending;
+    lib->pending_head = 0;
+    lib->pending_capacity = capacity;
+    return true;
+}
+
+/*
+ * Makes room for size more bytes at the end of the output buffer, first by
+ * dropping what was already written and then by growing it.
+ */
+static bool reserve_out(libcall_t *lib, size_t size)
+{
+    if (lib->out_start > 0)
+    {
+        memmove(lib->out, lib->out + lib->out_start,
+                lib->out_end - lib->out_start);
+        lib->out_end -= lib->out_start;
+        lib->out_start = 0;
+    }
+    if (lib->out_end + size <= lib->out_capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = lib->out_capacity > 0 ? lib->out_capacity : 1024;
+    while (capacity < lib->out_end + size)
+    {
+        capacity *= 2;
+    }
+    char *out = realloc(lib->out, capacity);
+    if (out == NULL)
+    {
+        return false;
+    }
+    lib->out = out;
+    lib->out_capacity = capacity;
+    return true;
+}
+
+/*
+ * Writes as much of the output buffer as the socket takes. Returns false if
+ * the connection was lost.
+ */
+static bool flush_out(libcall_t *lib)
+{
+    while (lib->out_start < lib->out_end)
+    {
+        ssize_t sent = send(lib->fd, lib->out + lib->out_start,
+                            lib->out_end - lib->out_start, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        lib->out_start += (size_t)sent;
+    }
+    lib->out_start = lib->out_end = 0;
+    return true;
+}
+
+/*
+ * Completes the oldest call with an answer from the controller, either
+ * `CAR {name}` or `UNAVAILABLE`. Returns false if no call was waiting.
+ */
+static bool handle_answer(libcall_t *lib, char *answer)
+{
+    if (lib->pending_count == 0)
+    {
+        return false;
+    }
+
+    char *saveptr;
+    const char *type = strtok_r(answer, " ", &saveptr);
+    if (type != NULL && strcmp(type, "CAR") == 0)
+    {
+        complete_oldest(lib, CALL_RESULT_CAR, strtok_r(NULL, " ", &saveptr));
+    }
+    else
+    {
+        complete_oldest(lib, CALL_RESULT_UNAVAILABLE, NULL);
+    }
+    return true;
+}
+
+/*
+ * Connects to the controller, or takes over the socket given in the
+ * transport, and makes it non-blocking.
+ */
+bool libcall_init(libcall_t *lib, const call_transport_t *transport)
+{
+    memset(lib, 0, sizeof(*lib));
+    lib->next_handle = 1;
+    lib->fd = transport->fd;
+
+    if (lib->fd < 0)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(transport->port);
+        if (inet_pton(AF_INET, transport->host, &addr.sin_addr) <= 0)
+        {
+            return false;
+        }
+
+        lib->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (lib->fd < 0)
+        {
+            return false;
+        }
+        if (connect(lib->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(lib->fd);
+            lib->fd = -1;
+            return false;
+        }
+
+        /* Answers to a kiosk shouldn't wait for earlier calls to be ACKed. */
+        int one = 1;
+        setsockopt(lib->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    int flags = fcntl(lib->fd, F_GETFL);
+    if (flags == -1 || fcntl(lib->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        close(lib->fd);
+        lib->fd = -1;
+        return false;
+    }
+
+    msg_reader_init(&lib->reader, lib->fd);
+    return true;
+}
+
+/*
+ * Closes the connection and releases the buffers. Calls still in flight are
+ * completed with CALL_RESULT_FAILED.
+ */
+void libcall_deinit(libcall_t *lib)
+{
+    fail_all(lib);
+    if (lib->fd >= 0)
+    {
+        close(lib->fd);
+    }
+    free(lib->pending);
+    free(lib->out);
+    memset(lib, 0, sizeof(*lib));
+    lib->fd = -1;
+}
+
+/*
+ * Queues a call. It is sent by the next libcall_dispatch().
+ */
+uint64_t libcall_submit(libcall_t *lib, const char *source_floor,
+                        const char *destination_floor,
+                        call_callback_t callback, void *user_data)
+{
+    if (lib->failed || !is_valid_floor(source_floor) ||
+        !is_valid_floor(destination_floor) ||
+        strcmp(source_floor, destination_floor) == 0)
+    {
+        return 0;
+    }
+    if (lib->pending_count == lib->pending_capacity && !grow_pending(lib))
+    {
+        return 0;
+    }
+
+    /* Encode the message the way send_message() does. */
+    char message[16];
+    int length = snprintf(message, sizeof(message), "CALL %s %s",
+                          source_floor, destination_floor);
+    uint32_t nlen = htonl((uint32_t)length);
+    if (!reserve_out(lib, sizeof(nlen) + (size_t)length))
+    {
+        return 0;
+    }
+    memcpy(lib->out + lib->out_end, &nlen, sizeof(nlen));
+    memcpy(lib->out + lib->out_end + sizeof(nlen), message, (size_t)length);
+    lib->out_end += sizeof(nlen) + (size_t)length;
+
+    call_pending_t *call =
+        &lib->pending[(lib->pending_head + lib->pending_count) %
+                      lib->pending_capacity];
+    call->handle = lib->next_handle++;
+    strcpy(call->source_floor, source_floor);
+    strcpy(call->destination_floor, destination_floor);
+    call->callback = callback;
+    call->user_data = user_data;
+    call->submitted_ns = monotonic_ns();
+    lib->pending_count += 1;
+    return call->handle;
+}
+
+/*
+ * Returns the socket to poll.
+ */
+int libcall_fd(const libcall_t *lib) { return lib->fd; }
+
+/*
+ * Returns POLLIN, plus POLLOUT while there are calls the socket hasn't taken
+ * yet.
+ */
+short libcall_events(const libcall_t *lib)
+{
+    return lib->out_start < lib->out_end ? POLLIN | POLLOUT : POLLIN;
+}
+
+/*
+ * Sends queued calls and handles every answer that has arrived.
+ */
+int libcall_dispatch(libcall_t *lib)
+{
+    if (lib->failed)
+    {
+        return -1;
+    }
+    if (!flush_out(lib))
+    {
+        fail_all(lib);
+        return -1;
+    }
+
+    int completed = 0;
+    while (lib->pending_count > 0)
+    {
+        char *answer;
+        while ((answer = msg_reader_frame(&lib->reader)) != NULL)
+        {
+            completed += handle_answer(lib, answer) ? 1 : 0;
+        }
+
+        ssize_t received = msg_reader_fill(&lib->reader);
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (received <= 0)
+        {
+            fail_all(lib);
+            return -1;
+        }
+    }
+
+    /* A callback may have submitted more calls. */
+    if (!flush_out(lib))
+    {
+        fail_all(lib);
+        return -1;
+    }
+    return completed;
+}
+
+/*
+ * Waits for the socket to be ready, then dispatches. A timeout or signal
+ * completes nothing.
+ */
+int libcall_wait(libcall_t *lib, int timeout_ms)
+{
+    struct pollfd pfd = {
+        .fd = lib->fd, .events = libcall_events(lib), .revents = 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == -1 && errno != EINTR)
+    {
+        fail_all(lib);
+        return -1;
+    }
+    return ready > 0 ? libcall_dispatch(lib) : 0;
+}
+
+/*
+ * Returns the number of calls submitted but not yet completed.
+ */
+size_t libcall_pending(const libcall_t *lib) { return lib->pending_count; }
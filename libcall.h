@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * This header file defines libcall, a non-blocking client for making calls to
+ * the elevator controller from inside another program, e.g. a lobby kiosk or
+ * a load generator. Calls are submitted without waiting and complete through
+ * a callback. Any number of calls can be in flight over a single connection:
+ * the controller answers the calls of one connection in order, so libcall
+ * only has to match each answer to the oldest unanswered call.
+ *
+ * A program with its own event loop registers libcall_fd() with poll() or
+ * epoll for the events returned by libcall_events() and calls
+ * libcall_dispatch() whenever the fd is ready. A program without one can
+ * call libcall_wait() instead.
+ *
+ *   libcall_t lib;
+ *   call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+ *   libcall_init(&lib, &transport);
+ *   libcall_submit(&lib, "1", "5", on_done, NULL);
+ *   while (libcall_pending(&lib) > 0)
+ *       libcall_wait(&lib, -1);
+ *   libcall_deinit(&lib);
+ *
+ * See libcall.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcpip.h"
+
+/*
+ * Where libcall finds the controller. A connected socket can be handed over
+ * with fd, otherwise libcall connects to host:port itself.
+ */
+typedef struct call_transport
+{
+    const char *host; // IPv4 address of the controller
+    uint16_t port;    // Port of the controller
+    int fd;           // Already connected socket to use, or -1
+} call_transport_t;
+
+/* The controller on this machine, as used by `call` */
+#define CALL_TRANSPORT_DEFAULT {URL, PORT, -1}
+
+/*
+ * How a call ended
+ */
+typedef enum
+{
+    CALL_RESULT_CAR,         // A car is on its way
+    CALL_RESULT_UNAVAILABLE, // No car can take the call
+    CALL_RESULT_FAILED       // The connection was lost before an answer came
+} call_result_t;
+
+/*
+ * Passed to the callback of a completed call. The strings are only valid
+ * during the callback.
+ */
+typedef struct call_completion
+{
+    uint64_t handle;               // What libcall_submit() returned
+    const char *source_floor;      // Floor the call was made from
+    const char *destination_floor; // Floor the caller wants to go to
+    call_result_t result;          // How the call ended
+    const char *car_name;          // The car coming, or NULL
+    uint64_t latency_ns;           // Time from submitting to the answer
+} call_completion_t;
+
+// Called once for every call, with the user data given to libcall_submit()
+typedef void (*call_callback_t)(const call_completion_t *, void *);
+
+/*
+ * A call waiting for its answer
+ */
+typedef struct call_pending
+{
+    uint64_t handle;
+    char source_floor[4];
+    char destination_floor[4];
+    call_callback_t callback;
+    void *user_data;
+    uint64_t submitted_ns; // CLOCK_MONOTONIC time it was submitted
+} call_pending_t;
+
+/*
+ * A connection to the controller and the calls in flight on it
+ */
+typedef struct libcall
+{
+    int fd;                  // Non-blocking socket to the controller
+    bool failed;             // The connection was lost, every call fails
+    uint64_t next_handle;    // Handle of the next call submitted
+    call_pending_t *pending; // Ring of unanswered calls, oldest first
+    size_t pending_head;     // Index of the oldest unanswered call
+    size_t pending_count;    // Number of unanswered calls
+    size_t pending_capacity; // Size of the ring
+    char *out;               // Encoded calls not yet written to the socket
+    size_t out_start;        // First byte of out not yet written
+    size_t out_end;          // One past the last byte in out
+    size_t out_capacity;     // Size of out
+    msg_reader_t reader;     // Answers from the controller
+} libcall_t;
+
+// Connects to the controller, returns false if it can't be reached
+bool libcall_init(libcall_t *, const call_transport_t *);
+// Closes the connection, failing any calls still in flight
+void libcall_deinit(libcall_t *);
+// Submits a call without waiting, returns its handle or 0 if the floors are
+// invalid, the same or the connection was lost
+uint64_t libcall_submit(libcall_t *, const char *, const char *,
+                        call_callback_t, void *);
+// Returns the fd to poll
+int libcall_fd(const libcall_t *);
+// Returns the poll() events to wait for on the fd
+short libcall_events(const libcall_t *);
+// Sends and receives whatever it can without blocking and runs the callbacks
+// of completed calls, returns how many completed or -1 if the connection was
+// lost
+int libcall_dispatch(libcall_t *);
+// Waits up to the given ms (-1 forever) for the fd and dispatches
+int libcall_wait(libcall_t *, int);
+// Returns the number of calls in flight
+size_t libcall_pending(const libcall_t *);
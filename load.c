@@ -0,0 +1,677 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of the load generator. Everything runs on one poll() loop: a
+ * timing wheel makes each passenger's call at its arrival time, libcall sends
+ * the calls and completes them as the controller answers, and a follow timer
+ * reads the history ring of each car that has passengers when it is due.
+ *
+ * A passenger waits for the car the controller named. As in test-sched, they
+ * get in once a record shows that car open on their floor and heading their
+ * way, and get out once one shows it open on their destination. Times come
+ * from the records' own timestamps, so they are as precise as the car's clock
+ * however late the ring is read. A car is mapped the first time an answer
+ * names it, and its ring is read up to date before each passenger is added,
+ * so the car may already be open for them.
+ */
+
+#include "global.h"
+#include "history.h"
+#include "libcall.h"
+#include "load.h"
+#include "posix.h"
+#include "timerwheel.h"
+#include "workload.h"
+
+/* Flag to control the main loop, modified by signal handler */
+static volatile sig_atomic_t keep_running = 1;
+
+/*
+ * Signal handler function for handling SIGINT signal
+ */
+static void signal_handler(int signum)
+{
+    if (signum == SIGINT)
+    {
+        keep_running = 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    load_options_t options;
+    load_options_init(&options);
+    if (!load_options_parse(&options, argc, argv))
+    {
+        return 1;
+    }
+
+    /* An interrupted run still reports the passengers seen so far. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, NULL) == -1)
+    {
+        return 1;
+    }
+
+    load_t load;
+    if (!load_init(&load, &options))
+    {
+        load_deinit(&load);
+        return 1;
+    }
+
+    uint64_t started = monotonic_ns();
+    load_run(&load, &keep_running);
+    load_report(&load, (double)(monotonic_ns() - started) / 1e9);
+    load_deinit(&load);
+    return 0;
+}
+
+/*
+ * Fills in the defaults.
+ */
+void load_options_init(load_options_t *options)
+{
+    options->num_passengers = LOAD_DEFAULT_PASSENGERS;
+    options->lowest_floor = LOAD_DEFAULT_LOWEST_FLOOR;
+    options->highest_floor = LOAD_DEFAULT_HIGHEST_FLOOR;
+    options->start_ms = LOAD_DEFAULT_START_MS;
+    options->end_ms = LOAD_DEFAULT_END_MS;
+    options->histogram_len = LOAD_DEFAULT_HISTOGRAM_LEN;
+    options->seed = LOAD_DEFAULT_SEED;
+    options->timeout_ms = LOAD_DEFAULT_TIMEOUT_MS;
+}
+
+/*
+ * Reads the options given as `--{name} {value}` pairs, see load.h.
+ */
+bool load_options_parse(load_options_t *options, int argc, char *argv[])
+{
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "Usage: %s [--{option} {value}]...\n", argv[0]);
+        return false;
+    }
+
+    for (int i = 1; i < argc - 1; i += 2)
+    {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        uint64_t number = 0;
+        bool numeric = parse_number(value, &number);
+        bool valid = true;
+
+        if (strcmp(name, "--num-passengers") == 0)
+        {
+            valid = numeric && number < LOAD_NONE;
+            options->num_passengers = (size_t)number;
+        }
+        else if (strcmp(name, "--lowest-floor") == 0)
+        {
+            valid = is_valid_floor(value) && value[0] != '\0';
+            options->lowest_floor = value;
+        }
+        else if (strcmp(name, "--highest-floor") == 0)
+        {
+            valid = is_valid_floor(value) && value[0] != '\0';
+            options->highest_floor = value;
+        }
+        else if (strcmp(name, "--sim-start") == 0)
+        {
+            valid = numeric;
+            options->start_ms = number;
+        }
+        else if (strcmp(name, "--sim-end") == 0)
+        {
+            valid = numeric;
+            options->end_ms = number;
+        }
+        else if (strcmp(name, "--histogram-len") == 0)
+        {
+            valid = numeric && number > 0;
+            options->histogram_len = (size_t)number;
+        }
+        else if (strcmp(name, "--seed") == 0)
+        {
+            valid = numeric;
+            options->seed = number;
+        }
+        else if (strcmp(name, "--timeout") == 0)
+        {
+            valid = numeric;
+            options->timeout_ms = number;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid parameter: %s\n", name);
+            return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+            return false;
+        }
+    }
+
+    if (floor_to_int(options->lowest_floor) >=
+        floor_to_int(options->highest_floor))
+    {
+        fprintf(stderr, "The lowest floor must be below the highest floor.\n");
+        return false;
+    }
+    if (options->start_ms > options->end_ms)
+    {
+        fprintf(stderr, "The simulation must start before it ends.\n");
+        return false;
+    }
+    return true;
+}
+
+static void arrival_timer_fired(void *);
+static void follow_timer_fired(void *);
+
+/*
+ * Connects to the controller and creates the passengers, see workload.h.
+ */
+bool load_init(load_t *load, const load_options_t *options)
+{
+    memset(load, 0, sizeof(*load));
+    load->options = *options;
+    timer_event_init(&load->arrival_timer, arrival_timer_fired, load);
+    timer_event_init(&load->follow_timer, follow_timer_fired, load);
+
+    call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+    if (!libcall_init(&load->lib, &transport))
+    {
+        printf("Unable to connect to elevator system.\n");
+        return false;
+    }
+
+    load->lowest = floor_to_int(options->lowest_floor);
+    load->num_floors = floor_to_int(options->highest_floor) - load->lowest + 1;
+
+    size_t count = options->num_passengers;
+    workload_trip_t *trips = workload_generate(
+        count, load->lowest, load->lowest + load->num_floors - 1,
+        options->start_ms, options->end_ms, options->seed);
+    load->passengers = calloc(count == 0 ? 1 : count,
+                              sizeof(*load->passengers));
+    if (trips == NULL || load->passengers == NULL)
+    {
+        perror("malloc()");
+        free(trips);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        load_passenger_t *p = &load->passengers[i];
+        p->load = load;
+        p->from = trips[i].from;
+        p->to = trips[i].to;
+        p->arrive_ms = trips[i].arrive_ms;
+        p->next = LOAD_NONE;
+        p->stage = LOAD_ARRIVING;
+    }
+    load->num_passengers = count;
+
+    free(trips);
+    return true;
+}
+
+/*
+ * Closes the connection, which fails any call still waiting for an answer,
+ * then unmaps the cars and releases the passengers.
+ */
+void load_deinit(load_t *load)
+{
+    libcall_deinit(&load->lib);
+    for (size_t i = 0; i < load->num_cars; i++)
+    {
+        load_car_t *car = &load->cars[i];
+        if (car->state != NULL)
+        {
+            unmap_car(car->state);
+            close(car->fd);
+        }
+        free(car->waiting);
+        free(car->riding);
+    }
+    free(load->cars);
+    free(load->passengers);
+    load->cars = NULL;
+    load->passengers = NULL;
+    load->num_cars = 0;
+    load->cars_capacity = 0;
+    load->num_passengers = 0;
+}
+
+/*
+ * Records that a passenger is done, one way or another.
+ */
+static void finish(load_t *load, load_passenger_t *p, load_stage_t stage)
+{
+    p->stage = stage;
+    load->travelling -= 1;
+}
+
+/*
+ * Lets passengers out and in while the car is open, as of a record with the
+ * given timestamp. Like test-sched, a passenger only gets in if the car is
+ * heading their way.
+ */
+static void move_passengers(load_t *load, load_car_t *car, uint64_t now_ns)
+{
+    int floor = car->current - load->lowest;
+    if (!car->open || floor < 0 || floor >= load->num_floors)
+    {
+        return;
+    }
+
+    load_passenger_t *passengers = load->passengers;
+    for (uint32_t i = car->riding[floor]; i != LOAD_NONE;
+         i = passengers[i].next)
+    {
+        passengers[i].alight_ns = now_ns;
+        finish(load, &passengers[i], LOAD_ARRIVED);
+        car->passengers -= 1;
+    }
+    car->riding[floor] = LOAD_NONE;
+
+    int direction = (car->destination > car->current) -
+                    (car->destination < car->current);
+    uint32_t *link = &car->waiting[floor];
+    while (*link != LOAD_NONE)
+    {
+        uint32_t index = *link;
+        load_passenger_t *p = &passengers[index];
+        if (direction == 0 || (p->to > p->from ? 1 : -1) != direction)
+        {
+            link = &p->next;
+            continue;
+        }
+
+        *link = p->next;
+        p->stage = LOAD_RIDING;
+        p->board_ns = now_ns;
+        p->next = car->riding[p->to - load->lowest];
+        car->riding[p->to - load->lowest] = index;
+    }
+}
+
+/*
+ * Reads the car's history ring up to date, moving passengers at each record,
+ * and works out when it is next due. The next read comes about when a quarter
+ * of the ring would have filled at the rate these records came in.
+ */
+static void follow_car(load_t *load, load_car_t *car)
+{
+    uint64_t lost = car->reader.lost;
+    uint64_t records = 0;
+    history_record_t record;
+    while (history_read(&car->reader, &record))
+    {
+        car->current = floor_to_int(record.current_floor);
+        car->destination = floor_to_int(record.destination_floor);
+        car->open = strncmp(record.status, "Open", sizeof(record.status)) == 0;
+        move_passengers(load, car, record.timestamp_ns);
+        records += 1;
+    }
+    load->lost += car->reader.lost - lost;
+
+    uint64_t now = load->wheel.now;
+    uint64_t interval = LOAD_FOLLOW_MAX_MS;
+    if (records > 0)
+    {
+        interval = (now - car->read_ms) * (HISTORY_CAPACITY / 4) / records;
+    }
+    if (interval < LOAD_FOLLOW_MIN_MS)
+    {
+        interval = LOAD_FOLLOW_MIN_MS;
+    }
+    else if (interval > LOAD_FOLLOW_MAX_MS)
+    {
+        interval = LOAD_FOLLOW_MAX_MS;
+    }
+    car->read_ms = now;
+    car->follow_ms = now + interval;
+}
+
+/*
+ * Schedules the follow timer for the first car due to be read, or cancels it
+ * if no car has passengers.
+ */
+static void schedule_follow_timer(load_t *load)
+{
+    uint64_t due = UINT64_MAX;
+    for (size_t i = 0; i < load->num_cars; i++)
+    {
+        const load_car_t *car = &load->cars[i];
+        if (car->passengers > 0 && car->follow_ms < due)
+        {
+            due = car->follow_ms;
+        }
+    }
+
+    if (due == UINT64_MAX)
+    {
+        timer_cancel(&load->wheel, &load->follow_timer);
+        return;
+    }
+    timer_schedule(&load->wheel, &load->follow_timer,
+                   due > load->wheel.now ? due - load->wheel.now : 0);
+}
+
+/*
+ * Maps a car the first time an answer names it and reads what its ring holds
+ * so far. A car that can't be mapped or has no extension region is kept
+ * without a ring, so it isn't retried for every call.
+ */
+static load_car_t *add_car(load_t *load, const char *name)
+{
+    if (load->num_cars == load->cars_capacity)
+    {
+        size_t capacity = load->cars_capacity == 0 ? 4
+                                                   : load->cars_capacity * 2;
+        load_car_t *cars = realloc(load->cars, capacity * sizeof(*cars));
+        if (cars == NULL)
+        {
+            return NULL;
+        }
+        load->cars = cars;
+        load->cars_capacity = capacity;
+    }
+    load_car_t *car = &load->cars[load->num_cars];
+    memset(car, 0, sizeof(*car));
+    snprintf(car->name, sizeof(car->name), "%s", name);
+    car->fd = -1;
+
+    car->waiting = malloc((size_t)load->num_floors * sizeof(uint32_t));
+    car->riding = malloc((size_t)load->num_floors * sizeof(uint32_t));
+    if (car->waiting == NULL || car->riding == NULL)
+    {
+        free(car->waiting);
+        free(car->riding);
+        return NULL;
+    }
+    for (int i = 0; i < load->num_floors; i++)
+    {
+        car->waiting[i] = car->riding[i] = LOAD_NONE;
+    }
+    load->num_cars += 1;
+
+    char *shm_name = get_shm_name(name);
+    if (!connect_to_car(&car->state, shm_name, &car->fd))
+    {
+        if (car->fd >= 0)
+        {
+            close(car->fd);
+        }
+        car->state = NULL;
+        car->fd = -1;
+    }
+    free(shm_name);
+
+    car_shm_ext *ext = car->state != NULL ? get_shm_ext(car->state) : NULL;
+    if (ext != NULL)
+    {
+        car->followed = true;
+        history_reader_init(&car->reader, &ext->history);
+        follow_car(load, car);
+    }
+    return car;
+}
+
+/*
+ * Returns the car with the given name, mapping it if it is new.
+ */
+static load_car_t *find_car(load_t *load, const char *name)
+{
+    if (name == NULL || strlen(name) >= sizeof(load->cars->name))
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < load->num_cars; i++)
+    {
+        if (strcmp(load->cars[i].name, name) == 0)
+        {
+            return &load->cars[i];
+        }
+    }
+    return add_car(load, name);
+}
+
+/*
+ * Puts a passenger on their floor to wait for the car the controller named.
+ */
+static void call_answered(const call_completion_t *completion, void *arg)
+{
+    load_passenger_t *p = arg;
+    load_t *load = p->load;
+    p->latency_ns = completion->latency_ns;
+
+    if (completion->result == CALL_RESULT_UNAVAILABLE)
+    {
+        finish(load, p, LOAD_UNAVAILABLE);
+        return;
+    }
+    load_car_t *car = completion->result == CALL_RESULT_CAR
+                          ? find_car(load, completion->car_name)
+                          : NULL;
+    if (car == NULL)
+    {
+        finish(load, p, LOAD_FAILED);
+        return;
+    }
+    if (!car->followed)
+    {
+        finish(load, p, LOAD_UNFOLLOWED);
+        return;
+    }
+
+    /* Nobody needed the car's records since it last had passengers, so any
+     * the ring dropped in the meantime weren't missed. */
+    if (car->passengers == 0)
+    {
+        history_reader_init(&car->reader, car->reader.ring);
+    }
+    follow_car(load, car);
+    uint32_t index = (uint32_t)(p - load->passengers);
+    p->stage = LOAD_WAITING;
+    p->next = car->waiting[p->from - load->lowest];
+    car->waiting[p->from - load->lowest] = index;
+    car->passengers += 1;
+    move_passengers(load, car, monotonic_ns());
+    schedule_follow_timer(load);
+}
+
+/*
+ * Submits a passenger's call. It goes out the next time the loop polls.
+ */
+static void make_call(load_t *load, load_passenger_t *p)
+{
+    char from[16];
+    char to[16];
+    int_to_floor(p->from, from, sizeof(from));
+    int_to_floor(p->to, to, sizeof(to));
+
+    p->stage = LOAD_CALLING;
+    p->call_ns = monotonic_ns();
+    load->travelling += 1;
+    if (load->travelling > load->peak_travelling)
+    {
+        load->peak_travelling = load->travelling;
+    }
+    if (libcall_submit(&load->lib, from, to, call_answered, p) == 0)
+    {
+        finish(load, p, LOAD_FAILED);
+    }
+}
+
+/*
+ * Makes the calls of every passenger arriving now and waits for the next.
+ */
+static void arrival_timer_fired(void *arg)
+{
+    load_t *load = arg;
+    while (load->next_arrival < load->num_passengers &&
+           load->passengers[load->next_arrival].arrive_ms <= load->wheel.now)
+    {
+        make_call(load, &load->passengers[load->next_arrival]);
+        load->next_arrival += 1;
+    }
+
+    if (load->next_arrival < load->num_passengers)
+    {
+        timer_schedule(&load->wheel, &load->arrival_timer,
+                       load->passengers[load->next_arrival].arrive_ms -
+                           load->wheel.now);
+    }
+}
+
+/*
+ * Reads the history ring of every car with passengers that is due.
+ */
+static void follow_timer_fired(void *arg)
+{
+    load_t *load = arg;
+    for (size_t i = 0; i < load->num_cars; i++)
+    {
+        load_car_t *car = &load->cars[i];
+        if (car->passengers > 0 && car->follow_ms <= load->wheel.now)
+        {
+            follow_car(load, car);
+        }
+    }
+    schedule_follow_timer(load);
+}
+
+/*
+ * Polls the controller connection until the wheel next has timers due, then
+ * runs them. Stops once every passenger is done, when --timeout has passed
+ * since --sim-end or when *running is cleared.
+ */
+void load_run(load_t *load, volatile sig_atomic_t *running)
+{
+    timer_wheel_init(&load->wheel);
+    if (load->num_passengers > 0)
+    {
+        timer_schedule(&load->wheel, &load->arrival_timer,
+                       load->passengers[0].arrive_ms);
+    }
+
+    uint64_t deadline = load->options.end_ms + load->options.timeout_ms;
+    bool connected = true;
+    while (*running && load->wheel.now < deadline &&
+           (load->next_arrival < load->num_passengers || load->travelling > 0))
+    {
+        /* A lost connection has failed its calls, but passengers already
+         * waiting for a car can still get there. */
+        struct pollfd pfd = {.fd = connected ? libcall_fd(&load->lib) : -1,
+                             .events = libcall_events(&load->lib),
+                             .revents = 0};
+        /* Nothing may be due before the deadline, e.g. while every call
+         * waits for an answer. */
+        int64_t timeout = timer_wheel_next_ms(&load->wheel);
+        if (timeout < 0 || (uint64_t)timeout > deadline - load->wheel.now)
+        {
+            timeout = (int64_t)(deadline - load->wheel.now);
+        }
+        if (poll(&pfd, 1, (int)timeout) == -1 && errno != EINTR)
+        {
+            perror("poll()");
+            break;
+        }
+        if (pfd.revents != 0 && libcall_dispatch(&load->lib) == -1)
+        {
+            fprintf(stderr, "Lost the connection to the controller.\n");
+            connected = false;
+        }
+        timer_wheel_advance(&load->wheel);
+    }
+
+    timer_cancel(&load->wheel, &load->arrival_timer);
+    timer_cancel(&load->wheel, &load->follow_timer);
+}
+
+/*
+ * Prints how the run went and the waiting and riding times of every passenger
+ * who reached their floor. Waiting starts when the call is made, so it
+ * includes the controller's answer.
+ */
+void load_report(const load_t *load, double seconds)
+{
+    size_t count = load->num_passengers;
+    uint64_t *waits = malloc((count == 0 ? 1 : count) * sizeof(*waits));
+    uint64_t *rides = malloc((count == 0 ? 1 : count) * sizeof(*rides));
+    if (waits == NULL || rides == NULL)
+    {
+        perror("malloc()");
+        free(waits);
+        free(rides);
+        return;
+    }
+
+    size_t stages[LOAD_UNFOLLOWED + 1] = {0};
+    size_t served = 0;
+    size_t answered = 0;
+    uint64_t total_latency = 0;
+    uint64_t max_latency = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const load_passenger_t *p = &load->passengers[i];
+        stages[p->stage] += 1;
+        if (p->stage > LOAD_CALLING && p->stage != LOAD_FAILED)
+        {
+            answered += 1;
+            total_latency += p->latency_ns;
+            max_latency = p->latency_ns > max_latency ? p->latency_ns
+                                                      : max_latency;
+        }
+        if (p->stage == LOAD_ARRIVED)
+        {
+            /* A record can be stamped just before the call went out. */
+            waits[served] =
+                (p->board_ns > p->call_ns ? p->board_ns - p->call_ns : 0) /
+                1000;
+            rides[served] = (p->alight_ns - p->board_ns) / 1000;
+            served += 1;
+        }
+    }
+
+    printf("Ran %zu of %zu passengers on %zu cars in %.3f s, at most %zu "
+           "travelling at once\n",
+           count - stages[LOAD_ARRIVING], count, load->num_cars, seconds,
+           load->peak_travelling);
+    printf("Served: %zu, unavailable: %zu, failed: %zu, on cars without a "
+           "history ring: %zu, never reached their floor: %zu\n",
+           served, stages[LOAD_UNAVAILABLE], stages[LOAD_FAILED],
+           stages[LOAD_UNFOLLOWED],
+           stages[LOAD_CALLING] + stages[LOAD_WAITING] + stages[LOAD_RIDING]);
+    printf("Call answers: avg %.2fms, longest %.2fms\n",
+           answered > 0 ? (double)total_latency / (double)answered / 1e6 : 0.0,
+           (double)max_latency / 1e6);
+    if (load->lost > 0)
+    {
+        printf("History records missed: %lu\n", (unsigned long)load->lost);
+    }
+    printf("\n");
+
+    workload_print_trips(waits, rides, served, load->options.histogram_len);
+
+    free(waits);
+    free(rides);
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+/*
+ * This header file defines the load generator run by `load [options]`. It
+ * plays test-sched's passengers against a controller and cars that are
+ * already running, but from a single thread instead of a thread and a `call`
+ * process per passenger: every call goes out through libcall on one
+ * connection, and passengers get in and out by following each car's history
+ * ring (see history.h), so tens of thousands of them can be travelling at
+ * once.
+ *
+ * Options are given as `--{name} {value}` pairs. Those shared with test-sched
+ * and sim mean the same thing, and the same seed gives the same passengers as
+ * sim does:
+ *
+ *   --num-passengers {count}
+ *   --lowest-floor {floor}  Range of the passengers' floors
+ *   --highest-floor {floor}
+ *   --sim-start {ms}        Passengers arrive at random times between these,
+ *   --sim-end {ms}          counted from when load starts
+ *   --histogram-len {bars}
+ *   --seed {number}         Seed of the random passengers, see workload.h
+ *   --timeout {ms}          How long after --sim-end to wait for passengers
+ *                           who are still travelling
+ *
+ * Cars are found through the controller's answers, so they must be started
+ * with segments that have an extension region (`car` or `car --fleet`).
+ *
+ * See load.c for implementation details.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libcall.h"
+#include "posix.h"
+#include "timerwheel.h"
+
+/* Defaults, the same as test-sched's where it has the option */
+#define LOAD_DEFAULT_PASSENGERS 10
+#define LOAD_DEFAULT_LOWEST_FLOOR "1"
+#define LOAD_DEFAULT_HIGHEST_FLOOR "4"
+#define LOAD_DEFAULT_START_MS 40
+#define LOAD_DEFAULT_END_MS 1000
+#define LOAD_DEFAULT_HISTOGRAM_LEN 5
+#define LOAD_DEFAULT_SEED 1
+#define LOAD_DEFAULT_TIMEOUT_MS 60000
+
+/* Bounds on how long a car's history ring goes unread while passengers are
+ * waiting for it or riding it. The records carry their own timestamps, so a
+ * read only has to come before the ring fills; each one is timed from how
+ * fast the car's last records came in. */
+#define LOAD_FOLLOW_MIN_MS 1
+#define LOAD_FOLLOW_MAX_MS 50
+
+/* Marks the end of a list of passengers */
+#define LOAD_NONE UINT32_MAX
+
+/*
+ * Settings of a run
+ */
+typedef struct load_options
+{
+    size_t num_passengers;
+    const char *lowest_floor;
+    const char *highest_floor;
+    uint64_t start_ms;
+    uint64_t end_ms;
+    size_t histogram_len;
+    uint64_t seed;
+    uint64_t timeout_ms;
+} load_options_t;
+
+/*
+ * How far a passenger has got
+ */
+typedef enum
+{
+    LOAD_ARRIVING,    // Hasn't called yet
+    LOAD_CALLING,     // Waiting for the controller's answer
+    LOAD_WAITING,     // Waiting for the car on their floor
+    LOAD_RIDING,      // In the car
+    LOAD_ARRIVED,     // Got out on their floor
+    LOAD_UNAVAILABLE, // No car could take the call
+    LOAD_FAILED,      // The call couldn't be made or the connection was lost
+    LOAD_UNFOLLOWED   // The car has no history ring to follow
+} load_stage_t;
+
+struct load;
+
+/*
+ * A passenger. Floors are floor_to_int() numbers and times are CLOCK_MONOTONIC
+ * nanoseconds.
+ */
+typedef struct load_passenger
+{
+    struct load *load;
+    int from;
+    int to;
+    uint64_t arrive_ms;  // When the passenger calls, from the start of the run
+    uint64_t call_ns;    // When the call was made
+    uint64_t latency_ns; // How long the controller took to answer
+    uint64_t board_ns;   // When the passenger got in
+    uint64_t alight_ns;  // When the passenger got out
+    uint32_t next;       // Next passenger in the same list
+    load_stage_t stage;
+} load_passenger_t;
+
+/*
+ * A car named by the controller's answers
+ */
+typedef struct load_car
+{
+    char name[16];
+    int fd;
+    car_shared_mem *state;
+    history_reader_t reader; // Follows the car's history ring
+    bool followed;           // The car has a history ring
+    int current;             // floor_to_int() of the current floor
+    int destination;         // floor_to_int() of the destination floor
+    bool open;               // The doors are open
+    uint32_t *waiting;       // Passengers waiting on each floor
+    uint32_t *riding;        // Passengers in the car, by the floor they get
+                             // out at
+    size_t passengers;       // Passengers waiting for or riding the car
+    uint64_t read_ms;        // Wheel tick the ring was last read on
+    uint64_t follow_ms;      // Wheel tick the ring is next due to be read on
+} load_car_t;
+
+/*
+ * A run of the load generator
+ */
+typedef struct load
+{
+    load_options_t options;
+    libcall_t lib;
+    timer_wheel_t wheel;
+    timer_event_t arrival_timer;
+    timer_event_t follow_timer;   // Reads the history rings that are due
+    load_passenger_t *passengers; // In order of arrival
+    size_t num_passengers;
+    size_t next_arrival;          // First passenger who hasn't called yet
+    size_t travelling;            // Passengers who called but aren't done
+    size_t peak_travelling;       // Most passengers travelling at once
+    load_car_t *cars;
+    size_t num_cars;
+    size_t cars_capacity;
+    int lowest;                   // floor_to_int() of the lowest floor
+    int num_floors;               // Floors passengers travel between
+    uint64_t lost;                // History records overwritten before read
+} load_t;
+
+// Fills in the defaults
+void load_options_init(load_options_t *);
+// Reads `--{name} {value}` arguments, prints the problem and returns false if
+// one isn't valid
+bool load_options_parse(load_options_t *, int, char *[]);
+// Creates the passengers and connects to the controller, prints the problem
+// and returns false if it can't be reached
+bool load_init(load_t *, const load_options_t *);
+// Releases the run's resources and unmaps the cars
+void load_deinit(load_t *);
+// Runs the passengers until they are all done, the timeout passes or
+// *running is cleared
+void load_run(load_t *, volatile sig_atomic_t *);
+// Prints the waiting and riding times like test-sched
+void load_report(const load_t *, double);
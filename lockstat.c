@@ -0,0 +1,179 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Implementation of the lock contention statistics. The counters live in the
+ * car's shared memory object so the car, safety and internal all add to the
+ * same numbers, and the monitor tool can read them while the car is running.
+ *
+ * Histograms use power-of-two buckets. They are coarse, but recording a sample
+ * costs a couple of atomic adds, which keeps the instrumentation from hiding
+ * the contention it is meant to find.
+ */
+
+#include "lockstat.h"
+
+_Static_assert(LOCK_SITE_COUNT <= LOCK_SITE_CAPACITY,
+               "LOCK_SITE_CAPACITY must be raised, which changes the layout "
+               "of the shared memory");
+
+static const char *lock_site_names[LOCK_SITE_COUNT] = {
+    "reset_shm",
+    "set_status",
+    "set_destination_floor",
+    "set_open_button",
+    "set_close_button",
+    "set_emergency_stop",
+    "set_service_mode",
+    "open_button_is",
+    "close_button_is",
+    "status_is",
+    "service_mode_is",
+    "car_init",
+    "car doors wait",
+    "car open doors",
+    "car close doors",
+    "car level wait",
+    "car level bounds check",
+    "car level move",
+    "car sleep_delay_cond",
+    "car cdcmp_floors",
+    "car receiver",
+    "car updater wait",
+    "car signal controller",
+    "car maintain connection",
+    "car connection",
+    "car loop bridge",
+    "car loop evaluate",
+    "car loop doors",
+    "car loop level",
+    "car loop receiver",
+    "car loop sync",
+    "car loop poll",
+    "internal can_car_move",
+    "internal up",
+    "internal down",
+    "internal wait",
+    "safety check",
+    "safety watch",
+    "safety sweep",
+    "safety stress",
+    "wake observe",
+};
+
+/*
+ * Returns the name of a lock site, or "unknown" for a site added by a newer
+ * build.
+ */
+const char *lock_site_name(lock_site_t site)
+{
+    if (site < 0 || site >= LOCK_SITE_COUNT)
+    {
+        return "unknown";
+    }
+    return lock_site_names[site];
+}
+
+/*
+ * Returns the histogram bucket for a sample in nanoseconds.
+ */
+static int bucket_for(uint64_t ns)
+{
+    int bucket = 0;
+    while (ns > 1 && bucket < LOCK_HIST_BUCKETS - 1)
+    {
+        ns >>= 1;
+        bucket += 1;
+    }
+    return bucket;
+}
+
+/*
+ * Adds a sample in nanoseconds to a histogram.
+ */
+void lock_hist_add(_Atomic uint64_t *hist, uint64_t ns)
+{
+    atomic_fetch_add_explicit(&hist[bucket_for(ns)], 1, memory_order_relaxed);
+}
+
+/*
+ * Raises *max to value if value is larger.
+ */
+static void update_max(_Atomic uint64_t *max, uint64_t value)
+{
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(max, &current, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+    }
+}
+
+/*
+ * Records one acquisition of the mutex at a site and how long it waited.
+ */
+void lock_stats_record_wait(lock_stats_t *stats, lock_site_t site,
+                            uint64_t wait_ns)
+{
+    lock_site_stats_t *s = &stats->sites[site];
+    atomic_store_explicit(&stats->enabled, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->acquisitions, 1, memory_order_relaxed);
+    if (wait_ns > 0)
+    {
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&s->wait_total_ns, wait_ns, memory_order_relaxed);
+    lock_hist_add(s->wait_hist, wait_ns);
+    update_max(&s->wait_max_ns, wait_ns);
+}
+
+/*
+ * Records how long the mutex was held for at a site.
+ */
+void lock_stats_record_hold(lock_stats_t *stats, lock_site_t site,
+                            uint64_t hold_ns)
+{
+    lock_site_stats_t *s = &stats->sites[site];
+    atomic_fetch_add_explicit(&s->hold_total_ns, hold_ns, memory_order_relaxed);
+    lock_hist_add(s->hold_hist, hold_ns);
+    update_max(&s->hold_max_ns, hold_ns);
+}
+
+/*
+ * Records a broadcast on the condition variable made from a site.
+ */
+void lock_stats_record_broadcast(lock_stats_t *stats, lock_site_t site)
+{
+    atomic_fetch_add_explicit(&stats->sites[site].broadcasts, 1,
+                              memory_order_relaxed);
+}
+
+/*
+ * Returns the upper edge of the bucket that contains the given percentile
+ * (0-100) of a histogram, or 0 if the histogram is empty.
+ */
+uint64_t lock_hist_percentile(const _Atomic uint64_t *hist, double percentile)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LOCK_HIST_BUCKETS; i++)
+    {
+        total += atomic_load_explicit(&hist[i], memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    double target = (double)total * percentile / 100.0;
+    uint64_t seen = 0;
+    for (int i = 0; i < LOCK_HIST_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&hist[i], memory_order_relaxed);
+        if ((double)seen >= target)
+        {
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return (uint64_t)1 << LOCK_HIST_BUCKETS;
+}
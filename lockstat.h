@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * This header file defines the lock contention statistics kept in the
+ * extension region of a car's shared memory object. The statistics are only
+ * recorded by programs built with LOCK_STATS defined (`make LOCK_STATS=1`),
+ * but the region is always present so every build agrees on the layout.
+ * See lockstat.c and the shm_lock() family in posix.c for the details.
+ */
+
+/* Number of logarithmic histogram buckets, bucket i counts samples in
+ * [2^i, 2^(i+1)) nanoseconds and the last bucket also counts anything larger */
+#define LOCK_HIST_BUCKETS 32
+/* Lock site slots reserved in the shared memory. Sites can be added up to
+ * this many without changing the layout, so programs built with different
+ * sites still agree on it and SHM_EXT_VERSION stays the same. */
+#define LOCK_SITE_CAPACITY 64
+
+/*
+ * Every place that takes a car's mutex. New lock sites must be added at the
+ * end, before LOCK_SITE_COUNT, and to the names in lockstat.c. Existing sites
+ * keep their numbers so older builds still name them correctly.
+ */
+typedef enum
+{
+    LOCK_SITE_RESET_SHM = 0,
+    LOCK_SITE_SET_STATUS,
+    LOCK_SITE_SET_DESTINATION_FLOOR,
+    LOCK_SITE_SET_OPEN_BUTTON,
+    LOCK_SITE_SET_CLOSE_BUTTON,
+    LOCK_SITE_SET_EMERGENCY_STOP,
+    LOCK_SITE_SET_SERVICE_MODE,
+    LOCK_SITE_OPEN_BUTTON_IS,
+    LOCK_SITE_CLOSE_BUTTON_IS,
+    LOCK_SITE_STATUS_IS,
+    LOCK_SITE_SERVICE_MODE_IS,
+    LOCK_SITE_CAR_INIT,
+    LOCK_SITE_CAR_DOORS_WAIT,
+    LOCK_SITE_CAR_OPEN_DOORS,
+    LOCK_SITE_CAR_CLOSE_DOORS,
+    LOCK_SITE_CAR_LEVEL_WAIT,
+    LOCK_SITE_CAR_LEVEL_BOUNDS,
+    LOCK_SITE_CAR_LEVEL_MOVE,
+    LOCK_SITE_CAR_SLEEP_DELAY_COND,
+    LOCK_SITE_CAR_CDCMP_FLOORS,
+    LOCK_SITE_CAR_RECEIVER,
+    LOCK_SITE_CAR_UPDATER_WAIT,
+    LOCK_SITE_CAR_SIGNAL_CONTROLLER,
+    LOCK_SITE_CAR_MAINTAIN_CONNECTION,
+    LOCK_SITE_CAR_CONNECTION,
+    LOCK_SITE_CAR_LOOP_BRIDGE,
+    LOCK_SITE_CAR_LOOP_EVALUATE,
+    LOCK_SITE_CAR_LOOP_DOORS,
+    LOCK_SITE_CAR_LOOP_LEVEL,
+    LOCK_SITE_CAR_LOOP_RECEIVER,
+    LOCK_SITE_CAR_LOOP_SYNC,
+    LOCK_SITE_CAR_LOOP_POLL,
+    LOCK_SITE_INTERNAL_CAN_MOVE,
+    LOCK_SITE_INTERNAL_UP,
+    LOCK_SITE_INTERNAL_DOWN,
+    LOCK_SITE_INTERNAL_WAIT,
+    LOCK_SITE_SAFETY_CHECK,
+    LOCK_SITE_SAFETY_WATCH,
+    LOCK_SITE_SAFETY_SWEEP,
+    LOCK_SITE_SAFETY_STRESS,
+    LOCK_SITE_WAKE_OBSERVE,
+    LOCK_SITE_COUNT
+} lock_site_t;
+
+/*
+ * Statistics for a single lock site. Counters are updated with relaxed
+ * atomics because several processes may share a site.
+ */
+typedef struct
+{
+    _Atomic uint64_t acquisitions; // Times the mutex was acquired here
+    _Atomic uint64_t contended;    // Acquisitions that had to wait
+    _Atomic uint64_t broadcasts;   // Broadcasts made while holding the mutex
+    _Atomic uint64_t wait_total_ns;
+    _Atomic uint64_t wait_max_ns;
+    _Atomic uint64_t wait_hist[LOCK_HIST_BUCKETS];
+    _Atomic uint64_t hold_total_ns;
+    _Atomic uint64_t hold_max_ns;
+    _Atomic uint64_t hold_hist[LOCK_HIST_BUCKETS];
+} lock_site_stats_t;
+
+/*
+ * Statistics for every lock site of a car.
+ */
+typedef struct
+{
+    _Atomic uint32_t enabled; // Set once an instrumented build records data
+    lock_site_stats_t sites[LOCK_SITE_CAPACITY]; // Indexed by lock_site_t
+} lock_stats_t;
+
+// Returns a printable name for a lock site
+const char *lock_site_name(lock_site_t);
+// Records the time spent waiting for the mutex
+void lock_stats_record_wait(lock_stats_t *, lock_site_t, uint64_t);
+// Records the time the mutex was held for
+void lock_stats_record_hold(lock_stats_t *, lock_site_t, uint64_t);
+// Records a broadcast on the condition variable
+void lock_stats_record_broadcast(lock_stats_t *, lock_site_t);
+// Adds a sample in nanoseconds to a histogram
+void lock_hist_add(_Atomic uint64_t *, uint64_t);
+// Returns an upper bound for the given percentile of a histogram
+uint64_t lock_hist_percentile(const _Atomic uint64_t *, double);
@@ -0,0 +1,307 @@
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * This is the implementation of the monitor tool. It maps a car's shared
+ * memory object but never takes the car's mutex; it only reads from the
+ * extension region the car publishes into, so it can be pointed at a car under
+ * load without disturbing it.
+ *
+ * Usage: monitor {car name} history|locks|connection|safety
+ *
+ *   history    - Print the car's state transitions as they happen.
+ *   locks      - Print mutex contention statistics (needs a LOCK_STATS build).
+ *   connection - Print controller connection and reconnect statistics.
+ *   safety     - Print how quickly safety has reacted to each kind of fault.
+ */
+
+#include "history.h"
+#include "lockstat.h"
+#include "monitor.h"
+#include "posix.h"
+#include "safetystat.h"
+
+/* Flag to control the main loop, modified by signal handler */
+static volatile sig_atomic_t keep_running = 1;
+
+/*
+ * Signal handler function for handling SIGINT signal
+ */
+static void signal_handler(int signum)
+{
+    if (signum == SIGINT)
+    {
+        keep_running = 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /* Check if the correct number of command line arguments is provided */
+    if (argc != 3)
+    {
+        printf("Usage: %s {car name} history|locks|connection|safety\n",
+               argv[0]);
+        return 1;
+    }
+
+    /* Setup the signal handler. SA_RESTART is left off so that blocking waits
+     * return when the user presses Ctrl-C. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGINT, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        return 1;
+    }
+
+    monitor_t monitor;
+    monitor_init(&monitor, argv[1]);
+    if (!monitor_connect(&monitor))
+    {
+        monitor_deinit(&monitor);
+        return 1;
+    }
+
+    int result = 0;
+    if (strcmp(argv[2], "history") == 0)
+    {
+        tail_history(&monitor);
+    }
+    else if (strcmp(argv[2], "locks") == 0)
+    {
+        print_lock_stats(&monitor);
+    }
+    else if (strcmp(argv[2], "connection") == 0)
+    {
+        print_connection_stats(&monitor);
+    }
+    else if (strcmp(argv[2], "safety") == 0)
+    {
+        print_safety_stats(&monitor);
+    }
+    else
+    {
+        printf("Invalid report.\n");
+        result = 1;
+    }
+
+    monitor_deinit(&monitor);
+    return result;
+}
+
+/*
+ * Initialise the monitor with the name of the car to observe
+ */
+void monitor_init(monitor_t *monitor, const char *car_name)
+{
+    monitor->car_name = car_name;
+    monitor->shm_name = get_shm_name(car_name);
+    monitor->fd = -1;
+    monitor->state = NULL;
+    monitor->ext = NULL;
+}
+
+/*
+ * Deinitialise the monitor and release its resources
+ */
+void monitor_deinit(monitor_t *monitor)
+{
+    if (monitor->state != NULL)
+    {
+        unmap_car(monitor->state);
+        monitor->state = NULL;
+        monitor->ext = NULL;
+    }
+
+    if (monitor->fd >= 0)
+    {
+        close(monitor->fd);
+        monitor->fd = -1;
+    }
+
+    free(monitor->shm_name);
+    monitor->shm_name = NULL;
+}
+
+/*
+ * Maps the car's shared memory object and makes sure it has an extension
+ * region to read from. Prints the reason and returns false on failure.
+ */
+bool monitor_connect(monitor_t *monitor)
+{
+    if (!connect_to_car(&monitor->state, monitor->shm_name, &monitor->fd))
+    {
+        printf("Unable to access car %s.\n", monitor->car_name);
+        return false;
+    }
+
+    monitor->ext = get_shm_ext(monitor->state);
+    if (monitor->ext == NULL)
+    {
+        printf("Car %s does not publish monitoring data.\n",
+               monitor->car_name);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Prints every record held by the car's history ring and then keeps printing
+ * new records as they are published until SIGINT is received.
+ */
+void tail_history(monitor_t *monitor)
+{
+    history_reader_t reader;
+    history_reader_init(&reader, &monitor->ext->history);
+
+    uint64_t lost = 0;
+    while (keep_running)
+    {
+        history_record_t record;
+        while (history_read(&reader, &record))
+        {
+            print_history_record(&record);
+        }
+
+        /* Let the user know if we fell behind the car. */
+        if (reader.lost != lost)
+        {
+            printf("... %lu records lost\n",
+                   (unsigned long)(reader.lost - lost));
+            lost = reader.lost;
+        }
+        fflush(stdout);
+
+        history_wait(&reader, -1);
+    }
+}
+
+/*
+ * Prints a single history record on one line. The hex number after the
+ * timestamp is the mask of SHM_FIELD_* bits the update changed.
+ */
+void print_history_record(const history_record_t *record)
+{
+    printf("%lu.%06lu %03x %-7s %3s %3s  open=%u close=%u obstruction=%u "
+           "overload=%u stop=%u service=%u emergency=%u\n",
+           (unsigned long)(record->timestamp_ns / 1000000000u),
+           (unsigned long)(record->timestamp_ns % 1000000000u / 1000u),
+           record->dirty, record->status, record->current_floor,
+           record->destination_floor,
+           record->open_button, record->close_button,
+           record->door_obstruction, record->overload, record->emergency_stop,
+           record->individual_service_mode, record->emergency_mode);
+}
+
+/*
+ * Prints the lock contention statistics for every lock site that has been
+ * used. Times are in microseconds; percentiles are the upper edge of the
+ * power-of-two histogram bucket they fall in.
+ */
+void print_lock_stats(const monitor_t *monitor)
+{
+    const lock_stats_t *stats = &monitor->ext->lock_stats;
+    if (atomic_load(&stats->enabled) == 0)
+    {
+        printf("No lock statistics recorded, build with `make LOCK_STATS=1`."
+               "\n");
+        return;
+    }
+
+    printf("%-24s %9s %9s %9s | %9s %9s %9s | %9s %9s %9s\n", "site",
+           "acquired", "contended", "bcasts", "wait avg", "wait p99",
+           "wait max", "hold avg", "hold p99", "hold max");
+    for (int i = 0; i < LOCK_SITE_CAPACITY; i++)
+    {
+        const lock_site_stats_t *s = &stats->sites[i];
+        uint64_t acquisitions = atomic_load(&s->acquisitions);
+        if (acquisitions == 0)
+        {
+            continue;
+        }
+
+        /* Sites added by a newer build than this one are shown by number. */
+        char number[16];
+        snprintf(number, sizeof(number), "site %d", i);
+        const char *name =
+            i < LOCK_SITE_COUNT ? lock_site_name((lock_site_t)i) : number;
+
+        printf("%-24s %9lu %9lu %9lu | %9.2f %9.2f %9.2f | %9.2f %9.2f %9.2f"
+               "\n",
+               name, (unsigned long)acquisitions,
+               (unsigned long)atomic_load(&s->contended),
+               (unsigned long)atomic_load(&s->broadcasts),
+               (double)atomic_load(&s->wait_total_ns) /
+                   (double)acquisitions / 1000.0,
+               (double)lock_hist_percentile(s->wait_hist, 99.0) / 1000.0,
+               (double)atomic_load(&s->wait_max_ns) / 1000.0,
+               (double)atomic_load(&s->hold_total_ns) /
+                   (double)acquisitions / 1000.0,
+               (double)lock_hist_percentile(s->hold_hist, 99.0) / 1000.0,
+               (double)atomic_load(&s->hold_max_ns) / 1000.0);
+    }
+}
+
+/*
+ * Prints the car's controller connection statistics. Times are in
+ * milliseconds.
+ */
+void print_connection_stats(const monitor_t *monitor)
+{
+    const reconnect_stats_t *stats = &monitor->ext->reconnect;
+    uint64_t connects = atomic_load(&stats->connects);
+    uint64_t downtime_ns = atomic_load(&stats->downtime_ns);
+
+    printf("attempts     %9lu\n", (unsigned long)atomic_load(&stats->attempts));
+    printf("failures     %9lu\n", (unsigned long)atomic_load(&stats->failures));
+    printf("connects     %9lu\n", (unsigned long)connects);
+    printf("disconnects  %9lu\n",
+           (unsigned long)atomic_load(&stats->disconnects));
+    printf("backoff      %9lu\n",
+           (unsigned long)atomic_load(&stats->backoff_ms));
+    printf("downtime     %9.1f\n", (double)downtime_ns / 1000000.0);
+    printf("downtime avg %9.1f\n",
+           connects > 0 ? (double)downtime_ns / (double)connects / 1000000.0
+                        : 0.0);
+    printf("downtime max %9.1f\n",
+           (double)atomic_load(&stats->max_downtime_ns) / 1000000.0);
+}
+
+/*
+ * Prints safety's reaction latency for each kind of fault. Times are in
+ * microseconds; percentiles are the upper edge of the power-of-two histogram
+ * bucket they fall in.
+ */
+void print_safety_stats(const monitor_t *monitor)
+{
+    const safety_stats_t *stats = &monitor->ext->safety;
+
+    printf("%-18s %9s %9s | %9s %9s %9s %9s\n", "fault", "reactions",
+           "untimed", "avg", "p50", "p99", "max");
+    for (int i = 0; i < SAFETY_FAULT_COUNT; i++)
+    {
+        const safety_fault_stats_t *s = &stats->faults[i];
+        uint64_t reactions = atomic_load(&s->reactions);
+
+        printf("%-18s %9lu %9lu | %9.2f %9.2f %9.2f %9.2f\n",
+               safety_fault_name((safety_fault_t)i), (unsigned long)reactions,
+               (unsigned long)atomic_load(&s->untimed),
+               reactions > 0 ? (double)atomic_load(&s->total_ns) /
+                                   (double)reactions / 1000.0
+                             : 0.0,
+               (double)lock_hist_percentile(s->hist, 50.0) / 1000.0,
+               (double)lock_hist_percentile(s->hist, 99.0) / 1000.0,
+               (double)atomic_load(&s->max_ns) / 1000.0);
+    }
+}
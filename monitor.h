@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * This header file defines the `monitor_t` struct used by the monitor tool to
+ * observe a running car through the extension region of its shared memory
+ * object, along with the function prototypes for each of its reports.
+ *
+ * See monitor.c for implementation details.
+ */
+
+#include <stdbool.h>
+
+#include "posix.h"
+
+/*
+ * Struct holding data for observing a single car
+ */
+typedef struct monitor
+{
+    const char *car_name;
+    char *shm_name;
+    int fd;
+    car_shared_mem *state;
+    car_shm_ext *ext;
+} monitor_t;
+
+void monitor_init(monitor_t *, const char *);
+void monitor_deinit(monitor_t *);
+bool monitor_connect(monitor_t *);
+
+void tail_history(monitor_t *);
+void print_history_record(const history_record_t *);
+void print_lock_stats(const monitor_t *);
+void print_connection_stats(const monitor_t *);
+void print_safety_stats(const monitor_t *);
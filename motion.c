@@ -0,0 +1,282 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Implementation of the motion model. A trip follows a trapezoidal speed
+ * profile: constant acceleration up to max_speed, a cruise, then the same
+ * deceleration down to a stop at the destination. Trips too short to reach
+ * max_speed peak halfway instead. The car still reports its position a floor
+ * at a time, so a trip is cut into steps and each step takes the time the
+ * profile needs to cover that storey. Short steps happen at cruising speed in
+ * the middle of an express run, long ones while the car speeds up and slows
+ * down.
+ *
+ * A destination that changes mid-trip is treated as if it had been the
+ * destination from the start, which is exact while the car is still speeding
+ * up or cruising. A destination behind the car means it has to stop and turn
+ * around, so the trip starts again from rest where it is.
+ */
+
+#include "global.h"
+#include "motion.h"
+
+/*
+ * Returns the height of the storey from a floor to the one above.
+ */
+static double storey_height(const motion_t *m, int floor)
+{
+    for (size_t i = 0; i < m->num_heights; i++)
+    {
+        if (m->heights[i].floor == floor)
+        {
+            return m->heights[i].height;
+        }
+    }
+    return m->floor_height;
+}
+
+/*
+ * Returns the distance in metres between two floors.
+ */
+static double distance(const motion_t *m, int from, int to)
+{
+    int low = from < to ? from : to;
+    int high = from < to ? to : from;
+    double metres = 0;
+    for (int floor = low; floor < high; floor++)
+    {
+        metres += storey_height(m, floor);
+    }
+    return metres;
+}
+
+/*
+ * Returns how many seconds into a trip of length total the car has covered
+ * position metres.
+ */
+static double time_at(const motion_t *m, double total, double position)
+{
+    double a = m->acceleration;
+    double v = m->max_speed;
+    double ramp = v * v / (2 * a);
+
+    /* Too short to reach full speed, accelerate for the first half. */
+    if (2 * ramp > total)
+    {
+        double end = 2 * sqrt(total / a);
+        if (position <= total / 2)
+            return sqrt(2 * position / a);
+        return end - sqrt(2 * (total - position) / a);
+    }
+
+    double end = total / v + v / a;
+    if (position <= ramp)
+        return sqrt(2 * position / a);
+    if (position <= total - ramp)
+        return v / a + (position - ramp) / v;
+    return end - sqrt(2 * (total - position) / a);
+}
+
+/*
+ * Converts seconds to whole milliseconds, never less than one so every step
+ * still takes a timer.
+ */
+static uint32_t to_ms(double seconds)
+{
+    double ms = seconds * 1000 + 0.5;
+    return ms < 1 ? 1 : (uint32_t)ms;
+}
+
+/*
+ * Parses a positive number, returns false if it isn't one.
+ */
+static bool parse_positive(const char *text, double *value)
+{
+    char *end;
+    *value = text != NULL ? strtod(text, &end) : 0;
+    return text != NULL && *end == '\0' && *value > 0;
+}
+
+/*
+ * Parses a door phase in milliseconds, returns false if it isn't one.
+ */
+static bool parse_ms(const char *text, uint32_t *value)
+{
+    double ms;
+    if (!parse_positive(text, &ms) || ms > UINT32_MAX)
+    {
+        return false;
+    }
+    *value = (uint32_t)ms;
+    return true;
+}
+
+/*
+ * Applies a single line of a motion file, returns false if it is invalid.
+ */
+static bool apply_setting(motion_t *m, char *line)
+{
+    char *saveptr;
+    const char *key = strtok_r(line, " \t\r", &saveptr);
+    if (key == NULL || key[0] == '#')
+    {
+        return true;
+    }
+
+    const char *value = strtok_r(NULL, " \t\r", &saveptr);
+    const char *extra = strtok_r(NULL, " \t\r", &saveptr);
+    bool valid = extra == NULL || extra[0] == '#';
+
+    if (strcmp(key, "acceleration") == 0)
+    {
+        m->kinematic = true;
+        return valid && parse_positive(value, &m->acceleration);
+    }
+    else if (strcmp(key, "max_speed") == 0)
+    {
+        m->kinematic = true;
+        return valid && parse_positive(value, &m->max_speed);
+    }
+    else if (strcmp(key, "floor_height") == 0)
+    {
+        m->kinematic = true;
+        return valid && parse_positive(value, &m->floor_height);
+    }
+    else if (strcmp(key, "height") == 0)
+    {
+        /* height {floor} {metres} */
+        const char *metres = extra;
+        extra = strtok_r(NULL, " \t\r", &saveptr);
+        double height;
+        if (value == NULL || !is_valid_floor(value) ||
+            !parse_positive(metres, &height) ||
+            (extra != NULL && extra[0] != '#') ||
+            m->num_heights == MOTION_MAX_HEIGHTS)
+        {
+            return false;
+        }
+        m->heights[m->num_heights].floor = floor_to_int(value);
+        m->heights[m->num_heights].height = height;
+        m->num_heights += 1;
+        m->kinematic = true;
+        return true;
+    }
+    else if (strcmp(key, "door_open") == 0)
+    {
+        return valid && parse_ms(value, &m->door_open_ms);
+    }
+    else if (strcmp(key, "door_dwell") == 0)
+    {
+        return valid && parse_ms(value, &m->door_dwell_ms);
+    }
+    else if (strcmp(key, "door_close") == 0)
+    {
+        return valid && parse_ms(value, &m->door_close_ms);
+    }
+    return false;
+}
+
+/*
+ * Sets up the default model: a floor per delay and every door phase one
+ * delay long.
+ */
+void motion_init(motion_t *m, uint32_t delay_ms)
+{
+    memset(m, 0, sizeof(*m));
+    m->delay_ms = delay_ms;
+    m->kinematic = false;
+    m->acceleration = MOTION_DEFAULT_ACCELERATION;
+    m->max_speed = MOTION_DEFAULT_MAX_SPEED;
+    m->floor_height = MOTION_DEFAULT_FLOOR_HEIGHT;
+    m->door_open_ms = delay_ms;
+    m->door_dwell_ms = delay_ms;
+    m->door_close_ms = delay_ms;
+}
+
+/*
+ * Reads a motion file on top of the current settings.
+ */
+bool motion_load(motion_t *m, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number += 1;
+        line[strcspn(line, "\n")] = '\0';
+        if (!apply_setting(m, line))
+        {
+            fprintf(stderr, "Error: Invalid setting on line %d of %s.\n",
+                    line_number, path);
+            ok = false;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/*
+ * Works out how long the step from `from` to the next floor towards `to`
+ * takes on a trip that started from rest at *start, which is moved to `from`
+ * if the car has to turn around.
+ */
+uint32_t motion_step_ms(const motion_t *m, int *start, int from, int to)
+{
+    if (!m->kinematic || from == to)
+    {
+        return m->delay_ms;
+    }
+
+    /* A destination behind the car, or between it and where it started,
+     * means stopping and starting again from here. */
+    int direction = to > from ? 1 : -1;
+    if ((from - *start) * direction < 0)
+    {
+        *start = from;
+    }
+
+    double total = distance(m, *start, to);
+    double t0 = time_at(m, total, distance(m, *start, from));
+    double t1 = time_at(m, total, distance(m, *start, from + direction));
+    return to_ms(t1 - t0);
+}
+
+/*
+ * Works out how long a whole trip takes, the sum of its steps.
+ */
+uint32_t motion_trip_ms(const motion_t *m, int from, int to)
+{
+    if (!m->kinematic)
+    {
+        int floors = from < to ? to - from : from - to;
+        return (uint32_t)floors * m->delay_ms;
+    }
+    return to_ms(time_at(m, distance(m, from, to), distance(m, from, to)));
+}
+
+/*
+ * Returns the shortest of the three door phases.
+ */
+uint32_t motion_min_door_ms(const motion_t *m)
+{
+    uint32_t shortest = m->door_open_ms;
+    if (m->door_dwell_ms < shortest)
+        shortest = m->door_dwell_ms;
+    if (m->door_close_ms < shortest)
+        shortest = m->door_close_ms;
+    return shortest;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * This header file defines the motion model that decides how long a car takes
+ * to travel between floors and to cycle its doors. By default every floor and
+ * every door phase takes the car's delay, as it always has. A motion file
+ * (`car --motion {file} ...`) replaces that with a kinematic model: the car
+ * accelerates to its top speed, cruises and brakes to a stop over the real
+ * distance between the floors, and each door phase has its own duration.
+ *
+ * A motion file has one setting per line, blank lines and lines starting with
+ * '#' are ignored:
+ *
+ *   acceleration 1.2   # m/s^2, for speeding up and braking
+ *   max_speed 6        # m/s
+ *   floor_height 3.5   # m, for every storey not listed below
+ *   height 1 5         # m, from floor 1 to the floor above, e.g. a lobby
+ *   door_open 1500     # ms spent "Opening"
+ *   door_dwell 3000    # ms spent "Open"
+ *   door_close 1500    # ms spent "Closing"
+ *
+ * Any setting may be left out. The travel settings default to the values
+ * below as soon as one of them is given, otherwise the car moves a floor per
+ * delay. Door phases not given take the car's delay.
+ *
+ * See motion.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Travel settings used when a motion file gives some but not all of them */
+#define MOTION_DEFAULT_ACCELERATION 1.0 // m/s^2
+#define MOTION_DEFAULT_MAX_SPEED 2.5    // m/s
+#define MOTION_DEFAULT_FLOOR_HEIGHT 3.5 // m
+
+/* Most storeys that can be given their own height */
+#define MOTION_MAX_HEIGHTS 32
+
+/*
+ * A storey whose height differs from floor_height
+ */
+typedef struct motion_height
+{
+    int floor;     // floor_to_int() of the floor at the bottom of the storey
+    double height; // Metres to the floor above
+} motion_height_t;
+
+/*
+ * How a car moves
+ */
+typedef struct motion
+{
+    uint32_t delay_ms;       // Time per floor when travel isn't kinematic
+    bool kinematic;          // Travel follows the settings below
+    double acceleration;     // m/s^2
+    double max_speed;        // m/s
+    double floor_height;     // Metres per storey unless listed in heights
+    motion_height_t heights[MOTION_MAX_HEIGHTS];
+    size_t num_heights;
+    uint32_t door_open_ms;   // Time spent "Opening"
+    uint32_t door_dwell_ms;  // Time spent "Open" before closing by itself
+    uint32_t door_close_ms;  // Time spent "Closing"
+} motion_t;
+
+// Sets up the default model where everything takes the given delay in ms
+void motion_init(motion_t *, uint32_t);
+// Applies the settings of a motion file, prints the problem and returns false
+// if it can't be read
+bool motion_load(motion_t *, const char *);
+// Returns how many ms the car takes to move one floor on from the second
+// floor towards the third, on a trip that started at rest on the first, which
+// is updated if the car turns around. Floors are floor_to_int() numbers.
+uint32_t motion_step_ms(const motion_t *, int *, int, int);
+// Returns how many ms a trip between two floors takes from rest to rest
+uint32_t motion_trip_ms(const motion_t *, int, int);
+// Returns the shortest door phase in ms
+uint32_t motion_min_door_ms(const motion_t *);
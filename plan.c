@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Implementation of the stop plan. The plan only keeps track of which stop the
+ * car is heading for; sending the car there is left to the runtime, which
+ * treats the returned stop exactly like the floor of a FLOOR message. A stop
+ * is only returned when it differs from the one the car was last sent to, so
+ * a PLAN that just appends stops doesn't disturb the car.
+ */
+
+#include "global.h"
+#include "plan.h"
+
+/*
+ * Makes the first stop the car's target and returns it, or returns NULL if
+ * the car is already heading there or the plan is empty.
+ */
+static const char *retarget(car_plan_t *plan)
+{
+    if (plan->num_stops == 0)
+    {
+        plan->target[0] = '\0';
+        return NULL;
+    }
+    if (strcmp(plan->stops[0], plan->target) == 0)
+    {
+        return NULL;
+    }
+
+    strcpy(plan->target, plan->stops[0]);
+    return plan->target;
+}
+
+/*
+ * Empties a plan.
+ */
+void plan_init(car_plan_t *plan)
+{
+    plan->num_stops = 0;
+    plan->target[0] = '\0';
+}
+
+/*
+ * Replaces the plan with the rest of a PLAN message. Invalid floors are
+ * skipped, as are stops beyond PLAN_MAX_STOPS.
+ */
+const char *plan_replace(car_plan_t *plan, char **saveptr)
+{
+    plan->num_stops = 0;
+    for (const char *floor = strtok_r(NULL, " ", saveptr);
+         floor != NULL && plan->num_stops < PLAN_MAX_STOPS;
+         floor = strtok_r(NULL, " ", saveptr))
+    {
+        if (is_valid_floor(floor))
+        {
+            strcpy(plan->stops[plan->num_stops++], floor);
+        }
+    }
+    return retarget(plan);
+}
+
+/*
+ * Drops the target from the front of the plan once the doors open on it,
+ * along with any repeats of the same floor, and returns the next stop.
+ * Opening anywhere else, e.g. for the open button, doesn't affect the plan.
+ */
+const char *plan_arrived(car_plan_t *plan, const char *floor)
+{
+    if (plan->target[0] == '\0' || strcmp(plan->target, floor) != 0)
+    {
+        return NULL;
+    }
+
+    size_t reached = 0;
+    while (reached < plan->num_stops &&
+           strcmp(plan->stops[reached], floor) == 0)
+    {
+        reached += 1;
+    }
+    plan->num_stops -= reached;
+    memmove(plan->stops, plan->stops + reached,
+            plan->num_stops * sizeof(plan->stops[0]));
+
+    plan->target[0] = '\0';
+    return retarget(plan);
+}
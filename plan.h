@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * This header file defines the stop plan a car executes when the controller
+ * pipelines its stops. A car started with `--plan` announces it with
+ * `FEATURES PLAN` straight after its CAR message, and from then on the
+ * controller sends `PLAN {floor} {floor} ...` with every upcoming stop in
+ * order instead of one FLOOR at a time. Each PLAN replaces the previous one.
+ * Once the doors have cycled at the first stop the car moves on to the next
+ * stop by itself, so it doesn't have to wait for the controller to see the
+ * STATUS and answer with a FLOOR. The controller follows along from the same
+ * STATUS messages it always gets.
+ *
+ * See plan.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Most stops in a single PLAN message. The controller sends the rest once the
+ * car has worked through some of them. */
+#define PLAN_MAX_STOPS 64
+
+/*
+ * The stops a car has been asked to make, in order
+ */
+typedef struct car_plan
+{
+    char stops[PLAN_MAX_STOPS][4]; // Upcoming stops, the first one is next
+    size_t num_stops;              // Number of stops in the plan
+    char target[4]; // Stop the car was last sent to, "" if none
+} car_plan_t;
+
+// Empties a plan
+void plan_init(car_plan_t *);
+// Replaces the plan with the floors left in a PLAN message being tokenised
+// with strtok_r(), returns the stop the car should be sent to or NULL
+const char *plan_replace(car_plan_t *, char **);
+// Called once the doors have opened on a floor, returns the next stop the
+// car should be sent to when they have closed again or NULL
+const char *plan_arrived(car_plan_t *, const char *);
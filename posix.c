@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,6 +11,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 /*
@@ -17,38 +20,445 @@
  * that is acquiring mutexes, connecting to and creating shared memory objects.
  */
 
+#include "global.h"
+#include "history.h"
 #include "posix.h"
 
+_Static_assert(sizeof(car_shared_mem) <= SHM_EXT_OFFSET,
+               "car_shared_mem overlaps the extension region");
+
 /*
- * Pre processor macro to reduce repatition when acquiring the mutex and
- * broadcasting on the condition variable
+ * Pre processor macro to reduce repatition when updating a single field in a
+ * transaction of its own
  */
-#define WITH_LOCK_AND_BROADCAST(state, code)                                   \
+#define WITH_UPDATE(state, site, u, code)                                      \
     do                                                                         \
     {                                                                          \
-        pthread_mutex_lock(&(state)->mutex);                                   \
+        shm_update_t u;                                                        \
+        shm_begin(&u, state, site);                                            \
         code;                                                                  \
-        pthread_cond_broadcast(&(state)->cond);                                \
-        pthread_mutex_unlock(&(state)->mutex);                                 \
+        shm_commit(&u);                                                        \
     } while (0)
 
+/*
+ * Table of the segments mapped by this process that have an extension region.
+ * It is consulted on every state change so lookups don't take a lock; a slot
+ * is claimed by swapping a state pointer into it and released by storing NULL.
+ */
+#define MAX_MAPPED_CARS 1024
+
+typedef struct
+{
+    _Atomic(car_shared_mem *) state; // Start of the mapping, NULL if unused
+    size_t size;                     // Length of the mapping
+} shm_mapping_t;
+
+static shm_mapping_t mappings[MAX_MAPPED_CARS];
+static atomic_size_t mappings_used;
+
+/*
+ * Adds a mapping to the table. If the table is full the mapping is still
+ * usable, it just behaves as if it had no extension region.
+ */
+static void register_mapping(car_shared_mem *state, size_t size)
+{
+    for (size_t i = 0; i < MAX_MAPPED_CARS; i++)
+    {
+        car_shared_mem *expected = NULL;
+        if (atomic_compare_exchange_strong(&mappings[i].state, &expected,
+                                           state))
+        {
+            /* The size is only read back by unmap_car(), so it is fine to
+             * fill it in after the slot has been claimed. */
+            mappings[i].size = size;
+
+            /* Grow the part of the table that lookups scan. */
+            size_t used = atomic_load(&mappings_used);
+            while (used < i + 1 &&
+                   !atomic_compare_exchange_weak(&mappings_used, &used, i + 1))
+            {
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Finds the table entry for a mapping, returns NULL if it isn't registered.
+ */
+static shm_mapping_t *find_mapping(const car_shared_mem *state)
+{
+    size_t used = atomic_load_explicit(&mappings_used, memory_order_acquire);
+    for (size_t i = 0; i < used; i++)
+    {
+        if (atomic_load_explicit(&mappings[i].state, memory_order_acquire) ==
+            state)
+        {
+            return &mappings[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the extension region of a car's shared memory object, or NULL if
+ * the segment doesn't have one.
+ */
+car_shm_ext *get_shm_ext(const car_shared_mem *state)
+{
+    if (find_mapping(state) == NULL)
+    {
+        return NULL;
+    }
+    return (car_shm_ext *)((uintptr_t)state + SHM_EXT_OFFSET);
+}
+
+#ifdef LOCK_STATS
+/*
+ * The lock site and acquisition time of the car mutex held by this thread.
+ * A thread never holds more than one car's mutex at a time.
+ */
+static _Thread_local lock_site_t held_site;
+static _Thread_local uint64_t held_since_ns;
+
+/*
+ * Locks the car's mutex, giving up at the deadline if there is one, and
+ * records how long the caller waited for it.
+ */
+static int lock_until(car_shared_mem *state, lock_site_t site,
+                      const struct timespec *deadline)
+{
+    uint64_t start = monotonic_ns();
+    int result = pthread_mutex_trylock(&state->mutex);
+    uint64_t wait_ns = 0;
+    if (result == EBUSY)
+    {
+        result = deadline != NULL
+                     ? pthread_mutex_timedlock(&state->mutex, deadline)
+                     : pthread_mutex_lock(&state->mutex);
+        wait_ns = monotonic_ns() - start;
+    }
+    if (result != 0)
+    {
+        return result;
+    }
+
+    held_site = site;
+    held_since_ns = start + wait_ns;
+    car_shm_ext *ext = get_shm_ext(state);
+    if (ext != NULL)
+    {
+        lock_stats_record_wait(&ext->lock_stats, site, wait_ns);
+    }
+    return 0;
+}
+
+/*
+ * Locks the car's mutex, recording how long the caller waited for it.
+ */
+int shm_lock(car_shared_mem *state, lock_site_t site)
+{
+    return lock_until(state, site, NULL);
+}
+
+/*
+ * Same as shm_lock() but gives up with ETIMEDOUT at an absolute deadline.
+ */
+int shm_timedlock(car_shared_mem *state, lock_site_t site,
+                  const struct timespec *deadline)
+{
+    return lock_until(state, site, deadline);
+}
+
+/*
+ * Records how long the mutex was held for at the current site.
+ */
+static void record_hold(car_shared_mem *state)
+{
+    car_shm_ext *ext = get_shm_ext(state);
+    if (ext != NULL)
+    {
+        lock_stats_record_hold(&ext->lock_stats, held_site,
+                               monotonic_ns() - held_since_ns);
+    }
+}
+
+/*
+ * Unlocks the car's mutex, recording how long it was held for.
+ */
+int shm_unlock(car_shared_mem *state)
+{
+    record_hold(state);
+    return pthread_mutex_unlock(&state->mutex);
+}
+
+/*
+ * Waits on the car's condition variable. The time spent waiting doesn't count
+ * as holding the mutex, so the hold is closed before waiting and a new one is
+ * started once the mutex is reacquired.
+ */
+int shm_cond_wait(car_shared_mem *state)
+{
+    record_hold(state);
+    int result = pthread_cond_wait(&state->cond, &state->mutex);
+    held_since_ns = monotonic_ns();
+    return result;
+}
+
+/*
+ * Same as shm_cond_wait() but with an absolute timeout.
+ */
+int shm_cond_timedwait(car_shared_mem *state, const struct timespec *ts)
+{
+    record_hold(state);
+    int result = pthread_cond_timedwait(&state->cond, &state->mutex, ts);
+    held_since_ns = monotonic_ns();
+    return result;
+}
+#endif
+
+/*
+ * Publishes a committed update: bumps the extension region's sequence numbers,
+ * records the new state in the history ring, if the car has one, and
+ * broadcasts on the condition variable. Called with the mutex held.
+ */
+static void publish_change(car_shared_mem *state, uint32_t dirty)
+{
+    car_shm_ext *ext = get_shm_ext(state);
+    if (ext != NULL)
+    {
+        uint64_t now = monotonic_ns();
+        ext->commit_seq += 1;
+        for (int i = 0; i < SHM_FIELD_COUNT; i++)
+        {
+            if (dirty & (1u << i))
+            {
+                ext->field_seq[i] = ext->commit_seq;
+                ext->field_ns[i] = now;
+            }
+        }
+
+        history_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.timestamp_ns = now;
+        record.dirty = dirty;
+        strncpy(record.current_floor, state->current_floor,
+                sizeof(record.current_floor) - 1);
+        strncpy(record.destination_floor, state->destination_floor,
+                sizeof(record.destination_floor) - 1);
+        strncpy(record.status, state->status, sizeof(record.status) - 1);
+        record.open_button = state->open_button;
+        record.close_button = state->close_button;
+        record.door_obstruction = state->door_obstruction;
+        record.overload = state->overload;
+        record.emergency_stop = state->emergency_stop;
+        record.individual_service_mode = state->individual_service_mode;
+        record.emergency_mode = state->emergency_mode;
+        history_publish(&ext->history, &record);
+#ifdef LOCK_STATS
+        lock_stats_record_broadcast(&ext->lock_stats, held_site);
+#endif
+    }
+    pthread_cond_broadcast(&state->cond);
+}
+
+/*
+ * Acquires the mutex and starts a transaction on the car's shared memory.
+ */
+void shm_begin(shm_update_t *u, car_shared_mem *state, lock_site_t site)
+{
+    shm_lock(state, site);
+    shm_update_init(u, state);
+}
+
+/*
+ * Publishes the transaction and releases the mutex. Returns the fields that
+ * changed.
+ */
+uint32_t shm_commit(shm_update_t *u)
+{
+    uint32_t dirty = shm_publish(u);
+    shm_unlock(u->state);
+    return dirty;
+}
+
+/*
+ * Starts a transaction on a car whose mutex the caller already holds, for
+ * example right after waking from shm_cond_wait().
+ */
+void shm_update_init(shm_update_t *u, car_shared_mem *state)
+{
+    u->state = state;
+    u->dirty = 0;
+}
+
+/*
+ * Broadcasts once if any field changed since the transaction started, or since
+ * the last publish, and leaves the mutex held. Returns the fields that
+ * changed.
+ */
+uint32_t shm_publish(shm_update_t *u)
+{
+    uint32_t dirty = u->dirty;
+    if (dirty != 0)
+    {
+        publish_change(u->state, dirty);
+        u->dirty = 0;
+    }
+    return dirty;
+}
+
+/*
+ * Marks fields the caller changed in place as dirty.
+ */
+void shm_mark_dirty(shm_update_t *u, uint32_t fields)
+{
+    u->dirty |= fields;
+}
+
+/*
+ * Copies a string into a field, returning whether its value changed.
+ */
+static bool update_string(char *field, size_t size, const char *value)
+{
+    if (strncmp(field, value, size) == 0)
+    {
+        return false;
+    }
+    strncpy(field, value, size - 1);
+    field[size - 1] = '\0';
+    return true;
+}
+
+/*
+ * Stores a flag, returning whether its value changed.
+ */
+static bool update_flag(uint8_t *field, uint8_t value)
+{
+    if (*field == value)
+    {
+        return false;
+    }
+    *field = value;
+    return true;
+}
+
+/*
+ * Field setters for transactions. Each only marks its field dirty if the
+ * value actually changed.
+ */
+void shm_update_current_floor(shm_update_t *u, const char *floor)
+{
+    if (update_string(u->state->current_floor,
+                      sizeof(u->state->current_floor), floor))
+    {
+        u->dirty |= SHM_FIELD_CURRENT_FLOOR;
+    }
+}
+
+void shm_update_destination_floor(shm_update_t *u, const char *floor)
+{
+    if (update_string(u->state->destination_floor,
+                      sizeof(u->state->destination_floor), floor))
+    {
+        u->dirty |= SHM_FIELD_DESTINATION_FLOOR;
+    }
+}
+
+void shm_update_status(shm_update_t *u, const char *status)
+{
+    if (update_string(u->state->status, sizeof(u->state->status), status))
+    {
+        u->dirty |= SHM_FIELD_STATUS;
+    }
+}
+
+void shm_update_open_button(shm_update_t *u, uint8_t value)
+{
+    if (update_flag(&u->state->open_button, value))
+    {
+        u->dirty |= SHM_FIELD_OPEN_BUTTON;
+    }
+}
+
+void shm_update_close_button(shm_update_t *u, uint8_t value)
+{
+    if (update_flag(&u->state->close_button, value))
+    {
+        u->dirty |= SHM_FIELD_CLOSE_BUTTON;
+    }
+}
+
+void shm_update_emergency_stop(shm_update_t *u, uint8_t value)
+{
+    if (update_flag(&u->state->emergency_stop, value))
+    {
+        u->dirty |= SHM_FIELD_EMERGENCY_STOP;
+    }
+}
+
+void shm_update_service_mode(shm_update_t *u, uint8_t value)
+{
+    if (update_flag(&u->state->individual_service_mode, value))
+    {
+        u->dirty |= SHM_FIELD_SERVICE_MODE;
+    }
+}
+
+void shm_update_emergency_mode(shm_update_t *u, uint8_t value)
+{
+    if (update_flag(&u->state->emergency_mode, value))
+    {
+        u->dirty |= SHM_FIELD_EMERGENCY_MODE;
+    }
+}
+
+/*
+ * Returns the fields changed by updates published since *seen, and advances
+ * *seen. Must be called with the mutex held. Programs that write the shared
+ * memory directly (the testers do) don't go through shm_publish(), so if no
+ * update was published at all, or the car has no extension region, every
+ * field is reported as possibly changed.
+ */
+uint32_t shm_dirty_since(const car_shared_mem *state, uint32_t *seen)
+{
+    const car_shm_ext *ext = get_shm_ext((car_shared_mem *)(uintptr_t)state);
+    if (ext == NULL || ext->commit_seq == *seen)
+    {
+        return SHM_FIELD_ALL;
+    }
+
+    uint32_t dirty = 0;
+    for (int i = 0; i < SHM_FIELD_COUNT; i++)
+    {
+        /* Sequence numbers wrap, so compare the distance from *seen. */
+        if ((int32_t)(ext->field_seq[i] - *seen) > 0)
+        {
+            dirty |= 1u << i;
+        }
+    }
+    *seen = ext->commit_seq;
+    return dirty;
+}
+
 /*
  * Sets the shared memory objects fields to default values.
  */
 void reset_shm(car_shared_mem *s)
 {
-    pthread_mutex_lock(&s->mutex);
+    shm_lock(s, LOCK_SITE_RESET_SHM);
     size_t offset = offsetof(car_shared_mem, current_floor);
     memset((char *)s + offset, 0, sizeof(*s) - offset);
 
     strcpy(s->status, "Closed");
     strcpy(s->current_floor, "1");
     strcpy(s->destination_floor, "1");
-    pthread_mutex_unlock(&s->mutex);
+    shm_unlock(s);
 }
 
 /*
- * Opens the shared memory object and maps its contents to the state pointer
+ * Opens the shared memory object and maps its contents to the state pointer.
+ * If the segment was created by the car its extension region is mapped too.
  */
 bool connect_to_car(car_shared_mem **state, const char *shm_name, int *fd)
 {
@@ -60,17 +470,90 @@ bool connect_to_car(car_shared_mem **state, const char *shm_name, int *fd)
         return false;
     }
 
+    /* Only map the extension region if the segment is big enough to have
+     * one. */
+    struct stat st;
+    size_t size = sizeof(**state);
+    if (fstat(*fd, &st) == 0 && (size_t)st.st_size >= SHM_SEGMENT_SIZE)
+    {
+        size = SHM_SEGMENT_SIZE;
+    }
+
     /* Map the shared memory object to `state` */
-    *state =
-        mmap(0, sizeof(**state), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
-    if (*state == NULL)
+    *state = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (*state == MAP_FAILED)
     {
+        *state = NULL;
         return false;
     }
 
+    /* Register the extension region once the car has initialised it. */
+    const car_shm_ext *ext =
+        (const car_shm_ext *)((uintptr_t)*state + SHM_EXT_OFFSET);
+    if (size == SHM_SEGMENT_SIZE && ext->magic == SHM_EXT_MAGIC &&
+        ext->version == SHM_EXT_VERSION)
+    {
+        register_mapping(*state, size);
+    }
+
     return true;
 }
 
+/*
+ * Unmaps a car's shared memory object, including the extension region if it
+ * was mapped.
+ */
+void unmap_car(car_shared_mem *state)
+{
+    size_t size = sizeof(*state);
+    shm_mapping_t *mapping = find_mapping(state);
+    if (mapping != NULL)
+    {
+        size = mapping->size;
+        atomic_store(&mapping->state, NULL);
+    }
+    munmap(state, size);
+}
+
+/*
+ * Sets the deadline to ms milliseconds from now on the given clock.
+ */
+static void deadline_after(clockid_t clock, uint32_t ms,
+                           struct timespec *deadline)
+{
+    clock_gettime(clock, deadline);
+    deadline->tv_sec += (time_t)(ms / 1000);
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * Builds the deadline for a timed wait on a car's condition variable. Segments
+ * created by the car wait on CLOCK_MONOTONIC so a wall clock change can't
+ * stretch or cut short a delay. Segments created by anything else use the
+ * default CLOCK_REALTIME.
+ */
+void shm_deadline(const car_shared_mem *state, uint32_t ms,
+                  struct timespec *deadline)
+{
+    const car_shm_ext *ext = get_shm_ext(state);
+    deadline_after(ext != NULL ? (clockid_t)ext->cond_clock : CLOCK_REALTIME,
+                   ms, deadline);
+}
+
+/*
+ * Builds the deadline for shm_timedlock(). Mutexes always time out against
+ * CLOCK_REALTIME.
+ */
+void shm_lock_deadline(uint32_t ms, struct timespec *deadline)
+{
+    deadline_after(CLOCK_REALTIME, ms, deadline);
+}
+
 /*
  * Initialize the mutex and condition variables and sets the remaining fields to
  * defult values.
@@ -84,15 +567,33 @@ void init_shm(car_shared_mem *s)
     pthread_mutex_init(&s->mutex, &mutattr);
     pthread_mutexattr_destroy(&mutattr);
 
-    /* Initialise condition variable */
+    /* Initialise condition variable. Timed waits use the monotonic clock when
+     * the segment has an extension region to record that in. */
+    car_shm_ext *ext = get_shm_ext(s);
     pthread_condattr_t condattr;
     pthread_condattr_init(&condattr);
     pthread_condattr_setpshared(&condattr, PTHREAD_PROCESS_SHARED);
+    if (ext != NULL)
+    {
+        pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    }
     pthread_cond_init(&s->cond, &condattr);
     pthread_condattr_destroy(&condattr);
 
     /* Set the rest of the fields to defult values */
     reset_shm(s);
+
+    /* Initialise the extension region if the segment has one. The magic number
+     * is written last so nobody connects to a half initialised region. */
+    if (ext != NULL)
+    {
+        memset(ext, 0, sizeof(*ext));
+        ext->version = SHM_EXT_VERSION;
+        ext->cond_clock = CLOCK_MONOTONIC;
+        history_init(&ext->history);
+        atomic_thread_fence(memory_order_release);
+        ext->magic = SHM_EXT_MAGIC;
+    }
 }
 
 /*
@@ -114,8 +615,9 @@ bool create_shared_mem(car_shared_mem **shm, int *fd, const char *name)
         return false;
     }
 
-    /* Set the capacity of the shared memory object via ftruncate. */
-    if (ftruncate(*fd, sizeof(car_shared_mem)))
+    /* Set the capacity of the shared memory object via ftruncate, leaving
+     * room for the extension region. */
+    if (ftruncate(*fd, SHM_SEGMENT_SIZE))
     {
         *shm = NULL;
         return false;
@@ -123,12 +625,13 @@ bool create_shared_mem(car_shared_mem **shm, int *fd, const char *name)
 
     /* Otherwise, attempt to map the shared memory via mmap, and save the
      * adress in *shm. If mapping fails, return false. */
-    *shm = mmap(NULL, sizeof(car_shared_mem), PROT_READ | PROT_WRITE,
-                MAP_SHARED, *fd, 0);
+    *shm = mmap(NULL, SHM_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                *fd, 0);
     if (*shm == MAP_FAILED)
     {
         return false;
     }
+    register_mapping(*shm, SHM_SEGMENT_SIZE);
 
     return true;
 }
@@ -138,7 +641,8 @@ bool create_shared_mem(car_shared_mem **shm, int *fd, const char *name)
  */
 void set_status(car_shared_mem *state, const char *status)
 {
-    WITH_LOCK_AND_BROADCAST(state, strcpy(state->status, status));
+    WITH_UPDATE(state, LOCK_SITE_SET_STATUS, u,
+                shm_update_status(&u, status));
 }
 
 /*
@@ -147,7 +651,8 @@ void set_status(car_shared_mem *state, const char *status)
  */
 void set_destination_floor(car_shared_mem *state, const char *floor)
 {
-    WITH_LOCK_AND_BROADCAST(state, strcpy(state->destination_floor, floor));
+    WITH_UPDATE(state, LOCK_SITE_SET_DESTINATION_FLOOR, u,
+                shm_update_destination_floor(&u, floor));
 }
 
 /*
@@ -155,7 +660,8 @@ void set_destination_floor(car_shared_mem *state, const char *floor)
  */
 void set_open_button(car_shared_mem *state, uint8_t value)
 {
-    WITH_LOCK_AND_BROADCAST(state, state->open_button = value);
+    WITH_UPDATE(state, LOCK_SITE_SET_OPEN_BUTTON, u,
+                shm_update_open_button(&u, value));
 }
 
 /*
@@ -164,7 +670,8 @@ void set_open_button(car_shared_mem *state, uint8_t value)
  */
 void set_close_button(car_shared_mem *state, uint8_t value)
 {
-    WITH_LOCK_AND_BROADCAST(state, state->close_button = value);
+    WITH_UPDATE(state, LOCK_SITE_SET_CLOSE_BUTTON, u,
+                shm_update_close_button(&u, value));
 }
 
 /*
@@ -172,7 +679,8 @@ void set_close_button(car_shared_mem *state, uint8_t value)
  */
 void set_emergency_stop(car_shared_mem *state, uint8_t value)
 {
-    WITH_LOCK_AND_BROADCAST(state, state->emergency_stop = value);
+    WITH_UPDATE(state, LOCK_SITE_SET_EMERGENCY_STOP, u,
+                shm_update_emergency_stop(&u, value));
 }
 
 /*
@@ -182,14 +690,14 @@ void set_emergency_stop(car_shared_mem *state, uint8_t value)
  */
 void set_service_mode(car_shared_mem *state, uint8_t value)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_update_t u;
+    shm_begin(&u, state, LOCK_SITE_SET_SERVICE_MODE);
     if (value == 1)
     {
-        state->emergency_mode = 0;
+        shm_update_emergency_mode(&u, 0);
     }
-    state->individual_service_mode = value;
-    pthread_cond_broadcast(&state->cond);
-    pthread_mutex_unlock(&state->mutex);
+    shm_update_service_mode(&u, value);
+    shm_commit(&u);
 }
 
 /*
@@ -198,9 +706,9 @@ void set_service_mode(car_shared_mem *state, uint8_t value)
  */
 bool open_button_is(car_shared_mem *state, uint8_t value)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_OPEN_BUTTON_IS);
     bool result = state->open_button == value;
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
     return result;
 }
 
@@ -210,9 +718,9 @@ bool open_button_is(car_shared_mem *state, uint8_t value)
  */
 bool close_button_is(car_shared_mem *state, uint8_t value)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_CLOSE_BUTTON_IS);
     bool result = state->close_button == value;
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
     return result;
 }
 
@@ -222,9 +730,9 @@ bool close_button_is(car_shared_mem *state, uint8_t value)
  */
 bool status_is(car_shared_mem *state, const char *status)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_STATUS_IS);
     bool result = strcmp(state->status, status) == 0;
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
     return result;
 }
 
@@ -234,9 +742,9 @@ bool status_is(car_shared_mem *state, const char *status)
  */
 bool service_mode_is(car_shared_mem *state, uint8_t value)
 {
-    pthread_mutex_lock(&state->mutex);
+    shm_lock(state, LOCK_SITE_SERVICE_MODE_IS);
     bool result = state->individual_service_mode == value;
-    pthread_mutex_unlock(&state->mutex);
+    shm_unlock(state);
     return result;
 }
 
@@ -247,7 +755,7 @@ bool service_mode_is(car_shared_mem *state, uint8_t value)
  */
 char *get_shm_name(const char *car_name)
 {
-    char *shm_name = malloc(sizeof(car_name) + 5);
+    char *shm_name = malloc(strlen(car_name) + 5);
     sprintf(shm_name, "/car%s", car_name);
     return shm_name;
 }
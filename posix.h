@@ -5,6 +5,11 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "history.h"
+#include "lockstat.h"
+#include "reconnect.h"
+#include "safetystat.h"
+
 typedef struct
 {
     pthread_mutex_t mutex;     // Locked while accessing struct contents
@@ -21,11 +26,114 @@ typedef struct
     uint8_t emergency_mode;          // 1 if in emergency mode, else 0
 } car_shared_mem;
 
+/*
+ * Segments created by the car are larger than car_shared_mem. The extra space
+ * holds an extension region at SHM_EXT_OFFSET which is never touched by tools
+ * that only know about car_shared_mem. Segments created by anything else (e.g.
+ * the testers) are left as they are and simply have no extension region.
+ */
+#define SHM_EXT_OFFSET 128
+#define SHM_EXT_MAGIC 0x43415258 // "CARX"
+#define SHM_EXT_VERSION 10
+
+/*
+ * Bits naming the fields of car_shared_mem, used for the dirty-field masks
+ * produced by shm_publish().
+ */
+#define SHM_FIELD_CURRENT_FLOOR (1u << 0)
+#define SHM_FIELD_DESTINATION_FLOOR (1u << 1)
+#define SHM_FIELD_STATUS (1u << 2)
+#define SHM_FIELD_OPEN_BUTTON (1u << 3)
+#define SHM_FIELD_CLOSE_BUTTON (1u << 4)
+#define SHM_FIELD_DOOR_OBSTRUCTION (1u << 5)
+#define SHM_FIELD_OVERLOAD (1u << 6)
+#define SHM_FIELD_EMERGENCY_STOP (1u << 7)
+#define SHM_FIELD_SERVICE_MODE (1u << 8)
+#define SHM_FIELD_EMERGENCY_MODE (1u << 9)
+#define SHM_FIELD_COUNT 10
+#define SHM_FIELD_ALL ((1u << SHM_FIELD_COUNT) - 1)
+
+typedef struct
+{
+    uint32_t magic;          // SHM_EXT_MAGIC once the region is initialised
+    uint32_t version;        // SHM_EXT_VERSION
+    history_ring_t history;  // State transitions published by the car
+    lock_stats_t lock_stats; // Mutex contention, see lockstat.h
+    uint32_t commit_seq;     // Number of published updates, mutex protected
+    uint32_t field_seq[SHM_FIELD_COUNT]; // commit_seq of each field's last
+                                         // change, mutex protected
+    int32_t cond_clock; // Clock the condition variable's timed waits use
+    reconnect_stats_t reconnect; // Controller connection statistics
+    uint64_t field_ns[SHM_FIELD_COUNT]; // CLOCK_MONOTONIC time of each
+                                        // field's last change, mutex protected
+    safety_stats_t safety; // Safety reaction latencies, see safetystat.h
+} car_shm_ext;
+
+/* Total size of a segment created by the car */
+#define SHM_SEGMENT_SIZE (SHM_EXT_OFFSET + sizeof(car_shm_ext))
+
 void init_shm(car_shared_mem *);
 void reset_shm(car_shared_mem *);
 
 bool create_shared_mem(car_shared_mem **, int *, const char *);
 bool connect_to_car(car_shared_mem **, const char *, int *);
+void unmap_car(car_shared_mem *);
+car_shm_ext *get_shm_ext(const car_shared_mem *);
+// Builds an absolute deadline ms milliseconds from now for
+// shm_cond_timedwait() on the car's condition variable
+void shm_deadline(const car_shared_mem *, uint32_t, struct timespec *);
+// Builds an absolute deadline ms milliseconds from now for shm_timedlock()
+void shm_lock_deadline(uint32_t, struct timespec *);
+
+/*
+ * Every lock of a car's mutex goes through these so that builds with
+ * LOCK_STATS defined can record how long each site waits for and holds the
+ * mutex. Without LOCK_STATS they are plain pthread calls.
+ */
+#ifdef LOCK_STATS
+int shm_lock(car_shared_mem *, lock_site_t);
+int shm_timedlock(car_shared_mem *, lock_site_t, const struct timespec *);
+int shm_unlock(car_shared_mem *);
+int shm_cond_wait(car_shared_mem *);
+int shm_cond_timedwait(car_shared_mem *, const struct timespec *);
+#else
+#define shm_lock(state, site)                                                  \
+    ((void)(site), pthread_mutex_lock(&(state)->mutex))
+#define shm_timedlock(state, site, deadline)                                   \
+    ((void)(site), pthread_mutex_timedlock(&(state)->mutex, (deadline)))
+#define shm_unlock(state) pthread_mutex_unlock(&(state)->mutex)
+#define shm_cond_wait(state) pthread_cond_wait(&(state)->cond, &(state)->mutex)
+#define shm_cond_timedwait(state, ts)                                          \
+    pthread_cond_timedwait(&(state)->cond, &(state)->mutex, (ts))
+#endif
+
+/*
+ * A batch of field writes made under a single lock of the car's mutex and
+ * published with a single broadcast. Fields are only marked dirty when their
+ * value actually changes, and nothing is broadcast if no field changed.
+ */
+typedef struct
+{
+    car_shared_mem *state; // The car being updated, locked for the duration
+    uint32_t dirty;        // SHM_FIELD_* bits changed so far
+} shm_update_t;
+
+void shm_begin(shm_update_t *, car_shared_mem *, lock_site_t);
+uint32_t shm_commit(shm_update_t *);
+void shm_update_init(shm_update_t *, car_shared_mem *);
+uint32_t shm_publish(shm_update_t *);
+void shm_mark_dirty(shm_update_t *, uint32_t);
+
+void shm_update_current_floor(shm_update_t *, const char *);
+void shm_update_destination_floor(shm_update_t *, const char *);
+void shm_update_status(shm_update_t *, const char *);
+void shm_update_open_button(shm_update_t *, uint8_t);
+void shm_update_close_button(shm_update_t *, uint8_t);
+void shm_update_emergency_stop(shm_update_t *, uint8_t);
+void shm_update_service_mode(shm_update_t *, uint8_t);
+void shm_update_emergency_mode(shm_update_t *, uint8_t);
+
+uint32_t shm_dirty_since(const car_shared_mem *, uint32_t *);
 
 void set_status(car_shared_mem *, const char *);
 void set_destination_floor(car_shared_mem *, const char *);
@@ -27,7 +27,11 @@
 /*
  * Initializes the queue by setting the head to NULL.
  */
-void queue_init(queue_t *queue) { queue->head = NULL; }
+void queue_init(queue_t *queue)
+{
+    queue->head = NULL;
+    queue->last_displayed = NULL;
+}
 
 /*
  * Deinitializes the queue by freeing all nodes, then setting head to NULL.
@@ -43,6 +47,7 @@ void queue_deinit(queue_t *queue)
         current = next;
     }
     queue->head = NULL;
+    queue->last_displayed = NULL;
 }
 
 /*
@@ -56,6 +61,7 @@ void node_init(node_t **node, const char *floor, floor_direction_t direction,
 
     (*node)->data.floor =
         strdup(floor); // Duplicate the floor string for the node
+    (*node)->data.floor_number = floor_to_int(floor);
     (*node)->data.direction = direction; // Set the direction
     (*node)->data.been_displayed =
         false;            // Initially, the node has not been displayed
@@ -88,8 +94,7 @@ void enqueue(queue_t *queue, const char *floor, floor_direction_t direction)
     node_t *prev = NULL;
     node_t *new_node = NULL;
     node_init(&new_node, floor, direction, NULL); // Initialize the new node
-    int floor_number =
-        floor_to_int(floor); // Convert floor to an integer for comparison
+    int floor_number = new_node->data.floor_number;
 
     /* Edge case: If the queue is empty, add the new node as the head */
     if (queue_empty(queue))
@@ -101,7 +106,7 @@ void enqueue(queue_t *queue, const char *floor, floor_direction_t direction)
     /* Traverse the queue to find the correct insertion point */
     while (current != NULL)
     {
-        int current_floor_number = floor_to_int(current->data.floor);
+        int current_floor_number = current->data.floor_number;
 
         /* Check for a duplicate node in the same direction that hasn’t been
          * displayed yet */
@@ -178,6 +183,10 @@ void dequeue(queue_t *queue)
     if (queue->head == NULL)
         return;
     node_t *head = queue->head;
+    if (queue->last_displayed == head)
+    {
+        queue->last_displayed = NULL;
+    }
     queue->head = head->next; // Update head to the next node
     node_deinit(&head);       // Free the original head
 }
@@ -243,6 +252,7 @@ char *queue_get_undisplayed(queue_t *queue)
             return NULL;
         /* Mark the current node as been displayed */
         current->data.been_displayed = true;
+        queue->last_displayed = current;
         return current->data.floor;
     }
 }
@@ -253,13 +263,17 @@ char *queue_get_undisplayed(queue_t *queue)
 bool queue_empty(const queue_t *queue) { return queue->head == NULL; }
 
 /*
- * Returns the floor of the most recent displayed node, stopping at the first
- * match.
+ * Returns the floor of the most recent displayed node, which is where the car
+ * was last sent. Stops may have been inserted in front of it since, so it
+ * isn't necessarily the last of the displayed nodes at the head. Without a
+ * displayed node, falls back to the last of those.
  */
 char *queue_prev_floor(queue_t *queue)
 {
     if (queue_empty(queue))
         return NULL;
+    else if (queue->last_displayed != NULL)
+        return queue->last_displayed->data.floor;
     else
     {
         node_t *current = queue->head;
@@ -270,3 +284,26 @@ char *queue_prev_floor(queue_t *queue)
         return current->data.floor;
     }
 }
+
+/*
+ * Marks the first undisplayed node as displayed if it is for the given floor,
+ * along with any undisplayed nodes for the same floor straight after it. Used
+ * for cars that are sent their whole plan, where a node only counts as
+ * displayed once the car has stopped there. Returns true if a node was
+ * marked.
+ */
+bool queue_display_floor(queue_t *queue, const char *floor)
+{
+    bool marked = false;
+    for (node_t *current = queue->head; current != NULL;
+         current = current->next)
+    {
+        if (current->data.been_displayed)
+            continue;
+        if (strcmp(current->data.floor, floor) != 0)
+            break;
+        current->data.been_displayed = true;
+        marked = true;
+    }
+    return marked;
+}
@@ -37,6 +37,9 @@ typedef struct node_data
     bool been_displayed;
     /* Floor represented by a string. */
     char *floor;
+    /* floor_to_int() of the floor, so the queue can be sorted without
+     * parsing every floor it passes. */
+    int floor_number;
 } node_data_t;
 
 /*
@@ -56,6 +59,8 @@ typedef struct queue
 {
     /* Reference to the first node in the queue */
     node_t *head;
+    /* The node queue_get_undisplayed() returned last, NULL if none. */
+    node_t *last_displayed;
 } queue_t;
 
 /* Function prototypes for queue operations */
@@ -72,3 +77,4 @@ node_t *queue_peek_undisplayed(queue_t *);
 char *queue_prev_floor(queue_t *);
 char *queue_get_undisplayed(queue_t *);
 bool queue_empty(const queue_t *);
+bool queue_display_floor(queue_t *, const char *);
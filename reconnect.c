@@ -0,0 +1,119 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of the reconnect backoff. After each failed attempt the wait
+ * doubles, from the car's delay up to RECONNECT_MAX_MS. The actual wait is
+ * picked at random from the upper half of that range ("equal jitter"), so a
+ * fleet of cars that lost the controller together don't all come back in the
+ * same millisecond, but no car waits less than half the backoff. The first
+ * retry therefore still comes within one delay, as it always has.
+ */
+
+#include "global.h"
+#include "reconnect.h"
+
+/*
+ * Adds to a statistic.
+ */
+static void stat_add(_Atomic uint64_t *stat, uint64_t value)
+{
+    atomic_fetch_add_explicit(stat, value, memory_order_relaxed);
+}
+
+/*
+ * Sets a statistic.
+ */
+static void stat_set(_Atomic uint64_t *stat, uint64_t value)
+{
+    atomic_store_explicit(stat, value, memory_order_relaxed);
+}
+
+/*
+ * Starts timing the outage if it isn't already being timed.
+ */
+static void start_downtime(reconnect_t *r)
+{
+    if (r->down_since_ns == 0)
+    {
+        r->down_since_ns = monotonic_ns();
+    }
+}
+
+/*
+ * Initialises the backoff state. The statistics are zeroed by whoever created
+ * the memory they live in.
+ */
+void reconnect_init(reconnect_t *r, uint32_t base_ms, reconnect_stats_t *stats)
+{
+    memset(r, 0, sizeof(*r));
+    r->base_ms = base_ms > 0 ? base_ms : 1;
+    r->backoff_ms = r->base_ms;
+    r->seed = (unsigned int)(monotonic_ns() ^ (uint64_t)getpid());
+    r->stats = stats != NULL ? stats : &r->private;
+}
+
+/*
+ * Records a successful attempt, resets the backoff and stops timing the
+ * outage.
+ */
+void reconnect_connected(reconnect_t *r)
+{
+    stat_add(&r->stats->attempts, 1);
+    stat_add(&r->stats->connects, 1);
+
+    if (r->down_since_ns != 0)
+    {
+        uint64_t down = monotonic_ns() - r->down_since_ns;
+        stat_add(&r->stats->downtime_ns, down);
+        if (down > atomic_load_explicit(&r->stats->max_downtime_ns,
+                                        memory_order_relaxed))
+        {
+            stat_set(&r->stats->max_downtime_ns, down);
+        }
+        r->down_since_ns = 0;
+    }
+
+    r->backoff_ms = r->base_ms;
+    stat_set(&r->stats->backoff_ms, 0);
+}
+
+/*
+ * Records a failed attempt and works out the wait before the next one.
+ */
+uint32_t reconnect_failed(reconnect_t *r)
+{
+    stat_add(&r->stats->attempts, 1);
+    stat_add(&r->stats->failures, 1);
+    start_downtime(r);
+
+    uint32_t half = r->backoff_ms / 2;
+    uint32_t wait =
+        r->backoff_ms - half + (uint32_t)rand_r(&r->seed) % (half + 1);
+
+    uint32_t max_ms = RECONNECT_MAX_MS > r->base_ms ? RECONNECT_MAX_MS
+                                                    : r->base_ms;
+    r->backoff_ms = r->backoff_ms > max_ms / 2 ? max_ms : r->backoff_ms * 2;
+    stat_set(&r->stats->backoff_ms, r->backoff_ms);
+
+    return wait;
+}
+
+/*
+ * Records that a connection ended. An outage only starts if the car still
+ * wants to be connected; time spent in a mode that keeps the car off the
+ * controller isn't counted until the first failed attempt afterwards.
+ */
+void reconnect_lost(reconnect_t *r, bool outage)
+{
+    stat_add(&r->stats->disconnects, 1);
+    if (outage)
+    {
+        start_downtime(r);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/*
+ * This header file defines the backoff policy a car uses to reconnect to the
+ * controller, along with the connection statistics it publishes in its shared
+ * memory extension region for `monitor {car name} connection`.
+ *
+ * See reconnect.c for implementation details.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Longest wait between two connection attempts, unless the car's delay is
+ * longer still */
+#ifndef RECONNECT_MAX_MS
+#define RECONNECT_MAX_MS 2000
+#endif
+
+/*
+ * Connection statistics. Only the car writes them, but the monitor reads them
+ * without taking the car's mutex, so every field is a relaxed atomic.
+ */
+typedef struct
+{
+    _Atomic uint64_t attempts;        // Calls to connect_to_controller()
+    _Atomic uint64_t failures;        // Attempts that failed
+    _Atomic uint64_t connects;        // Attempts that succeeded
+    _Atomic uint64_t disconnects;     // Connections lost or dropped for a mode
+    _Atomic uint64_t backoff_ms;      // Current wait between failed attempts
+    _Atomic uint64_t downtime_ns;     // Total time spent wanting a connection
+    _Atomic uint64_t max_downtime_ns; // Longest single outage
+} reconnect_stats_t;
+
+/*
+ * Backoff state of a single car
+ */
+typedef struct
+{
+    uint32_t base_ms;          // First wait after a failure, the car's delay
+    uint32_t backoff_ms;       // Upper bound of the next wait
+    unsigned int seed;         // rand_r() state for the jitter
+    uint64_t down_since_ns;    // When reconnecting started, 0 if it hasn't
+    reconnect_stats_t *stats;  // Where statistics are published
+    reconnect_stats_t private; // Used when there is nowhere to publish them
+} reconnect_t;
+
+// Initialises the backoff state with the base wait and where to publish stats,
+// or NULL to keep them private
+void reconnect_init(reconnect_t *, uint32_t, reconnect_stats_t *);
+// Records a successful attempt and resets the backoff
+void reconnect_connected(reconnect_t *);
+// Records a failed attempt, returns how many milliseconds to wait before the
+// next one
+uint32_t reconnect_failed(reconnect_t *);
+// Records that an established connection ended, the flag says whether the car
+// still wants to be connected, i.e. whether an outage has started
+void reconnect_lost(reconnect_t *, bool);
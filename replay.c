@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Implementation of the replay tool. The trace is streamed rather than read
+ * up front, so a trace of any length replays in constant memory. Calls are
+ * submitted through libcall as they fall due; in between, the answers to
+ * earlier calls are dispatched while waiting for the next one, so at high
+ * speeds many calls are in flight at once just as they were when recorded.
+ */
+
+#include "global.h"
+#include "libcall.h"
+#include "replay.h"
+#include "trace.h"
+
+/*
+ * Prints how to use the tool.
+ */
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s --trace {file} [--speed {factor}]\n"
+            "       %s --trace {file} --fleet {delay}\n",
+            program, program);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *trace_file = NULL;
+    const char *speed = NULL;
+    const char *fleet_delay = NULL;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--trace") == 0)
+            trace_file = argv[i + 1];
+        else if (strcmp(argv[i], "--speed") == 0)
+            speed = argv[i + 1];
+        else if (strcmp(argv[i], "--fleet") == 0)
+            fleet_delay = argv[i + 1];
+        else
+            trace_file = NULL;
+    }
+    if (argc % 2 == 0 || trace_file == NULL ||
+        (speed != NULL && fleet_delay != NULL))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (fleet_delay != NULL)
+    {
+        char *end;
+        errno = 0;
+        unsigned long delay = strtoul(fleet_delay, &end, 10);
+        if (errno != 0 || *end != '\0' || end == fleet_delay ||
+            delay > UINT32_MAX)
+        {
+            fprintf(stderr, "Invalid delay: %s\n", fleet_delay);
+            return 1;
+        }
+        return replay_print_fleet(trace_file, (uint32_t)delay) ? 0 : 1;
+    }
+
+    double factor = REPLAY_DEFAULT_SPEED;
+    if (speed != NULL)
+    {
+        char *end;
+        factor = strtod(speed, &end);
+        if (*end != '\0' || end == speed || !(factor >= 1.0) ||
+            factor > REPLAY_MAX_SPEED)
+        {
+            fprintf(stderr, "The speed must be from 1 to %.0f.\n",
+                    REPLAY_MAX_SPEED);
+            return 1;
+        }
+    }
+
+    replay_t replay;
+    if (!replay_init(&replay, trace_file, factor))
+    {
+        replay_deinit(&replay);
+        return 1;
+    }
+    bool ok = replay_run(&replay);
+    replay_report(&replay);
+    replay_deinit(&replay);
+    return ok ? 0 : 1;
+}
+
+/*
+ * Opens the trace and connects to the controller on this machine.
+ */
+bool replay_init(replay_t *replay, const char *path, double speed)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->speed = speed;
+    replay->lib.fd = -1;
+
+    if (!trace_reader_open(&replay->reader, path))
+    {
+        return false;
+    }
+    call_transport_t transport = CALL_TRANSPORT_DEFAULT;
+    if (!libcall_init(&replay->lib, &transport))
+    {
+        printf("Unable to connect to elevator system.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Closes the connection, failing any call still unanswered, and the trace.
+ */
+void replay_deinit(replay_t *replay)
+{
+    libcall_deinit(&replay->lib);
+    trace_reader_close(&replay->reader);
+    free(replay->cars);
+    replay->cars = NULL;
+    replay->num_cars = 0;
+}
+
+/*
+ * Counts a call for the car that was sent. Returns false if out of memory.
+ */
+static bool count_car(replay_t *replay, const char *name)
+{
+    for (size_t i = 0; i < replay->num_cars; i++)
+    {
+        if (strcmp(replay->cars[i].name, name) == 0)
+        {
+            replay->cars[i].calls += 1;
+            return true;
+        }
+    }
+
+    replay_car_t *cars = realloc(replay->cars, (replay->num_cars + 1) *
+                                                   sizeof(*replay->cars));
+    if (cars == NULL)
+    {
+        return false;
+    }
+    replay->cars = cars;
+    snprintf(cars[replay->num_cars].name, sizeof(cars->name), "%s", name);
+    cars[replay->num_cars].calls = 1;
+    replay->num_cars += 1;
+    return true;
+}
+
+/*
+ * Tallies the controller's answer to a call.
+ */
+static void call_answered(const call_completion_t *completion, void *arg)
+{
+    replay_t *replay = arg;
+    switch (completion->result)
+    {
+    case CALL_RESULT_CAR:
+        count_car(replay, completion->car_name != NULL ? completion->car_name
+                                                       : "");
+        break;
+    case CALL_RESULT_UNAVAILABLE:
+        replay->unavailable += 1;
+        break;
+    case CALL_RESULT_FAILED:
+        replay->failed += 1;
+        return;
+    }
+    replay->total_latency_ns += completion->latency_ns;
+    if (completion->latency_ns > replay->max_latency_ns)
+    {
+        replay->max_latency_ns = completion->latency_ns;
+    }
+}
+
+/*
+ * Handles answers until a CLOCK_MONOTONIC time, or until there are no calls
+ * in flight if that comes first and drain is set. Returns false if the
+ * connection to the controller was lost.
+ */
+static bool wait_until(replay_t *replay, uint64_t deadline_ns, bool drain)
+{
+    for (;;)
+    {
+        if (replay->lib.failed)
+        {
+            return false;
+        }
+        uint64_t now = monotonic_ns();
+        if (now >= deadline_ns || (drain && libcall_pending(&replay->lib) == 0))
+        {
+            return true;
+        }
+        /* Rounded up, so the last millisecond isn't spent polling. */
+        int timeout_ms = (int)((deadline_ns - now + 999999) / 1000000);
+        if (libcall_wait(&replay->lib, timeout_ms) == -1)
+        {
+            return false;
+        }
+    }
+}
+
+/*
+ * Counts the calls left in the trace as failed, once the connection has been
+ * lost. Returns the status of the last trace_read().
+ */
+static int fail_rest(replay_t *replay)
+{
+    trace_event_t event;
+    int status;
+    while ((status = trace_read(&replay->reader, &event)) == 1)
+    {
+        if (event.type == TRACE_CALL)
+        {
+            replay->calls += 1;
+            replay->failed += 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * Streams the trace, making each call when it falls due. Stops making calls
+ * if the connection to the controller is lost.
+ */
+bool replay_run(replay_t *replay)
+{
+    replay->start_ns = monotonic_ns();
+
+    trace_event_t event;
+    int status;
+    bool lost = false;
+    while (!lost && (status = trace_read(&replay->reader, &event)) == 1)
+    {
+        if (event.type == TRACE_CAR_JOIN)
+        {
+            replay->joins += 1;
+            continue;
+        }
+        if (event.type == TRACE_CAR_LEAVE)
+        {
+            replay->leaves += 1;
+            continue;
+        }
+        if (event.type != TRACE_CALL)
+        {
+            continue;
+        }
+
+        uint64_t due_ns = replay->start_ns +
+                          (uint64_t)((double)event.time_us * 1000.0 /
+                                     replay->speed);
+        if (!wait_until(replay, due_ns, false))
+        {
+            lost = true;
+            replay->calls += 1;
+            replay->failed += 1;
+            break;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now >= due_ns && now - due_ns > replay->max_lag_ns)
+        {
+            replay->max_lag_ns = now - due_ns;
+        }
+        if (libcall_submit(&replay->lib, event.source_floor,
+                           event.destination_floor, call_answered,
+                           replay) == 0)
+        {
+            if (replay->lib.failed)
+            {
+                lost = true;
+                replay->calls += 1;
+                replay->failed += 1;
+            }
+            else
+            {
+                replay->skipped += 1;
+            }
+            continue;
+        }
+        replay->calls += 1;
+
+        /* Send it now rather than when the next call falls due. */
+        libcall_dispatch(&replay->lib);
+    }
+
+    if (lost)
+    {
+        status = fail_rest(replay);
+    }
+    else
+    {
+        lost = !wait_until(
+            replay, monotonic_ns() + (uint64_t)REPLAY_DRAIN_MS * 1000000, true);
+    }
+    if (lost)
+    {
+        fprintf(stderr, "Error: Lost the connection to the controller.\n");
+    }
+    if (status == -1)
+    {
+        fprintf(stderr, "Error: The trace is corrupt after %zu calls.\n",
+                replay->calls + replay->skipped);
+        return false;
+    }
+    return !lost;
+}
+
+/*
+ * Prints the number of calls each car was sent and how quickly the controller
+ * answered.
+ */
+void replay_report(const replay_t *replay)
+{
+    size_t answered = 0;
+    for (size_t i = 0; i < replay->num_cars; i++)
+    {
+        answered += replay->cars[i].calls;
+    }
+    answered += replay->unavailable;
+
+    printf("Replayed %zu calls at %gx in %.3f s, up to %.2fms behind\n",
+           replay->calls, replay->speed,
+           (double)(monotonic_ns() - replay->start_ns) / 1e9,
+           (double)replay->max_lag_ns / 1e6);
+    printf("Skipped: %zu, unavailable: %zu, failed: %zu, unanswered: %zu\n",
+           replay->skipped, replay->unavailable, replay->failed,
+           replay->calls - answered - replay->failed);
+    printf("Cars joined: %zu, left: %zu (not replayed)\n", replay->joins,
+           replay->leaves);
+    printf("Call answers: avg %.2fms, longest %.2fms\n",
+           answered > 0
+               ? (double)replay->total_latency_ns / (double)answered / 1e6
+               : 0.0,
+           (double)replay->max_latency_ns / 1e6);
+    for (size_t i = 0; i < replay->num_cars; i++)
+    {
+        printf("  %s: %zu\n", replay->cars[i].name, replay->cars[i].calls);
+    }
+}
+
+/*
+ * Prints a fleet line for every car that joined, once each, in the order they
+ * first joined so the controller routes calls to them the same way.
+ */
+bool replay_print_fleet(const char *path, uint32_t delay_ms)
+{
+    trace_reader_t reader;
+    if (!trace_reader_open(&reader, path))
+    {
+        return false;
+    }
+
+    replay_t seen;
+    memset(&seen, 0, sizeof(seen));
+    trace_event_t event;
+    int status;
+    while ((status = trace_read(&reader, &event)) == 1)
+    {
+        if (event.type != TRACE_CAR_JOIN)
+        {
+            continue;
+        }
+        size_t before = seen.num_cars;
+        bool known = false;
+        for (size_t i = 0; i < seen.num_cars && !known; i++)
+        {
+            known = strcmp(seen.cars[i].name, event.name) == 0;
+        }
+        if (!known && count_car(&seen, event.name) &&
+            seen.num_cars > before)
+        {
+            printf("%s %s %s %u\n", event.name, event.lowest_floor,
+                   event.highest_floor, delay_ms);
+        }
+    }
+
+    free(seen.cars);
+    trace_reader_close(&reader);
+    if (status == -1)
+    {
+        fprintf(stderr, "Error: The trace is corrupt.\n");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * This header file defines the replay tool, which feeds a trace recorded by
+ * `controller --trace` (see trace.h) back into a running controller:
+ *
+ *   replay --trace {file} [--speed {factor}]
+ *       Makes every recorded call at its recorded time, divided by the speed
+ *       factor (1 to 1000, default 1), and reports how the controller
+ *       answered.
+ *
+ *   replay --trace {file} --fleet {delay}
+ *       Prints the cars that joined during the recording as a fleet file
+ *       with the given delay, for `car --fleet` or `sim --fleet`.
+ *
+ * The cars themselves aren't replayed; start the fleet before replaying the
+ * calls. To simulate a trace instead, run `sim --trace {file}`.
+ *
+ * See replay.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libcall.h"
+#include "trace.h"
+
+/* Fastest and default replay speed */
+#define REPLAY_MAX_SPEED 1000.0
+#define REPLAY_DEFAULT_SPEED 1.0
+/* How long to wait for the last answers once every call has been made */
+#define REPLAY_DRAIN_MS 10000
+
+/*
+ * How many calls a car was sent
+ */
+typedef struct replay_car
+{
+    char name[TRACE_MAX_FIELD + 1];
+    size_t calls;
+} replay_car_t;
+
+/*
+ * A replay of a trace
+ */
+typedef struct replay
+{
+    trace_reader_t reader;
+    libcall_t lib;
+    double speed;
+    uint64_t start_ns;     // CLOCK_MONOTONIC time the replay started
+    uint64_t max_lag_ns;   // Furthest a call went out behind its time
+    size_t calls;          // Calls made
+    size_t skipped;        // Recorded calls libcall refuses, e.g. bad floors
+    size_t unavailable;    // Calls no car could take
+    size_t failed;         // Calls lost with the connection, sent or not
+    size_t joins;          // Cars that joined during the recording
+    size_t leaves;         // Cars that left during the recording
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+    replay_car_t *cars;    // Cars the controller answered with
+    size_t num_cars;
+} replay_t;
+
+// Opens the trace and connects to the controller, prints the problem and
+// returns false if either fails
+bool replay_init(replay_t *, const char *, double);
+// Closes the trace and the connection
+void replay_deinit(replay_t *);
+// Makes every call in the trace on time, then waits for the last answers.
+// Returns false if the trace is corrupt or the connection was lost, counting
+// the calls it couldn't make as failed.
+bool replay_run(replay_t *);
+// Prints how the controller answered
+void replay_report(const replay_t *);
+// Prints the cars that joined as a fleet file, returns false if the trace is
+// corrupt
+bool replay_print_fleet(const char *, uint32_t);
@@ -1,15 +1,21 @@
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /*
@@ -55,6 +61,8 @@
 #include "global.h"
 #include "posix.h"
 #include "safety.h"
+#include "stress.h"
+#include "validator.h"
 
 /* Flag to control the main loop, modified by signal handler */
 static volatile sig_atomic_t keep_running = 1;
@@ -72,6 +80,19 @@ static void signal_handler(int signum)
 
 int main(int argc, char *argv[])
 {
+    /* `safety --stress {car name} [faults]` runs the stress harness. */
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "--stress") == 0)
+    {
+        long faults = argc == 4 ? strtol(argv[3], NULL, 10)
+                                : STRESS_DEFAULT_FAULTS;
+        if (faults <= 0)
+        {
+            write(STDOUT_FILENO, "Invalid number of faults\n", 25);
+            return 1;
+        }
+        return stress_safety(argv[0], argv[2], (size_t)faults);
+    }
+
     /* Validate correct number of command line args. */
     if (argc != 2)
     {
@@ -96,6 +117,18 @@ int main(int argc, char *argv[])
      */
     signal(SIGPIPE, SIG_IGN);
 
+    if (strcmp(argv[1], "--all") == 0)
+    {
+        safety_supervisor_t supervisor;
+        if (!supervisor_init(&supervisor))
+        {
+            return 1;
+        }
+        int result = supervisor_run(&supervisor, &keep_running);
+        supervisor_deinit(&supervisor);
+        return result;
+    }
+
     /* Initialize the Safety structure */
     safety_t safety;
     safety_init(&safety, argv[1]);
@@ -114,79 +147,596 @@ int main(int argc, char *argv[])
      *flag. */
     struct timespec ts;
 
+    /* The mutex is held from one wait to the next, so a change made while
+     * the last one was being checked can't slip past before the next wait. */
+    if (shm_lock(safety.state, LOCK_SITE_SAFETY_CHECK) != 0)
+    {
+        return 1;
+    }
+
     /* Loop untill the SIGINT signal is sent */
     while (keep_running)
     {
         /* Set a 1-second timeout */
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec += 1;
+        shm_deadline(safety.state, 1000, &ts);
 
-        /* Acquire the mutex and wait on the condition variable periodically
-         * checking if the keep_running flag is set */
-        if (pthread_mutex_lock(&safety.state->mutex) != 0)
-        {
-            return 1;
-        }
-
-        int wait_result = pthread_cond_timedwait(&safety.state->cond,
-                                                 &safety.state->mutex, &ts);
+        /* Wait on the condition variable periodically checking if the
+         * keep_running flag is set */
+        int wait_result = shm_cond_timedwait(safety.state, &ts);
         if (wait_result != 0 && wait_result != ETIMEDOUT)
         {
-            /* If pthread_condwait was interupted then release the mutex and
+            /* If pthread_condwait was interupted then try again, otherwise
              * break out of the main loop */
             if (wait_result == EINTR)
             {
-                pthread_mutex_unlock(&safety.state->mutex);
                 continue;
             }
             perror("pthread_cond_timedwait");
-            pthread_mutex_unlock(&safety.state->mutex);
             break;
         }
 
-        /* Check for data consistancy errors */
-        if (!is_shm_data_valid(safety.state))
+        safety_check(&safety);
+    }
+    shm_unlock(safety.state);
+
+    safety_deinit(&safety);
+
+    return 0;
+}
+
+/*
+ * Writes a message to standard output, naming the car when it is one of many
+ * watched by the supervisor.
+ */
+static void report(const safety_t *safety, const char *msg)
+{
+    char buf[128];
+    int len = safety->supervised
+                  ? snprintf(buf, sizeof(buf), "Car %s: %s", safety->car_name,
+                             msg)
+                  : snprintf(buf, sizeof(buf), "%s", msg);
+    if (len < 0)
+    {
+        return;
+    }
+    if ((size_t)len >= sizeof(buf))
+    {
+        len = (int)sizeof(buf) - 1;
+        buf[len - 1] = '\n';
+    }
+    write(STDOUT_FILENO, buf, (size_t)len);
+}
+
+/* Fields whose last change marks the start of each fault */
+static const uint32_t fault_fields[SAFETY_FAULT_COUNT] = {
+    [SAFETY_FAULT_OBSTRUCTION] = SHM_FIELD_STATUS | SHM_FIELD_DOOR_OBSTRUCTION,
+    [SAFETY_FAULT_EMERGENCY_STOP] = SHM_FIELD_EMERGENCY_STOP,
+    [SAFETY_FAULT_OVERLOAD] = SHM_FIELD_OVERLOAD,
+    [SAFETY_FAULT_DATA] = SHM_FIELD_ALL,
+};
+
+/*
+ * Records how long each fault corrected by the last check took to react to,
+ * timed from the last change to the fields that make up the fault. A fault
+ * whose fields haven't changed since the previous check was made by a write
+ * that was never published, so its start isn't known. Called with the car's
+ * mutex held.
+ */
+static void record_reactions(safety_t *safety, uint32_t faults, uint64_t now)
+{
+    car_shm_ext *ext = get_shm_ext(safety->state);
+    if (ext == NULL)
+    {
+        return;
+    }
+
+    for (int fault = 0; fault < SAFETY_FAULT_COUNT; fault++)
+    {
+        if ((faults & (1u << fault)) == 0)
         {
-            write(STDOUT_FILENO, "Data consistency error!\n", 24);
-            safety.state->emergency_mode = 1;
-            pthread_cond_broadcast(&safety.state->cond);
+            continue;
         }
 
-        /* If there is a door obstruction, set the doors to 'Opening' */
-        if (strcmp(safety.state->status, "Closing") == 0 &&
-            safety.state->door_obstruction == 1)
+        uint64_t start = 0;
+        for (int i = 0; i < SHM_FIELD_COUNT; i++)
         {
-            strcpy(safety.state->status, "Opening");
-            pthread_cond_broadcast(&safety.state->cond);
+            if ((fault_fields[fault] & (1u << i)) && ext->field_ns[i] > start)
+            {
+                start = ext->field_ns[i];
+            }
         }
 
-        /* If the emergency stop button is pressed and a message hasn't been
-         * printed about it. Print the message and put the car into emergency
-         * mode. */
-        if (safety.state->emergency_stop == 1 && safety.emergency_msg_sent == 0)
+        if (start > safety->checked_ns && start <= now)
         {
-            write(STDOUT_FILENO,
-                  "The emergency stop button has been pressed!\n", 44);
-            safety.emergency_msg_sent = 1;
-            safety.state->emergency_mode = 1;
-            pthread_cond_broadcast(&safety.state->cond);
+            safety_stats_record(&ext->safety, (safety_fault_t)fault,
+                                now - start);
         }
+        else
+        {
+            safety_stats_untimed(&ext->safety, (safety_fault_t)fault);
+        }
+    }
+}
 
-        /* If the overload sensor has been tripped and a message hasn't been
-         * printed, put the car into emergency mode and print the message */
-        if (safety.state->overload == 1 && safety.overload_msg_sent == 0)
+/*
+ * Runs every check against the car. Every correction is published in a single
+ * update once all the checks have run. Called with the car's mutex held.
+ */
+void safety_check(safety_t *safety)
+{
+    shm_update_t u;
+    shm_update_init(&u, safety->state);
+    uint32_t faults = 0;
+
+    /* Check for data consistancy errors, only re-running the rules whose
+     * fields changed since the last check */
+    if (!validator_check(&safety->validator, safety->state))
+    {
+        report(safety, "Data consistency error!\n");
+        shm_update_emergency_mode(&u, 1);
+        faults |= 1u << SAFETY_FAULT_DATA;
+    }
+
+    /* If there is a door obstruction, set the doors to 'Opening' */
+    if (safety->validator.status == SHM_STATUS_CLOSING &&
+        safety->state->door_obstruction == 1)
+    {
+        shm_update_status(&u, "Opening");
+        faults |= 1u << SAFETY_FAULT_OBSTRUCTION;
+    }
+
+    /* If the emergency stop button is pressed and a message hasn't been
+     * printed about it. Print the message and put the car into emergency
+     * mode. */
+    if (safety->state->emergency_stop == 1 && safety->emergency_msg_sent == 0)
+    {
+        report(safety, "The emergency stop button has been pressed!\n");
+        safety->emergency_msg_sent = 1;
+        shm_update_emergency_mode(&u, 1);
+        faults |= 1u << SAFETY_FAULT_EMERGENCY_STOP;
+    }
+
+    /* If the overload sensor has been tripped and a message hasn't been
+     * printed, put the car into emergency mode and print the message */
+    if (safety->state->overload == 1 && safety->overload_msg_sent == 0)
+    {
+        report(safety, "The overload sensor has been tripped!\n");
+        safety->overload_msg_sent = 1;
+        shm_update_emergency_mode(&u, 1);
+        faults |= 1u << SAFETY_FAULT_OVERLOAD;
+    }
+
+    if (faults != 0)
+    {
+        record_reactions(safety, faults, monotonic_ns());
+    }
+    shm_publish(&u);
+
+    /* Taken after publishing so the corrections above aren't mistaken for
+     * new faults by the next check. */
+    safety->checked_ns = monotonic_ns();
+}
+
+/*
+ * Checks the car every time its condition variable is broadcast, until
+ * safety_unwatch() sets the stop flag.
+ */
+static void *watch_car(void *arg)
+{
+    safety_t *safety = (safety_t *)arg;
+
+    shm_lock(safety->state, LOCK_SITE_SAFETY_WATCH);
+    safety_check(safety);
+    while (!atomic_load(&safety->stop))
+    {
+        shm_cond_wait(safety->state);
+        if (!atomic_load(&safety->stop))
         {
-            write(STDOUT_FILENO, "The overload sensor has been tripped!\n", 38);
-            safety.overload_msg_sent = 1;
-            safety.state->emergency_mode = 1;
-            pthread_cond_broadcast(&safety.state->cond);
+            safety_check(safety);
         }
+    }
+    shm_unlock(safety->state);
+
+    return NULL;
+}
 
-        pthread_mutex_unlock(&safety.state->mutex);
+/*
+ * Starts the thread that watches the car. The thread blocks every signal so
+ * SIGINT is always delivered to the thread that handles it.
+ */
+bool safety_watch(safety_t *safety)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    atomic_store(&safety->stop, false);
+    int result = pthread_create(&safety->thread, &attr, watch_car, safety);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (result != 0)
+    {
+        perror("pthread_create()");
+        return false;
     }
+    safety->watching = true;
+    return true;
+}
 
-    safety_deinit(&safety);
+/*
+ * Stops the thread watching the car and waits for it to exit. The mutex is
+ * only taken so the broadcast can't slip in between the thread checking the
+ * stop flag and waiting. If the car died holding it the thread is blocked on
+ * it for good, so it is detached instead and the caller must keep the memory
+ * it uses.
+ */
+bool safety_unwatch(safety_t *safety)
+{
+    if (!safety->watching)
+    {
+        return true;
+    }
+    atomic_store(&safety->stop, true);
+    safety->watching = false;
+
+    struct timespec deadline;
+    shm_lock_deadline(SAFETY_LOCK_MS, &deadline);
+    if (shm_timedlock(safety->state, LOCK_SITE_SAFETY_WATCH, &deadline) != 0)
+    {
+        pthread_detach(safety->thread);
+        return false;
+    }
+    pthread_cond_broadcast(&safety->state->cond);
+    shm_unlock(safety->state);
+    pthread_join(safety->thread, NULL);
+    return true;
+}
 
+/*
+ * Returns whether a file in SAFETY_SHM_DIR is a car's shared memory object.
+ */
+static bool is_car_segment(const char *name)
+{
+    return strncmp(name, "car", 3) == 0 && name[3] != '\0';
+}
+
+/*
+ * Finds the car whose segment has the given file name.
+ */
+static size_t find_car(const safety_supervisor_t *supervisor, const char *name)
+{
+    size_t i = 0;
+    while (i < supervisor->num_cars &&
+           strcmp(supervisor->cars[i]->car_name, name + 3) != 0)
+    {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Starts tracking a car segment. The car is watched once it is ready.
+ */
+static void add_car(safety_supervisor_t *supervisor, const char *name,
+                    uint64_t found_ns)
+{
+    if (find_car(supervisor, name) < supervisor->num_cars)
+    {
+        return;
+    }
+
+    if (supervisor->num_cars == supervisor->capacity)
+    {
+        size_t capacity = supervisor->capacity ? supervisor->capacity * 2 : 16;
+        safety_t **cars =
+            realloc(supervisor->cars, capacity * sizeof(*supervisor->cars));
+        if (cars == NULL)
+        {
+            perror("realloc()");
+            return;
+        }
+        supervisor->cars = cars;
+        supervisor->capacity = capacity;
+    }
+
+    safety_t *safety = malloc(sizeof(*safety));
+    char *car_name = strdup(name + 3);
+    if (safety == NULL || car_name == NULL)
+    {
+        perror("malloc()");
+        free(safety);
+        free(car_name);
+        return;
+    }
+    safety_init(safety, car_name);
+    safety->supervised = true;
+    safety->found_ns = found_ns;
+    supervisor->cars[supervisor->num_cars++] = safety;
+}
+
+/*
+ * Stops watching a car and forgets it. A car that died holding its mutex
+ * still has a watcher thread blocked on it, so its memory is never released.
+ */
+static void remove_car(safety_supervisor_t *supervisor, size_t i)
+{
+    safety_t *safety = supervisor->cars[i];
+    if (safety_unwatch(safety))
+    {
+        free(safety->car_name);
+        safety_deinit(safety);
+        free(safety);
+    }
+    else
+    {
+        report(safety, "Its mutex is held by a car that stopped, no longer "
+                       "watching it.\n");
+    }
+    supervisor->cars[i] = supervisor->cars[--supervisor->num_cars];
+}
+
+/*
+ * Tracks every car segment in SAFETY_SHM_DIR that isn't tracked yet.
+ */
+static void scan_cars(safety_supervisor_t *supervisor, uint64_t found_ns)
+{
+    DIR *dir = opendir(SAFETY_SHM_DIR);
+    if (dir == NULL)
+    {
+        perror(SAFETY_SHM_DIR);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (is_car_segment(entry->d_name))
+        {
+            add_car(supervisor, entry->d_name, found_ns);
+        }
+    }
+    closedir(dir);
+}
+
+/*
+ * Unmaps a car that isn't being watched.
+ */
+static void release_car(safety_t *safety)
+{
+    if (safety->state != NULL)
+    {
+        unmap_car(safety->state);
+        safety->state = NULL;
+    }
+    if (safety->fd >= 0)
+    {
+        close(safety->fd);
+        safety->fd = -1;
+    }
+}
+
+/*
+ * Maps a car and starts watching it if it is ready. A car started by the car
+ * program is ready once its extension region is published, since that happens
+ * after the mutex and condition variable are initialised. Anything else is
+ * given SAFETY_SETTLE_MS after it appears. Returns whether the car is watched.
+ */
+static bool try_watch(safety_t *safety, uint64_t now)
+{
+    bool ready = connect_to_car(&safety->state, safety->shm_name, &safety->fd);
+    if (ready && get_shm_ext(safety->state) == NULL)
+    {
+        ready = now - safety->found_ns >= (uint64_t)SAFETY_SETTLE_MS * 1000000u;
+    }
+    if (!ready || !safety_watch(safety))
+    {
+        release_car(safety);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Watches every car that is ready. Returns the number still waiting.
+ */
+static size_t watch_ready_cars(safety_supervisor_t *supervisor, uint64_t now)
+{
+    size_t waiting = 0;
+    for (size_t i = 0; i < supervisor->num_cars; i++)
+    {
+        safety_t *safety = supervisor->cars[i];
+        if (!safety->watching && !try_watch(safety, now))
+        {
+            waiting++;
+        }
+    }
+    return waiting;
+}
+
+/*
+ * Rechecks every watched car, for programs that change a car's shared memory
+ * without broadcasting on its condition variable.
+ */
+static void sweep_cars(safety_supervisor_t *supervisor)
+{
+    for (size_t i = 0; i < supervisor->num_cars; i++)
+    {
+        safety_t *safety = supervisor->cars[i];
+        if (!safety->watching)
+        {
+            continue;
+        }
+        struct timespec deadline;
+        shm_lock_deadline(SAFETY_LOCK_MS, &deadline);
+        if (shm_timedlock(safety->state, LOCK_SITE_SAFETY_SWEEP,
+                          &deadline) != 0)
+        {
+            /* Left for the next sweep, or for good if the car died holding
+             * its mutex. */
+            continue;
+        }
+        safety_check(safety);
+        shm_unlock(safety->state);
+    }
+}
+
+/*
+ * Forgets cars whose segments no longer exist, after inotify events were
+ * lost.
+ */
+static void forget_missing_cars(safety_supervisor_t *supervisor)
+{
+    char path[PATH_MAX];
+    size_t i = 0;
+    while (i < supervisor->num_cars)
+    {
+        snprintf(path, sizeof(path), "%s/car%s", SAFETY_SHM_DIR,
+                 supervisor->cars[i]->car_name);
+        if (access(path, F_OK) != 0)
+        {
+            remove_car(supervisor, i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/*
+ * Reads the pending inotify events and tracks or forgets cars accordingly.
+ * A car restarting unlinks its old segment before creating a new one, so the
+ * old mapping is always dropped before the new one is found.
+ */
+static void handle_shm_events(safety_supervisor_t *supervisor, uint64_t now)
+{
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(supervisor->inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + len;)
+        {
+            const struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(*event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                forget_missing_cars(supervisor);
+                scan_cars(supervisor, now);
+            }
+            else if (event->len == 0 || !is_car_segment(event->name))
+            {
+                continue;
+            }
+            else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                add_car(supervisor, event->name, now);
+            }
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                size_t i = find_car(supervisor, event->name);
+                if (i < supervisor->num_cars)
+                {
+                    remove_car(supervisor, i);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Starts watching SAFETY_SHM_DIR for car segments. The cars already there are
+ * taken to be initialised.
+ */
+bool supervisor_init(safety_supervisor_t *supervisor)
+{
+    memset(supervisor, 0, sizeof(*supervisor));
+    supervisor->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (supervisor->inotify_fd < 0)
+    {
+        perror("inotify_init1()");
+        return false;
+    }
+    if (inotify_add_watch(supervisor->inotify_fd, SAFETY_SHM_DIR,
+                          IN_CREATE | IN_DELETE | IN_MOVED_TO |
+                              IN_MOVED_FROM) < 0)
+    {
+        perror(SAFETY_SHM_DIR);
+        close(supervisor->inotify_fd);
+        return false;
+    }
+
+    /* Cars created between adding the watch and the scan are reported twice,
+     * add_car() ignores the second. */
+    scan_cars(supervisor, 0);
+    supervisor->last_sweep_ns = monotonic_ns();
+    return true;
+}
+
+/*
+ * Stops watching every car and releases the supervisor's resources.
+ */
+void supervisor_deinit(safety_supervisor_t *supervisor)
+{
+    while (supervisor->num_cars > 0)
+    {
+        remove_car(supervisor, supervisor->num_cars - 1);
+    }
+    free(supervisor->cars);
+    supervisor->cars = NULL;
+    supervisor->capacity = 0;
+
+    if (supervisor->inotify_fd >= 0)
+    {
+        close(supervisor->inotify_fd);
+        supervisor->inotify_fd = -1;
+    }
+}
+
+/*
+ * Supervises cars until *running is cleared. The main thread only wakes
+ * for cars starting and stopping, to retry cars that aren't ready and for the
+ * sweep; the checks themselves run on each car's thread.
+ */
+int supervisor_run(safety_supervisor_t *supervisor,
+                   volatile sig_atomic_t *running)
+{
+    struct pollfd pfd = {.fd = supervisor->inotify_fd, .events = POLLIN};
+
+    while (*running)
+    {
+        uint64_t now = monotonic_ns();
+        size_t waiting = watch_ready_cars(supervisor, now);
+
+        uint64_t sweep_ns = (uint64_t)SAFETY_SWEEP_MS * 1000000u;
+        if (now - supervisor->last_sweep_ns >= sweep_ns)
+        {
+            sweep_cars(supervisor);
+            supervisor->last_sweep_ns = now;
+        }
+
+        int timeout = (int)((supervisor->last_sweep_ns + sweep_ns - now) /
+                            1000000u) + 1;
+        if (waiting > 0 && timeout > SAFETY_RETRY_MS)
+        {
+            timeout = SAFETY_RETRY_MS;
+        }
+
+        int result = poll(&pfd, 1, timeout);
+        if (result < 0 && errno != EINTR)
+        {
+            perror("poll()");
+            return 1;
+        }
+        if (result > 0)
+        {
+            handle_shm_events(supervisor, monotonic_ns());
+        }
+    }
     return 0;
 }
 
@@ -201,6 +751,12 @@ void safety_init(safety_t *safety, char *car_name)
     safety->state = NULL;
     safety->emergency_msg_sent = 0;
     safety->overload_msg_sent = 0;
+    safety->supervised = false;
+    safety->found_ns = 0;
+    safety->watching = false;
+    atomic_store(&safety->stop, false);
+    safety->checked_ns = monotonic_ns();
+    validator_init(&safety->validator);
 }
 
 /*
@@ -228,7 +784,7 @@ void safety_deinit(safety_t *safety)
     if (safety->state != NULL)
     {
         /* Unmap the shared memory */
-        munmap(safety->state, sizeof(car_shared_mem));
+        unmap_car(safety->state);
         safety->state = NULL;
     }
 
@@ -248,75 +804,12 @@ void safety_deinit(safety_t *safety)
 }
 
 /*
- * Checks the shared memory objects uint8_t flags for data consistancy errors.
- */
-bool is_shm_int_fields_valid(const car_shared_mem *state)
-{
-    /* Check to see if all uint8_t fields of the shared memory object are either
-     * 0 or 1. */
-    return (state->open_button < 2 && state->close_button < 2 &&
-            state->emergency_mode < 2 && state->emergency_stop < 2 &&
-            state->overload < 2 && state->individual_service_mode < 2 &&
-            state->door_obstruction < 2);
-}
-
-/*
- * Checks if the status in the car shared memory object is 1 of either "Closed",
- * "Opening", "Open", "Closing", or "Between".
- */
-bool is_shm_status_valid(const car_shared_mem *state)
-{
-    /* Define all posible valid states. */
-    const char *statuses[] = {"Opening", "Open", "Closing", "Closed",
-                              "Between"};
-    /* Loop over the valid statuses setting is_valid to true if a match is
-     * found. If no match is found then the given status is invalid.  */
-    bool is_valid = false;
-    for (int i = 0; i < 5; i++)
-    {
-        if (strcmp(state->status, statuses[i]) == 0)
-        {
-            is_valid = true;
-            break;
-        }
-    }
-    return is_valid;
-}
-
-/*
- * Checks if the door obstruction flag in shared memory is set while doors are
- * in a complementary state (i.e. "Opening", "Closing"). If the obstruction flag
- * isn't set then the doors can be in any other valid state.
- */
-bool is_shm_obstruction_valid(const car_shared_mem *state)
-{
-    /* Check to see if the doors are either "Opening" or "closing". */
-    bool is_valid_obstruction_state = strcmp(state->status, "Closing") == 0 ||
-                                      strcmp(state->status, "Opening") == 0;
-    /* If there's no door ubstruction then the obstruction state is fine but if
-     * there is the doors must be in 1 of the 2 valid status. */
-    if (state->door_obstruction == 0)
-        return true;
-    else
-        return is_valid_obstruction_state;
-}
-
-/*
- * Checks the shared memory object for data consistancy errors by checking that
- * all the following conditions true:
- *	- The status is valid.
- *	- The current floor is valid.
- *	- The destination floor is valid.
- *	- All the uint8_t flags are either 0 or 1.
- *	- If there is a door obstruction the status is either "Opening" or
- *	  "Closing".
+ * Checks the shared memory object for data consistancy errors by running every
+ * rule of the validator, see validator.c.
  */
 bool is_shm_data_valid(const car_shared_mem *state)
 {
-    return (is_shm_status_valid(state) &&
-            is_valid_floor(state->current_floor) &&
-            is_valid_floor(state->destination_floor) &&
-            is_shm_int_fields_valid(state) && is_shm_obstruction_valid(state)
-
-    );
+    shm_validator_t validator;
+    validator_init(&validator);
+    return validator_check(&validator, state);
 }
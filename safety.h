@@ -1,6 +1,36 @@
+#pragma once
+
+/*
+ * This header file defines the state of the safety component, both for a
+ * single car (`safety {car name}`) and for the supervisor that watches every
+ * car on the machine from one process (`safety --all`).
+ *
+ * See safety.c for implementation details.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "posix.h"
+#include "validator.h"
+
+/* Where POSIX shared memory objects show up as files */
+#define SAFETY_SHM_DIR "/dev/shm"
+/* How often the supervisor rechecks every car, as a backstop for programs that
+ * change a car without broadcasting */
+#define SAFETY_SWEEP_MS 1000
+/* How often the supervisor retries cars that aren't ready to be watched */
+#define SAFETY_RETRY_MS 5
+/* How long a segment without an extension region is given to initialise its
+ * mutex and condition variable before it is watched */
+#define SAFETY_SETTLE_MS 50
+/* How long the supervisor waits for a car's mutex before leaving the car
+ * alone, so a car that died holding it can't stall every other car */
+#define SAFETY_LOCK_MS 100
 
 typedef struct
 {
@@ -10,12 +40,46 @@ typedef struct
     uint8_t emergency_msg_sent;
     uint8_t overload_msg_sent;
     car_shared_mem *state;
+
+    bool supervised;     // Messages name the car, set by the supervisor
+    uint64_t found_ns;   // When the supervisor found the segment, 0 at startup
+    pthread_t thread;    // Waits for changes to the car
+    bool watching;       // The thread was started
+    atomic_bool stop;    // Asks the thread to exit
+    uint64_t checked_ns; // When the car was last checked, mutex protected
+    shm_validator_t validator; // Consistency as of the last check
 } safety_t;
 
+/*
+ * State of `safety --all`
+ */
+typedef struct
+{
+    int inotify_fd;         // Reports segments created in SAFETY_SHM_DIR
+    safety_t **cars;        // Every car segment found
+    size_t num_cars;
+    size_t capacity;
+    uint64_t last_sweep_ns; // When every car was last rechecked
+} safety_supervisor_t;
+
 void safety_init(safety_t *, char *);
 void safety_deinit(safety_t *);
 
-bool is_shm_int_fields_valid(const car_shared_mem *);
-bool is_shm_status_valid(const car_shared_mem *);
-bool is_shm_obstruction_valid(const car_shared_mem *);
+// Runs every check against the car and publishes any corrections, called with
+// the car's mutex held
+void safety_check(safety_t *);
+// Starts a thread that checks the car each time its shared memory changes
+bool safety_watch(safety_t *);
+// Stops the thread started by safety_watch(), returns false if the car's
+// mutex couldn't be taken and the thread was left blocked on it
+bool safety_unwatch(safety_t *);
+
+// Starts watching SAFETY_SHM_DIR and every car segment already in it
+bool supervisor_init(safety_supervisor_t *);
+// Stops watching every car and releases the supervisor's resources
+void supervisor_deinit(safety_supervisor_t *);
+// Supervises cars as they come and go until *running is cleared
+int supervisor_run(safety_supervisor_t *, volatile sig_atomic_t *);
+
+// Checks every consistency rule from scratch
 bool is_shm_data_valid(const car_shared_mem *);
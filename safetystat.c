@@ -0,0 +1,59 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Implementation of the safety reaction latency statistics. Samples share the
+ * power-of-two histogram of the lock statistics.
+ */
+
+#include "lockstat.h"
+#include "safetystat.h"
+
+/* Names of the faults, in the same order as safety_fault_t */
+static const char *const safety_fault_names[SAFETY_FAULT_COUNT] = {
+    "obstruction",
+    "emergency stop",
+    "overload",
+    "data consistency",
+};
+
+/*
+ * Returns a printable name for a fault.
+ */
+const char *safety_fault_name(safety_fault_t fault)
+{
+    if (fault < 0 || fault >= SAFETY_FAULT_COUNT)
+    {
+        return "unknown";
+    }
+    return safety_fault_names[fault];
+}
+
+/*
+ * Records how long safety took to correct a fault.
+ */
+void safety_stats_record(safety_stats_t *stats, safety_fault_t fault,
+                         uint64_t ns)
+{
+    safety_fault_stats_t *s = &stats->faults[fault];
+    atomic_fetch_add_explicit(&s->reactions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->total_ns, ns, memory_order_relaxed);
+    lock_hist_add(s->hist, ns);
+
+    uint64_t max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(
+                           &s->max_ns, &max, ns, memory_order_relaxed,
+                           memory_order_relaxed))
+    {
+    }
+}
+
+/*
+ * Records a fault safety corrected without knowing when it started, because
+ * whoever made it wrote the shared memory directly.
+ */
+void safety_stats_untimed(safety_stats_t *stats, safety_fault_t fault)
+{
+    atomic_fetch_add_explicit(&stats->faults[fault].untimed, 1,
+                              memory_order_relaxed);
+}
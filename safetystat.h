@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * This header file defines the reaction latency statistics the safety
+ * component publishes in the extension region of a car's shared memory object
+ * for `monitor {car name} safety`. A reaction is timed from the moment the
+ * fields that make up a fault were last changed to the moment safety publishes
+ * its correction.
+ *
+ * See safetystat.c for implementation details.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "lockstat.h"
+
+/*
+ * The faults safety reacts to
+ */
+typedef enum
+{
+    SAFETY_FAULT_OBSTRUCTION = 0, // Doors obstructed while closing
+    SAFETY_FAULT_EMERGENCY_STOP,  // Emergency stop button pressed
+    SAFETY_FAULT_OVERLOAD,        // Overload sensor tripped
+    SAFETY_FAULT_DATA,            // Data consistency error
+    SAFETY_FAULT_COUNT
+} safety_fault_t;
+
+/*
+ * Reaction statistics for one kind of fault. Safety writes them and the
+ * monitor reads them without the car's mutex, so every field is a relaxed
+ * atomic.
+ */
+typedef struct
+{
+    _Atomic uint64_t reactions; // Faults corrected with a known start time
+    _Atomic uint64_t untimed;   // Faults made by writes that weren't published
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t hist[LOCK_HIST_BUCKETS];
+} safety_fault_stats_t;
+
+typedef struct
+{
+    safety_fault_stats_t faults[SAFETY_FAULT_COUNT];
+} safety_stats_t;
+
+// Returns a printable name for a fault
+const char *safety_fault_name(safety_fault_t);
+// Records how long safety took to correct a fault
+void safety_stats_record(safety_stats_t *, safety_fault_t, uint64_t);
+// Records a fault whose start time isn't known
+void safety_stats_untimed(safety_stats_t *, safety_fault_t);
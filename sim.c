@@ -0,0 +1,911 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Implementation of the discrete event simulator. Every delay is a timer on a
+ * timing wheel whose clock only moves when the simulator advances it, straight
+ * to the next tick with something to do. Nothing ever waits, so the run is as
+ * fast as the events can be processed and doesn't depend on how the operating
+ * system schedules anything.
+ *
+ * The cars take the same steps as the event loop in carloop.c: each door phase
+ * and each floor travelled is a timer, a new destination sets a resting car
+ * moving once its doors have closed, and arrival opens the doors. The threaded
+ * car in car.c answers the controller the same way, so the statistics describe
+ * `car` run either way; test-sim checks them against load. Whenever a car's
+ * status, current floor or destination floor changes the controller is told,
+ * just like with a STATUS message, and answers through dispatch.c without any
+ * delay. Buttons, service mode and emergencies aren't modelled; nothing in a
+ * scheduling run uses them.
+ *
+ * Passengers behave like the ones in test-sched. Each calls a car at a random
+ * time, gets in once that car is open on their floor and heading their way,
+ * and gets out when it is open on their destination. Passengers the
+ * controller never gets to are reported rather than waited for forever.
+ */
+
+#include "carloop.h"
+#include "dispatch.h"
+#include "global.h"
+#include "motion.h"
+#include "queue.h"
+#include "sim.h"
+#include "timerwheel.h"
+#include "trace.h"
+#include "workload.h"
+
+int main(int argc, char *argv[])
+{
+    sim_options_t options;
+    sim_options_init(&options);
+    if (!sim_options_parse(&options, argc, argv))
+    {
+        return 1;
+    }
+
+    sim_t sim;
+    if (!sim_init(&sim, &options))
+    {
+        sim_deinit(&sim);
+        return 1;
+    }
+
+    uint64_t start = monotonic_ns();
+    sim_run(&sim);
+    sim_report(&sim, (double)(monotonic_ns() - start) / 1e9);
+
+    sim_deinit(&sim);
+    return 0;
+}
+
+/*
+ * Fills in the defaults.
+ */
+void sim_options_init(sim_options_t *options)
+{
+    options->delay_ms = SIM_DEFAULT_DELAY_MS;
+    options->num_cars = SIM_DEFAULT_CARS;
+    options->num_passengers = SIM_DEFAULT_PASSENGERS;
+    options->lowest_floor = SIM_DEFAULT_LOWEST_FLOOR;
+    options->highest_floor = SIM_DEFAULT_HIGHEST_FLOOR;
+    options->start_ms = SIM_DEFAULT_START_MS;
+    options->end_ms = SIM_DEFAULT_END_MS;
+    options->histogram_len = SIM_DEFAULT_HISTOGRAM_LEN;
+    options->seed = SIM_DEFAULT_SEED;
+    options->motion_file = NULL;
+    options->fleet_file = NULL;
+    options->trace_file = NULL;
+}
+
+/*
+ * Reads the options given as `--{name} {value}` pairs, see sim.h.
+ */
+bool sim_options_parse(sim_options_t *options, int argc, char *argv[])
+{
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "Usage: %s [--{option} {value}]...\n", argv[0]);
+        return false;
+    }
+
+    for (int i = 1; i < argc - 1; i += 2)
+    {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        uint64_t number = 0;
+        bool numeric = parse_number(value, &number);
+        bool valid = true;
+
+        if (strcmp(name, "--car-delay") == 0)
+        {
+            valid = numeric && number <= UINT32_MAX;
+            options->delay_ms = (uint32_t)number;
+        }
+        else if (strcmp(name, "--cars") == 0)
+        {
+            valid = numeric && number > 0;
+            options->num_cars = (size_t)number;
+        }
+        else if (strcmp(name, "--num-passengers") == 0)
+        {
+            valid = numeric && number < SIM_NONE;
+            options->num_passengers = (size_t)number;
+        }
+        else if (strcmp(name, "--lowest-floor") == 0)
+        {
+            valid = is_valid_floor(value) && value[0] != '\0';
+            options->lowest_floor = value;
+        }
+        else if (strcmp(name, "--highest-floor") == 0)
+        {
+            valid = is_valid_floor(value) && value[0] != '\0';
+            options->highest_floor = value;
+        }
+        else if (strcmp(name, "--sim-start") == 0)
+        {
+            valid = numeric;
+            options->start_ms = number;
+        }
+        else if (strcmp(name, "--sim-end") == 0)
+        {
+            valid = numeric;
+            options->end_ms = number;
+        }
+        else if (strcmp(name, "--histogram-len") == 0)
+        {
+            valid = numeric && number > 0;
+            options->histogram_len = (size_t)number;
+        }
+        else if (strcmp(name, "--seed") == 0)
+        {
+            valid = numeric;
+            options->seed = number;
+        }
+        else if (strcmp(name, "--motion") == 0)
+        {
+            options->motion_file = value;
+        }
+        else if (strcmp(name, "--fleet") == 0)
+        {
+            options->fleet_file = value;
+        }
+        else if (strcmp(name, "--trace") == 0)
+        {
+            options->trace_file = value;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid parameter: %s\n", name);
+            return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+            return false;
+        }
+    }
+
+    if (floor_to_int(options->lowest_floor) >=
+        floor_to_int(options->highest_floor))
+    {
+        fprintf(stderr, "The lowest floor must be below the highest floor.\n");
+        return false;
+    }
+    if (options->start_ms > options->end_ms)
+    {
+        fprintf(stderr, "The simulation must start before it ends.\n");
+        return false;
+    }
+    return true;
+}
+
+/* The statuses a car shows. A car's status always points at one of these, so
+ * statuses can be compared by address. */
+static const char status_opening[] = "Opening";
+static const char status_open[] = "Open";
+static const char status_closing[] = "Closing";
+static const char status_closed[] = "Closed";
+static const char status_between[] = "Between";
+
+static void door_timer_fired(void *);
+static void level_timer_fired(void *);
+static void arrival_timer_fired(void *);
+
+/*
+ * Adds a car to the simulation. Returns false if its settings aren't valid.
+ */
+static bool add_car(sim_t *sim, const char *name, const char *lowest_floor,
+                    const char *highest_floor, uint32_t delay_ms,
+                    const char *motion_file)
+{
+    if (!is_valid_floor(lowest_floor) || !is_valid_floor(highest_floor) ||
+        lowest_floor[0] == '\0' || highest_floor[0] == '\0' ||
+        floor_to_int(lowest_floor) > floor_to_int(highest_floor))
+    {
+        fprintf(stderr, "Error: Car %s has an invalid range.\n", name);
+        return false;
+    }
+
+    sim_car_t *car = &sim->cars[sim->num_cars];
+    memset(car, 0, sizeof(*car));
+    car->sim = sim;
+    snprintf(car->name, sizeof(car->name), "%s", name);
+    strcpy(car->lowest_floor, lowest_floor);
+    strcpy(car->highest_floor, highest_floor);
+    car->lowest = floor_to_int(lowest_floor);
+    car->num_floors = floor_to_int(highest_floor) - car->lowest + 1;
+    queue_init(&car->queue);
+    sim->num_cars += 1;
+
+    motion_init(&car->motion, delay_ms);
+    if (motion_file != NULL && !motion_load(&car->motion, motion_file))
+    {
+        return false;
+    }
+
+    /* Cars start closed on their lowest floor, like car_init(). */
+    car->state.status = status_closed;
+    car->state.current = car->lowest;
+    car->state.destination = car->lowest;
+    car->sent = car->state;
+    car->doors = DOORS_IDLE;
+    timer_event_init(&car->door_timer, door_timer_fired, car);
+    timer_event_init(&car->level_timer, level_timer_fired, car);
+
+    size_t floors = (size_t)car->num_floors;
+    car->waiting = malloc(floors * sizeof(*car->waiting));
+    car->riding = malloc(floors * sizeof(*car->riding));
+    if (car->waiting == NULL || car->riding == NULL)
+    {
+        perror("malloc()");
+        return false;
+    }
+    for (size_t i = 0; i < floors; i++)
+    {
+        car->waiting[i] = SIM_NONE;
+        car->riding[i] = SIM_NONE;
+    }
+    return true;
+}
+
+/*
+ * Makes sure there is room in the cars array for one more car, growing it by
+ * doubling. Returns false if out of memory.
+ */
+static bool make_room_for_car(sim_t *sim, size_t *capacity)
+{
+    if (sim->num_cars < *capacity)
+    {
+        return true;
+    }
+    size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+    sim_car_t *cars = realloc(sim->cars, new_capacity * sizeof(*cars));
+    if (cars == NULL)
+    {
+        perror("realloc()");
+        return false;
+    }
+    /* The timers point back at their cars. */
+    for (size_t i = 0; i < sim->num_cars; i++)
+    {
+        cars[i].door_timer.arg = &cars[i];
+        cars[i].level_timer.arg = &cars[i];
+    }
+    sim->cars = cars;
+    *capacity = new_capacity;
+    return true;
+}
+
+/*
+ * Adds the cars listed in a fleet file. Returns false if it can't be read or
+ * a line isn't valid.
+ */
+static bool read_fleet(sim_t *sim, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    size_t capacity = 0;
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number += 1;
+
+        char *saveptr;
+        char *fields[6];
+        int num_fields = 0;
+        for (char *field = strtok_r(line, " \t\r\n", &saveptr);
+             field != NULL && num_fields < 6;
+             field = strtok_r(NULL, " \t\r\n", &saveptr))
+        {
+            fields[num_fields++] = field;
+        }
+        if (num_fields == 0 || fields[0][0] == '#')
+        {
+            continue;
+        }
+
+        uint64_t delay_ms = 0;
+        if ((num_fields != 4 && num_fields != 5) ||
+            !parse_number(fields[3], &delay_ms) || delay_ms > UINT32_MAX)
+        {
+            fprintf(stderr,
+                    "Error: Fleet line %d should be {name} {lowest floor} "
+                    "{highest floor} {delay} [motion file].\n",
+                    line_number);
+            ok = false;
+            break;
+        }
+
+        ok = make_room_for_car(sim, &capacity) &&
+             add_car(sim, fields[0], fields[1], fields[2], (uint32_t)delay_ms,
+                     num_fields == 5 ? fields[4] : sim->options.motion_file);
+    }
+
+    fclose(file);
+    if (ok && sim->num_cars == 0)
+    {
+        fprintf(stderr, "Error: %s has no cars.\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Creates the passengers in order of arrival, see workload.h.
+ */
+static bool create_passengers(sim_t *sim)
+{
+    const sim_options_t *options = &sim->options;
+    size_t count = options->num_passengers;
+    workload_trip_t *trips = workload_generate(
+        count, floor_to_int(options->lowest_floor),
+        floor_to_int(options->highest_floor), options->start_ms,
+        options->end_ms, options->seed);
+    sim->passengers = calloc(count == 0 ? 1 : count,
+                             sizeof(*sim->passengers));
+    if (trips == NULL || sim->passengers == NULL)
+    {
+        perror("malloc()");
+        free(trips);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sim_passenger_t *p = &sim->passengers[i];
+        p->from = trips[i].from;
+        p->to = trips[i].to;
+        p->arrive_ms = trips[i].arrive_ms;
+        p->car = SIM_NONE;
+        p->next = SIM_NONE;
+    }
+    sim->num_passengers = count;
+
+    free(trips);
+    return true;
+}
+
+/*
+ * Takes the passengers from the calls in a trace recorded by the controller,
+ * arriving when the call was made, and the cars from the cars that joined
+ * unless a fleet file gave them. Cars are added in the order they first
+ * joined, so calls go to the same cars as when recorded; a car leaving isn't
+ * simulated. Calls the controller would have refused are skipped.
+ */
+static bool read_trace(sim_t *sim, const char *path)
+{
+    trace_reader_t reader;
+    if (!trace_reader_open(&reader, path))
+    {
+        return false;
+    }
+
+    bool join_cars = sim->num_cars == 0;
+    size_t car_capacity = sim->num_cars;
+    size_t capacity = 0;
+    trace_event_t event;
+    int status;
+    bool ok = true;
+    while (ok && (status = trace_read(&reader, &event)) == 1)
+    {
+        if (event.type == TRACE_CAR_JOIN && join_cars)
+        {
+            bool known = false;
+            for (size_t i = 0; i < sim->num_cars && !known; i++)
+            {
+                known = strcmp(sim->cars[i].name, event.name) == 0;
+            }
+            ok = known || (make_room_for_car(sim, &car_capacity) &&
+                           add_car(sim, event.name, event.lowest_floor,
+                                   event.highest_floor, sim->options.delay_ms,
+                                   sim->options.motion_file));
+            continue;
+        }
+        if (event.type != TRACE_CALL)
+        {
+            continue;
+        }
+        if (!is_valid_floor(event.source_floor) ||
+            !is_valid_floor(event.destination_floor) ||
+            strcmp(event.source_floor, event.destination_floor) == 0)
+        {
+            sim->skipped_calls += 1;
+            continue;
+        }
+
+        if (sim->num_passengers == capacity)
+        {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            sim_passenger_t *passengers =
+                realloc(sim->passengers, capacity * sizeof(*passengers));
+            if (passengers == NULL)
+            {
+                perror("realloc()");
+                ok = false;
+                break;
+            }
+            sim->passengers = passengers;
+        }
+        sim_passenger_t *p = &sim->passengers[sim->num_passengers++];
+        memset(p, 0, sizeof(*p));
+        p->from = floor_to_int(event.source_floor);
+        p->to = floor_to_int(event.destination_floor);
+        p->arrive_ms = event.time_us / 1000;
+        p->car = SIM_NONE;
+        p->next = SIM_NONE;
+    }
+    trace_reader_close(&reader);
+
+    if (ok && status == -1)
+    {
+        /* A controller that was killed can leave a record cut short. */
+        fprintf(stderr, "Warning: %s is corrupt after %zu calls, simulating "
+                        "those.\n",
+                path, sim->num_passengers + sim->skipped_calls);
+    }
+    if (ok && sim->num_cars == 0)
+    {
+        fprintf(stderr, "Error: No cars joined in %s.\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Creates the cars, from the fleet file, the trace or as num_cars identical
+ * cars, and the passengers, from the trace or at random.
+ */
+bool sim_init(sim_t *sim, const sim_options_t *options)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->options = *options;
+    timer_wheel_init_manual(&sim->wheel);
+    timer_event_init(&sim->arrival_timer, arrival_timer_fired, sim);
+
+    if (options->fleet_file != NULL)
+    {
+        if (!read_fleet(sim, options->fleet_file))
+        {
+            return false;
+        }
+    }
+    else if (options->trace_file == NULL)
+    {
+        sim->cars = calloc(options->num_cars, sizeof(*sim->cars));
+        if (sim->cars == NULL)
+        {
+            perror("calloc()");
+            return false;
+        }
+        for (size_t i = 0; i < options->num_cars; i++)
+        {
+            char name[24];
+            snprintf(name, sizeof(name), "Sim%zu", i + 1);
+            if (!add_car(sim, name, options->lowest_floor,
+                         options->highest_floor, options->delay_ms,
+                         options->motion_file))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (options->trace_file != NULL)
+    {
+        return read_trace(sim, options->trace_file);
+    }
+    return create_passengers(sim);
+}
+
+/*
+ * Releases the cars, their queues and the passengers.
+ */
+void sim_deinit(sim_t *sim)
+{
+    for (size_t i = 0; i < sim->num_cars; i++)
+    {
+        queue_deinit(&sim->cars[i].queue);
+        free(sim->cars[i].waiting);
+        free(sim->cars[i].riding);
+    }
+    free(sim->cars);
+    free(sim->passengers);
+    sim->cars = NULL;
+    sim->passengers = NULL;
+    sim->num_cars = 0;
+    sim->num_passengers = 0;
+}
+
+/*
+ * Compares the current and destination floors like compare_floors() in
+ * carloop.c: 1 if the car is heading up, -1 if down and 0 if it is there.
+ */
+static int compare_floors(const sim_car_state_t *state)
+{
+    if (state->current > state->destination)
+        return -1;
+    else if (state->current < state->destination)
+        return 1;
+    else
+        return 0;
+}
+
+/*
+ * Lets out the passengers who have reached their floor and lets in those
+ * waiting on it who are heading the car's way, as long as the car is open.
+ */
+static void move_passengers(sim_car_t *car)
+{
+    if (car->state.status != status_open)
+    {
+        return;
+    }
+
+    sim_passenger_t *passengers = car->sim->passengers;
+    uint64_t now = car->sim->wheel.now;
+    int floor = car->state.current - car->lowest;
+
+    for (uint32_t i = car->riding[floor]; i != SIM_NONE;
+         i = passengers[i].next)
+    {
+        passengers[i].alighted = true;
+        passengers[i].alight_ms = now;
+    }
+    car->riding[floor] = SIM_NONE;
+
+    int direction = compare_floors(&car->state);
+    uint32_t *link = &car->waiting[floor];
+    while (*link != SIM_NONE)
+    {
+        uint32_t index = *link;
+        sim_passenger_t *p = &passengers[index];
+        if (direction == 0 || (p->to > p->from ? 1 : -1) != direction)
+        {
+            link = &p->next;
+            continue;
+        }
+
+        *link = p->next;
+        p->boarded = true;
+        p->board_ms = now;
+        p->next = car->riding[p->to - car->lowest];
+        car->riding[p->to - car->lowest] = index;
+    }
+}
+
+static void request_floor(sim_car_t *, const char *);
+
+/*
+ * Tells the passengers and the controller about the car's state if it changed
+ * since they were last told, and follows the controller's answer. Only an
+ * opening car can be sent anywhere, so the floor is only named for those.
+ */
+static void publish(sim_car_t *car)
+{
+    if (car->state.status == car->sent.status &&
+        car->state.current == car->sent.current &&
+        car->state.destination == car->sent.destination)
+    {
+        return;
+    }
+    car->sent = car->state;
+
+    move_passengers(car);
+
+    if (car->state.status == status_opening)
+    {
+        char current_floor[16];
+        int_to_floor(car->state.current, current_floor,
+                     sizeof(current_floor));
+        const char *next_floor =
+            dispatch_status(&car->queue, car->state.status, current_floor);
+        if (next_floor != NULL)
+        {
+            request_floor(car, next_floor);
+        }
+    }
+}
+
+/*
+ * Starts opening the doors.
+ */
+static void start_opening(sim_car_t *car)
+{
+    car->state.status = status_opening;
+    car->doors = DOORS_OPENING;
+    timer_schedule(&car->sim->wheel, &car->door_timer,
+                   car->motion.door_open_ms);
+}
+
+/*
+ * Schedules the car's arrival at the next floor towards its destination.
+ */
+static void schedule_step(sim_car_t *car)
+{
+    timer_schedule(&car->sim->wheel, &car->level_timer,
+                   motion_step_ms(&car->motion, &car->trip_start,
+                                  car->state.current,
+                                  car->state.destination));
+}
+
+/*
+ * Sets a resting car moving once its doors have finished cycling. The
+ * controller only sends floors within the car's range, so unlike evaluate()
+ * in carloop.c there is no need to pull the destination back into it.
+ */
+static void evaluate(sim_car_t *car)
+{
+    if (!car->moving && car->doors == DOORS_IDLE &&
+        compare_floors(&car->state) != 0)
+    {
+        car->state.status = status_between;
+        car->moving = true;
+        car->trip_start = car->state.current;
+        schedule_step(car);
+    }
+}
+
+/*
+ * Sends the car to a floor, or cycles the doors if it is already there, as
+ * asked by a FLOOR message. A car travelling to the floor opens the doors
+ * when it gets there, and one stopped on it cycles them once any cycle in
+ * progress is over, like request_floor() in car.c and carloop.c.
+ */
+static void request_floor(sim_car_t *car, const char *floor)
+{
+    int destination = floor_to_int(floor);
+    if (car->state.destination != destination)
+    {
+        car->state.destination = destination;
+        car->cycle_doors = false;
+    }
+    if (!car->moving && compare_floors(&car->state) == 0)
+    {
+        if (car->doors == DOORS_IDLE)
+        {
+            start_opening(car);
+        }
+        else
+        {
+            car->cycle_doors = true;
+        }
+    }
+    evaluate(car);
+    publish(car);
+}
+
+/*
+ * Advances the doors to their next phase.
+ */
+static void door_timer_fired(void *arg)
+{
+    sim_car_t *car = arg;
+    switch (car->doors)
+    {
+    case DOORS_OPENING:
+        car->state.status = status_open;
+        car->doors = DOORS_OPEN;
+        timer_schedule(&car->sim->wheel, &car->door_timer,
+                       car->motion.door_dwell_ms);
+        break;
+    case DOORS_OPEN:
+        car->state.status = status_closing;
+        car->doors = DOORS_CLOSING;
+        timer_schedule(&car->sim->wheel, &car->door_timer,
+                       car->motion.door_close_ms);
+        break;
+    case DOORS_CLOSING:
+        car->state.status = status_closed;
+        car->doors = DOORS_IDLE;
+        break;
+    case DOORS_IDLE:
+        break;
+    }
+    evaluate(car);
+    publish(car);
+
+    /* Report the doors closed before they open again, like carloop.c. */
+    if (car->doors == DOORS_IDLE && car->cycle_doors)
+    {
+        car->cycle_doors = false;
+        start_opening(car);
+        publish(car);
+    }
+}
+
+/*
+ * Moves the car one floor towards its destination and opens the doors when it
+ * gets there.
+ */
+static void level_timer_fired(void *arg)
+{
+    sim_car_t *car = arg;
+    car->state.current += compare_floors(&car->state);
+
+    if (compare_floors(&car->state) != 0)
+    {
+        schedule_step(car);
+    }
+    else
+    {
+        car->moving = false;
+        start_opening(car);
+    }
+    publish(car);
+}
+
+/*
+ * Returns the car that takes calls between two floors. Like handle_call() in
+ * the controller, that's the first car whose range covers both floors.
+ */
+static uint32_t route_call(const sim_t *sim, int from, int to)
+{
+    char from_floor[16];
+    char to_floor[16];
+    int_to_floor(from, from_floor, sizeof(from_floor));
+    int_to_floor(to, to_floor, sizeof(to_floor));
+
+    for (size_t i = 0; i < sim->num_cars; i++)
+    {
+        /* Cars that obviously can't take the call are skipped without
+         * parsing their floors, dispatch.c has the final say. */
+        const sim_car_t *car = &sim->cars[i];
+        int highest = car->lowest + car->num_floors - 1;
+        if (from < car->lowest || from > highest || to < car->lowest ||
+            to > highest)
+        {
+            continue;
+        }
+        if (dispatch_in_range(car->lowest_floor, car->highest_floor,
+                              from_floor, to_floor))
+        {
+            return (uint32_t)i;
+        }
+    }
+    return SIM_NONE;
+}
+
+/*
+ * Makes a passenger's call and sends the car that takes it where the
+ * controller would.
+ */
+static void make_call(sim_t *sim, uint32_t index)
+{
+    sim_passenger_t *p = &sim->passengers[index];
+    p->car = route_call(sim, p->from, p->to);
+    if (p->car == SIM_NONE)
+    {
+        return;
+    }
+
+    sim_car_t *car = &sim->cars[p->car];
+    p->next = car->waiting[p->from - car->lowest];
+    car->waiting[p->from - car->lowest] = index;
+
+    char from[16];
+    char to[16];
+    int_to_floor(p->from, from, sizeof(from));
+    int_to_floor(p->to, to, sizeof(to));
+    const char *next_floor = dispatch_call(&car->queue, from, to);
+    if (next_floor != NULL)
+    {
+        request_floor(car, next_floor);
+    }
+
+    /* The car may already be open on the passenger's floor. */
+    move_passengers(car);
+}
+
+/*
+ * Makes the calls of every passenger arriving now and waits for the next.
+ */
+static void arrival_timer_fired(void *arg)
+{
+    sim_t *sim = arg;
+    while (sim->next_arrival < sim->num_passengers &&
+           sim->passengers[sim->next_arrival].arrive_ms <= sim->wheel.now)
+    {
+        make_call(sim, (uint32_t)sim->next_arrival);
+        sim->next_arrival += 1;
+    }
+
+    if (sim->next_arrival < sim->num_passengers)
+    {
+        timer_schedule(&sim->wheel, &sim->arrival_timer,
+                       sim->passengers[sim->next_arrival].arrive_ms -
+                           sim->wheel.now);
+    }
+}
+
+/*
+ * Runs every timer in order, jumping the clock straight to the next one,
+ * until nothing is left to happen.
+ */
+void sim_run(sim_t *sim)
+{
+    if (sim->num_passengers > 0)
+    {
+        timer_schedule(&sim->wheel, &sim->arrival_timer,
+                       sim->passengers[0].arrive_ms);
+    }
+
+    while (sim->wheel.pending > 0)
+    {
+        int64_t next_ms = timer_wheel_next_ms(&sim->wheel);
+        sim->events +=
+            timer_wheel_advance_to(&sim->wheel, sim->wheel.now +
+                                                    (uint64_t)next_ms);
+    }
+}
+
+/*
+ * Prints how the run went and the waiting and riding times of every passenger
+ * who reached their floor.
+ */
+void sim_report(const sim_t *sim, double seconds)
+{
+    size_t count = sim->num_passengers;
+    uint64_t *waits = malloc((count == 0 ? 1 : count) * sizeof(*waits));
+    uint64_t *rides = malloc((count == 0 ? 1 : count) * sizeof(*rides));
+    if (waits == NULL || rides == NULL)
+    {
+        perror("malloc()");
+        free(waits);
+        free(rides);
+        return;
+    }
+
+    size_t served = 0;
+    size_t unavailable = 0;
+    size_t stranded = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const sim_passenger_t *p = &sim->passengers[i];
+        if (p->car == SIM_NONE)
+        {
+            unavailable += 1;
+        }
+        else if (!p->alighted)
+        {
+            stranded += 1;
+        }
+        else
+        {
+            waits[served] = (p->board_ms - p->arrive_ms) * 1000;
+            rides[served] = (p->alight_ms - p->board_ms) * 1000;
+            served += 1;
+        }
+    }
+
+    printf("Simulated %zu passengers on %zu cars: %.3f s of virtual time in "
+           "%.3f s, %lu events\n",
+           count, sim->num_cars, (double)sim->wheel.now / 1000.0, seconds,
+           (unsigned long)sim->events);
+    printf("Served: %zu, unavailable: %zu, never reached their floor: %zu\n",
+           served, unavailable, stranded);
+    printf("Cars modelled on car, threaded or with --event-loop\n");
+    if (sim->skipped_calls > 0)
+    {
+        printf("Calls in the trace that couldn't be made: %zu\n",
+               sim->skipped_calls);
+    }
+    printf("\n");
+
+    workload_print_trips(waits, rides, served, sim->options.histogram_len);
+
+    free(waits);
+    free(rides);
+}
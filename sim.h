@@ -0,0 +1,162 @@
+#pragma once
+
+/*
+ * This header file defines the discrete event simulator run by
+ * `sim [options]`. It answers the same question as test-sched, how long
+ * passengers wait for and ride in the cars, without starting any processes:
+ * the controller's scheduling decisions (dispatch.c and queue.c) drive a model
+ * of the car's state machine on a timing wheel with a virtual clock, so a day
+ * of passengers takes moments and the same seed always gives the same result.
+ *
+ * Options are given as `--{name} {value}` pairs. Those shared with test-sched
+ * mean the same thing:
+ *
+ *   --car-delay {ms}        Delay of every car
+ *   --cars {count}          Number of cars, named Sim1, Sim2 and so on
+ *   --num-passengers {count}
+ *   --lowest-floor {floor}  Range of the cars and of the passengers' floors
+ *   --highest-floor {floor}
+ *   --sim-start {ms}        Passengers arrive at random times between these
+ *   --sim-end {ms}
+ *   --histogram-len {bars}
+ *   --seed {number}         Seed of the random passengers, see workload.h
+ *   --motion {file}         Motion file for every car, see motion.h
+ *   --fleet {file}          Cars to use instead of --cars, one per line as
+ *                           {name} {lowest} {highest} {delay} [motion file]
+ *   --trace {file}          Passengers to use instead of random ones, the
+ *                           calls recorded by `controller --trace`. Unless
+ *                           --fleet is given the cars are those that joined,
+ *                           with --car-delay; cars leaving is ignored.
+ *
+ * See sim.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "carloop.h"
+#include "motion.h"
+#include "queue.h"
+#include "timerwheel.h"
+
+/* Defaults, the same as test-sched's */
+#define SIM_DEFAULT_DELAY_MS 100
+#define SIM_DEFAULT_CARS 1
+#define SIM_DEFAULT_PASSENGERS 10
+#define SIM_DEFAULT_LOWEST_FLOOR "1"
+#define SIM_DEFAULT_HIGHEST_FLOOR "4"
+#define SIM_DEFAULT_START_MS 40
+#define SIM_DEFAULT_END_MS 1000
+#define SIM_DEFAULT_HISTOGRAM_LEN 5
+#define SIM_DEFAULT_SEED 1
+
+/* Marks the end of a list of passengers, or a call no car can take */
+#define SIM_NONE UINT32_MAX
+
+/*
+ * Settings of a simulation
+ */
+typedef struct sim_options
+{
+    uint32_t delay_ms;
+    size_t num_cars;
+    size_t num_passengers;
+    const char *lowest_floor;
+    const char *highest_floor;
+    uint64_t start_ms;
+    uint64_t end_ms;
+    size_t histogram_len;
+    uint64_t seed;
+    const char *motion_file; // NULL for a floor per delay
+    const char *fleet_file;  // NULL for num_cars identical cars
+    const char *trace_file;  // NULL for random passengers, see trace.h
+} sim_options_t;
+
+/*
+ * A passenger. Floors are floor_to_int() numbers and times are virtual
+ * milliseconds.
+ */
+typedef struct sim_passenger
+{
+    int from;
+    int to;
+    uint64_t arrive_ms; // When the passenger calls a car
+    uint64_t board_ms;  // When the passenger got in
+    uint64_t alight_ms; // When the passenger got out
+    uint32_t car;       // Car that took the call, SIM_NONE if none could
+    uint32_t next;      // Next passenger in the same list
+    bool boarded;
+    bool alighted;
+} sim_passenger_t;
+
+struct sim;
+
+/*
+ * What a car shows, the fields of a STATUS message
+ */
+typedef struct sim_car_state
+{
+    const char *status; // One of the status strings in sim.c
+    int current;        // floor_to_int() of the current floor
+    int destination;    // floor_to_int() of the destination floor
+} sim_car_state_t;
+
+/*
+ * A simulated car, following the same steps as the event loop in carloop.c
+ */
+typedef struct sim_car
+{
+    struct sim *sim;
+    char name[16];
+    char lowest_floor[4];
+    char highest_floor[4];
+    int lowest;    // floor_to_int() of lowest_floor
+    int num_floors;
+    motion_t motion;
+    queue_t queue; // The controller's queue for the car
+
+    sim_car_state_t state; // What the car shows
+    sim_car_state_t sent;  // Last STATUS sent to the controller
+    door_phase_t doors;
+    bool moving;
+    bool cycle_doors; // Cycle the doors again once they have closed
+    int trip_start;
+    timer_event_t door_timer;
+    timer_event_t level_timer;
+
+    uint32_t *waiting; // Passengers waiting on each floor
+    uint32_t *riding;  // Passengers in the car, by the floor they get out at
+} sim_car_t;
+
+/*
+ * A simulation
+ */
+typedef struct sim
+{
+    sim_options_t options;
+    timer_wheel_t wheel;
+    sim_car_t *cars;
+    size_t num_cars;
+    sim_passenger_t *passengers; // In order of arrival
+    size_t num_passengers;
+    size_t next_arrival;         // First passenger who hasn't called yet
+    timer_event_t arrival_timer;
+    uint64_t events;             // Timers that fired
+    size_t skipped_calls;        // Calls in the trace with invalid floors
+} sim_t;
+
+// Fills in the defaults
+void sim_options_init(sim_options_t *);
+// Reads `--{name} {value}` arguments, prints the problem and returns false if
+// one isn't valid
+bool sim_options_parse(sim_options_t *, int, char *[]);
+// Creates the cars and the passengers, prints the problem and returns false
+// if the cars can't be set up
+bool sim_init(sim_t *, const sim_options_t *);
+// Releases the simulation's resources
+void sim_deinit(sim_t *);
+// Runs the simulation until every car has come to rest
+void sim_run(sim_t *);
+// Prints the waiting and riding times like test-sched
+void sim_report(const sim_t *, double);
@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of the safety stress harness. The harness creates a car's
+ * shared memory object itself, with an extension region so every change is
+ * timestamped, and starts `safety {car name}` on it. It then injects faults
+ * back to back: each fault is published, the harness waits on the condition
+ * variable for safety's correction, then clears the fault and the emergency
+ * mode so the next one starts from a healthy car.
+ *
+ * Door obstructions and data consistency errors are injected alternately,
+ * since safety reacts to every one of them. The emergency stop button and the
+ * overload sensor are only reported by safety the first time they trip, so
+ * each of those is injected once at the end.
+ *
+ * Two sets of latencies are printed: the round trip seen by the harness and
+ * the reaction safety recorded itself (see safetystat.h). Both are also left
+ * for `monitor`, until the harness removes the car on exit.
+ */
+
+#include "global.h"
+#include "lockstat.h"
+#include "posix.h"
+#include "safetystat.h"
+#include "stress.h"
+
+/*
+ * Starts the safety program on the car with its messages discarded. Returns
+ * its pid or -1.
+ */
+static pid_t start_safety(const char *safety_path, const char *car_name)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+        execlp(safety_path, safety_path, car_name, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+    {
+        perror("fork()");
+    }
+    return pid;
+}
+
+/*
+ * Makes the car show a fault. Called with the car's mutex held.
+ */
+static void apply_fault(shm_update_t *u, safety_fault_t fault)
+{
+    car_shared_mem *state = u->state;
+    switch (fault)
+    {
+    case SAFETY_FAULT_OBSTRUCTION:
+        shm_update_status(u, "Closing");
+        state->door_obstruction = 1;
+        shm_mark_dirty(u, SHM_FIELD_DOOR_OBSTRUCTION);
+        break;
+    case SAFETY_FAULT_EMERGENCY_STOP:
+        shm_update_emergency_stop(u, 1);
+        break;
+    case SAFETY_FAULT_OVERLOAD:
+        state->overload = 1;
+        shm_mark_dirty(u, SHM_FIELD_OVERLOAD);
+        break;
+    default:
+        shm_update_status(u, "Bogus");
+        break;
+    }
+}
+
+/*
+ * Returns whether safety has corrected a fault. Called with the car's mutex
+ * held.
+ */
+static bool has_reacted(const car_shared_mem *state, safety_fault_t fault)
+{
+    if (fault == SAFETY_FAULT_OBSTRUCTION)
+    {
+        return strcmp(state->status, "Opening") == 0;
+    }
+    return state->emergency_mode == 1;
+}
+
+/*
+ * Clears every fault and the emergency mode. Called with the car's mutex
+ * held.
+ */
+static void clear_faults(shm_update_t *u)
+{
+    car_shared_mem *state = u->state;
+    shm_update_status(u, "Closed");
+    shm_update_emergency_stop(u, 0);
+    shm_update_emergency_mode(u, 0);
+    if (state->door_obstruction != 0 || state->overload != 0)
+    {
+        state->door_obstruction = 0;
+        state->overload = 0;
+        shm_mark_dirty(u, SHM_FIELD_DOOR_OBSTRUCTION | SHM_FIELD_OVERLOAD);
+    }
+}
+
+/*
+ * Injects one fault and waits up to timeout_ms for safety to correct it.
+ * Returns the round trip in nanoseconds, or UINT64_MAX if it was missed.
+ */
+static uint64_t inject_fault(car_shared_mem *state, safety_fault_t fault,
+                             uint32_t timeout_ms)
+{
+    shm_update_t u;
+    shm_begin(&u, state, LOCK_SITE_SAFETY_STRESS);
+    apply_fault(&u, fault);
+    uint64_t start = monotonic_ns();
+    shm_publish(&u);
+
+    struct timespec deadline;
+    shm_deadline(state, timeout_ms, &deadline);
+    bool reacted;
+    while (!(reacted = has_reacted(state, fault)))
+    {
+        if (shm_cond_timedwait(state, &deadline) == ETIMEDOUT)
+        {
+            reacted = has_reacted(state, fault);
+            break;
+        }
+    }
+    uint64_t round_trip = monotonic_ns() - start;
+
+    clear_faults(&u);
+    shm_commit(&u);
+    return reacted ? round_trip : UINT64_MAX;
+}
+
+/*
+ * Injects a fault and records the outcome.
+ */
+static void run_fault(car_shared_mem *state, safety_fault_t fault,
+                      stress_result_t *result)
+{
+    result->injected[fault]++;
+    uint64_t round_trip = inject_fault(state, fault, STRESS_TIMEOUT_MS);
+    if (round_trip == UINT64_MAX)
+    {
+        result->missed[fault]++;
+    }
+    else
+    {
+        safety_stats_record(&result->observed, fault, round_trip);
+    }
+}
+
+/*
+ * Prints one table of reaction latencies in microseconds.
+ */
+static void print_latencies(const char *title, const safety_stats_t *stats,
+                            const stress_result_t *result)
+{
+    printf("%-18s %9s %9s | %9s %9s %9s %9s\n", title, "injected", "missed",
+           "avg", "p50", "p99", "max");
+    for (int i = 0; i < SAFETY_FAULT_COUNT; i++)
+    {
+        const safety_fault_stats_t *s = &stats->faults[i];
+        uint64_t reactions = atomic_load(&s->reactions);
+
+        printf("%-18s %9lu %9lu | %9.2f %9.2f %9.2f %9.2f\n",
+               safety_fault_name((safety_fault_t)i),
+               (unsigned long)result->injected[i],
+               (unsigned long)result->missed[i],
+               reactions > 0 ? (double)atomic_load(&s->total_ns) /
+                                   (double)reactions / 1000.0
+                             : 0.0,
+               (double)lock_hist_percentile(s->hist, 50.0) / 1000.0,
+               (double)lock_hist_percentile(s->hist, 99.0) / 1000.0,
+               (double)atomic_load(&s->max_ns) / 1000.0);
+    }
+}
+
+/*
+ * Creates the car, runs safety on it and injects faults at it as fast as
+ * safety corrects them. See the top of this file.
+ */
+int stress_safety(const char *safety_path, const char *car_name,
+                  size_t faults)
+{
+    char *shm_name = get_shm_name(car_name);
+    car_shared_mem *state = NULL;
+    int fd = -1;
+    if (!create_shared_mem(&state, &fd, shm_name))
+    {
+        perror(shm_name);
+        free(shm_name);
+        return 1;
+    }
+    init_shm(state);
+    car_shm_ext *ext = get_shm_ext(state);
+
+    int status = 1;
+    pid_t pid = start_safety(safety_path, car_name);
+    if (pid > 0)
+    {
+        /* Safety may not be waiting on the car yet, so the first fault is
+         * given longer and doesn't count. */
+        if (inject_fault(state, SAFETY_FAULT_DATA, STRESS_STARTUP_MS) ==
+            UINT64_MAX)
+        {
+            printf("Safety didn't start watching car %s.\n", car_name);
+        }
+        else
+        {
+            shm_lock(state, LOCK_SITE_SAFETY_STRESS);
+            memset(&ext->safety, 0, sizeof(ext->safety));
+            shm_unlock(state);
+
+            stress_result_t result;
+            memset(&result, 0, sizeof(result));
+            uint64_t start = monotonic_ns();
+            for (size_t i = 0; i < faults; i++)
+            {
+                run_fault(state,
+                          i % 2 == 0 ? SAFETY_FAULT_OBSTRUCTION
+                                     : SAFETY_FAULT_DATA,
+                          &result);
+            }
+            run_fault(state, SAFETY_FAULT_EMERGENCY_STOP, &result);
+            run_fault(state, SAFETY_FAULT_OVERLOAD, &result);
+            double seconds = (double)(monotonic_ns() - start) / 1e9;
+
+            print_latencies("round trip", &result.observed, &result);
+            printf("\n");
+            print_latencies("safety", &ext->safety, &result);
+            printf("\n%zu faults in %.2f s (%.0f per second)\n", faults + 2,
+                   seconds, (double)(faults + 2) / seconds);
+
+            status = 0;
+            for (int i = 0; i < SAFETY_FAULT_COUNT; i++)
+            {
+                if (result.missed[i] > 0)
+                {
+                    status = 1;
+                }
+            }
+        }
+
+        kill(pid, SIGINT);
+        waitpid(pid, NULL, 0);
+    }
+
+    unmap_car(state);
+    close(fd);
+    shm_unlink(shm_name);
+    free(shm_name);
+    return status;
+}
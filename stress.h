@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * This header file defines the fault injection harness run by
+ * `safety --stress {car name} [faults]`, which measures how quickly the safety
+ * component reacts to faults injected back to back.
+ *
+ * See stress.c for implementation details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "safetystat.h"
+
+/* Number of faults injected when none is given */
+#define STRESS_DEFAULT_FAULTS 10000
+/* How long safety is given to react to a fault before it counts as missed */
+#define STRESS_TIMEOUT_MS 1000
+/* How long safety is given to start watching the car */
+#define STRESS_STARTUP_MS 3000
+
+/*
+ * Results of a stress run, timed by the harness from publishing a fault to
+ * seeing the correction
+ */
+typedef struct
+{
+    safety_stats_t observed;              // Round trip latencies
+    uint64_t injected[SAFETY_FAULT_COUNT]; // Faults injected of each kind
+    uint64_t missed[SAFETY_FAULT_COUNT];   // Faults safety didn't correct
+} stress_result_t;
+
+// Creates the car, starts the safety program given by the path on it, injects
+// the faults and prints the results, returns 1 if any fault was missed
+int stress_safety(const char *, const char *, size_t);
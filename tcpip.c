@@ -1,4 +1,5 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -6,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "tcpip.h"
@@ -84,7 +86,10 @@ bool connect_to_controller(int *sd, struct sockaddr_in *sockaddr)
     return true;
 }
 
-void send_looped(int fd, const void *buf, size_t sz)
+/*
+ * Writes the whole buffer. Returns false if the connection failed.
+ */
+bool send_looped(int fd, const void *buf, size_t sz)
 {
     const char *ptr = buf;
     size_t remain = sz;
@@ -94,60 +99,216 @@ void send_looped(int fd, const void *buf, size_t sz)
         ssize_t sent = write(fd, ptr, remain);
         if (sent == -1)
         {
-            perror("write()");
-            exit(1);
+            if (errno == EINTR)
+                continue;
+            return false;
         }
         ptr += sent;
         remain -= (long unsigned)sent;
     }
+    return true;
+}
+
+/*
+ * Formats a length prefixed message into a frame of size bytes. Returns the
+ * frame's length, or 0 if the message doesn't fit.
+ */
+static size_t format_frame(char *frame, size_t size, const char *format,
+                           va_list args)
+{
+    char *message = frame + sizeof(uint32_t);
+    int message_len =
+        vsnprintf(message, size - sizeof(uint32_t), format, args);
+    if (message_len < 0 || message_len >= (int)(size - sizeof(uint32_t)))
+    {
+        return 0;
+    }
+
+    uint32_t len = htonl((uint32_t)message_len);
+    memcpy(frame, &len, sizeof(len));
+    return sizeof(len) + (size_t)message_len;
 }
 
-void send_message(int fd, const char *format, ...)
+/*
+ * Sends a length prefixed message. Returns false if it couldn't be sent.
+ */
+bool send_message(int fd, const char *format, ...)
 {
+    /* The length prefix and the message go out in a single write. Two small
+     * writes in a row would leave the second one waiting for the peer's
+     * delayed ACK of the first, adding tens of milliseconds to every
+     * exchange on a connection that is used more than once. */
+    char frame[sizeof(uint32_t) + 1024];
     va_list args;
     va_start(args, format);
-
-    char message[1024];
-    int message_len = vsnprintf(message, sizeof(message), format, args);
+    size_t frame_len = format_frame(frame, sizeof(frame), format, args);
     va_end(args);
 
-    if (message_len < 0 || message_len >= (int)sizeof(message))
+    return frame_len > 0 && send_looped(fd, frame, frame_len);
+}
+
+/*
+ * Sends a length prefixed message without blocking. Returns false if it
+ * couldn't be sent whole, e.g. because the peer stopped reading and the
+ * socket's buffer is full. Part of the frame may have gone out, so the caller
+ * should hang up.
+ */
+bool send_message_nowait(int fd, const char *format, ...)
+{
+    char frame[sizeof(uint32_t) + 1024];
+    va_list args;
+    va_start(args, format);
+    size_t frame_len = format_frame(frame, sizeof(frame), format, args);
+    va_end(args);
+    if (frame_len == 0)
     {
-        return;
+        return false;
     }
 
-    uint32_t len = htonl((uint32_t)message_len);
-    send_looped(fd, &len, sizeof(len));
+    ssize_t sent;
+    do
+    {
+        sent = send(fd, frame, frame_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    return sent == (ssize_t)frame_len;
+}
 
-    send_looped(fd, message, (size_t)message_len);
+/*
+ * Initialises a reader for a socket. The reader is a plain struct with no
+ * pointers into itself, so it can be copied to hand a connection and any data
+ * already buffered for it over to someone else.
+ */
+void msg_reader_init(msg_reader_t *reader, int fd)
+{
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+    reader->held = 0;
+    reader->held_byte = '\0';
+    reader->has_held = false;
+    reader->failed = false;
 }
 
-void recv_looped(int fd, void *buf, size_t sz)
+/*
+ * Puts back the byte overwritten by the terminator of the last frame handed
+ * out, which ends that frame's lifetime.
+ */
+static void restore_held(msg_reader_t *reader)
 {
-    char *ptr = buf;
-    size_t remain = sz;
+    if (reader->has_held)
+    {
+        reader->buf[reader->held] = reader->held_byte;
+        reader->has_held = false;
+    }
+}
 
-    while (remain > 0)
+/*
+ * Moves the unread data to the front of the buffer.
+ */
+static void compact(msg_reader_t *reader)
+{
+    memmove(reader->buf, reader->buf + reader->start,
+            reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+}
+
+/*
+ * Reads as much as fits into the buffer with a single read(), first moving any
+ * partial frame to the front so a whole frame always fits in one piece.
+ * Returns the number of bytes read, 0 at end of file and -1 on error.
+ * Invalidates the last frame handed out.
+ */
+ssize_t msg_reader_fill(msg_reader_t *reader)
+{
+    restore_held(reader);
+    if (reader->failed)
     {
-        ssize_t received = read(fd, ptr, remain);
-        if (received == -1)
-        {
-            perror("read()");
-            exit(1);
-        }
-        ptr += received;
-        remain -= (unsigned long)received;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (reader->start > 0)
+    {
+        compact(reader);
     }
+
+    ssize_t received;
+    do
+    {
+        received = read(reader->fd, reader->buf + reader->end,
+                        sizeof(reader->buf) - reader->end);
+    } while (received == -1 && errno == EINTR);
+
+    if (received > 0)
+    {
+        reader->end += (size_t)received;
+    }
+    return received;
 }
 
-char *receive_msg(int fd)
+/*
+ * Hands out the next complete frame already in the buffer without making any
+ * system calls. The frame is NUL terminated in place by borrowing the byte
+ * after it, which is put back on the next call, so the frame is only valid
+ * until then. Returns NULL if no complete frame is buffered, or if the next
+ * frame could never fit, in which case the reader fails.
+ */
+char *msg_reader_frame(msg_reader_t *reader)
 {
+    restore_held(reader);
+
     uint32_t nlen;
-    recv_looped(fd, &nlen, sizeof(nlen));
-    uint32_t len = ntohl(nlen);
+    size_t available = reader->end - reader->start;
+    if (reader->failed || available < sizeof(nlen))
+    {
+        return NULL;
+    }
 
-    char *buf = malloc(len + 1);
-    buf[len] = '\0';
-    recv_looped(fd, buf, len);
-    return buf;
+    memcpy(&nlen, reader->buf + reader->start, sizeof(nlen));
+    size_t len = ntohl(nlen);
+    if (len > sizeof(reader->buf) - sizeof(nlen) - 1)
+    {
+        reader->failed = true;
+        return NULL;
+    }
+    if (available - sizeof(nlen) < len)
+    {
+        return NULL;
+    }
+
+    /* The terminator needs a byte after the frame. */
+    if (reader->start + sizeof(nlen) + len == sizeof(reader->buf))
+    {
+        compact(reader);
+    }
+
+    char *frame = reader->buf + reader->start + sizeof(nlen);
+    reader->start += sizeof(nlen) + len;
+    reader->held = reader->start;
+    reader->held_byte = reader->buf[reader->held];
+    reader->has_held = true;
+    frame[len] = '\0';
+    return frame;
+}
+
+/*
+ * Returns the next frame, reading from the socket only when no complete frame
+ * is buffered. Returns NULL if the connection was closed or failed first. The
+ * frame is only valid until the next call.
+ */
+char *msg_reader_next(msg_reader_t *reader)
+{
+    while (true)
+    {
+        char *frame = msg_reader_frame(reader);
+        if (frame != NULL)
+        {
+            return frame;
+        }
+        if (msg_reader_fill(reader) <= 0)
+        {
+            return NULL;
+        }
+    }
 }
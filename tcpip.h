@@ -1,7 +1,9 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdlib.h> // also provides size_t
+#include <sys/types.h>
 
 #define PORT 3000
 #define URL "127.0.0.1"
@@ -9,7 +11,41 @@
 void server_init(int *, struct sockaddr_in *);
 bool connect_to_controller(int *, struct sockaddr_in *);
 
-void send_looped(int, const void *, size_t);
-void send_message(int, const char *, ...);
-void recv_looped(int, void *, size_t);
-char *receive_msg(int);
+/* Size of the buffer each connection reads into, large enough for several
+ * frames of the largest message send_message() produces */
+#define MSG_READER_SIZE 4096
+
+/*
+ * Buffered reader for the length prefixed messages sent with send_message().
+ * Data is read from the socket in large chunks and frames are handed out as
+ * views into the buffer, so receiving a message needs no allocation and a
+ * burst of messages costs a single read().
+ */
+typedef struct msg_reader
+{
+    int fd;                     // The socket being read
+    size_t start;               // First byte not yet handed out
+    size_t end;                 // One past the last byte read
+    size_t held;                // Offset of the byte borrowed as a terminator
+    char held_byte;             // Its original value
+    bool has_held;              // A byte is currently borrowed
+    bool failed;                // A frame too large for the buffer arrived
+    char buf[MSG_READER_SIZE];  // Data read from the socket
+} msg_reader_t;
+
+// The send and receive functions fail when the peer has gone away rather than
+// exiting, so a program can notice and reconnect.
+bool send_looped(int, const void *, size_t);
+bool send_message(int, const char *, ...);
+// Like send_message() but fails instead of blocking, for peers that may stop
+// reading. The connection should be dropped if it fails.
+bool send_message_nowait(int, const char *, ...);
+
+// Initialises a reader for a socket
+void msg_reader_init(msg_reader_t *, int);
+// Reads once from the socket, returns the byte count, 0 at EOF or -1
+ssize_t msg_reader_fill(msg_reader_t *);
+// Returns the next buffered frame, or NULL if there isn't a complete one
+char *msg_reader_frame(msg_reader_t *);
+// Returns the next frame, reading as needed, or NULL if the connection ended
+char *msg_reader_next(msg_reader_t *);
@@ -5,6 +5,8 @@
 #include <ncurses.h>
 #include <math.h>
 #include <dirent.h>
+#include <errno.h>
+#include <sys/inotify.h>
 #include <sys/time.h>
 #include "shared.h"
 
@@ -14,19 +16,32 @@
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+// Cars are mapped once, when their shared memory appears in /dev/shm, and
+// stay mapped until it is removed. An inotify watch on /dev/shm says when
+// that happens, so the directory is only read in full at startup (or every
+// frame if inotify isn't available).
 struct carinfo {
     char name[128];
     int64_t delay;
     struct timeval status_tv;
     char state;
-    car_shared_mem mem;
+    car_shared_mem *shm; // Mapped for as long as the car exists
+    car_shared_mem mem;  // Copy of *shm as last drawn
+    int dirty;           // Its column needs drawing again
+    int settled;         // Drawn where its movement ends
     struct carinfo *next;
 };
 
 static struct carinfo *cars = NULL;
 static int highest = 1, lowest = 1;
+// Set when every column has to be drawn again, e.g. a car came or went
+static int layout_dirty = 1;
 int64_t us_diff(const struct timeval *, const struct timeval *);
 void scan_cars(void);
+void watch_cars(int);
+void update_cars(void);
+int animating(const struct carinfo *);
+void draw_car(struct carinfo *, int, int, int, int, const struct timeval *);
 
 int fti(const char *f)
 {
@@ -53,126 +68,81 @@ int main(int argc, char **argv)
 	initscr();
     nodelay(stdscr, true);
 
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch != -1 && inotify_add_watch(watch, "/dev/shm", IN_CREATE |
+            IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1) {
+        close(watch);
+        watch = -1;
+    }
+    scan_cars();
+
+    int last_w = 0, last_h = 0;
     for (;;) {
-        erase();
-        move(0, 20);
-        scan_cars();
         if (getch() == 27) { // Esc
             break;
         }
+        if (watch != -1) {
+            watch_cars(watch);
+        } else {
+            scan_cars();
+        }
+        update_cars();
+
         int w, h;
         getmaxyx(stdscr, h, w);
+        if (w != last_w || h != last_h) {
+            last_w = w;
+            last_h = h;
+            layout_dirty = 1;
+        }
 
         int height = highest - lowest + 1;
-        
-        // Write floor numbers
-        for (int i = 0; i < height; i++) {
-            int y1 = (h * i / height);
-            int y2 = (h * (i + 1) / height - 1);
-            move((y1 + y2) / 2, 0);
-            char buf[4];
-            itf(buf, highest - i);
-            printw("%s", buf);
-        }
 
         // Count how many cars are active
         int numcars = 0;
         struct carinfo *c = cars;
         while (c != NULL) {
-            if (c->state == 'c') numcars++;
+            numcars++;
             c = c->next;
         }
 
-        // Draw each car
-        c = cars;
-        int carpos = 0;
+        if (layout_dirty) {
+            erase();
+            // Write floor numbers
+            for (int i = 0; i < height; i++) {
+                int y1 = (h * i / height);
+                int y2 = (h * (i + 1) / height - 1);
+                move((y1 + y2) / 2, 0);
+                char buf[4];
+                itf(buf, highest - i);
+                printw("%s", buf);
+            }
+        }
 
         struct timeval current_tv;
         gettimeofday(&current_tv, NULL);
 
+        // Draw each car whose column changed, or that is moving or has its
+        // doors moving and so looks different every frame
+        c = cars;
+        int carpos = 0;
         while (c != NULL) {
-            if (c->state != 'c') continue; // Only render active cars
-
-            // Determine X bounds of the car
-            int x1 = ((w - 4) * carpos / numcars) + 4;
-            int x2 = ((w - 4) * (carpos + 1) / numcars) + 3;
-            int colwidth = x2 - x1 + 1;
-            // Determine Y bounds of the car
-            int current_floor = fti(c->mem.current_floor);
-            
-            float floor = height - 1 - (current_floor - lowest);
-            // Look at timestamp of last status change - guess progress
-            int64_t us_passed = us_diff(&c->status_tv, &current_tv);
-            float progress = fminf(1.0f * us_passed / c->delay, 1.0f);
-
-            if (strcmp(c->mem.status, "Between")==0) {
-                int destination_floor = fti(c->mem.destination_floor);
-                int dir = (destination_floor - current_floor) / abs(destination_floor - current_floor);
-                floor -= progress * dir;
-            }
-            
-            int y1 = (int) roundf(h * floor / height);
-            int y2 = (int) roundf(h * (floor + 1) / height - 1);
-
-            for (int x = x1; x <= x2; x++) {
-                move(y1, x);
-                printw("=");
-                move(y2, x);
-                printw("=");
+            if (layout_dirty || c->dirty || animating(c)) {
+                draw_car(c, carpos, numcars, w, h, &current_tv);
+                c->dirty = 0;
             }
-            for (int y = y1 + 1; y < y2; y++) {
-                move(y, x1);
-                printw("||");
-                move(y, x2-1);
-                printw("||");
-            }
-            // Draw the insides of the car, showing the doors open/closed
-            int door_closed_w;
-            if (strcmp(c->mem.status, "Open")==0) {
-                door_closed_w = 0;
-            } else if (strcmp(c->mem.status, "Opening")==0) {
-                door_closed_w = (int) roundf( (colwidth - 2) / 2 * (1.0f - progress) );
-            } else if (strcmp(c->mem.status, "Closing")==0) {
-                door_closed_w = (int) roundf( (colwidth - 2) / 2 * progress );
-            } else {
-                door_closed_w = (colwidth - 2) / 2;
-            }
-
-            // Display service mode / emergency mode
-            move(y2, x1);
-            if (c->mem.individual_service_mode) printw("(S)");
-            if (c->mem.emergency_mode) printw("(E)");
-
-            for (int y = y1 + 1; y < y2; y++) {
-                move(y, x1 + 2);
-                for (int i = 2; i < door_closed_w; i++) {
-                    printw(".");
-                }
-                move(y, x2 - door_closed_w);
-                for (int i = 0; i < door_closed_w - 1; i++) {
-                    printw(".");
-                }
-                move(y, x1 + door_closed_w);
-                printw("|");
-                move(y, x2 - door_closed_w);
-                printw("|");
-            }
-
-            // Write car name
-            move(y1, (colwidth - strlen(c->name + 3) - 4)/2 + x1);
-            printw("( %s )", c->name + 3);
-            // Write car status
-            move(y2, (colwidth - strlen(c->mem.status))/2 + x1);
-            printw("%s", c->mem.status);
-            
             carpos++;
             c = c->next;
         }
-        
+        layout_dirty = 0;
+
         move(0, 0);
-        
+
         refresh();
         usleep(REFRESH_DELAY);
+    }
+    if (watch != -1) {
+        close(watch);
     }
 	endwin();
 
@@ -186,6 +156,101 @@ int64_t us_diff(const struct timeval *before, const struct timeval *after)
     return diff;
 }
 
+int animating(const struct carinfo *c)
+{
+    if (c->settled) return 0;
+    return strcmp(c->mem.status, "Between")==0 ||
+        strcmp(c->mem.status, "Opening")==0 ||
+        strcmp(c->mem.status, "Closing")==0;
+}
+
+void draw_car(struct carinfo *c, int carpos, int numcars, int w, int h,
+    const struct timeval *current_tv)
+{
+    int height = highest - lowest + 1;
+
+    // Determine X bounds of the car
+    int x1 = ((w - 4) * carpos / numcars) + 4;
+    int x2 = ((w - 4) * (carpos + 1) / numcars) + 3;
+    int colwidth = x2 - x1 + 1;
+
+    // Clear the car's column, leaving the others as they are
+    for (int y = 0; y < h; y++) {
+        mvhline(y, x1, ' ', colwidth);
+    }
+
+    // Determine Y bounds of the car
+    int current_floor = fti(c->mem.current_floor);
+
+    float floor = height - 1 - (current_floor - lowest);
+    // Look at timestamp of last status change - guess progress
+    int64_t us_passed = us_diff(&c->status_tv, current_tv);
+    float progress = fminf(1.0f * us_passed / c->delay, 1.0f);
+    c->settled = progress >= 1.0f;
+
+    if (strcmp(c->mem.status, "Between")==0) {
+        int destination_floor = fti(c->mem.destination_floor);
+        if (destination_floor != current_floor) {
+            int dir = (destination_floor - current_floor) / abs(destination_floor - current_floor);
+            floor -= progress * dir;
+        }
+    }
+
+    int y1 = (int) roundf(h * floor / height);
+    int y2 = (int) roundf(h * (floor + 1) / height - 1);
+
+    for (int x = x1; x <= x2; x++) {
+        move(y1, x);
+        printw("=");
+        move(y2, x);
+        printw("=");
+    }
+    for (int y = y1 + 1; y < y2; y++) {
+        move(y, x1);
+        printw("||");
+        move(y, x2-1);
+        printw("||");
+    }
+    // Draw the insides of the car, showing the doors open/closed
+    int door_closed_w;
+    if (strcmp(c->mem.status, "Open")==0) {
+        door_closed_w = 0;
+    } else if (strcmp(c->mem.status, "Opening")==0) {
+        door_closed_w = (int) roundf( (colwidth - 2) / 2 * (1.0f - progress) );
+    } else if (strcmp(c->mem.status, "Closing")==0) {
+        door_closed_w = (int) roundf( (colwidth - 2) / 2 * progress );
+    } else {
+        door_closed_w = (colwidth - 2) / 2;
+    }
+
+    // Display service mode / emergency mode
+    move(y2, x1);
+    if (c->mem.individual_service_mode) printw("(S)");
+    if (c->mem.emergency_mode) printw("(E)");
+
+    for (int y = y1 + 1; y < y2; y++) {
+        move(y, x1 + 2);
+        for (int i = 2; i < door_closed_w; i++) {
+            printw(".");
+        }
+        move(y, x2 - door_closed_w);
+        for (int i = 0; i < door_closed_w - 1; i++) {
+            printw(".");
+        }
+        move(y, x1 + door_closed_w);
+        printw("|");
+        move(y, x2 - door_closed_w);
+        printw("|");
+    }
+
+    // Write car name
+    move(y1, (colwidth - strlen(c->name + 3) - 4)/2 + x1);
+    printw("( %s )", c->name + 3);
+    // Write car status
+    move(y2, (colwidth - strlen(c->mem.status))/2 + x1);
+    printw("%s", c->mem.status);
+}
+
 struct carinfo *get_car_by_name(const char *name)
 {
     struct carinfo *c = cars;
@@ -198,28 +263,111 @@ struct carinfo *get_car_by_name(const char *name)
     return NULL;
 }
 
+// Includes the floors a car is at and going to in the range shown
+void fit_floors(const car_shared_mem *mem)
+{
+    int old_highest = highest, old_lowest = lowest;
+    int curr_floor = fti(mem->current_floor);
+    highest = MAX(highest, curr_floor);
+    lowest = MIN(lowest, curr_floor);
+    int dest_floor = fti(mem->destination_floor);
+    highest = MAX(highest, dest_floor);
+    lowest = MIN(lowest, dest_floor);
+    if (highest != old_highest || lowest != old_lowest) layout_dirty = 1;
+}
+
+// Maps a car's shared memory the first time it is seen. The car creates it
+// before setting its size, so one that is still too small is left until the
+// next change to it.
+struct carinfo *add_car(const char *name)
+{
+    struct carinfo *c = get_car_by_name(name);
+    if (c != NULL) {
+        return c;
+    }
+
+    char shmname[257];
+    snprintf(shmname, sizeof(shmname), "/%s", name);
+    int fd = shm_open(shmname, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(car_shared_mem)) {
+        close(fd);
+        return NULL;
+    }
+    car_shared_mem *shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    c = malloc(sizeof(struct carinfo));
+    if (c == NULL) {
+        munmap(shm, sizeof(*shm));
+        return NULL;
+    }
+    snprintf(c->name, sizeof(c->name), "%s", name);
+
+    // Insert in alphabetical order
+    if (cars == NULL || strcmp(name, cars->name) < 0) {
+        c->next = cars;
+        cars = c;
+    } else {
+        struct carinfo *t = cars;
+        while (t != NULL) {
+            if (t->next == NULL || strcmp(name, t->next->name) < 0) {
+                c->next = t->next;
+                t->next = c;
+                break;
+            }
+            t = t->next;
+        }
+    }
+
+    gettimeofday(&c->status_tv, NULL);
+    c->shm = shm;
+    c->mem = *shm;
+    c->delay = 1000000; // Default (1000ms)
+    c->state = 'c';
+    c->dirty = 1;
+    c->settled = 0;
+    fit_floors(&c->mem);
+    layout_dirty = 1;
+    return c;
+}
+
+void remove_car(struct carinfo *c)
+{
+    if (cars == c) {
+        cars = c->next;
+    } else {
+        struct carinfo *t = cars;
+        while (t->next != c) {
+            t = t->next;
+        }
+        t->next = c->next;
+    }
+    munmap(c->shm, sizeof(*c->shm));
+    free(c);
+    layout_dirty = 1;
+}
+
 void cleanup(void)
 {
     // Clean up cars that are no longer present
     struct carinfo *c = cars;
-    struct carinfo *prev = NULL;
     while (c != NULL) {
+        struct carinfo *next = c->next;
         if (c->state == 'o') {
-            if (prev) {
-                prev->next = c->next;
-            } else {
-                cars = c->next;
-            }
-            struct carinfo *old = c;
-            c = c->next;
-            free(old);
-        } else {
-            prev = c;
-            c = c->next;
+            remove_car(c);
         }
+        c = next;
     }
 }
 
+// Reads the whole of /dev/shm, adding new cars and removing ones that are gone
 void scan_cars(void)
 {
     {
@@ -227,15 +375,11 @@ void scan_cars(void)
         // track of the ones that need to be removed.
         struct carinfo *c = cars;
         while (c != NULL) {
-            if (c->state == 'c') c->state = 'o';
+            c->state = 'o';
             c = c->next;
         }
     }
 
-    // Get the current time
-    struct timeval current_tv;
-    gettimeofday(&current_tv, NULL);
-
     DIR *dir = opendir("/dev/shm");
     if (dir) {
         for (;;) {
@@ -243,62 +387,10 @@ void scan_cars(void)
             if (!e) break;
 
             if (strncmp(e->d_name, "car", 3)==0) {
-                struct carinfo *c = get_car_by_name(e->d_name);
-                char shmname[257];
-                sprintf(shmname, "/%s", e->d_name);
-                int fd = shm_open(shmname, O_RDWR, 0);
-                if (fd == -1) {
-                    // Failed to load - skip and keep looping
-                    continue;
-                }
-                car_shared_mem *shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                if (c == NULL) {
-                    c = malloc(sizeof(struct carinfo));
-                    strncpy(c->name, e->d_name, 127);
-
-                    // Insert in alphabetical order
-                    if (cars == NULL || strcmp(e->d_name, cars->name) == -1) {
-                        c->next = cars;
-                        cars = c;
-                    } else {
-                        struct carinfo *t = cars;
-                        while (t != NULL) {
-                            if (t->next == NULL || strcmp(e->d_name, t->next->name) == -1) {
-                                c->next = t->next;
-                                t->next = c;
-                                break;
-                            }
-                            t = t->next;
-                        }
-                    }
-
-                    c->status_tv = current_tv;
-                    c->mem = *shm;
-                    c->delay = 1000000; // Default (1000ms)
+                struct carinfo *c = add_car(e->d_name);
+                if (c != NULL) {
+                    c->state = 'c';
                 }
-                c->state = 'c';
-                if (strcmp(c->mem.status, shm->status) != 0 || strcmp(c->mem.current_floor, shm->current_floor) != 0) {
-                    if ((strcmp(c->mem.status, "Between")==0 && strcmp(shm->status, "Opening")==0) ||
-                        (strcmp(c->mem.status, "Between")==0 && strcmp(shm->status, "Closed")==0) ||
-                        (strcmp(c->mem.status, "Opening")==0 && strcmp(shm->status, "Open")==0) ||
-                        (strcmp(c->mem.status, "Closing")==0 && strcmp(shm->status, "Closed")==0) ||
-                        (strcmp(c->mem.current_floor, shm->current_floor)!=0)) {
-                            c->delay = us_diff(&c->status_tv, &current_tv);
-                    }
-                    c->status_tv = current_tv;
-                }
-                c->mem = *shm;
-
-                // Dynamically resize
-                int curr_floor = fti(c->mem.current_floor);
-                highest = MAX(highest, curr_floor);
-                lowest = MIN(lowest, curr_floor);
-                int dest_floor = fti(c->mem.destination_floor);
-                highest = MAX(highest, dest_floor);
-                lowest = MIN(lowest, dest_floor);
-
-                munmap(shm, sizeof(*shm));
-                close(fd);
             }
         }
 
@@ -307,3 +399,70 @@ void scan_cars(void)
 
     cleanup();
 }
+
+// Adds and removes cars as their shared memory comes and goes
+void watch_cars(int watch)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(watch, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) continue;
+            return;
+        }
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *e = (const struct inotify_event *)p;
+            p += sizeof(*e) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                // Missed some, so look at everything
+                scan_cars();
+                continue;
+            }
+            if (e->len == 0 || strncmp(e->name, "car", 3) != 0) {
+                continue;
+            }
+            if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                struct carinfo *c = get_car_by_name(e->name);
+                if (c != NULL) remove_car(c);
+            } else {
+                add_car(e->name);
+            }
+        }
+    }
+}
+
+// Takes a fresh copy of each car's shared memory, marking the cars that
+// look different
+void update_cars(void)
+{
+    // Get the current time
+    struct timeval current_tv;
+    gettimeofday(&current_tv, NULL);
+
+    for (struct carinfo *c = cars; c != NULL; c = c->next) {
+        car_shared_mem mem = *c->shm;
+        if (strcmp(c->mem.status, mem.status) != 0 || strcmp(c->mem.current_floor, mem.current_floor) != 0) {
+            if ((strcmp(c->mem.status, "Between")==0 && strcmp(mem.status, "Opening")==0) ||
+                (strcmp(c->mem.status, "Between")==0 && strcmp(mem.status, "Closed")==0) ||
+                (strcmp(c->mem.status, "Opening")==0 && strcmp(mem.status, "Open")==0) ||
+                (strcmp(c->mem.status, "Closing")==0 && strcmp(mem.status, "Closed")==0) ||
+                (strcmp(c->mem.current_floor, mem.current_floor)!=0)) {
+                    c->delay = us_diff(&c->status_tv, &current_tv);
+            }
+            c->status_tv = current_tv;
+        }
+        if (strcmp(c->mem.status, mem.status) != 0 ||
+            strcmp(c->mem.current_floor, mem.current_floor) != 0 ||
+            strcmp(c->mem.destination_floor, mem.destination_floor) != 0 ||
+            c->mem.individual_service_mode != mem.individual_service_mode ||
+            c->mem.emergency_mode != mem.emergency_mode) {
+            c->dirty = 1;
+            c->settled = 0;
+        }
+        c->mem = mem;
+
+        // Dynamically resize
+        fit_floors(&c->mem);
+    }
+}
@@ -0,0 +1,130 @@
+#include "shared.h"
+
+// Tester for car (with controller, --plan. No shared memory tests.)
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t car(const char *, const char *, const char *, const char *);
+void cleanup(pid_t);
+void server_init();
+void test_recv(int, const char *);
+void test_check(char *, const char *);
+char *test_travel(int, const char *);
+
+int server_fd;
+
+int main()
+{
+  shm_unlink("/carTest"); // Remove shm object if it exists
+
+  pid_t p;
+
+  server_init();
+
+  p = car("Test", "1", "8", "20");
+
+  int fd;
+  fd = accept(server_fd, NULL, NULL);
+  test_recv(fd, "RECV: CAR Test 1 8");
+  test_recv(fd, "RECV: FEATURES PLAN");
+  test_recv(fd, "RECV: STATUS Closed 1 1");
+
+  // Plan a stop on the current floor first. The doors have to finish cycling
+  // before the car leaves for the next stop
+  send_message(fd, "PLAN 1 3 2");
+  test_recv(fd, "RECV: STATUS Opening 1 1");
+  test_recv(fd, "RECV: STATUS Open 1 1");
+  test_recv(fd, "RECV: STATUS Closing 1 1");
+  test_recv(fd, "RECV: STATUS Closed 1 1");
+
+  // The car moves on to each stop by itself once the doors have cycled
+  test_check(test_travel(fd, "3"), "RECV: STATUS Opening 3 3");
+  test_recv(fd, "RECV: STATUS Open 3 3");
+  test_recv(fd, "RECV: STATUS Closing 3 3");
+  test_recv(fd, "RECV: STATUS Closed 3 3");
+  test_check(test_travel(fd, "2"), "RECV: STATUS Opening 2 2");
+  test_recv(fd, "RECV: STATUS Open 2 2");
+  test_recv(fd, "RECV: STATUS Closing 2 2");
+  test_recv(fd, "RECV: STATUS Closed 2 2");
+
+  close(fd);
+  close(server_fd);
+
+  cleanup(p);
+  printf("\nTests completed.\n");
+}
+
+void test_recv(int fd, const char *t)
+{
+  test_check(receive_msg(fd), t);
+}
+
+void test_check(char *m, const char *t)
+{
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+// Receives the car travelling to floor `to`, which may be sent as any number
+// of Closed or Between updates, and returns the first message after them
+char *test_travel(int fd, const char *to)
+{
+  char expected[64];
+  snprintf(expected, sizeof(expected), "Travelled to %s with the doors closed",
+           to);
+  msg(expected);
+
+  char *m = receive_msg(fd);
+  const char *last;
+  while ((strncmp(m, "STATUS Closed ", 14) == 0 ||
+          strncmp(m, "STATUS Between ", 15) == 0) &&
+         (last = strrchr(m, ' ')) != NULL && strcmp(last + 1, to) == 0) {
+    free(m);
+    m = receive_msg(fd);
+  }
+
+  if (strncmp(m, "STATUS Opening ", 15) == 0) {
+    printf("%s\n", expected);
+  } else {
+    printf("RECV: %s\n", m);
+  }
+  return m;
+}
+
+void cleanup(pid_t p)
+{
+  kill(p, SIGINT);
+  usleep(DELAY);
+  shm_unlink("/carTest");
+}
+
+pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./car", "./car", "--plan", name, lowest_floor, highest_floor, delay, NULL);
+  }
+
+  return pid;
+}
+
+void server_init()
+{
+  struct sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_port = htons(3000);
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int opt_enable = 1;
+  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable));
+  if (bind(server_fd, (const struct sockaddr *)&a, sizeof(a)) == -1) {
+    perror("bind()");
+    exit(1);
+  }
+
+  listen(server_fd, 10);
+}
@@ -0,0 +1,149 @@
+#include "shared.h"
+
+// Tester for car (with controller, FLOOR for the current destination. No
+// shared memory tests.)
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t car(const char *, const char *, const char *, const char *);
+void cleanup(pid_t);
+void server_init();
+void test_recv(int, const char *);
+void test_check(char *, const char *);
+char *test_travel(int, const char *);
+char *test_skip(int, const char *);
+
+int server_fd;
+
+int main()
+{
+  shm_unlink("/carTest"); // Remove shm object if it exists
+
+  pid_t p;
+
+  server_init();
+
+  p = car("Test", "1", "8", "100");
+
+  int fd;
+  fd = accept(server_fd, NULL, NULL);
+  test_recv(fd, "RECV: CAR Test 1 8");
+  test_recv(fd, "RECV: STATUS Closed 1 1");
+
+  // Sending the destination again while travelling must not open the doors
+  // between floors. They open when the car gets there
+  send_message(fd, "FLOOR 5");
+  test_check(test_skip(fd, "STATUS Closed 1 5"), "RECV: STATUS Between 1 5");
+  send_message(fd, "FLOOR 5");
+  test_check(test_travel(fd, "5"), "RECV: STATUS Opening 5 5");
+  test_recv(fd, "RECV: STATUS Open 5 5");
+
+  // Sending the floor the car is on while the doors are open cycles them again
+  // once they have closed
+  send_message(fd, "FLOOR 5");
+  test_recv(fd, "RECV: STATUS Closing 5 5");
+  test_check(test_skip(fd, "STATUS Closed 5 5"), "RECV: STATUS Opening 5 5");
+  test_recv(fd, "RECV: STATUS Open 5 5");
+  test_recv(fd, "RECV: STATUS Closing 5 5");
+  test_recv(fd, "RECV: STATUS Closed 5 5");
+
+  // And sending it with the doors closed cycles them straight away
+  send_message(fd, "FLOOR 5");
+  test_recv(fd, "RECV: STATUS Opening 5 5");
+  test_recv(fd, "RECV: STATUS Open 5 5");
+  test_recv(fd, "RECV: STATUS Closing 5 5");
+  test_recv(fd, "RECV: STATUS Closed 5 5");
+
+  close(fd);
+  close(server_fd);
+
+  cleanup(p);
+  printf("\nTests completed.\n");
+}
+
+void test_recv(int fd, const char *t)
+{
+  test_check(receive_msg(fd), t);
+}
+
+void test_check(char *m, const char *t)
+{
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+// Receives the car travelling to floor `to`, which may be sent as any number
+// of Closed or Between updates, and returns the first message after them
+char *test_travel(int fd, const char *to)
+{
+  char expected[64];
+  snprintf(expected, sizeof(expected), "Travelled to %s with the doors closed",
+           to);
+  msg(expected);
+
+  char *m = receive_msg(fd);
+  const char *last;
+  while ((strncmp(m, "STATUS Closed ", 14) == 0 ||
+          strncmp(m, "STATUS Between ", 15) == 0) &&
+         (last = strrchr(m, ' ')) != NULL && strcmp(last + 1, to) == 0) {
+    free(m);
+    m = receive_msg(fd);
+  }
+
+  if (strncmp(m, "STATUS Opening ", 15) == 0) {
+    printf("%s\n", expected);
+  } else {
+    printf("RECV: %s\n", m);
+  }
+  return m;
+}
+
+// Returns the next message other than `skip`, which the car may or may not
+// send depending on how quickly it reports a status that is soon replaced
+char *test_skip(int fd, const char *skip)
+{
+  char *m = receive_msg(fd);
+  if (strcmp(m, skip) == 0) {
+    free(m);
+    m = receive_msg(fd);
+  }
+  return m;
+}
+
+void cleanup(pid_t p)
+{
+  kill(p, SIGINT);
+  usleep(DELAY);
+  shm_unlink("/carTest");
+}
+
+pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./car", "./car", name, lowest_floor, highest_floor, delay, NULL);
+  }
+
+  return pid;
+}
+
+void server_init()
+{
+  struct sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_port = htons(3000);
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int opt_enable = 1;
+  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable));
+  if (bind(server_fd, (const struct sockaddr *)&a, sizeof(a)) == -1) {
+    perror("bind()");
+    exit(1);
+  }
+
+  listen(server_fd, 10);
+}
@@ -1,4 +1,6 @@
 #include "shared.h"
+#include "../workload.h"
+#include <limits.h>
 #include <sys/time.h>
 
 // This is a multi-component tester that attempts to measure
@@ -18,6 +20,12 @@
 // --sim-end (value)
 // --histogram-len (number of bars on histogram)
 // --svg (filename - produces an animated svg)
+// --svg-start (milliseconds into the simulation the svg starts at)
+// --svg-end (milliseconds into the simulation the svg stops at)
+// --breakdown (car, floor or all - adds percentiles for each car and/or
+//              for each floor passengers called from)
+// --json (filename - writes the percentiles of every group as JSON)
+// --csv (filename - writes the percentiles of every group as CSV)
 
 #define CAR_DELAY       "100" // string, milliseconds
 #define CARS            1
@@ -29,6 +37,8 @@
 #define HISTOGRAM_LEN   5
 
 static double svg_timescale = 10.0;
+static int svg_window_start = 0;
+static int svg_window_end = -1; // -1 for the end of the simulation
 
 // NUM_PASSENGERS will be scheduled to arrive at random
 // times between SIM_START and SIM_END, and will arrive
@@ -39,6 +49,7 @@ typedef struct {
   char from[4], to[4], col[4];
   int delay;
   int idx;
+  int car; // Index of the car that came, -1 if the call failed
   int64_t time_waiting;
   int64_t time_in_elevator;
 } passenger_data;
@@ -71,6 +82,7 @@ void cleanup(pid_t);
 void cleanup_tracker(car_tracker *);
 void *sim_run(void *);
 
+void svg_init(void);
 void svg_write(void);
 void svg_add_event(struct timeval, int, int, int, int);
 
@@ -99,6 +111,9 @@ static int sim_end = SIM_END;
 static int histogram_len = HISTOGRAM_LEN;
 static const char *svg = NULL;
 static const char *svg_anim_id = SVG_ANIM_ID;
+static const char *breakdown = NULL;
+static const char *json = NULL;
+static const char *csv = NULL;
 
 static car_tracker *car_trackers;
 static passenger_data *pdata;
@@ -128,6 +143,99 @@ void draw_histogram(histogram *h) {
     }
 }
 
+// Metrics recorded for each group of passengers
+#define METRIC_WAIT 0
+#define METRIC_IN_CAR 1
+#define METRIC_END_TO_END 2
+#define METRICS 3
+
+static const char *metric_titles[METRICS] = {"Waiting", "In car", "End to end"};
+static const char *metric_keys[METRICS] = {"wait", "in_car", "end_to_end"};
+
+static const char *percentile_keys[WORKLOAD_NUM_PERCENTILES] = {"p50_ms", "p90_ms", "p99_ms", "p99_9_ms"};
+
+// Counts a time in a group's histogram, creating it on first use
+void record_time(workload_hist_t **h, int64_t v) {
+    if (!*h) {
+        *h = malloc(sizeof(workload_hist_t));
+        workload_hist_init(*h);
+    }
+    workload_hist_record(*h, v < 0 ? 0 : (uint64_t)v);
+}
+
+// A group of passengers: everyone, one car's or one floor's
+typedef struct {
+    const char *group;
+    char key[16];
+    workload_hist_t *h[METRICS];
+} time_group;
+
+static time_group *groups;
+static int num_groups;
+
+void print_percentiles(const time_group *g) {
+    static workload_hist_t empty;
+    workload_print_percentile_header();
+    for (int m = 0; m < METRICS; m++) {
+        workload_print_percentiles(metric_titles[m], g->h[m] ? g->h[m] : &empty);
+    }
+}
+
+void write_json(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+    fprintf(fp, "{\n  \"passengers\": %d,\n  \"cars\": %d,\n", num_passengers, cars);
+    fprintf(fp, "  \"lowest_floor\": \"%s\",\n  \"highest_floor\": \"%s\",\n", lowest_floor, highest_floor);
+    fprintf(fp, "  \"groups\": [");
+    int first = 1;
+    for (int i = 0; i < num_groups; i++) {
+        const time_group *g = &groups[i];
+        if (!g->h[METRIC_WAIT]) continue;
+        fprintf(fp, "%s\n    {\"group\": \"%s\", \"key\": \"%s\"", first ? "" : ",", g->group, g->key);
+        first = 0;
+        for (int m = 0; m < METRICS; m++) {
+            const workload_hist_t *h = g->h[m];
+            fprintf(fp, ",\n     \"%s\": {\"count\": %ld, \"avg_ms\": %.3f", metric_keys[m], (long)h->count, (double)h->total / h->count / 1000.0);
+            for (int p = 0; p < WORKLOAD_NUM_PERCENTILES; p++) {
+                fprintf(fp, ", \"%s\": %.3f", percentile_keys[p], workload_hist_percentile(h, workload_percentiles[p]) / 1000.0);
+            }
+            fprintf(fp, ", \"max_ms\": %.3f}", h->max / 1000.0);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+void write_csv(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+    fprintf(fp, "group,key,metric,count,avg_ms");
+    for (int p = 0; p < WORKLOAD_NUM_PERCENTILES; p++) {
+        fprintf(fp, ",%s", percentile_keys[p]);
+    }
+    fprintf(fp, ",max_ms\n");
+    for (int i = 0; i < num_groups; i++) {
+        const time_group *g = &groups[i];
+        if (!g->h[METRIC_WAIT]) continue;
+        for (int m = 0; m < METRICS; m++) {
+            const workload_hist_t *h = g->h[m];
+            fprintf(fp, "%s,%s,%s,%ld,%.3f", g->group, g->key, metric_keys[m], (long)h->count, (double)h->total / h->count / 1000.0);
+            for (int p = 0; p < WORKLOAD_NUM_PERCENTILES; p++) {
+                fprintf(fp, ",%.3f", workload_hist_percentile(h, workload_percentiles[p]) / 1000.0);
+            }
+            fprintf(fp, ",%.3f\n", h->max / 1000.0);
+        }
+    }
+    fclose(fp);
+}
+
 void init_args(int argc, char **argv)
 {
     for (int i = 1; i < argc - 1; i+=2) {
@@ -142,6 +250,11 @@ void init_args(int argc, char **argv)
         else if (strcmp(argv[i], "--svg")==0) svg = argv[i+1];
         else if (strcmp(argv[i], "--svg-anim-id")==0) svg_anim_id = argv[i+1];
         else if (strcmp(argv[i], "--svg-timescale")==0) svg_timescale = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--svg-start")==0) svg_window_start = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "--svg-end")==0) svg_window_end = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "--breakdown")==0) breakdown = argv[i+1];
+        else if (strcmp(argv[i], "--json")==0) json = argv[i+1];
+        else if (strcmp(argv[i], "--csv")==0) csv = argv[i+1];
         else {
             fprintf(stderr, "Invalid parameter: %s\n", argv[i]);
             exit(1);
@@ -155,6 +268,7 @@ int main(int argc, char **argv)
 
     srand(time(NULL));
     gettimeofday(&start_tv, NULL);
+    svg_init();
     pid_t controller_pid = controller();
     car_trackers = malloc(sizeof(car_tracker) * cars);
     for (int i = 0; i < cars; i++) {
@@ -176,6 +290,9 @@ int main(int argc, char **argv)
         col = rand_between(0, 2);
         pdata[i].col[col] = '0';
         pdata[i].idx = i;
+        pdata[i].car = -1;
+        pdata[i].time_waiting = 0;
+        pdata[i].time_in_elevator = 0;
         pthread_create(&passengers[i], NULL, sim_run, &pdata[i]);
     }
 
@@ -210,10 +327,35 @@ int main(int argc, char **argv)
         histo_ti[i].count = 0;
     }
     
+    // Bucket j starts at min + range * j / histogram_len, so the bucket of
+    // a value can be worked out directly
+    for (int i = 0; i < num_passengers && histogram_len > 0; i++) {
+        int64_t wait_range = max_wait_time - min_wait_time + 1;
+        int64_t spent_range = max_spent_time - min_spent_time + 1;
+        histo_tw[((pdata[i].time_waiting - min_wait_time + 1) * histogram_len - 1) / wait_range].count++;
+        histo_ti[((pdata[i].time_in_elevator - min_spent_time + 1) * histogram_len - 1) / spent_range].count++;
+    }
+
+    // Groups: everyone, then each car, then each floor called from
+    int floors = fti(highest_floor) - fti(lowest_floor) + 1;
+    num_groups = 1 + cars + floors;
+    groups = calloc(num_groups, sizeof(time_group));
+    groups[0].group = "all";
+    for (int i = 0; i < cars; i++) {
+        groups[1 + i].group = "car";
+        sprintf(groups[1 + i].key, "Sim%d", i + 1);
+    }
+    for (int i = 0; i < floors; i++) {
+        groups[1 + cars + i].group = "floor";
+        itf(groups[1 + cars + i].key, fti(lowest_floor) + i);
+    }
     for (int i = 0; i < num_passengers; i++) {
-        for (int j = 0; j < histogram_len; j++) {
-            if (pdata[i].time_waiting >= histo_tw[j].minval && pdata[i].time_waiting <= histo_tw[j].maxval) histo_tw[j].count++;
-            if (pdata[i].time_in_elevator >= histo_ti[j].minval && pdata[i].time_in_elevator <= histo_ti[j].maxval) histo_ti[j].count++;
+        if (pdata[i].car < 0) continue;
+        time_group *in[3] = {&groups[0], &groups[1 + pdata[i].car], &groups[1 + cars + fti(pdata[i].from) - fti(lowest_floor)]};
+        for (int j = 0; j < 3; j++) {
+            record_time(&in[j]->h[METRIC_WAIT], pdata[i].time_waiting);
+            record_time(&in[j]->h[METRIC_IN_CAR], pdata[i].time_in_elevator);
+            record_time(&in[j]->h[METRIC_END_TO_END], pdata[i].time_waiting + pdata[i].time_in_elevator);
         }
     }
     printf("Time spent waiting for an elevator:\n");
@@ -226,6 +368,19 @@ int main(int argc, char **argv)
     printf("Longest time: %.2fms\n", (double)max_spent_time / 1000.0);
     draw_histogram(histo_ti);
 
+    printf("\n");
+    printf("Percentiles (ms):\n");
+    print_percentiles(&groups[0]);
+    for (int i = 1; breakdown && i < num_groups; i++) {
+        int by_car = strcmp(groups[i].group, "car") == 0;
+        if (!groups[i].h[METRIC_WAIT]) continue;
+        if (strcmp(breakdown, "all") != 0 && strcmp(breakdown, groups[i].group) != 0) continue;
+        printf("\n%s %s:\n", by_car ? "Car" : "Passengers calling from floor", groups[i].key);
+        print_percentiles(&groups[i]);
+    }
+    if (json) write_json(json);
+    if (csv) write_csv(csv);
+
     for (int i = 0; i < cars; i++) {
         cleanup_tracker(&car_trackers[i]);
     }
@@ -233,6 +388,10 @@ int main(int argc, char **argv)
 
     svg_write();
 
+    for (int i = 0; i < num_groups; i++) {
+        for (int m = 0; m < METRICS; m++) free(groups[i].h[m]);
+    }
+    free(groups);
     free(pdata);
     free(car_trackers);
     return 0;
@@ -260,6 +419,7 @@ void *sim_run(void *v)
         return NULL;
     }
     car_tracker *t = &car_trackers[car_i];
+    data->car = car_i;
 
     // Wait for elevator to come
     struct timeval started_waiting;
@@ -456,6 +616,14 @@ void cleanup_tracker(car_tracker *t)
 }
 
 // SVG handling
+//
+// Events are dealt with as they arrive instead of being kept for the whole
+// run. Car and door animations only depend on the event that ends them, so
+// they are written straight away as <animate>s that point at their shape by
+// id. A passenger is written when they leave the car, into a temporary file
+// for each of the two layers passengers are drawn in. svg_write() then only
+// puts the layers together, so memory depends on the numbers of cars, floors
+// and passengers rather than on how long the run was.
 
 static int svg_floorheight = 96;
 static int svg_floorgap = 16;
@@ -475,85 +643,258 @@ double svgtime(const struct timeval *before, const struct timeval *after) {
     return us_diff(before, after) / 1000000.0 * svg_timescale;
 }
 
-typedef struct svg_event {
-    struct timeval tv;
-    int type, x, y, z;
-    struct svg_event *next;
-} svg_event;
-
-static svg_event *svg_head = NULL;
-static svg_event *svg_tail = NULL;
-static pthread_mutex_t svg_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Seconds into the animation, negative before the window starts
+double svg_at(const struct timeval *tv) {
+    return svgtime(&start_tv, tv) - svg_window_start / 1000.0 * svg_timescale;
+}
 
-void svg_add_event(struct timeval tv, int type, int x, int y, int z) {
-    if (!svg) return;
-    svg_event *e = malloc(sizeof(svg_event));
-    e->tv = tv;
-    e->type = type;
-    e->x = x;
-    e->y = y;
-    e->z = z;
-    e->next = NULL;
-    
-    pthread_mutex_lock(&svg_mutex);
-    if (!svg_tail) {
-        svg_head = svg_tail = e;
-    } else {
-        svg_tail->next = e;
-        svg_tail = e;
-    }
-    pthread_mutex_unlock(&svg_mutex);
+int svg_before_window(const struct timeval *tv) {
+    return us_diff(&start_tv, tv) < (int64_t)svg_window_start * 1000;
 }
 
-int svg_compar(const void *va, const void *vb) {
-    struct timeval a = ((const svg_event *)va)->tv;
-    struct timeval b = ((const svg_event *)vb)->tv;
-    if (a.tv_sec < b.tv_sec) return -1;
-    if (a.tv_sec > b.tv_sec) return 1;
-    if (a.tv_usec < b.tv_usec) return -1;
-    if (a.tv_usec > b.tv_usec) return 1;
-    return 0;
+int svg_after_window(const struct timeval *tv) {
+    return svg_window_end >= 0 && us_diff(&start_tv, tv) > (int64_t)svg_window_end * 1000;
 }
 
-void svg_draw_elevator(FILE *fp, svg_event *ev, int count, int car_id);
-void svg_draw_passenger(FILE *fp, svg_event *ev, int count, int pass_id, int fg);
-void svg_draw_doors(FILE *fp, svg_event *ev, int count, int car_id, int floor);
+typedef struct {
+    double start, finish; // Seconds into the animation
+    int from, to;
+} svg_move;
+
+typedef struct {
+    int floor;            // Floor it is at, or last left
+    int window_floor;     // Floor it was at when the window started
+    int window_open;      // Floor its doors were open at then, INT_MIN if none
+    struct timeval lift_start_tv;
+    int door_event;       // EV_STARTOPEN or EV_STARTCLOSE still to finish, or 0
+    int door_floor;
+    struct timeval door_tv;
+    int riders;           // First passenger inside, -1 if none
+} svg_car;
+
+#define SVG_PASS_UNSEEN 0
+#define SVG_PASS_WAITING 1
+#define SVG_PASS_RIDING 2
+#define SVG_PASS_DONE 3
+
+typedef struct {
+    int state;            // SVG_PASS_*
+    int car_id;
+    int srcfloor, destfloor, curr_floor;
+    double called_lift_at, lift_opened;
+    svg_move *moves;      // The car's moves while they were inside
+    int num_moves;
+    int next_rider;       // Next passenger in the same car, -1 if none
+} svg_passenger;
+
+static svg_car *svg_cars = NULL;
+static svg_passenger *svg_passengers = NULL;
+static FILE *svg_anims = NULL;    // Car and door animations
+static FILE *svg_pass_bg = NULL;  // Passengers inside cars
+static FILE *svg_pass_fg = NULL;  // Passengers outside cars
+static double svg_last = 0.0;     // Time of the last event in the window
+static pthread_mutex_t svg_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void svg_draw_passenger(FILE *fp, const svg_passenger *p, int pass_id, int fg, double exited_lift);
 void svg_draw_background(FILE *fp);
 
 static int svg_width, svg_height;
 
-void svg_write(void) {
-    if (!svg) return;
-    
-    // Pull events into a single array and sort them
-    svg_event *ev;
-    int count = 0;
-
-    {
-        svg_event *t = svg_head;
-        while (t != NULL) {
-            count++;
-            t = t->next;
-        }
-        ev = malloc(sizeof(svg_event) * count);
-        int idx = 0;
-        t = svg_head;
-        while (t != NULL) {
-            ev[idx] = *t;
-            free(t);
-            t = ev[idx].next;
-            idx++;
-        }
-        qsort(ev, count, sizeof(*ev), svg_compar);
+FILE *svg_tmpfile(void) {
+    FILE *fp = tmpfile();
+    if (!fp) {
+        perror("tmpfile");
+        exit(1);
     }
+    return fp;
+}
 
+void svg_init(void) {
+    if (!svg) return;
     svg_width = svg_horigap + svg_padw + cars * (svg_horigap + svg_elevw) + svg_horigap + svg_padw + svg_horigap;
     int floors = fti(highest_floor) - fti(lowest_floor) + 1;
     svg_height = (svg_floorheight + svg_floorgap) * floors - svg_floorgap;
     svg_height += svg_bottommargin;
-    int footer_start = svg_height;
     svg_height += svg_progressbar_h;
+
+    svg_cars = calloc(cars, sizeof(svg_car));
+    svg_passengers = calloc(num_passengers, sizeof(svg_passenger));
+    for (int i = 0; i < cars; i++) {
+        svg_cars[i].window_open = INT_MIN;
+        svg_cars[i].riders = -1;
+    }
+    svg_anims = svg_tmpfile();
+    svg_pass_bg = svg_tmpfile();
+    svg_pass_fg = svg_tmpfile();
+}
+
+int svg_car_y(int floor) {
+    return (svg_floorheight + svg_floorgap) * (fti(highest_floor) - floor) + svg_elevgap;
+}
+
+// Animates an attribute of the shape with the given id from one value to
+// another. One that started before the window starts part way through.
+void svg_animate(const char *id, const char *attr, int from, int to, double begin, double dur) {
+    if (begin < 0) {
+        if (begin + dur <= 0) return;
+        from += (int)((to - from) * (-begin / dur));
+        dur += begin;
+        begin = 0;
+    }
+    fprintf(svg_anims, "<animate href=\"#%s\" attributeName=\"%s\" values=\"%d;%d\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" fill=\"freeze\"/>\n",
+        id, attr, from, to, svg_anim_id, begin, dur);
+    svg_last = MAX(svg_last, begin + dur);
+}
+
+void svg_lift_finish(svg_car *c, int car_id, struct timeval tv, int dest_floor) {
+    if (svg_before_window(&tv)) {
+        c->window_floor = dest_floor;
+    } else if (!svg_after_window(&c->lift_start_tv)) {
+        char id[64];
+        snprintf(id, sizeof(id), "%s-c%d", svg_anim_id, car_id);
+        svg_animate(id, "y", svg_car_y(c->floor), svg_car_y(dest_floor),
+            svg_at(&c->lift_start_tv), svgtime(&c->lift_start_tv, &tv));
+    }
+
+    // Take the passengers inside along
+    double begin = svg_at(&c->lift_start_tv);
+    for (int i = c->riders; i != -1; i = svg_passengers[i].next_rider) {
+        svg_passenger *p = &svg_passengers[i];
+        if (p->curr_floor == p->destfloor || begin < p->lift_opened) continue;
+        svg_move *moves = realloc(p->moves, sizeof(svg_move) * (p->num_moves + 1));
+        if (!moves) continue;
+        p->moves = moves;
+        moves[p->num_moves].start = begin;
+        moves[p->num_moves].finish = svg_at(&tv);
+        moves[p->num_moves].from = c->floor;
+        moves[p->num_moves].to = dest_floor;
+        p->num_moves++;
+        p->curr_floor = dest_floor;
+    }
+    c->floor = dest_floor;
+}
+
+void svg_door_finish(svg_car *c, int car_id, int type, struct timeval tv, int floor) {
+    int opened = type == EV_FINISHOPEN;
+    int started = opened ? EV_STARTOPEN : EV_STARTCLOSE;
+    if (c->door_event != started || c->door_floor != floor) return;
+    c->door_event = 0;
+
+    if (svg_before_window(&tv)) {
+        c->window_open = opened ? floor : INT_MIN;
+        return;
+    }
+    if (svg_after_window(&c->door_tv)) return;
+
+    int x = svg_horigap + svg_padw + car_id * (svg_horigap + svg_elevw) + svg_horigap;
+    for (int door = 0; door < 2; door++) {
+        int xpos = x + door * svg_elevw / 2;
+        int openmove = door == 0 ? svg_elevw / -2 : svg_elevw / 2;
+        char id[64];
+        snprintf(id, sizeof(id), "%s-d%d-%d-%d", svg_anim_id, car_id, fti(highest_floor) - floor, door);
+        svg_animate(id, "x", opened ? xpos : xpos + openmove, opened ? xpos + openmove : xpos,
+            svg_at(&c->door_tv), svgtime(&c->door_tv, &tv));
+    }
+}
+
+void svg_pass_exit(svg_car *c, int pass_id, struct timeval tv, int floor) {
+    svg_passenger *p = &svg_passengers[pass_id];
+    if (p->state != SVG_PASS_RIDING) return;
+    p->state = SVG_PASS_DONE;
+    for (int *i = &c->riders; *i != -1; i = &svg_passengers[*i].next_rider) {
+        if (*i == pass_id) {
+            *i = p->next_rider;
+            break;
+        }
+    }
+
+    p->destfloor = floor;
+    double exited_lift = svg_at(&tv);
+    svg_draw_passenger(svg_pass_bg, p, pass_id, 0, exited_lift);
+    svg_draw_passenger(svg_pass_fg, p, pass_id, 1, exited_lift);
+    svg_last = MAX(svg_last, exited_lift);
+    free(p->moves);
+    p->moves = NULL;
+}
+
+void svg_add_event(struct timeval tv, int type, int x, int y, int z) {
+    if (!svg) return;
+    if (x < 0 || x >= cars) return;
+    int is_passenger = type == EV_WAITFORLIFT || type == EV_ENTERLIFT || type == EV_EXITLIFT;
+    if (is_passenger && (z < 0 || z >= num_passengers)) return;
+
+    pthread_mutex_lock(&svg_mutex);
+    svg_car *c = &svg_cars[x];
+    svg_passenger *p = &svg_passengers[is_passenger ? z : 0];
+    switch (type) {
+    case EV_NEWLIFT:
+        c->floor = c->window_floor = y;
+        break;
+    case EV_LIFTSTART:
+        c->lift_start_tv = tv;
+        break;
+    case EV_LIFTFINISH:
+        svg_lift_finish(c, x, tv, y);
+        break;
+    case EV_STARTOPEN:
+    case EV_STARTCLOSE:
+        c->door_event = type;
+        c->door_floor = y;
+        c->door_tv = tv;
+        break;
+    case EV_FINISHOPEN:
+    case EV_FINISHCLOSE:
+        svg_door_finish(c, x, type, tv, y);
+        break;
+    case EV_WAITFORLIFT:
+        // Only passengers who turn up during the window are drawn
+        if (p->state != SVG_PASS_UNSEEN) break;
+        if (svg_before_window(&tv) || svg_after_window(&tv)) {
+            p->state = SVG_PASS_DONE;
+            break;
+        }
+        p->state = SVG_PASS_WAITING;
+        p->car_id = x;
+        p->srcfloor = y;
+        p->called_lift_at = svg_at(&tv);
+        break;
+    case EV_ENTERLIFT:
+        if (p->state != SVG_PASS_WAITING) break;
+        p->state = SVG_PASS_RIDING;
+        p->srcfloor = p->curr_floor = y;
+        p->destfloor = fti(pdata[z].to);
+        p->lift_opened = svg_at(&tv);
+        p->next_rider = c->riders;
+        c->riders = z;
+        break;
+    case EV_EXITLIFT:
+        svg_pass_exit(c, z, tv, y);
+        break;
+    }
+    pthread_mutex_unlock(&svg_mutex);
+}
+
+// Copies a layer into the SVG and closes it
+void svg_copy_layer(FILE *fp, FILE *layer) {
+    char buf[65536];
+    size_t len;
+    rewind(layer);
+    while ((len = fread(buf, 1, sizeof(buf), layer)) > 0) {
+        fwrite(buf, 1, len, fp);
+    }
+    fclose(layer);
+}
+
+void svg_write(void) {
+    if (!svg) return;
+    pthread_mutex_lock(&svg_mutex);
+
+    int footer_start = svg_height - svg_progressbar_h;
     FILE *fp = fopen(svg, "w");
+    if (!fp) {
+        perror(svg);
+        exit(1);
+    }
     fprintf(fp, "<svg version=\"1.1\" width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">", svg_width, svg_height);
     fprintf(fp, "<defs><g id=\"p\"><circle r=\"%d\" cx=\"%d\" cy=\"%d\" /><rect x=\"0\" y=\"%d\" width=\"%d\" height=\"%d\" /></g></defs>",
         svg_personsize, svg_personsize, svg_personsize, svg_personsize * 2, svg_personsize * 2, svg_personsize * 2
@@ -561,28 +902,43 @@ void svg_write(void) {
     // Layers, from back to front
     // - Elevator cars
     // - Passengers inside cars
+    // - Elevator doors
     // - Building background (partially transparent fill, so cars/passengers can be seen between levels)
     // - Passengers outside cars
+    // followed by the progress bar and the car and door animations
 
+    int elevh = svg_floorheight - svg_elevgap * 2;
     for (int i = 0; i < cars; i++) {
-        svg_draw_elevator(fp, ev, count, i);
+        int x = svg_horigap + svg_padw + i * (svg_horigap + svg_elevw) + svg_horigap;
+        int y = svg_car_y(svg_cars[i].window_floor);
+        fprintf(fp, "<rect id=\"%s-c%d\" x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" style=\"fill: none; stroke: black; stroke-width: 5;\">\n", svg_anim_id, i, x, y, svg_elevw, elevh);
+        fprintf(fp, "  <set attributeName=\"y\" to=\"%d\" begin=\"%s.begin\" />\n", y, svg_anim_id);
+        fprintf(fp, "</rect>\n");
     }
 
-    for (int i = 0; i < num_passengers; i++) {
-        svg_draw_passenger(fp, ev, count, i, 0);
-    }
+    svg_copy_layer(fp, svg_pass_bg);
 
+    const char *style = "fill: #ccc; fill-opacity: 0.8; stroke: black";
     for (int i = 0; i < cars; i++) {
-        for (int j = fti(lowest_floor); j <= fti(highest_floor); j++) {
-            svg_draw_doors(fp, ev, count, i, j);
+        int x = svg_horigap + svg_padw + i * (svg_horigap + svg_elevw) + svg_horigap;
+        for (int floor = fti(lowest_floor); floor <= fti(highest_floor); floor++) {
+            int floor_pos = fti(highest_floor) - floor;
+            int y = (svg_floorheight + svg_floorgap) * floor_pos + svg_elevgap;
+            for (int door = 0; door < 2; door++) {
+                int xpos = x + door * svg_elevw / 2;
+                if (svg_cars[i].window_open == floor) {
+                    xpos += door == 0 ? svg_elevw / -2 : svg_elevw / 2;
+                }
+                fprintf(fp, "  <rect id=\"%s-d%d-%d-%d\" x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" style=\"%s\">\n", svg_anim_id, i, floor_pos, door, xpos, y, svg_elevw / 2, elevh, style);
+                fprintf(fp, "    <set attributeName=\"x\" to=\"%d\" begin=\"%s.begin\" />\n", xpos, svg_anim_id);
+                fprintf(fp, "  </rect>\n");
+            }
         }
     }
 
     svg_draw_background(fp);
 
-    for (int i = 0; i < num_passengers; i++) {
-        svg_draw_passenger(fp, ev, count, i, 1);
-    }
+    svg_copy_layer(fp, svg_pass_fg);
 
     // Progress bar
 
@@ -595,48 +951,25 @@ void svg_write(void) {
         svg_width, footer_start + svg_progressbar_h
     );
     fprintf(fp, "<rect width=\"%d\" height=\"%d\" x=\"0\" y=\"%d\">\n", svg_progressbar_w, svg_progressbar_h, footer_start);
-    double total_dur = svgtime(&start_tv, &ev[count-1].tv);
+    double total_dur = svg_last;
+    if (svg_window_end >= 0) {
+        total_dur = (svg_window_end - svg_window_start) / 1000.0 * svg_timescale;
+    }
     fprintf(fp, "  <animate id=\"%s\" attributeName=\"x\" begin=\"0s;%s.end\" dur=\"%.2fs\" from=\"0\" to=\"%d\" />",
         svg_anim_id, svg_anim_id, total_dur, svg_width - svg_progressbar_w);
     fprintf(fp, "</rect>\n");
 
+    svg_copy_layer(fp, svg_anims);
+
     fprintf(fp, "</svg>\n");
     fclose(fp);
 
-    free(ev);
-    pthread_mutex_unlock(&svg_mutex);
-}
-
-void svg_draw_elevator(FILE *fp, svg_event *ev, int count, int car_id) {
-    int x = svg_horigap + svg_padw + car_id * (svg_horigap + svg_elevw) + svg_horigap;
-    int curr_floor;
-    struct timeval lift_start_tv, lift_finish_tv;
-
-    for (int i = 0; i < count; i++) {
-        if (ev[i].x != car_id) continue;
-        if (ev[i].type == EV_NEWLIFT) {
-            curr_floor = ev[i].y;
-            int curr_floor_pos = fti(highest_floor) - curr_floor;
-            int y = (svg_floorheight + svg_floorgap) * curr_floor_pos + svg_elevgap;
-            int elevh = svg_floorheight - svg_elevgap * 2;
-            fprintf(fp, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" style=\"fill: none; stroke: black; stroke-width: 5;\">\n", x, y, svg_elevw, elevh);
-            fprintf(fp, "  <set attributeName=\"y\" to=\"%d\" begin=\"%s.begin\" />\n", y, svg_anim_id);
-        } else if (ev[i].type == EV_LIFTSTART) {
-            lift_start_tv = ev[i].tv;
-        } else if (ev[i].type == EV_LIFTFINISH) {
-            lift_finish_tv = ev[i].tv;
-            int dest_floor = ev[i].y;
-            int curr_floor_pos = fti(highest_floor) - curr_floor;
-            int dest_floor_pos = fti(highest_floor) - dest_floor;
-            int sy = (svg_floorheight + svg_floorgap) * curr_floor_pos + svg_elevgap;
-            int dy = (svg_floorheight + svg_floorgap) * dest_floor_pos + svg_elevgap;
-            double begin = svgtime(&start_tv, &lift_start_tv);
-            double dur = svgtime(&lift_start_tv, &lift_finish_tv);
-            fprintf(fp, "  <animate attributeName=\"y\" values=\"%d;%d\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" fill=\"freeze\"/>\n", sy, dy, svg_anim_id, begin, dur);
-            curr_floor = dest_floor;
-        }
+    for (int i = 0; i < num_passengers; i++) {
+        free(svg_passengers[i].moves);
     }
-    fprintf(fp, "</rect>\n");
+    free(svg_passengers);
+    free(svg_cars);
+    pthread_mutex_unlock(&svg_mutex);
 }
 
 #define PASSENGER_BASE_SPEED 1000
@@ -649,33 +982,15 @@ double svg_passenger_secs_to_dist(double secs) {
     return secs * pixels_per_second;
 }
 
-void svg_draw_passenger(FILE *fp, svg_event *ev, int count, int pass_id, int fg) {
+void svg_draw_passenger(FILE *fp, const svg_passenger *p, int pass_id, int fg, double exited_lift) {
     const char *col = pdata[pass_id].col;
     int from_right = pass_id % 2;
     double adjusted_delay = atoi(CAR_DELAY) * 0.001 * svg_timescale;
 
-    double called_lift_at;
-    double lift_opened;
-    double exited_lift;
-    int srcfloor, destfloor;
-    int car_id;
-    int enter_lift_i = -1;
-    for (int i = 0; i < count; i++) {
-        if (ev[i].z != pass_id) continue;
-        if (ev[i].type == EV_WAITFORLIFT) {
-            car_id = ev[i].x;
-            called_lift_at = svgtime(&start_tv, &ev[i].tv);
-        }
-        else if (ev[i].type == EV_ENTERLIFT) {
-            enter_lift_i = i;
-            srcfloor = ev[i].y;
-            lift_opened = svgtime(&start_tv, &ev[i].tv);
-        }
-        else if (ev[i].type == EV_EXITLIFT) {
-            destfloor = ev[i].y;
-            exited_lift = svgtime(&start_tv, &ev[i].tv);
-        }
-    }
+    double called_lift_at = p->called_lift_at;
+    double lift_opened = p->lift_opened;
+    int srcfloor = p->srcfloor;
+    int car_id = p->car_id;
 
     if (called_lift_at + adjusted_delay >= lift_opened) {
         called_lift_at = lift_opened - adjusted_delay;
@@ -737,37 +1052,15 @@ void svg_draw_passenger(FILE *fp, svg_event *ev, int count, int pass_id, int fg)
         fprintf(fp, "  <set attributeName=\"x\" to=\"%d\" begin=\"%s.begin+%.2fs\" />\n", wait_x, svg_anim_id, lift_opened);
     }
 
-    double elev_start, elev_finish = -999.0;
-    // Find when this elevator next moves and go with it
-    int curr_floor = srcfloor;
+    // Go along with the car's moves while inside
     int elev_y = y;
-    for (int i = enter_lift_i + 1; i < count; i++) {
-        if (ev[i].type != EV_LIFTSTART) continue;
-        if (ev[i].x != car_id) continue;
-
-        elev_start = svgtime(&start_tv, &ev[i].tv);
-        if (elev_start < lift_opened) continue;
-        for (int j = i + 1; j < count; j++) {
-            if (ev[j].type != EV_LIFTFINISH) continue;
-            if (ev[j].x != car_id) continue;
-            
-            elev_finish = svgtime(&start_tv, &ev[j].tv);
-            curr_floor = ev[j].y;
-            
-            int frompos = fti(highest_floor) - ev[i].y;
-            int topos = fti(highest_floor) - ev[j].y;
-            int y_offset = (topos - frompos);
-
-            int new_y = elev_y + y_offset * (svg_floorheight + svg_floorgap);
-
-            if (!fg) {
-                fprintf(fp, "  <animate attributeName=\"y\" values=\"%d;%d\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" fill=\"freeze\" />\n", elev_y, new_y, svg_anim_id, elev_start, elev_finish - elev_start);
-            }
-            elev_y = new_y;
-
-            break;
+    for (int i = 0; i < p->num_moves; i++) {
+        const svg_move *m = &p->moves[i];
+        int new_y = elev_y + (m->from - m->to) * (svg_floorheight + svg_floorgap);
+        if (!fg) {
+            fprintf(fp, "  <animate attributeName=\"y\" values=\"%d;%d\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" fill=\"freeze\" />\n", elev_y, new_y, svg_anim_id, m->start, m->finish - m->start);
         }
-        if (curr_floor == destfloor) break;
+        elev_y = new_y;
     }
 
     // Exit elevator
@@ -796,48 +1089,6 @@ void svg_draw_passenger(FILE *fp, svg_event *ev, int count, int pass_id, int fg)
     fprintf(fp, "</use>\n");
 }
 
-void svg_draw_doors(FILE *fp, svg_event *ev, int count, int car_id, int floor) {
-    const char *style = "fill: #ccc; fill-opacity: 0.8; stroke: black";
-    int floor_pos = fti(highest_floor) - floor;
-
-    int x = svg_horigap + svg_padw + car_id * (svg_horigap + svg_elevw) + svg_horigap;
-    int y = (svg_floorheight + svg_floorgap) * floor_pos + svg_elevgap;
-    int elevh = svg_floorheight - svg_elevgap * 2;
-
-    for (int door = 0; door < 2; door++) {
-        int xpos = x + door * svg_elevw / 2;
-        int openmove = door == 0 ? svg_elevw / -2 : svg_elevw / 2;
-        fprintf(fp, "  <rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" style=\"%s\">\n", xpos, y, svg_elevw / 2, elevh, style);
-        fprintf(fp, "    <set attributeName=\"x\" to=\"%d\" begin=\"%s.begin\" />\n", xpos, svg_anim_id);
-        
-        // Add animations
-        for (int i = 0; i < count; i++) {
-            if (ev[i].x != car_id) continue;
-            if (fti(highest_floor) - ev[i].y != floor_pos) continue;
-            if (ev[i].type != EV_STARTOPEN && ev[i].type != EV_STARTCLOSE) continue;                  
-
-            for (int j = i + 1; j < count; j++) {
-                if (ev[j].x != ev[i].x || ev[j].y != ev[i].y) continue;
-                double begin = svgtime(&start_tv, &ev[i].tv);
-                double dur = svgtime(&ev[i].tv, &ev[j].tv);
-
-                if (ev[i].type == EV_STARTOPEN && ev[j].type == EV_FINISHOPEN) {
-                    fprintf(fp, "    <animate attributeName=\"x\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" values=\"%d;%d\" fill=\"freeze\"/>\n",
-                        svg_anim_id, begin, dur, xpos, xpos + openmove
-                    );
-                    break;
-                } else if (ev[i].type == EV_STARTCLOSE && ev[j].type == EV_FINISHCLOSE) {
-                    fprintf(fp, "    <animate attributeName=\"x\" begin=\"%s.begin+%.2fs\" dur=\"%.2fs\" values=\"%d;%d\" fill=\"freeze\"/>\n",
-                        svg_anim_id, begin, dur, xpos + openmove, xpos
-                    );
-                    break;
-                }
-            }
-        }
-        fprintf(fp, "  </rect>\n");
-    }
-}
-
 void svg_draw_background(FILE *fp) {
     int elevh = svg_floorheight - svg_elevgap * 2;
     int floors = fti(highest_floor) - fti(lowest_floor) + 1;
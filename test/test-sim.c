@@ -0,0 +1,109 @@
+#include "shared.h"
+
+#include <sys/wait.h>
+
+// Tester for sim (with controller, car and load. Compares how many passengers
+// sim says are served with how many load sees served by real cars on the same
+// seed.)
+
+#define DELAY 50000 // 50ms
+#define NUM_CARS 2
+
+pid_t controller(void);
+pid_t car(const char *, const char *, const char *, const char *);
+void cleanup(pid_t);
+int served(const char *);
+void test_seed(int);
+
+int main()
+{
+  // Light loads, so every call is dealt with long before the next one and the
+  // cars' real timing can't change the order things happen in
+  for (int seed = 1; seed <= 3; seed++) {
+    test_seed(seed);
+  }
+
+  printf("\nTests completed.\n");
+}
+
+void test_seed(int seed)
+{
+  const char *options = "--num-passengers 8 --highest-floor 6 --sim-end 6000";
+  char cmd[256];
+  char expected[64];
+
+  snprintf(cmd, sizeof(cmd), "./sim --cars %d %s --seed %d", NUM_CARS, options,
+           seed);
+  int sim = served(cmd);
+
+  pid_t c = controller();
+  usleep(DELAY * 4);
+  pid_t cars[NUM_CARS];
+  for (int i = 0; i < NUM_CARS; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "Sim%d", i + 1);
+    cars[i] = car(name, "1", "6", "100");
+  }
+  usleep(DELAY * 10);
+
+  snprintf(cmd, sizeof(cmd), "./load %s --seed %d --timeout 5000", options,
+           seed);
+  int load = served(cmd);
+
+  for (int i = 0; i < NUM_CARS; i++) {
+    cleanup(cars[i]);
+  }
+  cleanup(c);
+
+  snprintf(expected, sizeof(expected), "Seed %d: load served %d", seed, sim);
+  msg(expected);
+  printf("Seed %d: load served %d\n", seed, load);
+}
+
+// Runs `cmd` and returns the count on its "Served: " line, -1 if there isn't
+// one
+int served(const char *cmd)
+{
+  FILE *fp = popen(cmd, "r");
+  if (fp == NULL) {
+    perror("popen()");
+    exit(1);
+  }
+
+  int count = -1;
+  char line[256];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    const char *s = strstr(line, "Served: ");
+    if (s != NULL) {
+      sscanf(s, "Served: %d", &count);
+    }
+  }
+  pclose(fp);
+  return count;
+}
+
+void cleanup(pid_t p)
+{
+  kill(p, SIGINT);
+  waitpid(p, NULL, 0);
+}
+
+pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./car", "./car", name, lowest_floor, highest_floor, delay, NULL);
+  }
+
+  return pid;
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./controller", "./controller", NULL);
+  }
+
+  return pid;
+}
@@ -0,0 +1,309 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+/*
+ * Implementation of the hierarchical timing wheel. Level 0 has one slot per
+ * millisecond for the next 64 ms, level 1 one slot per 64 ms for the next
+ * 4096 ms and so on. A timer is filed in the lowest level whose range covers
+ * it. Every time level 0 wraps around, the next slot of level 1 is emptied
+ * and its timers are filed again, now in level 0, and likewise for the levels
+ * above. Timers beyond the top level's range are filed in its furthest slot
+ * and simply re-filed when that slot is reached.
+ */
+
+#include "global.h"
+#include "timerwheel.h"
+
+/* Each level's occupied slots fit in one word */
+_Static_assert(TIMER_WHEEL_SLOTS == 64,
+               "timer_wheel_t.occupied needs a bit per slot");
+
+/*
+ * Returns the slot index of a tick at a level.
+ */
+static size_t slot_index(uint64_t tick, int level)
+{
+    return (size_t)(tick >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+}
+
+/*
+ * Files a timer in the slot matching its expiry.
+ */
+static void file_timer(timer_wheel_t *wheel, timer_event_t *timer)
+{
+    uint64_t delta = timer->expires - wheel->now;
+    uint64_t expires = timer->expires;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (uint64_t)1 << ((level + 1) * TIMER_WHEEL_BITS))
+    {
+        level += 1;
+    }
+
+    /* Past the top level, park the timer in the furthest slot. */
+    uint64_t range = (uint64_t)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS);
+    if (delta >= range)
+    {
+        expires = wheel->now + range - 1;
+    }
+
+    size_t index = slot_index(expires, level);
+    timer_event_t **slot = &wheel->slots[level][index];
+    wheel->occupied[level] |= (uint64_t)1 << index;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL)
+    {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+/*
+ * Removes a timer from whichever slot it is in.
+ */
+static void unlink_timer(timer_wheel_t *wheel, timer_event_t *timer)
+{
+    if (timer->prev != NULL)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        *timer->slot = timer->next;
+    }
+    if (timer->next != NULL)
+    {
+        timer->next->prev = timer->prev;
+    }
+    if (*timer->slot == NULL)
+    {
+        size_t offset = (size_t)(timer->slot - &wheel->slots[0][0]);
+        wheel->occupied[offset / TIMER_WHEEL_SLOTS] &=
+            ~((uint64_t)1 << (offset % TIMER_WHEEL_SLOTS));
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->slot = NULL;
+}
+
+/*
+ * Empties a slot and files its timers again. Returns the slot index so the
+ * caller knows whether this level wrapped around too.
+ */
+static size_t cascade(timer_wheel_t *wheel, int level)
+{
+    size_t index = slot_index(wheel->now, level);
+    timer_event_t *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << index);
+    while (timer != NULL)
+    {
+        timer_event_t *next = timer->next;
+        file_timer(wheel, timer);
+        timer = next;
+    }
+    return index;
+}
+
+/*
+ * Initialises an empty wheel.
+ */
+void timer_wheel_init(timer_wheel_t *wheel)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->start_ns = monotonic_ns();
+}
+
+/*
+ * Initialises an empty wheel whose ticks are only processed by
+ * timer_wheel_advance_to(), so delays are counted from the last processed
+ * tick rather than the real time.
+ */
+void timer_wheel_init_manual(timer_wheel_t *wheel)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->manual = true;
+}
+
+/*
+ * Initialises a timer.
+ */
+void timer_event_init(timer_event_t *timer, void (*callback)(void *),
+                      void *arg)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/*
+ * Schedules a timer delay_ms milliseconds from now.
+ */
+void timer_schedule(timer_wheel_t *wheel, timer_event_t *timer,
+                    uint64_t delay_ms)
+{
+    timer_cancel(wheel, timer);
+
+    /* Count from the real time rather than the last processed tick so a
+     * wheel that hasn't been advanced for a while doesn't fire early. */
+    uint64_t base = wheel->now;
+    if (!wheel->manual)
+    {
+        uint64_t elapsed = (monotonic_ns() - wheel->start_ns) / 1000000u;
+        base = elapsed > base ? elapsed : base;
+    }
+    timer->expires = base + (delay_ms == 0 ? 1 : delay_ms);
+    timer->pending = true;
+    wheel->pending += 1;
+    file_timer(wheel, timer);
+}
+
+/*
+ * Cancels a timer. Does nothing if it isn't pending.
+ */
+void timer_cancel(timer_wheel_t *wheel, timer_event_t *timer)
+{
+    if (!timer->pending)
+    {
+        return;
+    }
+    unlink_timer(wheel, timer);
+    timer->pending = false;
+    wheel->pending -= 1;
+}
+
+/*
+ * Processes every tick up to the current time and runs the timers that
+ * expired.
+ */
+size_t timer_wheel_advance(timer_wheel_t *wheel)
+{
+    return timer_wheel_advance_to(
+        wheel, (monotonic_ns() - wheel->start_ns) / 1000000u);
+}
+
+/*
+ * Processes every tick up to the target and runs the timers that expired.
+ * Callbacks may schedule and cancel timers, including their own.
+ */
+size_t timer_wheel_advance_to(timer_wheel_t *wheel, uint64_t target)
+{
+    size_t fired = 0;
+
+    /* Nothing to run, so skip straight to the current time. */
+    if (wheel->pending == 0)
+    {
+        wheel->now = target > wheel->now ? target : wheel->now;
+        return 0;
+    }
+
+    while (wheel->now < target)
+    {
+        wheel->now += 1;
+
+        /* When a level wraps around, bring down the next slot of the level
+         * above. */
+        int level = 1;
+        if (slot_index(wheel->now, 0) == 0)
+        {
+            while (level < TIMER_WHEEL_LEVELS && cascade(wheel, level) == 0)
+            {
+                level += 1;
+            }
+        }
+
+        /* Run the timers due on this tick. They are detached from the slot
+         * one at a time so a callback can safely cancel any other timer. */
+        timer_event_t **slot = &wheel->slots[0][slot_index(wheel->now, 0)];
+        while (*slot != NULL)
+        {
+            timer_event_t *timer = *slot;
+            timer_cancel(wheel, timer);
+            if (timer->expires > wheel->now)
+            {
+                /* Parked beyond the top level, file it again. */
+                timer->pending = true;
+                wheel->pending += 1;
+                file_timer(wheel, timer);
+                continue;
+            }
+            fired += 1;
+            timer->callback(timer->arg);
+        }
+
+        if (wheel->pending == 0)
+        {
+            wheel->now = target;
+        }
+    }
+
+    return fired;
+}
+
+/*
+ * Returns how many milliseconds from the last processed tick the wheel needs
+ * advancing again: when the first timer in level 0 is due, or when the next
+ * occupied slot of a higher level has to be cascaded, whichever comes first.
+ */
+int64_t timer_wheel_next_ms(const timer_wheel_t *wheel)
+{
+    if (wheel->pending == 0)
+    {
+        return -1;
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        /* Rotate the slot after the current one down to bit 0, the lowest
+         * set bit is then the first occupied slot from there on. */
+        int shift = level * TIMER_WHEEL_BITS;
+        uint64_t base = wheel->now >> shift;
+        unsigned int first = (unsigned int)((base + 1) & TIMER_WHEEL_MASK);
+        if (first != 0)
+        {
+            occupied = (occupied >> first) |
+                       (occupied << (TIMER_WHEEL_SLOTS - first));
+        }
+        uint64_t k = (uint64_t)__builtin_ctzll(occupied) + 1;
+
+        uint64_t tick = (base + k) << shift;
+        if (tick - wheel->now < best)
+        {
+            best = tick - wheel->now;
+        }
+    }
+    return (int64_t)best;
+}
+
+/*
+ * Arms a timerfd (CLOCK_MONOTONIC) to expire when the wheel next needs to be
+ * advanced, or disarms it if the wheel is empty.
+ */
+void timer_wheel_arm_timerfd(const timer_wheel_t *wheel, int fd)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+
+    int64_t next_ms = timer_wheel_next_ms(wheel);
+    if (next_ms >= 0)
+    {
+        uint64_t deadline_ns = wheel->start_ns +
+                               (wheel->now + (uint64_t)next_ms) * 1000000u;
+        its.it_value.tv_sec = (time_t)(deadline_ns / 1000000000u);
+        its.it_value.tv_nsec = (long)(deadline_ns % 1000000000u);
+    }
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * This header file defines a hierarchical timing wheel used to schedule the
+ * door, travel and reconnect delays of cars driven by an event loop. A wheel
+ * holds any number of timers, runs on CLOCK_MONOTONIC with millisecond ticks
+ * and only needs a single timerfd to drive it, so a worker hosting hundreds of
+ * cars doesn't need hundreds of timerfds. Scheduling and cancelling a timer
+ * are O(1).
+ *
+ * A wheel can also run on a virtual clock that only moves when it is told to,
+ * which lets the simulator (sim.c) run a day of timers in moments.
+ *
+ * A wheel is not thread safe; it belongs to the thread that drives it.
+ * See timerwheel.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Each level of the wheel has 2^TIMER_WHEEL_BITS slots */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+/* Four levels cover 2^24 ms (about 4.6 hours) before a timer has to be
+ * re-filed, which happens transparently */
+#define TIMER_WHEEL_LEVELS 4
+
+/*
+ * A timer. It is owned by the caller and must stay alive while it is pending.
+ */
+typedef struct timer_event
+{
+    struct timer_event *next;  // Next timer in the same slot
+    struct timer_event *prev;  // Previous timer in the same slot
+    struct timer_event **slot; // Head of the slot the timer is filed in
+    uint64_t expires;          // Tick the timer fires on
+    void (*callback)(void *);  // Called when the timer fires
+    void *arg;                 // Passed to callback
+    bool pending;              // The timer is scheduled
+} timer_event_t;
+
+/*
+ * A timing wheel
+ */
+typedef struct timer_wheel
+{
+    uint64_t start_ns; // CLOCK_MONOTONIC time of tick 0
+    bool manual;       // Time only moves in timer_wheel_advance_to()
+    uint64_t now;      // Last tick that has been processed
+    size_t pending;    // Number of scheduled timers
+    timer_event_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS]; // Bit per slot that holds timers
+} timer_wheel_t;
+
+// Initialises an empty wheel starting at the current time
+void timer_wheel_init(timer_wheel_t *);
+// Initialises an empty wheel on a virtual clock starting at tick 0
+void timer_wheel_init_manual(timer_wheel_t *);
+// Initialises a timer with the function to call when it fires
+void timer_event_init(timer_event_t *, void (*)(void *), void *);
+// Schedules a timer to fire after a number of milliseconds, rescheduling it if
+// it is already pending
+void timer_schedule(timer_wheel_t *, timer_event_t *, uint64_t);
+// Cancels a timer if it is pending
+void timer_cancel(timer_wheel_t *, timer_event_t *);
+// Runs every timer that is due, returns how many ran
+size_t timer_wheel_advance(timer_wheel_t *);
+// Runs every timer due up to and including a tick, returns how many ran
+size_t timer_wheel_advance_to(timer_wheel_t *, uint64_t);
+// Returns the milliseconds until the wheel next needs advancing, or -1 if no
+// timers are pending
+int64_t timer_wheel_next_ms(const timer_wheel_t *);
+// Arms a timerfd to fire when the wheel next needs advancing
+void timer_wheel_arm_timerfd(const timer_wheel_t *, int);
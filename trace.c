@@ -0,0 +1,290 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Implementation of the traffic trace. Records are appended to a stdio
+ * buffer, so recording a call costs the controller no system call; the
+ * controller flushes once per round of messages, after it has answered them.
+ * Timestamps are deltas in microseconds, which keeps the common case to one
+ * or two bytes, and fields are length prefixed so a trace can hold whatever
+ * a call pad or car sent, valid or not.
+ */
+
+#include "global.h"
+#include "trace.h"
+
+/* Size of the stdio buffer records collect in between flushes */
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Creates the trace. A failure to record later on is reported once and
+ * doesn't disturb whoever is recording.
+ */
+bool trace_writer_open(trace_writer_t *writer, const char *path)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    setvbuf(writer->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, writer->file) !=
+        TRACE_MAGIC_SIZE)
+    {
+        perror(path);
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+    writer->start_ns = monotonic_ns();
+    return true;
+}
+
+/*
+ * Flushes and closes the trace.
+ */
+void trace_writer_close(trace_writer_t *writer)
+{
+    if (writer->file != NULL)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+}
+
+/*
+ * Notes a failed write, after which nothing more is recorded.
+ */
+static void writer_failed(trace_writer_t *writer)
+{
+    if (!writer->failed)
+    {
+        perror("Trace not recorded");
+        writer->failed = true;
+    }
+}
+
+/*
+ * Writes out the records buffered so far.
+ */
+void trace_writer_flush(trace_writer_t *writer)
+{
+    if (writer->file != NULL && !writer->failed && fflush(writer->file) != 0)
+    {
+        writer_failed(writer);
+    }
+}
+
+/*
+ * Starts a record: its type and the time since the previous one.
+ */
+static void write_header(trace_writer_t *writer, trace_type_t type)
+{
+    uint64_t now_us = (monotonic_ns() - writer->start_ns) / 1000;
+    uint64_t delta = now_us - writer->last_us;
+    writer->last_us = now_us;
+
+    unsigned char bytes[11];
+    size_t size = 0;
+    bytes[size++] = (unsigned char)type;
+    do
+    {
+        bytes[size] = (unsigned char)(delta & 0x7F);
+        delta >>= 7;
+        bytes[size++] |= delta != 0 ? 0x80 : 0;
+    } while (delta != 0);
+    fwrite(bytes, 1, size, writer->file);
+}
+
+/*
+ * Writes a field, cut short at TRACE_MAX_FIELD bytes.
+ */
+static void write_field(trace_writer_t *writer, const char *field)
+{
+    size_t length = field != NULL ? strlen(field) : 0;
+    if (length > TRACE_MAX_FIELD)
+    {
+        length = TRACE_MAX_FIELD;
+    }
+    fputc((int)length, writer->file);
+    fwrite(field, 1, length, writer->file);
+}
+
+/*
+ * Checks the record just written made it into the buffer.
+ */
+static void finish_record(trace_writer_t *writer)
+{
+    if (ferror(writer->file))
+    {
+        writer_failed(writer);
+    }
+}
+
+/*
+ * Records a call.
+ */
+void trace_write_call(trace_writer_t *writer, const char *source_floor,
+                      const char *destination_floor)
+{
+    if (writer->file == NULL || writer->failed)
+    {
+        return;
+    }
+    write_header(writer, TRACE_CALL);
+    write_field(writer, source_floor);
+    write_field(writer, destination_floor);
+    finish_record(writer);
+}
+
+/*
+ * Records a car joining.
+ */
+void trace_write_join(trace_writer_t *writer, const char *name,
+                      const char *lowest_floor, const char *highest_floor)
+{
+    if (writer->file == NULL || writer->failed)
+    {
+        return;
+    }
+    write_header(writer, TRACE_CAR_JOIN);
+    write_field(writer, name);
+    write_field(writer, lowest_floor);
+    write_field(writer, highest_floor);
+    finish_record(writer);
+}
+
+/*
+ * Records a car leaving.
+ */
+void trace_write_leave(trace_writer_t *writer, const char *name)
+{
+    if (writer->file == NULL || writer->failed)
+    {
+        return;
+    }
+    write_header(writer, TRACE_CAR_LEAVE);
+    write_field(writer, name);
+    finish_record(writer);
+}
+
+/*
+ * Opens a trace and checks it starts with TRACE_MAGIC.
+ */
+bool trace_reader_open(trace_reader_t *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    char magic[TRACE_MAGIC_SIZE];
+    if (fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic) ||
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "Error: %s isn't a trace this version can read.\n",
+                path);
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Closes the trace.
+ */
+void trace_reader_close(trace_reader_t *reader)
+{
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
+
+/*
+ * Reads a varint. Returns false if the trace ends inside it or it is too
+ * long.
+ */
+static bool read_varint(FILE *file, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            return false;
+        }
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Reads a field into a buffer of TRACE_MAX_FIELD + 1 bytes.
+ */
+static bool read_field(FILE *file, char *field)
+{
+    int length = fgetc(file);
+    if (length == EOF || length > TRACE_MAX_FIELD ||
+        fread(field, 1, (size_t)length, file) != (size_t)length)
+    {
+        return false;
+    }
+    field[length] = '\0';
+    return true;
+}
+
+/*
+ * Reads the next event.
+ */
+int trace_read(trace_reader_t *reader, trace_event_t *event)
+{
+    int type = fgetc(reader->file);
+    if (type == EOF)
+    {
+        return 0;
+    }
+
+    uint64_t delta;
+    if (!read_varint(reader->file, &delta))
+    {
+        return -1;
+    }
+    reader->time_us += delta;
+    event->type = (trace_type_t)type;
+    event->time_us = reader->time_us;
+
+    switch (type)
+    {
+    case TRACE_CALL:
+        return read_field(reader->file, event->source_floor) &&
+                       read_field(reader->file, event->destination_floor)
+                   ? 1
+                   : -1;
+    case TRACE_CAR_JOIN:
+        return read_field(reader->file, event->name) &&
+                       read_field(reader->file, event->lowest_floor) &&
+                       read_field(reader->file, event->highest_floor)
+                   ? 1
+                   : -1;
+    case TRACE_CAR_LEAVE:
+        return read_field(reader->file, event->name) ? 1 : -1;
+    default:
+        return -1;
+    }
+}
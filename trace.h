@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * This header file defines the traffic trace the controller records with
+ * `controller --trace {file}`: every CALL it handles and every car that joins
+ * or leaves, each with the time since recording started. `replay` feeds a
+ * trace back into a live controller and `sim --trace` simulates it, so a
+ * scheduling change can be compared on exactly the traffic that was recorded.
+ *
+ * A trace is TRACE_MAGIC followed by one record per event:
+ *
+ *   type       1 byte, a trace_type_t
+ *   delta      microseconds since the previous record, LEB128 varint
+ *   fields     each a length byte and that many bytes, no terminator:
+ *                TRACE_CALL       source floor, destination floor
+ *                TRACE_CAR_JOIN   name, lowest floor, highest floor
+ *                TRACE_CAR_LEAVE  name
+ *
+ * A call usually takes under 10 bytes.
+ *
+ * See trace.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* First bytes of every trace, the last one is the format version */
+#define TRACE_MAGIC "ELVTRC\0\1"
+#define TRACE_MAGIC_SIZE 8
+/* Longest field kept, longer ones are cut short when recorded */
+#define TRACE_MAX_FIELD 63
+
+/*
+ * Kinds of events in a trace
+ */
+typedef enum
+{
+    TRACE_CALL = 1,
+    TRACE_CAR_JOIN = 2,
+    TRACE_CAR_LEAVE = 3
+} trace_type_t;
+
+/*
+ * An event read back from a trace. Only the fields of its type are set.
+ */
+typedef struct trace_event
+{
+    trace_type_t type;
+    uint64_t time_us; // Since recording started
+    char source_floor[TRACE_MAX_FIELD + 1];
+    char destination_floor[TRACE_MAX_FIELD + 1];
+    char name[TRACE_MAX_FIELD + 1];
+    char lowest_floor[TRACE_MAX_FIELD + 1];
+    char highest_floor[TRACE_MAX_FIELD + 1];
+} trace_event_t;
+
+/*
+ * A trace being recorded
+ */
+typedef struct trace_writer
+{
+    FILE *file;
+    uint64_t start_ns; // CLOCK_MONOTONIC time recording started
+    uint64_t last_us;  // Time of the previous record
+    bool failed;       // A write failed, nothing more is recorded
+} trace_writer_t;
+
+/*
+ * A trace being read back
+ */
+typedef struct trace_reader
+{
+    FILE *file;
+    uint64_t time_us; // Time of the last event read
+} trace_reader_t;
+
+// Creates the file and writes the magic, returns false if it can't
+bool trace_writer_open(trace_writer_t *, const char *);
+// Flushes and closes the file
+void trace_writer_close(trace_writer_t *);
+// Hands what has been recorded so far to the operating system
+void trace_writer_flush(trace_writer_t *);
+// Records a call from a floor to a floor
+void trace_write_call(trace_writer_t *, const char *, const char *);
+// Records a car joining with its name and lowest and highest floors
+void trace_write_join(trace_writer_t *, const char *, const char *,
+                      const char *);
+// Records a car leaving
+void trace_write_leave(trace_writer_t *, const char *);
+
+// Opens a trace and checks its magic, prints the problem and returns false if
+// it isn't one
+bool trace_reader_open(trace_reader_t *, const char *);
+// Closes the file
+void trace_reader_close(trace_reader_t *);
+// Reads the next event, returns 1 if there was one, 0 at the end of the trace
+// and -1 if the rest of the trace is corrupt
+int trace_read(trace_reader_t *, trace_event_t *);
@@ -0,0 +1,316 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Implementation of the incremental shared memory validator. A car is
+ * consistent when:
+ *  - the status is one of "Opening", "Open", "Closing", "Closed" or "Between",
+ *  - both floors are valid floor names,
+ *  - every uint8_t flag is 0 or 1,
+ *  - the doors are only obstructed while "Opening" or "Closing".
+ *
+ * Each rule reads its fields without branching on their contents. Floors run
+ * through a small state machine one byte at a time, the status is compared as
+ * a single 64 bit word against each valid status, and the flags are checked
+ * together with one mask. Every rule gives the same answer as the string
+ * functions it replaces, including for bytes left behind a status's
+ * terminator by programs that strcpy() into the shared memory.
+ */
+
+#include "posix.h"
+#include "validator.h"
+
+/* The snapshot is read as whole words */
+_Static_assert(SHM_VALIDATOR_SNAPSHOT == 8 * SHM_VALIDATOR_WORDS,
+               "the validator's snapshot no longer matches car_shared_mem");
+
+/* Bit i set for each byte i of the snapshot a field occupies */
+#define FIELD_BYTES(name)                                                      \
+    (((1u << sizeof(((car_shared_mem *)0)->name)) - 1)                         \
+     << (offsetof(car_shared_mem, name) -                                      \
+         offsetof(car_shared_mem, current_floor)))
+
+/* The bytes of each field, in SHM_FIELD_* bit order */
+static const uint32_t field_bytes[SHM_FIELD_COUNT] = {
+    FIELD_BYTES(current_floor),    FIELD_BYTES(destination_floor),
+    FIELD_BYTES(status),           FIELD_BYTES(open_button),
+    FIELD_BYTES(close_button),     FIELD_BYTES(door_obstruction),
+    FIELD_BYTES(overload),         FIELD_BYTES(emergency_stop),
+    FIELD_BYTES(individual_service_mode), FIELD_BYTES(emergency_mode),
+};
+
+#undef FIELD_BYTES
+
+/*
+ * Byte classes and states of the floor name state machine. A floor name is
+ * empty, one to three digits, or 'B' followed by one or two digits, and must
+ * be terminated within its four bytes.
+ */
+enum
+{
+    FLOOR_OTHER,
+    FLOOR_NUL,
+    FLOOR_DIGIT,
+    FLOOR_B,
+    FLOOR_CLASSES
+};
+
+enum
+{
+    FLOOR_START,
+    FLOOR_AFTER_B,
+    FLOOR_DIGITS,
+    FLOOR_OK,
+    FLOOR_FAIL,
+    FLOOR_STATES
+};
+
+static const uint8_t floor_next[FLOOR_STATES][FLOOR_CLASSES] = {
+    [FLOOR_START] = {FLOOR_FAIL, FLOOR_OK, FLOOR_DIGITS, FLOOR_AFTER_B},
+    [FLOOR_AFTER_B] = {FLOOR_FAIL, FLOOR_FAIL, FLOOR_DIGITS, FLOOR_FAIL},
+    [FLOOR_DIGITS] = {FLOOR_FAIL, FLOOR_OK, FLOOR_DIGITS, FLOOR_FAIL},
+    [FLOOR_OK] = {FLOOR_OK, FLOOR_OK, FLOOR_OK, FLOOR_OK},
+    [FLOOR_FAIL] = {FLOOR_FAIL, FLOOR_FAIL, FLOOR_FAIL, FLOOR_FAIL},
+};
+
+/*
+ * Returns the class of a byte of a floor name.
+ */
+static unsigned int floor_class(unsigned char c)
+{
+    return FLOOR_NUL * (unsigned int)(c == 0) +
+           FLOOR_DIGIT * (unsigned int)((unsigned int)(c - '0') < 10u) +
+           FLOOR_B * (unsigned int)(c == 'B');
+}
+
+/*
+ * Returns 1 if a four byte field holds a valid floor name.
+ */
+static uint32_t floor_valid(const char *floor)
+{
+    unsigned int state = FLOOR_START;
+    for (int i = 0; i < 4; i++)
+    {
+        state = floor_next[state][floor_class((unsigned char)floor[i])];
+    }
+    return (uint32_t)(state == FLOOR_OK);
+}
+
+/*
+ * Loads eight bytes with the first in the least significant position, so the
+ * result is the same on any host.
+ */
+static uint64_t load_le64(const void *bytes)
+{
+    uint64_t word = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&word, bytes, sizeof(word));
+#else
+    for (int i = 0; i < 8; i++)
+    {
+        word |= (uint64_t)((const unsigned char *)bytes)[i] << (8 * i);
+    }
+#endif
+    return word;
+}
+
+/*
+ * Returns a mask with bit i set for each non-zero byte i of a word.
+ */
+static uint32_t nonzero_bytes(uint64_t word)
+{
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7Fu;
+
+    /* Sets the top bit of every non-zero byte without carrying between
+     * bytes, then gathers the eight top bits into the lowest byte. */
+    uint64_t high = (((word & low7) + low7) | word) & ~low7;
+    return (uint32_t)(((high >> 7) * 0x0102040810204080u) >> 56);
+}
+
+/*
+ * Returns the status bytes up to and including the terminator, with the bytes
+ * after it cleared.
+ */
+static uint64_t status_word(const char *status)
+{
+    const uint64_t ones = 0x0101010101010101u;
+    const uint64_t highs = 0x8080808080808080u;
+    uint64_t word = load_le64(status);
+
+    /* The lowest flagged byte is the first zero byte; without one every byte
+     * is kept, which matches none of the valid statuses. */
+    uint64_t zeros = (word - ones) & ~word & highs;
+    uint64_t first = zeros & (~zeros + 1);
+    uint64_t keep = (first << 1) - 1;
+    return word & keep;
+}
+
+/* Builds the word status_word() returns for a status of up to seven bytes */
+#define STATUS_WORD(a, b, c, d, e, f, g)                                       \
+    ((uint64_t)(a) | (uint64_t)(b) << 8 | (uint64_t)(c) << 16 |               \
+     (uint64_t)(d) << 24 | (uint64_t)(e) << 32 | (uint64_t)(f) << 40 |        \
+     (uint64_t)(g) << 48)
+
+/* The valid statuses, in shm_status_t order */
+static const uint64_t status_words[SHM_STATUS_INVALID] = {
+    STATUS_WORD('O', 'p', 'e', 'n', 'i', 'n', 'g'),
+    STATUS_WORD('O', 'p', 'e', 'n', 0, 0, 0),
+    STATUS_WORD('C', 'l', 'o', 's', 'i', 'n', 'g'),
+    STATUS_WORD('C', 'l', 'o', 's', 'e', 'd', 0),
+    STATUS_WORD('B', 'e', 't', 'w', 'e', 'e', 'n'),
+};
+
+#undef STATUS_WORD
+
+static uint32_t rule_status(const car_shared_mem *, shm_validator_t *);
+static uint32_t rule_floors(const car_shared_mem *, shm_validator_t *);
+static uint32_t rule_flags(const car_shared_mem *, shm_validator_t *);
+static uint32_t rule_obstruction(const car_shared_mem *, shm_validator_t *);
+
+/*
+ * A consistency rule and the fields it reads
+ */
+typedef struct
+{
+    uint32_t fields; // SHM_FIELD_* bits the rule reads
+    uint32_t (*valid)(const car_shared_mem *, shm_validator_t *); // 1 if held
+} shm_rule_t;
+
+/* Rules run in order; the obstruction rule uses the status found before it */
+static const shm_rule_t shm_rules[] = {
+    {SHM_FIELD_STATUS, rule_status},
+    {SHM_FIELD_CURRENT_FLOOR | SHM_FIELD_DESTINATION_FLOOR, rule_floors},
+    {SHM_FIELD_OPEN_BUTTON | SHM_FIELD_CLOSE_BUTTON |
+         SHM_FIELD_DOOR_OBSTRUCTION | SHM_FIELD_OVERLOAD |
+         SHM_FIELD_EMERGENCY_STOP | SHM_FIELD_SERVICE_MODE |
+         SHM_FIELD_EMERGENCY_MODE,
+     rule_flags},
+    {SHM_FIELD_STATUS | SHM_FIELD_DOOR_OBSTRUCTION, rule_obstruction},
+};
+
+#define SHM_RULE_COUNT (sizeof(shm_rules) / sizeof(shm_rules[0]))
+
+/*
+ * The status is one of the valid statuses. Records which one for the
+ * obstruction rule and safety's own checks.
+ */
+static uint32_t rule_status(const car_shared_mem *state,
+                            shm_validator_t *validator)
+{
+    uint64_t word = status_word(state->status);
+    uint32_t matched = 1u << SHM_STATUS_INVALID;
+    for (int i = 0; i < SHM_STATUS_INVALID; i++)
+    {
+        matched |= (uint32_t)(word == status_words[i]) << i;
+    }
+    validator->status = (shm_status_t)__builtin_ctz(matched);
+    return (uint32_t)(validator->status != SHM_STATUS_INVALID);
+}
+
+/*
+ * Both floors are valid floor names.
+ */
+static uint32_t rule_floors(const car_shared_mem *state,
+                            shm_validator_t *validator)
+{
+    (void)validator;
+    return floor_valid(state->current_floor) &
+           floor_valid(state->destination_floor);
+}
+
+/*
+ * Every uint8_t flag is 0 or 1.
+ */
+static uint32_t rule_flags(const car_shared_mem *state,
+                           shm_validator_t *validator)
+{
+    (void)validator;
+    const uint8_t *flags = &state->open_button;
+    uint32_t bits = 0;
+    for (size_t i = 0; i <= (size_t)(&state->emergency_mode - flags); i++)
+    {
+        bits |= flags[i];
+    }
+    return (uint32_t)((bits & 0xFEu) == 0);
+}
+
+/*
+ * The doors are only obstructed while opening or closing.
+ */
+static uint32_t rule_obstruction(const car_shared_mem *state,
+                                 shm_validator_t *validator)
+{
+    uint32_t moving_doors =
+        (uint32_t)(validator->status == SHM_STATUS_OPENING) |
+        (uint32_t)(validator->status == SHM_STATUS_CLOSING);
+    return (uint32_t)(state->door_obstruction == 0) | moving_doors;
+}
+
+/*
+ * Forgets the snapshot, so the next check runs every rule.
+ */
+void validator_init(shm_validator_t *validator)
+{
+    memset(validator, 0, sizeof(*validator));
+    validator->status = SHM_STATUS_INVALID;
+}
+
+/*
+ * Works out which fields changed since the snapshot and takes a new one.
+ */
+static uint32_t changed_fields(shm_validator_t *validator,
+                               const car_shared_mem *state)
+{
+    const unsigned char *now = (const unsigned char *)state->current_floor;
+
+    /* Bit i of bytes is set if byte i of the snapshot changed. */
+    uint32_t bytes = 0;
+    for (int i = 0; i < SHM_VALIDATOR_WORDS; i++)
+    {
+        uint64_t word = load_le64(now + 8 * i);
+        bytes |= nonzero_bytes(validator->seen[i] ^ word) << (8 * i);
+        validator->seen[i] = word;
+    }
+    if (!validator->primed)
+    {
+        validator->primed = true;
+        return SHM_FIELD_ALL;
+    }
+    if (bytes == 0)
+    {
+        return 0;
+    }
+
+    uint32_t changed = 0;
+    for (int i = 0; i < SHM_FIELD_COUNT; i++)
+    {
+        changed |= (uint32_t)((bytes & field_bytes[i]) != 0) << i;
+    }
+    return changed;
+}
+
+/*
+ * Re-runs the rules whose fields changed since the last check and returns
+ * whether every rule holds. Called with the car's mutex held.
+ */
+bool validator_check(shm_validator_t *validator, const car_shared_mem *state)
+{
+    uint32_t changed = changed_fields(validator, state);
+    if (changed == 0)
+    {
+        return validator->failed == 0;
+    }
+
+    for (size_t i = 0; i < SHM_RULE_COUNT; i++)
+    {
+        if (shm_rules[i].fields & changed)
+        {
+            uint32_t failed = shm_rules[i].valid(state, validator) ^ 1u;
+            validator->failed =
+                (validator->failed & ~(1u << i)) | (failed << i);
+        }
+    }
+    return validator->failed == 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * This header file defines the incremental validator safety uses to check a
+ * car's shared memory for data consistency errors. The checks are a table of
+ * rules, each naming the fields it reads; the validator keeps a snapshot of
+ * the fields as of the last check and only re-runs the rules whose fields
+ * changed since.
+ *
+ * See validator.c for implementation details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "posix.h"
+
+/*
+ * The statuses a car can be in
+ */
+typedef enum
+{
+    SHM_STATUS_OPENING = 0,
+    SHM_STATUS_OPEN,
+    SHM_STATUS_CLOSING,
+    SHM_STATUS_CLOSED,
+    SHM_STATUS_BETWEEN,
+    SHM_STATUS_INVALID
+} shm_status_t;
+
+/* Size of the fields a validator keeps a snapshot of, and the number of
+ * 64 bit words they fill */
+#define SHM_VALIDATOR_SNAPSHOT                                                 \
+    (sizeof(car_shared_mem) - offsetof(car_shared_mem, current_floor))
+#define SHM_VALIDATOR_WORDS 3
+
+/*
+ * State of an incremental validator
+ */
+typedef struct
+{
+    uint64_t seen[SHM_VALIDATOR_WORDS]; // Fields as of the last check
+    bool primed;         // seen holds a snapshot
+    uint32_t failed;     // Bit per rule that failed the last time it ran
+    shm_status_t status; // The car's status as of the last check
+} shm_validator_t;
+
+// Forgets the snapshot, so the next check runs every rule
+void validator_init(shm_validator_t *);
+// Re-runs the rules whose fields changed since the last check, returns whether
+// the shared memory is consistent, called with the car's mutex held
+bool validator_check(shm_validator_t *, const car_shared_mem *);
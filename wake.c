@@ -0,0 +1,546 @@
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Implementation of the wake-up benchmark. The benchmark and its observers
+ * run in lockstep: it publishes a change, each observer records when it saw
+ * the change and counts itself in on a futex word, and the last one in wakes
+ * the benchmark for the next round. Only one change is ever outstanding, so
+ * no observer falls behind and every observer sees every change, whichever
+ * way it waits.
+ *
+ * The observers are forked before the rounds start and inherit both the
+ * car's mapping and an anonymous shared mapping holding the round's start
+ * time and every observer's samples, which are read back once they exit.
+ * The status alternates between Open and Closed so every set_status() is a
+ * real change that bumps commit_seq and publishes a history record.
+ */
+
+#include "global.h"
+#include "lockstat.h"
+#include "posix.h"
+#include "wake.h"
+#include "workload.h"
+
+static const char *const mechanism_names[WAKE_MECHANISM_COUNT] = {
+    "condvar", "history", "spin"};
+
+int main(int argc, char *argv[])
+{
+    wake_options_t options;
+    wake_options_init(&options);
+    if (!wake_options_parse(&options, argc, argv))
+    {
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (options.csv_file != NULL)
+    {
+        csv = fopen(options.csv_file, "w");
+        if (csv == NULL)
+        {
+            perror(options.csv_file);
+            return 1;
+        }
+    }
+
+    wake_report_header(csv);
+    int status = 0;
+    for (int m = 0; m < WAKE_MECHANISM_COUNT && status == 0; m++)
+    {
+        if (!options.mechanisms[m])
+        {
+            continue;
+        }
+        for (size_t i = 0; i < options.num_observer_counts && status == 0;
+             i++)
+        {
+            wake_t wake;
+            if (wake_init(&wake, &options, (wake_mechanism_t)m,
+                          options.observers[i]) &&
+                wake_run(&wake))
+            {
+                wake_report(&wake, csv);
+            }
+            else
+            {
+                status = 1;
+            }
+            wake_deinit(&wake);
+        }
+    }
+
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return status;
+}
+
+/*
+ * Returns the name of a mechanism as given to --mechanisms.
+ */
+const char *wake_mechanism_name(wake_mechanism_t mechanism)
+{
+    return mechanism_names[mechanism];
+}
+
+/*
+ * Reads a comma separated list of mechanism names. Returns false if there is
+ * anything else.
+ */
+static bool parse_mechanisms(const char *text, bool *mechanisms)
+{
+    memset(mechanisms, 0, sizeof(bool) * WAKE_MECHANISM_COUNT);
+    for (const char *p = text;;)
+    {
+        size_t length = strcspn(p, ",");
+        bool known = false;
+        for (int m = 0; m < WAKE_MECHANISM_COUNT; m++)
+        {
+            if (strlen(mechanism_names[m]) == length &&
+                strncmp(p, mechanism_names[m], length) == 0)
+            {
+                mechanisms[m] = true;
+                known = true;
+            }
+        }
+        if (!known)
+        {
+            return false;
+        }
+        if (p[length] == '\0')
+        {
+            return true;
+        }
+        p += length + 1;
+    }
+}
+
+/*
+ * Fills in the defaults.
+ */
+void wake_options_init(wake_options_t *options)
+{
+    memset(options, 0, sizeof(*options));
+    parse_counts(WAKE_DEFAULT_OBSERVERS, WAKE_MAX_OBSERVERS, options->observers,
+                 WAKE_MAX_COUNTS, &options->num_observer_counts);
+    for (int m = 0; m < WAKE_MECHANISM_COUNT; m++)
+    {
+        options->mechanisms[m] = true;
+    }
+    options->rounds = WAKE_DEFAULT_ROUNDS;
+    options->gap_us = WAKE_DEFAULT_GAP_US;
+    options->csv_file = NULL;
+}
+
+/*
+ * Reads the options given as `--{name} {value}` pairs, see wake.h.
+ */
+bool wake_options_parse(wake_options_t *options, int argc, char *argv[])
+{
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "Usage: %s [--{option} {value}]...\n", argv[0]);
+        return false;
+    }
+
+    for (int i = 1; i < argc - 1; i += 2)
+    {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        uint64_t number = 0;
+        bool numeric = parse_number(value, &number);
+        bool valid = true;
+
+        if (strcmp(name, "--observers") == 0)
+        {
+            valid = parse_counts(value, WAKE_MAX_OBSERVERS, options->observers,
+                                 WAKE_MAX_COUNTS,
+                                 &options->num_observer_counts);
+        }
+        else if (strcmp(name, "--mechanisms") == 0)
+        {
+            valid = parse_mechanisms(value, options->mechanisms);
+        }
+        else if (strcmp(name, "--rounds") == 0)
+        {
+            valid = numeric && number > 0 && number <= WAKE_MAX_ROUNDS;
+            options->rounds = (size_t)number;
+        }
+        else if (strcmp(name, "--gap") == 0)
+        {
+            valid = numeric && number <= 1000000;
+            options->gap_us = (uint32_t)number;
+        }
+        else if (strcmp(name, "--csv") == 0)
+        {
+            options->csv_file = value;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid parameter: %s\n", name);
+            return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Counts an observer in for the round, waking the benchmark if it is the
+ * last one.
+ */
+static void acknowledge(wake_t *wake)
+{
+    if (atomic_fetch_add(&wake->shared->acks, 1) + 1 == wake->num_observers)
+    {
+        futex_wake(&wake->shared->acks);
+    }
+}
+
+/*
+ * Records when an observer saw this round's change.
+ */
+static void record_wake(wake_t *wake, size_t index, size_t round)
+{
+    uint64_t now = monotonic_ns();
+    uint64_t published = atomic_load(&wake->shared->published_ns);
+    wake->shared->samples[index * wake->options->rounds + round] =
+        now - published;
+}
+
+/*
+ * Waits on the car's condition variable the way internal and safety do,
+ * holding the mutex whenever it isn't waiting. Returns false if a change
+ * doesn't come in time.
+ */
+static bool observe_condvar(wake_t *wake, size_t index)
+{
+    car_shared_mem *state = wake->state;
+    car_shm_ext *ext = get_shm_ext(state);
+    shm_lock(state, LOCK_SITE_WAKE_OBSERVE);
+    uint32_t seen = ext->commit_seq;
+    acknowledge(wake);
+
+    bool ok = true;
+    for (size_t r = 0; r < wake->options->rounds && ok; r++)
+    {
+        struct timespec deadline;
+        shm_deadline(state, WAKE_TIMEOUT_MS, &deadline);
+        while (ext->commit_seq == seen && ok)
+        {
+            ok = shm_cond_timedwait(state, &deadline) != ETIMEDOUT;
+        }
+        if (ok)
+        {
+            record_wake(wake, index, r);
+            seen = ext->commit_seq;
+            acknowledge(wake);
+        }
+    }
+    shm_unlock(state);
+    return ok;
+}
+
+/*
+ * Tails the car's history ring, sleeping on its futex between records unless
+ * spinning. Returns false if a record doesn't come in time.
+ */
+static bool observe_history(wake_t *wake, size_t index, bool spin)
+{
+    history_reader_t reader;
+    history_record_t record;
+    history_reader_init(&reader, &get_shm_ext(wake->state)->history);
+    while (history_read(&reader, &record))
+    {
+    }
+    acknowledge(wake);
+
+    for (size_t r = 0; r < wake->options->rounds; r++)
+    {
+        uint64_t deadline = monotonic_ns() +
+                            (uint64_t)WAKE_TIMEOUT_MS * 1000000;
+        while (!history_read(&reader, &record))
+        {
+            if (monotonic_ns() > deadline)
+            {
+                return false;
+            }
+            if (spin)
+            {
+                sched_yield();
+            }
+            else
+            {
+                history_wait(&reader, WAKE_TIMEOUT_MS);
+            }
+        }
+        record_wake(wake, index, r);
+        if (r + 1 == wake->options->rounds)
+        {
+            atomic_fetch_add(&wake->shared->lost, reader.lost);
+        }
+        acknowledge(wake);
+    }
+    return true;
+}
+
+/*
+ * Body of an observer process.
+ */
+static void observe(wake_t *wake, size_t index)
+{
+    bool ok = wake->mechanism == WAKE_CONDVAR
+                  ? observe_condvar(wake, index)
+                  : observe_history(wake, index,
+                                    wake->mechanism == WAKE_SPIN);
+    if (!ok)
+    {
+        atomic_store(&wake->shared->failed, 1);
+    }
+    _exit(ok ? 0 : 1);
+}
+
+/*
+ * Waits for every observer to count itself in. Returns false if they don't
+ * in time.
+ */
+static bool wait_for_acks(wake_t *wake)
+{
+    uint64_t deadline = monotonic_ns() + (uint64_t)WAKE_TIMEOUT_MS * 1000000;
+    uint32_t acks;
+    while ((acks = atomic_load(&wake->shared->acks)) < wake->num_observers)
+    {
+        uint64_t now = monotonic_ns();
+        if (now >= deadline || atomic_load(&wake->shared->failed))
+        {
+            return false;
+        }
+        struct timespec ts = {(time_t)((deadline - now) / 1000000000u),
+                              (long)((deadline - now) % 1000000000u)};
+        futex_wait(&wake->shared->acks, acks, &ts);
+    }
+    return true;
+}
+
+/*
+ * Creates the car and the shared mapping, then forks the observers.
+ */
+bool wake_init(wake_t *wake, const wake_options_t *options,
+               wake_mechanism_t mechanism, size_t num_observers)
+{
+    memset(wake, 0, sizeof(*wake));
+    wake->options = options;
+    wake->mechanism = mechanism;
+    wake->num_observers = num_observers;
+    wake->fd = -1;
+    wake->shared = MAP_FAILED;
+
+    char car_name[32];
+    snprintf(car_name, sizeof(car_name), "Wake%ld", (long)getpid());
+    workload_hist_init(&wake->publish);
+    wake->shm_name = get_shm_name(car_name);
+    if (!create_shared_mem(&wake->state, &wake->fd, wake->shm_name))
+    {
+        perror(wake->shm_name);
+        return false;
+    }
+    init_shm(wake->state);
+
+    wake->shared_size = sizeof(wake_shared_t) +
+                        num_observers * options->rounds * sizeof(uint64_t);
+    wake->shared = mmap(NULL, wake->shared_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    wake->pids = calloc(num_observers, sizeof(*wake->pids));
+    if (wake->shared == MAP_FAILED || wake->pids == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return false;
+    }
+
+    fflush(stdout);
+    for (size_t i = 0; i < num_observers; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            observe(wake, i);
+        }
+        if (pid < 0)
+        {
+            perror("fork()");
+            return false;
+        }
+        wake->pids[wake->num_pids++] = pid;
+    }
+
+    if (!wait_for_acks(wake))
+    {
+        fprintf(stderr, "Error: The %s observers didn't start.\n",
+                mechanism_names[mechanism]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Stops any observer still running and removes the car.
+ */
+void wake_deinit(wake_t *wake)
+{
+    for (size_t i = 0; i < wake->num_pids; i++)
+    {
+        kill(wake->pids[i], SIGINT);
+        waitpid(wake->pids[i], NULL, 0);
+    }
+    free(wake->pids);
+    if (wake->shared != MAP_FAILED)
+    {
+        munmap(wake->shared, wake->shared_size);
+    }
+    if (wake->state != NULL)
+    {
+        unmap_car(wake->state);
+    }
+    if (wake->fd >= 0)
+    {
+        close(wake->fd);
+    }
+    if (wake->shm_name != NULL)
+    {
+        shm_unlink(wake->shm_name);
+        free(wake->shm_name);
+    }
+    memset(wake, 0, sizeof(*wake));
+}
+
+/*
+ * Publishes a change each round once every observer has seen the last one.
+ */
+bool wake_run(wake_t *wake)
+{
+    struct timespec gap = {(time_t)(wake->options->gap_us / 1000000),
+                           (long)(wake->options->gap_us % 1000000) * 1000};
+    for (size_t r = 0; r < wake->options->rounds; r++)
+    {
+        if (wake->options->gap_us > 0)
+        {
+            nanosleep(&gap, NULL);
+        }
+        atomic_store(&wake->shared->acks, 0);
+
+        uint64_t start = monotonic_ns();
+        atomic_store(&wake->shared->published_ns, start);
+        set_status(wake->state, r % 2 == 0 ? "Open" : "Closed");
+        workload_hist_record(&wake->publish, monotonic_ns() - start);
+
+        if (!wait_for_acks(wake))
+        {
+            fprintf(stderr,
+                    "Error: The %s observers stopped answering in round "
+                    "%zu.\n",
+                    mechanism_names[wake->mechanism], r + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Prints the table heading and the CSV header.
+ */
+void wake_report_header(FILE *csv)
+{
+    printf("%-19s%-45s%-16s%s\n", "", "Wake (us)", "Last wake (us)",
+           "set_status (us)");
+    printf("%-9s %9s %7s %7s %7s %7s %8s %7s %7s %7s %7s %8s %6s\n",
+           "mechanism", "observers", "p50", "p90", "p99", "p99.9", "max", "p50",
+           "p99", "p50", "p99", "max", "lost");
+    if (csv != NULL)
+    {
+        fprintf(csv, "mechanism,observers,rounds,wake_p50_us,wake_p90_us,"
+                     "wake_p99_us,wake_p99_9_us,wake_max_us,last_p50_us,"
+                     "last_p99_us,set_p50_us,set_p99_us,set_max_us,lost\n");
+    }
+}
+
+/*
+ * Prints a line of the table and the CSV row.
+ */
+void wake_report(wake_t *wake, FILE *csv)
+{
+    size_t rounds = wake->options->rounds;
+    uint64_t *samples = wake->shared->samples;
+
+    /* Every wake, and the slowest of each round. */
+    workload_hist_t *hists = malloc(2 * sizeof(*hists));
+    if (hists == NULL)
+    {
+        perror("malloc()");
+        return;
+    }
+    workload_hist_init(&hists[0]);
+    workload_hist_init(&hists[1]);
+    for (size_t r = 0; r < rounds; r++)
+    {
+        uint64_t last = 0;
+        for (size_t i = 0; i < wake->num_observers; i++)
+        {
+            uint64_t ns = samples[i * rounds + r];
+            workload_hist_record(&hists[0], ns);
+            last = ns > last ? ns : last;
+        }
+        workload_hist_record(&hists[1], last);
+    }
+
+    double wake_us[WORKLOAD_NUM_PERCENTILES + 1];
+    double last_us[WORKLOAD_NUM_PERCENTILES + 1];
+    double set_us[WORKLOAD_NUM_PERCENTILES + 1];
+    workload_hist_summarise(&hists[0], 1e3, wake_us);
+    workload_hist_summarise(&hists[1], 1e3, last_us);
+    workload_hist_summarise(&wake->publish, 1e3, set_us);
+    free(hists);
+    uint64_t lost = atomic_load(&wake->shared->lost);
+
+    printf("%-9s %9zu %7.1f %7.1f %7.1f %7.1f %8.1f %7.1f %7.1f %7.1f %7.1f "
+           "%8.1f %6llu\n",
+           mechanism_names[wake->mechanism], wake->num_observers, wake_us[0],
+           wake_us[1], wake_us[2], wake_us[3], wake_us[4], last_us[0],
+           last_us[2], set_us[0], set_us[2], set_us[4],
+           (unsigned long long)lost);
+    fflush(stdout);
+
+    if (csv != NULL)
+    {
+        fprintf(csv, "%s,%zu,%zu", mechanism_names[wake->mechanism],
+                wake->num_observers, rounds);
+        for (size_t i = 0; i <= WORKLOAD_NUM_PERCENTILES; i++)
+        {
+            fprintf(csv, ",%.1f", wake_us[i]);
+        }
+        fprintf(csv, ",%.1f,%.1f,%.1f,%.1f,%.1f,%llu\n", last_us[0],
+                last_us[2], set_us[0], set_us[2], set_us[4],
+                (unsigned long long)lost);
+    }
+}
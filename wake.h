@@ -0,0 +1,136 @@
+#pragma once
+
+/*
+ * This header file defines the wake-up benchmark run by `wake [options]`. It
+ * measures how long a change published by a car takes to reach the processes
+ * watching it, and what publishing costs the car as the watchers add up.
+ *
+ * For each mechanism and observer count it creates a car's shared memory
+ * object. The benchmark plays the car and changes the status once per round
+ * with set_status(), the same call the car makes. Each observer is a separate
+ * process, like internal and safety, and waits for every change in one of
+ * these ways:
+ *
+ *   condvar    Holds the car's mutex and waits on its condition variable, as
+ *              internal, safety and the car's own threads do
+ *   history    Tails the car's history ring, sleeping on its futex (see
+ *              history.h), without ever taking the mutex
+ *   spin       Tails the history ring without sleeping, yielding the CPU
+ *              between looks
+ *
+ * Three latencies are reported. The wake latency runs from just before
+ * set_status() to an observer seeing the change, and the last wake to the
+ * slowest observer seeing it. The publish cost is how long set_status()
+ * itself took. The next round starts once every observer has
+ * seen the change, after a --gap so the observers are back asleep.
+ *
+ * Options are given as `--{name} {value}` pairs:
+ *
+ *   --observers {n,n,...}    Observer counts to run, 1 to WAKE_MAX_OBSERVERS
+ *   --mechanisms {name,...}  Mechanisms to run, from the list above
+ *   --rounds {count}         Changes published in each run
+ *   --gap {microseconds}     Pause before each change
+ *   --csv {file}             Also write the results as CSV
+ *
+ * See wake.c for implementation details.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "posix.h"
+#include "workload.h"
+
+/* Defaults */
+#define WAKE_DEFAULT_OBSERVERS "1,2,4,8,16,32,64"
+#define WAKE_DEFAULT_ROUNDS 2000
+#define WAKE_DEFAULT_GAP_US 200
+
+/* Most observers a run can have */
+#define WAKE_MAX_OBSERVERS 64
+/* Most counts an --observers list can have */
+#define WAKE_MAX_COUNTS 16
+/* Most rounds a run can have */
+#define WAKE_MAX_ROUNDS 1000000
+/* How long a round may take before the run is given up on */
+#define WAKE_TIMEOUT_MS 5000
+
+/*
+ * How observers wait for a change
+ */
+typedef enum
+{
+    WAKE_CONDVAR = 0,
+    WAKE_HISTORY,
+    WAKE_SPIN,
+    WAKE_MECHANISM_COUNT
+} wake_mechanism_t;
+
+/*
+ * Settings of a benchmark
+ */
+typedef struct wake_options
+{
+    size_t observers[WAKE_MAX_COUNTS];
+    size_t num_observer_counts;
+    bool mechanisms[WAKE_MECHANISM_COUNT]; // Which to run
+    size_t rounds;
+    uint32_t gap_us;
+    const char *csv_file; // NULL for no CSV
+} wake_options_t;
+
+/*
+ * Memory shared by the car and its observers, besides the car's own
+ */
+typedef struct wake_shared
+{
+    _Atomic uint64_t published_ns; // When this round's change started
+    _Atomic uint32_t acks;   // Observers that have seen it, a futex word
+    _Atomic uint64_t lost;   // History records observers missed
+    _Atomic uint32_t failed; // Set by an observer that gave up waiting
+    uint64_t samples[];      // Wake latencies, --rounds per observer
+} wake_shared_t;
+
+/*
+ * One run of a mechanism with some number of observers
+ */
+typedef struct wake
+{
+    const wake_options_t *options;
+    wake_mechanism_t mechanism;
+    size_t num_observers;
+    char *shm_name;
+    car_shared_mem *state; // The car
+    int fd;
+    wake_shared_t *shared;
+    size_t shared_size;
+    pid_t *pids; // The observers
+    size_t num_pids;
+    workload_hist_t publish; // How long each set_status() took, in ns
+} wake_t;
+
+// Returns the name of a mechanism as given to --mechanisms
+const char *wake_mechanism_name(wake_mechanism_t);
+// Fills in the defaults
+void wake_options_init(wake_options_t *);
+// Reads `--{name} {value}` arguments, prints the problem and returns false if
+// one isn't valid
+bool wake_options_parse(wake_options_t *, int, char *[]);
+// Creates the car and starts the observers, prints the problem and returns
+// false if it can't
+bool wake_init(wake_t *, const wake_options_t *, wake_mechanism_t, size_t);
+// Stops the observers and removes the car
+void wake_deinit(wake_t *);
+// Publishes every round, prints the problem and returns false if an observer
+// stops answering
+bool wake_run(wake_t *);
+// Prints the heading of the table of results, and the CSV header if given a
+// file
+void wake_report_header(FILE *);
+// Prints the results of a run as a line of the table, and as CSV if given a
+// file
+void wake_report(wake_t *, FILE *);
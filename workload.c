@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Implementation of the shared passenger workload. Like test-sched, every
+ * passenger arrives at a random time and travels between two different random
+ * floors. The random numbers come from a splitmix64 sequence rather than
+ * rand(), so a seed gives the same trips on every machine and C library.
+ */
+
+#include "workload.h"
+
+const unsigned workload_percentiles[WORKLOAD_NUM_PERCENTILES] = {500, 900,
+                                                                 990, 999};
+
+/*
+ * Returns the next number of a splitmix64 sequence.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Returns a random number from min to max inclusive.
+ */
+static int64_t random_between(uint64_t *state, int64_t min, int64_t max)
+{
+    return min + (int64_t)(next_random(state) % (uint64_t)(max - min + 1));
+}
+
+/*
+ * Orders arrival times.
+ */
+static int compare_times(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Draws every arrival time first and sorts them, then draws the floors of
+ * each trip in order of arrival.
+ */
+workload_trip_t *workload_generate(size_t count, int lowest, int highest,
+                                   uint64_t start_ms, uint64_t end_ms,
+                                   uint64_t seed)
+{
+    workload_trip_t *trips = calloc(count == 0 ? 1 : count, sizeof(*trips));
+    uint64_t *times = malloc((count == 0 ? 1 : count) * sizeof(*times));
+    if (trips == NULL || times == NULL)
+    {
+        free(trips);
+        free(times);
+        return NULL;
+    }
+
+    uint64_t random = seed;
+    for (size_t i = 0; i < count; i++)
+    {
+        times[i] = (uint64_t)random_between(&random, (int64_t)start_ms,
+                                            (int64_t)end_ms);
+    }
+    qsort(times, count, sizeof(*times), compare_times);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        trips[i].from = (int)random_between(&random, lowest, highest);
+        do
+        {
+            trips[i].to = (int)random_between(&random, lowest, highest);
+        } while (trips[i].to == trips[i].from);
+        trips[i].arrive_ms = times[i];
+    }
+
+    free(times);
+    return trips;
+}
+
+/*
+ * Prints a summary of the times and a histogram of them, with the same
+ * buckets as draw_histogram() in test-sched.
+ */
+void workload_print_times(const char *title, const uint64_t *times,
+                          size_t count, size_t histogram_len)
+{
+    uint64_t total = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total += times[i];
+        min = times[i] < min ? times[i] : min;
+        max = times[i] > max ? times[i] : max;
+    }
+
+    printf("%s:\n", title);
+    printf("Avg time: %.2fms\n",
+           count > 0 ? (double)total / (double)count / 1000.0 : 0.0);
+    printf("Longest time: %.2fms\n", (double)max / 1000.0);
+
+    size_t len = histogram_len < count ? histogram_len : count;
+    uint64_t *bounds = calloc(len + 1, sizeof(*bounds));
+    size_t *counts = calloc(len + 1, sizeof(*counts));
+    if (len == 0 || bounds == NULL || counts == NULL)
+    {
+        free(bounds);
+        free(counts);
+        return;
+    }
+
+    /* Bucket i holds bounds[i] up to bounds[i + 1] - 1. */
+    uint64_t range = max - min + 1;
+    for (size_t i = 0; i <= len; i++)
+    {
+        bounds[i] = min + range * i / len;
+    }
+    size_t max_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        /* The last bucket starting at or below the time. */
+        size_t bucket = (size_t)(((times[i] - min + 1) * len - 1) / range);
+        counts[bucket] += 1;
+        max_count = counts[bucket] > max_count ? counts[bucket] : max_count;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        printf("%7.2f - %-7.2f ", (double)bounds[i] / 1000.0,
+               (double)(bounds[i + 1] - 1) / 1000.0);
+        size_t bar = counts[i];
+        if (max_count > 60)
+        {
+            bar = (bar * 60 + max_count - 1) / max_count;
+        }
+        for (size_t j = 0; j < bar; j++)
+        {
+            printf("#");
+        }
+        printf(" (%zu)\n", counts[i]);
+    }
+
+    free(bounds);
+    free(counts);
+}
+
+/*
+ * Prints both sets of times, then the percentiles of waiting, riding and the
+ * two together.
+ */
+void workload_print_trips(const uint64_t *waits, const uint64_t *rides,
+                          size_t count, size_t histogram_len)
+{
+    workload_print_times("Time spent waiting for an elevator", waits, count,
+                         histogram_len);
+    printf("\n");
+    workload_print_times("Time spent inside an elevator", rides, count,
+                         histogram_len);
+
+    workload_hist_t *hists = malloc(3 * sizeof(*hists));
+    if (hists == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        workload_hist_init(&hists[i]);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        workload_hist_record(&hists[0], waits[i]);
+        workload_hist_record(&hists[1], rides[i]);
+        workload_hist_record(&hists[2], waits[i] + rides[i]);
+    }
+
+    printf("\nPercentiles (ms):\n");
+    workload_print_percentile_header();
+    workload_print_percentiles("Waiting", &hists[0]);
+    workload_print_percentiles("In car", &hists[1]);
+    workload_print_percentiles("End to end", &hists[2]);
+    free(hists);
+}
+
+/*
+ * Empties a histogram.
+ */
+void workload_hist_init(workload_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+/*
+ * Returns the bucket counting a value.
+ */
+static size_t hist_index(uint64_t value)
+{
+    if (value < WORKLOAD_HIST_SUB_COUNT)
+    {
+        return (size_t)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - WORKLOAD_HIST_SUB_BITS + 1;
+    return (size_t)shift * WORKLOAD_HIST_HALF_COUNT + (size_t)(value >> shift);
+}
+
+/*
+ * Returns the highest value a bucket counts.
+ */
+static uint64_t hist_highest(size_t index)
+{
+    if (index < WORKLOAD_HIST_SUB_COUNT)
+    {
+        return index;
+    }
+    size_t shift = index / WORKLOAD_HIST_HALF_COUNT - 1;
+    uint64_t sub = index - shift * WORKLOAD_HIST_HALF_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * Counts a value.
+ */
+void workload_hist_record(workload_hist_t *hist, uint64_t value)
+{
+    hist->counts[hist_index(value)] += 1;
+    hist->count += 1;
+    hist->total += value;
+    hist->max = value > hist->max ? value : hist->max;
+}
+
+/*
+ * Walks the buckets to the one holding the value of the given rank. The
+ * bucket's highest value is returned, or the largest value recorded if that
+ * is lower.
+ */
+uint64_t workload_hist_percentile(const workload_hist_t *hist,
+                                  unsigned per_mille)
+{
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (per_mille * hist->count + 999) / 1000;
+    rank = rank < 1 ? 1 : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < WORKLOAD_HIST_BUCKETS; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t highest = hist_highest(i);
+            return highest < hist->max ? highest : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/*
+ * Fills in the percentiles then the largest value, divided by the scale.
+ */
+void workload_hist_summarise(const workload_hist_t *hist, double scale,
+                             double *values)
+{
+    for (size_t i = 0; i < WORKLOAD_NUM_PERCENTILES; i++)
+    {
+        values[i] =
+            (double)workload_hist_percentile(hist, workload_percentiles[i]) /
+            scale;
+    }
+    values[WORKLOAD_NUM_PERCENTILES] = (double)hist->max / scale;
+}
+
+/*
+ * Prints the heading of a table of percentiles, the same as test-sched's.
+ */
+void workload_print_percentile_header(void)
+{
+    printf("%-12s %10s %10s %10s %10s %10s\n", "", "p50", "p90", "p99",
+           "p99.9", "max");
+}
+
+/*
+ * Prints a line of the table.
+ */
+void workload_print_percentiles(const char *title, const workload_hist_t *hist)
+{
+    double ms[WORKLOAD_NUM_PERCENTILES + 1];
+    workload_hist_summarise(hist, 1000.0, ms);
+    printf("%-12s", title);
+    for (size_t i = 0; i <= WORKLOAD_NUM_PERCENTILES; i++)
+    {
+        printf(" %10.2f", ms[i]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * This header file defines the passenger workload shared by the simulator
+ * (`sim`) and the load generator (`load`). Trips are drawn the same way as
+ * test-sched's passengers, but from a seed of their own, so both programs
+ * given the same options see exactly the same passengers. The report of
+ * waiting and riding times is shared too, along with the log-linear
+ * histogram its percentiles come from, so their results line up with each
+ * other and with test-sched's.
+ *
+ * See workload.c for implementation details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Percentiles reported, in per mille */
+#define WORKLOAD_NUM_PERCENTILES 4
+extern const unsigned workload_percentiles[WORKLOAD_NUM_PERCENTILES];
+
+/* Values below WORKLOAD_HIST_SUB_COUNT get a bucket each. Above that every
+ * power of two is split into WORKLOAD_HIST_HALF_COUNT buckets, so a bucket is
+ * never wider than 1/64th of the values it holds. */
+#define WORKLOAD_HIST_SUB_BITS 7
+#define WORKLOAD_HIST_SUB_COUNT (1 << WORKLOAD_HIST_SUB_BITS)
+#define WORKLOAD_HIST_HALF_COUNT (WORKLOAD_HIST_SUB_COUNT / 2)
+#define WORKLOAD_HIST_BUCKETS                                                  \
+    ((64 - WORKLOAD_HIST_SUB_BITS + 2) * WORKLOAD_HIST_HALF_COUNT)
+
+/*
+ * A log-linear (HDR-style) histogram. Recording is O(1) and the size is
+ * fixed, so percentiles don't need the values to be kept or sorted.
+ */
+typedef struct workload_hist
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t counts[WORKLOAD_HIST_BUCKETS];
+} workload_hist_t;
+
+/*
+ * A passenger's trip. Floors are floor_to_int() numbers.
+ */
+typedef struct workload_trip
+{
+    int from;
+    int to;
+    uint64_t arrive_ms; // When the passenger calls a car
+} workload_trip_t;
+
+// Creates the given number of trips in order of arrival, between two floors
+// and two times, from a seed. Returns NULL if out of memory.
+workload_trip_t *workload_generate(size_t, int, int, uint64_t, uint64_t,
+                                   uint64_t);
+// Prints the average and longest of some times in microseconds and a
+// histogram of them with the given number of bars, like test-sched
+void workload_print_times(const char *, const uint64_t *, size_t, size_t);
+// Prints the waiting and riding times of some passengers in microseconds,
+// each like workload_print_times(), then a table of their percentiles like
+// test-sched's
+void workload_print_trips(const uint64_t *, const uint64_t *, size_t, size_t);
+
+// Empties a histogram
+void workload_hist_init(workload_hist_t *);
+// Counts a value
+void workload_hist_record(workload_hist_t *, uint64_t);
+// Returns the value at or below which some per mille of the values fall, to
+// within the width of its bucket, or 0 if there are none
+uint64_t workload_hist_percentile(const workload_hist_t *, unsigned);
+// Fills in each of workload_percentiles then the largest value, divided by a
+// scale
+void workload_hist_summarise(const workload_hist_t *, double, double *);
+// Prints the heading of a table of percentiles
+void workload_print_percentile_header(void);
+// Prints the percentiles and largest of some microseconds in milliseconds, as
+// a line of the table
+void workload_print_percentiles(const char *, const workload_hist_t *);